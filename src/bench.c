@@ -0,0 +1,1184 @@
+#include <gst/gst.h>
+#include <glib/gstdio.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "fft.h"
+#include "gst-backend.h"
+#include "lut3d.h"
+#include "profiler.h"
+#include "subtitlefile.h"
+
+/* Headless benchmark runner. Plays each input through the backend into
+ * fakesinks with sync=false and reports decode throughput, time-to-first-frame,
+ * seek latency, URI switch latency, playlist advance latency and peak RSS as
+ * JSON on stdout. With
+ * --threads every input is run once per decoder thread count. GLIESE_PROFILE
+ * profiles all runs into the given trace file. --lut-bench instead times the
+ * 3D LUT kernels on their own, --subtitle-bench the external subtitle
+ * parser and index, and --soak cycles one player through the inputs to check
+ * that its memory use stays flat. */
+
+typedef enum _BenchPhase {
+    PHASE_DECODE,
+    PHASE_PREROLL,
+    PHASE_SEEK,
+    PHASE_SWITCH,
+    PHASE_ADVANCE,
+    PHASE_SOAK,
+    PHASE_DONE
+} BenchPhase;
+
+typedef struct _BenchResult {
+    gchar*  uri;
+    guint   threads;
+    gboolean failed;
+    guint64 frames;
+    gdouble decodeSeconds;
+    gdouble timeToFirstFrame;
+    guint   seeks;
+    gdouble seekLatencyTotal;
+    gdouble seekLatencyMax;
+    gdouble switchLatency;
+    gdouble backendSwitchLatency;
+    gdouble advanceLatency;
+    gdouble backendAdvanceLatency;
+} BenchResult;
+
+typedef struct _BenchData {
+    BackendPlayer* player;
+    GMainLoop*   loop;
+    BenchPhase   phase;
+    BenchResult* result;
+    GRand*       rand;
+    gdouble      duration;
+    guint        seeksLeft;
+    guint        timeoutId;
+    gint64       operationStart;    /* monotonic time of the measured operation */
+    gint64       frameTime;         /* arrival of the frame ending it */
+    gint64       firstFrameTime;
+    gint64       lastFrameTime;
+    gint         frames;            /* atomic */
+    gint         waitingForFrame;   /* atomic */
+    guint        advanceId;         /* waiting for the next entry to preroll */
+    gboolean     advanceAsked;
+    gboolean     advanceFramed;     /* the advanced to entry's first frame has come */
+    gboolean     advancePlaying;    /* and the backend has reported it playing */
+    GPtrArray*   soakUris;
+    guint        soakSteps;
+    GArray*      rssSamples;        /* kilobytes after each soak cycle */
+} BenchData;
+
+typedef struct _SoakResult {
+    guint    cycles;
+    gboolean failed;
+    gint64   rssBaselineKb;         /* mean once warmed up */
+    gint64   rssFinalKb;            /* mean over the last cycles */
+    gint64   rssPeakKb;
+} SoakResult;
+
+static gint   generateSeconds = 0;
+static gint   generateWidth   = 1920;
+static gint   generateHeight  = 1080;
+static gint   seekCount       = 10;
+static gint   timeoutSeconds  = 120;
+static gchar* outputFile      = NULL;
+static gchar* threadList      = NULL;
+static gchar* threadType      = NULL;
+static gint   queueKb         = 0;
+static gint   queueMs         = 0;
+static gboolean glVideo       = FALSE;
+static gchar* lutFile         = NULL;
+static gboolean lutBench      = FALSE;
+static gboolean fftBench      = FALSE;
+static gchar* subtitlePath    = NULL;
+static gboolean subtitleBench = FALSE;
+static gint   subtitleCues    = 200000;
+static gint   memoryBudgetMb  = 0;
+static gint   soakCycles      = 0;
+static gint   soakGrowthKb    = 16384;
+static gchar** inputs         = NULL;
+
+static GOptionEntry entries[] = {
+    { "generate", 'g', 0, G_OPTION_ARG_INT, &generateSeconds,
+      "Also benchmark a generated test clip of N seconds", "N" },
+    { "width", 0, 0, G_OPTION_ARG_INT, &generateWidth, "Width of the generated clip", "W" },
+    { "height", 0, 0, G_OPTION_ARG_INT, &generateHeight, "Height of the generated clip", "H" },
+    { "seeks", 's', 0, G_OPTION_ARG_INT, &seekCount, "Number of seeks per input", "N" },
+    { "timeout", 't', 0, G_OPTION_ARG_INT, &timeoutSeconds, "Per-input timeout in seconds", "S" },
+    { "output", 'o', 0, G_OPTION_ARG_FILENAME, &outputFile, "Write the JSON report to FILE", "FILE" },
+    { "threads", 'j', 0, G_OPTION_ARG_STRING, &threadList,
+      "Decoder thread counts to sweep, 0 for automatic", "N[,N...]" },
+    { "thread-type", 0, 0, G_OPTION_ARG_STRING, &threadType,
+      "Decoder threading: auto, frame or slice", "TYPE" },
+    { "queue-kb", 0, 0, G_OPTION_ARG_INT, &queueKb, "Demuxer to decoder queue size", "KB" },
+    { "queue-ms", 0, 0, G_OPTION_ARG_INT, &queueMs, "Demuxer to decoder queue duration", "MS" },
+    { "gl", 0, 0, G_OPTION_ARG_NONE, &glVideo,
+      "Upload, convert and colour balance video in OpenGL like the player", NULL },
+    { "lut", 0, 0, G_OPTION_ARG_FILENAME, &lutFile,
+      "Grade video through a .cube 3D LUT, also the one --lut-bench uses", "FILE" },
+    { "lut-bench", 0, 0, G_OPTION_ARG_NONE, &lutBench,
+      "Time the 3D LUT kernels at 1080p and 2160p on one core instead", NULL },
+    { "fft-bench", 0, 0, G_OPTION_ARG_NONE, &fftBench,
+      "Time the visualiser's FFT kernels instead", NULL },
+    { "subtitles", 0, 0, G_OPTION_ARG_FILENAME, &subtitlePath,
+      "Subtitle file for --subtitle-bench instead of a generated one", "FILE" },
+    { "subtitle-bench", 0, 0, G_OPTION_ARG_NONE, &subtitleBench,
+      "Time loading, playing through and seeking in a subtitle file instead", NULL },
+    { "subtitle-cues", 0, 0, G_OPTION_ARG_INT, &subtitleCues,
+      "Cues in the file --subtitle-bench generates", "N" },
+    { "memory-budget-mb", 0, 0, G_OPTION_ARG_INT, &memoryBudgetMb,
+      "Cap what the player buffers, 0 for no cap", "MB" },
+    { "soak", 0, 0, G_OPTION_ARG_INT, &soakCycles,
+      "Open, seek and switch through the inputs N times instead, failing if RSS grows", "N" },
+    { "soak-growth-kb", 0, 0, G_OPTION_ARG_INT, &soakGrowthKb,
+      "RSS growth --soak tolerates once warmed up", "KB" },
+    { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &inputs, NULL, "FILE|URI..." },
+    { NULL, 0, 0, 0, NULL, NULL, NULL }
+};
+
+#define ADVANCE_SETTLE_MS 1000  /* for the next playlist entry to preroll */
+
+static void startSeek (BenchData* data);
+static void startAdvance (BenchData* data);
+static void soakNext (BenchData* data);
+
+/* With --gl the frames reach the fakesink through glsinkbin, in GL memory,
+ * so that upload, conversion and colour balance are measured too. Any GL
+ * driver will do, e.g. Mesa's llvmpipe under Xvfb on a headless box. */
+static GstElement* wrapInGl (GstElement* sink) {
+    GstElement* bin;
+
+    if (!glVideo) {
+        return sink;
+    }
+    bin = gst_element_factory_make ("glsinkbin", NULL);
+    if (!bin) {
+        g_printerr ("glsinkbin is not installed, running without GL\n");
+        glVideo = FALSE;
+        return sink;
+    }
+    g_object_set (bin, "sink", sink, NULL);
+    return bin;
+}
+
+/* Keeps backend chatter off stdout, which carries the report */
+static void printToStderr (const gchar* string) {
+    fputs (string, stderr);
+}
+
+static gdouble usToMs (gint64 us) {
+    return (gdouble) us / 1000.0;
+}
+
+static void finish (BenchData* data) {
+    data->phase = PHASE_DONE;
+    g_main_loop_quit (data->loop);
+}
+
+/* Once the next entry has both shown a frame and been reported playing, for
+ * which the backend has measured the advance */
+static void finishAdvance (BenchData* data) {
+    if (data->advanceFramed && data->advancePlaying) {
+        data->result->backendAdvanceLatency = backendGetAdvanceLatency (data->player) * 1000.0;
+        finish (data);
+    }
+}
+
+static gboolean advance_cb (BenchData* data) {
+    data->advanceId = 0;
+    data->advanceAsked = TRUE;
+    startOperation (data);
+    if (!backendPlaylistNext (data->player)) {
+        g_atomic_int_set (&data->waitingForFrame, 0);
+        finish (data);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+/* Queues the input again as the next playlist entry and pauses, so that the
+ * entry is prerolled in the background meanwhile, then advances to it */
+static void startAdvance (BenchData* data) {
+    data->phase = PHASE_ADVANCE;
+    backendPlaylistAppend (data->player, data->result->uri);
+    backendPause (data->player);
+    data->advanceId = g_timeout_add (ADVANCE_SETTLE_MS, (GSourceFunc) advance_cb, data);
+}
+
+static gboolean frameArrived_idle (BenchData* data) {
+    gint64 latency = data->frameTime - data->operationStart;
+
+    switch (data->phase) {
+    case PHASE_DECODE:
+        data->result->timeToFirstFrame = usToMs (latency);
+        break;
+    case PHASE_PREROLL:
+        data->phase = PHASE_SEEK;
+        startSeek (data);
+        break;
+    case PHASE_SEEK:
+        data->result->seeks++;
+        data->result->seekLatencyTotal += usToMs (latency);
+        data->result->seekLatencyMax = MAX (data->result->seekLatencyMax, usToMs (latency));
+        startSeek (data);
+        break;
+    case PHASE_SWITCH:
+        data->result->switchLatency = usToMs (latency);
+        data->result->backendSwitchLatency = backendGetSwitchLatency (data->player) * 1000.0;
+        startAdvance (data);
+        break;
+    case PHASE_ADVANCE:
+        data->result->advanceLatency = usToMs (latency);
+        data->advanceFramed = TRUE;
+        finishAdvance (data);
+        break;
+    case PHASE_SOAK:
+        soakNext (data);
+        break;
+    case PHASE_DONE:
+        break;
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static GstPadProbeReturn videoBuffer_cb (GstPad* pad, GstPadProbeInfo* info, BenchData* data) {
+    UNUSED (pad);
+    UNUSED (info);
+
+    gint64 now = g_get_monotonic_time();
+
+    if (g_atomic_int_add (&data->frames, 1) == 0) {
+        data->firstFrameTime = now;
+    }
+    data->lastFrameTime = now;
+
+    if (g_atomic_int_compare_and_exchange (&data->waitingForFrame, 1, 0)) {
+        data->frameTime = now;
+        g_idle_add ((GSourceFunc) frameArrived_idle, data);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+/* Arms the frame probe; the next video frame ends the measured operation */
+static void startOperation (BenchData* data) {
+    data->operationStart = g_get_monotonic_time();
+    g_atomic_int_set (&data->waitingForFrame, 1);
+}
+
+static void startSwitch (BenchData* data) {
+    data->phase = PHASE_SWITCH;
+    startOperation (data);
+    backendChangeUri (data->player, data->result->uri);
+}
+
+static void startSeek (BenchData* data) {
+    if (data->seeksLeft == 0 || data->duration <= 0) {
+        startSwitch (data);
+        return;
+    }
+    data->seeksLeft--;
+
+    startOperation (data);
+    backendSeek (data->player, g_rand_double_range (data->rand, 0, data->duration * 0.95));
+}
+
+static void backendEvent_cb (BackendEvent event, gdouble value, BenchData* data) {
+    switch (event) {
+    case BACKEND_EVENT_DURATION:
+        data->duration = value;
+        break;
+    case BACKEND_EVENT_EOS:
+        if (data->phase == PHASE_DECODE) {
+            data->result->frames = g_atomic_int_get (&data->frames);
+            data->result->decodeSeconds =
+                    (gdouble) (data->lastFrameTime - data->firstFrameTime) / G_USEC_PER_SEC;
+
+            /* EOS left the pipeline in READY; preroll again to seek */
+            data->phase = PHASE_PREROLL;
+            startOperation (data);
+            backendPause (data->player);
+        } else if (data->phase == PHASE_SEEK || data->phase == PHASE_PREROLL) {
+            startSwitch (data);
+        } else if (data->phase == PHASE_SOAK &&
+                   g_atomic_int_compare_and_exchange (&data->waitingForFrame, 1, 0)) {
+            /* A short input ran out before the frame came */
+            soakNext (data);
+        }
+        break;
+    case BACKEND_EVENT_ERROR:
+        data->result->failed = TRUE;
+        finish (data);
+        break;
+    case BACKEND_EVENT_STATE:
+        if (data->phase == PHASE_ADVANCE && data->advanceAsked && value > 0) {
+            data->advancePlaying = TRUE;
+            finishAdvance (data);
+        }
+        break;
+    case BACKEND_EVENT_POSITION:
+    case BACKEND_EVENT_TRACK_CHANGED:
+    case BACKEND_EVENT_FRAME:
+    case BACKEND_EVENT_TRACKS:
+        break;
+    }
+}
+
+static gboolean timeout_cb (BenchData* data) {
+    g_printerr ("Timed out benchmarking %s\n", data->result->uri);
+    data->result->failed = TRUE;
+    data->timeoutId = 0;
+    finish (data);
+    return G_SOURCE_REMOVE;
+}
+
+/* Fakesinks for every pipeline the player opens, the prerolled next entry's
+ * too, the video ones counting frames. Called on the control thread. */
+static GstElement* makeSink_cb (gboolean video, BenchData* data) {
+    GstElement* sink = gst_element_factory_make ("fakesink", NULL);
+    GstPad* pad;
+
+    g_object_set (sink, "sync", FALSE, NULL);
+    if (!video) {
+        return sink;
+    }
+    pad = gst_element_get_static_pad (sink, "sink");
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+            (GstPadProbeCallback) videoBuffer_cb, data, NULL);
+    gst_object_unref (pad);
+    return wrapInGl (sink);
+}
+
+static BackendPlayer* newPlayer (DecoderConfig* config) {
+    BackendPlayer* player = backendPlayerNew();
+
+    backendSetDecoderConfig (player, config);
+    backendSetMemoryBudget (player, (gsize) MAX (memoryBudgetMb, 0) * 1024 * 1024);
+    if (lutFile) {
+        backendSetLut (player, lutFile, LUT_INTERPOLATION_TETRAHEDRAL, NULL);
+    }
+    return player;
+}
+
+static void runInput (BenchResult* result, DecoderConfig* config) {
+    BenchData data = { 0 };
+
+    config->threads = result->threads;
+    data.player = newPlayer (config);
+
+    data.loop = g_main_loop_new (NULL, FALSE);
+    data.result = result;
+    data.rand = g_rand_new_with_seed (42);
+    data.seeksLeft = MAX (seekCount, 0);
+    data.phase = PHASE_DECODE;
+
+    backendSubscribe (data.player, (BackendEventFunc) backendEvent_cb, &data);
+    backendSetSinkFunc (data.player, (BackendSinkFunc) makeSink_cb, &data);
+
+    startOperation (&data);
+    if (backendPlay (data.player, result->uri) < 0) {
+        result->failed = TRUE;
+    } else {
+        data.timeoutId = g_timeout_add_seconds (timeoutSeconds, (GSourceFunc) timeout_cb, &data);
+        g_main_loop_run (data.loop);
+        if (data.timeoutId) {
+            g_source_remove (data.timeoutId);
+        }
+        if (data.advanceId) {
+            g_source_remove (data.advanceId);
+        }
+    }
+
+    backendPlayerFree (data.player);
+
+    /* Let idle callbacks queued by the probe run before data goes away */
+    while (g_main_context_iteration (NULL, FALSE));
+
+    g_rand_free (data.rand);
+    g_main_loop_unref (data.loop);
+}
+
+/* Resident set size from procfs, -1 where there is none */
+static gint64 currentRssKb (void) {
+    gchar* contents = NULL;
+    gchar** fields;
+    gint64 pages = -1;
+
+    if (!g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL)) {
+        return -1;
+    }
+    fields = g_strsplit (contents, " ", 3);
+    if (fields[0] && fields[1]) {
+        pages = g_ascii_strtoll (fields[1], NULL, 10);
+    }
+    g_strfreev (fields);
+    g_free (contents);
+    return pages < 0 ? -1 : pages * sysconf (_SC_PAGESIZE) / 1024;
+}
+
+static void restartTimeout (BenchData* data) {
+    if (data->timeoutId) {
+        g_source_remove (data->timeoutId);
+    }
+    data->timeoutId = g_timeout_add_seconds (timeoutSeconds, (GSourceFunc) timeout_cb, data);
+}
+
+/* Each cycle opens an input in a new pipeline, seeks somewhere into it and
+ * switches the pipeline over to the next input, each step as soon as a
+ * frame shows it took */
+static void soakNext (BenchData* data) {
+    guint step = data->soakSteps++;
+    guint cycle = step / 3;
+    GPtrArray* uris = data->soakUris;
+    gint64 rss;
+
+    restartTimeout (data);
+    startOperation (data);
+    switch (step % 3) {
+    case 0:
+        if (cycle > 0) {
+            rss = currentRssKb();
+            g_array_append_val (data->rssSamples, rss);
+            if (cycle % 100 == 0) {
+                g_printerr ("Soak cycle %u: %" G_GINT64_FORMAT " KB resident\n", cycle, rss);
+            }
+        }
+        if (cycle == (guint) soakCycles) {
+            g_atomic_int_set (&data->waitingForFrame, 0);
+            finish (data);
+            return;
+        }
+        data->duration = 0;
+        backendPlay (data->player, g_ptr_array_index (uris, cycle % uris->len));
+        break;
+    case 1:
+        backendSeek (data->player, g_rand_double_range (data->rand, 0, data->duration * 0.9));
+        break;
+    case 2:
+        backendChangeUri (data->player, g_ptr_array_index (uris, (cycle + 1) % uris->len));
+        break;
+    }
+}
+
+static gint64 meanKb (GArray* samples, guint from, guint count) {
+    gint64 sum = 0;
+
+    for (guint i = from; i < from + count; i++) {
+        sum += g_array_index (samples, gint64, i);
+    }
+    return count ? sum / count : 0;
+}
+
+/* --soak: the first tenth of the cycles lets the caches, pools and the
+ * registry settle; from then on the RSS must stay flat, within the allowed
+ * growth, from the following tenth to the last one */
+static void runSoak (GPtrArray* uris, DecoderConfig* config, SoakResult* soak) {
+    BenchResult result = { 0 };
+    BenchData data = { 0 };
+    guint warmup;
+    guint window;
+
+    data.player = newPlayer (config);
+    data.loop = g_main_loop_new (NULL, FALSE);
+    data.result = &result;
+    data.rand = g_rand_new_with_seed (42);
+    data.phase = PHASE_SOAK;
+    data.soakUris = uris;
+    data.rssSamples = g_array_new (FALSE, FALSE, sizeof (gint64));
+    result.uri = g_ptr_array_index (uris, 0);
+
+    backendSubscribe (data.player, (BackendEventFunc) backendEvent_cb, &data);
+    backendSetSinkFunc (data.player, (BackendSinkFunc) makeSink_cb, &data);
+    soakNext (&data);
+    g_main_loop_run (data.loop);
+    if (data.timeoutId) {
+        g_source_remove (data.timeoutId);
+    }
+    backendPlayerFree (data.player);
+    while (g_main_context_iteration (NULL, FALSE));
+
+    soak->cycles = data.rssSamples->len;
+    soak->failed = result.failed || soak->cycles < (guint) soakCycles;
+    warmup = soak->cycles / 10;
+    window = MAX ((soak->cycles - warmup) / 10, 1);
+    if (!soak->failed && soak->cycles > warmup + window &&
+        g_array_index (data.rssSamples, gint64, 0) >= 0) {
+        soak->rssBaselineKb = meanKb (data.rssSamples, warmup, window);
+        soak->rssFinalKb = meanKb (data.rssSamples, soak->cycles - window, window);
+        for (guint i = 0; i < soak->cycles; i++) {
+            soak->rssPeakKb = MAX (soak->rssPeakKb, g_array_index (data.rssSamples, gint64, i));
+        }
+        if (soak->rssFinalKb - soak->rssBaselineKb > soakGrowthKb) {
+            g_printerr ("RSS grew from %" G_GINT64_FORMAT " KB to %" G_GINT64_FORMAT " KB\n",
+                    soak->rssBaselineKb, soak->rssFinalKb);
+            soak->failed = TRUE;
+        }
+    }
+
+    g_array_free (data.rssSamples, TRUE);
+    g_rand_free (data.rand);
+    g_main_loop_unref (data.loop);
+}
+
+static void writeSoakReport (FILE* out, const SoakResult* soak) {
+    fprintf (out, "{\n  \"soakCycles\": %u", soak->cycles);
+    fprintf (out, ",\n  \"memoryBudgetMb\": %d", MAX (memoryBudgetMb, 0));
+    fprintf (out, ",\n  \"failed\": %s", soak->failed ? "true" : "false");
+    fprintf (out, ",\n  \"rssBaselineKb\": %" G_GINT64_FORMAT, soak->rssBaselineKb);
+    fprintf (out, ",\n  \"rssFinalKb\": %" G_GINT64_FORMAT, soak->rssFinalKb);
+    fprintf (out, ",\n  \"rssGrowthKb\": %" G_GINT64_FORMAT,
+            soak->rssFinalKb - soak->rssBaselineKb);
+    fprintf (out, ",\n  \"rssGrowthLimitKb\": %d", soakGrowthKb);
+    fprintf (out, ",\n  \"rssPeakKb\": %" G_GINT64_FORMAT "\n}\n", soak->rssPeakKb);
+}
+
+/* Encodes a clip from videotestsrc/audiotestsrc with the first encoders that
+ * are installed, falling back to raw streams in Matroska */
+static gchar* generateMedia (gint seconds, GError** error) {
+    static const gchar* videoEncoders[][2] = {
+        { "x264enc",     "x264enc speed-preset=ultrafast key-int-max=60" },
+        { "avenc_mpeg4", "avenc_mpeg4" },
+        { "vp8enc",      "vp8enc deadline=1" },
+        { "jpegenc",     "jpegenc" },
+    };
+    static const gchar* audioEncoders[][2] = {
+        { "vorbisenc", "vorbisenc" },
+        { "opusenc",   "opusenc" },
+    };
+    const gchar* videoEncoder = "identity";
+    const gchar* audioEncoder = "identity";
+    GstElement* generator;
+    GstBus* bus;
+    GstMessage* msg;
+    gchar* description;
+    gchar* location;
+    gint fd;
+
+    for (guint i = 0; i < G_N_ELEMENTS (videoEncoders); i++) {
+        GstElementFactory* factory = gst_element_factory_find (videoEncoders[i][0]);
+        if (factory) {
+            videoEncoder = videoEncoders[i][1];
+            gst_object_unref (factory);
+            break;
+        }
+    }
+    for (guint i = 0; i < G_N_ELEMENTS (audioEncoders); i++) {
+        GstElementFactory* factory = gst_element_factory_find (audioEncoders[i][0]);
+        if (factory) {
+            audioEncoder = audioEncoders[i][1];
+            gst_object_unref (factory);
+            break;
+        }
+    }
+
+    fd = g_file_open_tmp ("gliese-bench-XXXXXX.mkv", &location, error);
+    if (fd < 0) {
+        return NULL;
+    }
+    g_close (fd, NULL);
+
+    description = g_strdup_printf (
+            "matroskamux name=mux ! filesink location=\"%s\" "
+            "videotestsrc num-buffers=%d pattern=smpte ! "
+            "video/x-raw,width=%d,height=%d,framerate=30/1 ! videoconvert ! %s ! queue ! mux. "
+            "audiotestsrc num-buffers=%d samplesperbuffer=1024 ! audio/x-raw,rate=44100 ! "
+            "audioconvert ! %s ! queue ! mux.",
+            location, seconds * 30, generateWidth, generateHeight, videoEncoder,
+            seconds * 44100 / 1024, audioEncoder);
+    generator = gst_parse_launch (description, error);
+    g_free (description);
+    if (!generator) {
+        g_unlink (location);
+        g_free (location);
+        return NULL;
+    }
+
+    gst_element_set_state (generator, GST_STATE_PLAYING);
+    bus = gst_element_get_bus (generator);
+    msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+            GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+    if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+        gst_message_parse_error (msg, error, NULL);
+        g_unlink (location);
+        g_clear_pointer (&location, g_free);
+    }
+    gst_message_unref (msg);
+    gst_object_unref (bus);
+    gst_element_set_state (generator, GST_STATE_NULL);
+    gst_object_unref (generator);
+
+    g_printerr ("Generated %s (%s, %s)\n", location ? location : "nothing",
+            videoEncoder, audioEncoder);
+    return location;
+}
+
+static void writeJsonString (FILE* out, const gchar* str) {
+    fputc ('"', out);
+    for (const gchar* c = str; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf (out, "\\%c", *c);
+        } else if ((guchar) *c < 0x20) {
+            fprintf (out, "\\u%04x", (guchar) *c);
+        } else {
+            fputc (*c, out);
+        }
+    }
+    fputc ('"', out);
+}
+
+static void writeReport (FILE* out, GPtrArray* results, const DecoderConfig* config) {
+    static const gchar* threadTypes[] = { "auto", "frame", "slice" };
+    struct rusage usage;
+
+    getrusage (RUSAGE_SELF, &usage);
+
+    fprintf (out, "{\n  \"threadType\": \"%s\"", threadTypes[config->threadType]);
+    fprintf (out, ",\n  \"queueKb\": %u", config->queueBytes / 1024);
+    fprintf (out, ",\n  \"queueMs\": %" G_GUINT64_FORMAT, config->queueTime / GST_MSECOND);
+    fprintf (out, ",\n  \"gl\": %s", glVideo ? "true" : "false");
+    fprintf (out, ",\n  \"lut\": ");
+    if (lutFile) {
+        writeJsonString (out, lutFile);
+    } else {
+        fprintf (out, "null");
+    }
+    fprintf (out, ",\n  \"results\": [");
+    for (guint i = 0; i < results->len; i++) {
+        BenchResult* result = g_ptr_array_index (results, i);
+
+        fprintf (out, "%s\n    {\n      \"uri\": ", i ? "," : "");
+        writeJsonString (out, result->uri);
+        fprintf (out, ",\n      \"decoderThreads\": %u", result->threads);
+        fprintf (out, ",\n      \"failed\": %s", result->failed ? "true" : "false");
+        fprintf (out, ",\n      \"frames\": %" G_GUINT64_FORMAT, result->frames);
+        fprintf (out, ",\n      \"decodeFps\": %.2f",
+                result->decodeSeconds > 0 ? result->frames / result->decodeSeconds : 0);
+        fprintf (out, ",\n      \"timeToFirstFrameMs\": %.3f", result->timeToFirstFrame);
+        fprintf (out, ",\n      \"seeks\": %u", result->seeks);
+        fprintf (out, ",\n      \"seekLatencyMeanMs\": %.3f",
+                result->seeks ? result->seekLatencyTotal / result->seeks : 0);
+        fprintf (out, ",\n      \"seekLatencyMaxMs\": %.3f", result->seekLatencyMax);
+        fprintf (out, ",\n      \"uriSwitchLatencyMs\": %.3f", result->switchLatency);
+        fprintf (out, ",\n      \"backendSwitchLatencyMs\": %.3f", result->backendSwitchLatency);
+        fprintf (out, ",\n      \"playlistAdvanceLatencyMs\": %.3f", result->advanceLatency);
+        fprintf (out, ",\n      \"backendAdvanceLatencyMs\": %.3f",
+                result->backendAdvanceLatency);
+        fprintf (out, "\n    }");
+    }
+    /* ru_maxrss is in kilobytes on Linux */
+    fprintf (out, "\n  ],\n  \"peakRssKb\": %ld\n}\n", usage.ru_maxrss);
+}
+
+/* A 33-point grade for --lut-bench without --lut: a gamma lift and a warm
+ * tint, smooth enough for every cell of the grid to be used */
+static Lut3d* syntheticLut (void) {
+    const guint size = 33;
+    gfloat* grid = g_new (gfloat, size * size * size * 3);
+    Lut3d* lut;
+
+    for (guint b = 0; b < size; b++) {
+        for (guint g = 0; g < size; g++) {
+            for (guint r = 0; r < size; r++) {
+                gfloat* point = grid + ((b * size + g) * size + r) * 3;
+
+                point[0] = powf (r / (gfloat) (size - 1), 0.8f);
+                point[1] = powf (g / (gfloat) (size - 1), 0.9f);
+                point[2] = 0.9f * b / (gfloat) (size - 1) + 0.05f * g / (gfloat) (size - 1);
+            }
+        }
+    }
+    lut = lut3dNewFromGrid (size, grid);
+    g_free (grid);
+    return lut;
+}
+
+/* A frame of gradients with some noise, so that lookups wander the table
+ * about as much as they do on real pictures */
+static guint8* lutBenchFrame (LutImage* image, gint width, gint height, gboolean planar) {
+    GRand* rand = g_rand_new_with_seed (42);
+    gsize size = planar ? (gsize) width * height * 3 / 2 : (gsize) width * height * 4;
+    guint8* pixels = g_malloc (size);
+
+    for (gsize i = 0; i < size; i++) {
+        pixels[i] = (guint8) ((i % (gsize) width) * 255 / width + g_rand_int_range (rand, 0, 16));
+    }
+    g_rand_free (rand);
+
+    memset (image, 0, sizeof (LutImage));
+    image->width = width;
+    image->height = height;
+    image->data[0] = pixels;
+    if (planar) {
+        image->layout = LUT_LAYOUT_PLANAR;
+        image->data[1] = pixels + width * height;
+        image->data[2] = image->data[1] + width * height / 4;
+        image->stride[0] = width;
+        image->stride[1] = image->stride[2] = width / 2;
+        image->pixelStride[0] = image->pixelStride[1] = image->pixelStride[2] = 1;
+        image->subsampleX = image->subsampleY = 1;
+    } else {
+        image->layout = LUT_LAYOUT_PACKED;
+        image->stride[0] = width * 4;
+        image->shift[0] = 0;
+        image->shift[1] = 8;
+        image->shift[2] = 16;
+    }
+    return pixels;
+}
+
+/* Grades the frame over and over for half a second, in place like the
+ * element does, and returns the seconds one pass takes */
+static gdouble timeLut (const Lut3d* lut, LutInterpolation interpolation, LutKernel kernel,
+                        const LutImage* image) {
+    gint64 start;
+    gint64 elapsed;
+    guint passes = 0;
+
+    lut3dApplyImage (lut, interpolation, kernel, image);
+    start = g_get_monotonic_time();
+    do {
+        lut3dApplyImage (lut, interpolation, kernel, image);
+        passes++;
+        elapsed = g_get_monotonic_time() - start;
+    } while (elapsed < G_USEC_PER_SEC / 2 || passes < 3);
+    return (gdouble) elapsed / G_USEC_PER_SEC / passes;
+}
+
+/* --lut-bench: every kernel this CPU runs, with both interpolations, on RGBx
+ * and I420 frames at 1080p and 2160p. YUV goes through the table derived for
+ * BT.709, as in the player. Single threaded, like the element. */
+static gboolean runLutBench (FILE* out) {
+    static const gint sizes[][2] = { { 1920, 1080 }, { 3840, 2160 } };
+    static const gchar* interpolations[] = { "tetrahedral", "trilinear" };
+    GError* error = NULL;
+    Lut3d* rgb = lutFile ? lut3dLoad (lutFile, &error) : syntheticLut();
+    Lut3d* yuv;
+    gboolean firstResult = TRUE;
+
+    if (!rgb) {
+        g_printerr ("Could not load the LUT: %s\n", error->message);
+        g_clear_error (&error);
+        return FALSE;
+    }
+    yuv = lut3dToYuv (rgb, 0.2126, 0.0722, FALSE);
+
+    fprintf (out, "{\n  \"lutSize\": %u", lut3dGetSize (rgb));
+    fprintf (out, ",\n  \"bestKernel\": \"%s\"", lut3dKernelName (lut3dBestKernel()));
+    fprintf (out, ",\n  \"lutResults\": [");
+    for (guint s = 0; s < G_N_ELEMENTS (sizes); s++) {
+        for (gint planar = 0; planar < 2; planar++) {
+            LutImage image;
+            guint8* pixels = lutBenchFrame (&image, sizes[s][0], sizes[s][1], planar);
+
+            for (LutKernel kernel = LUT_KERNEL_SCALAR; kernel <= lut3dBestKernel(); kernel++) {
+                for (guint i = 0; i < G_N_ELEMENTS (interpolations); i++) {
+                    gdouble seconds = timeLut (planar ? yuv : rgb, (LutInterpolation) i,
+                            kernel, &image);
+
+                    g_printerr ("%dx%d %s %s %s: %.2f ms\n", sizes[s][0], sizes[s][1],
+                            planar ? "I420" : "RGBx", lut3dKernelName (kernel),
+                            interpolations[i], seconds * 1000);
+                    fprintf (out, "%s\n    {\n      \"width\": %d", firstResult ? "" : ",",
+                            sizes[s][0]);
+                    fprintf (out, ",\n      \"height\": %d", sizes[s][1]);
+                    fprintf (out, ",\n      \"format\": \"%s\"", planar ? "I420" : "RGBx");
+                    fprintf (out, ",\n      \"kernel\": \"%s\"", lut3dKernelName (kernel));
+                    fprintf (out, ",\n      \"interpolation\": \"%s\"", interpolations[i]);
+                    fprintf (out, ",\n      \"frameMs\": %.3f", seconds * 1000);
+                    fprintf (out, ",\n      \"mpixPerSecond\": %.1f",
+                            sizes[s][0] * sizes[s][1] / seconds / 1e6);
+                    fprintf (out, ",\n      \"fps\": %.1f", 1 / seconds);
+                    fprintf (out, "\n    }");
+                    firstResult = FALSE;
+                }
+            }
+            g_free (pixels);
+        }
+    }
+    fprintf (out, "\n  ]\n}\n");
+    lut3dUnref (yuv);
+    lut3dUnref (rgb);
+    return TRUE;
+}
+
+/* --fft-bench: the visualiser's spectrum at the sizes worth drawing with,
+ * with every kernel this CPU runs, over two seconds of stereo noise at 48 kHz
+ * taken a window at a time. Reports the microseconds a window takes. */
+static gboolean runFftBench (FILE* out) {
+    static const guint sizes[] = { 512, 1024, 2048, 4096 };
+    GRand* rand = g_rand_new_with_seed (42);
+    guint sampleCount = 2 * 48000;
+    gfloat* samples = g_new (gfloat, sampleCount);
+    gboolean firstResult = TRUE;
+
+    for (guint i = 0; i < sampleCount; i++) {
+        samples[i] = (gfloat) g_rand_double_range (rand, -1, 1);
+    }
+    fprintf (out, "{\n  \"bestKernel\": \"%s\"", fftKernelName (fftBestKernel()));
+    fprintf (out, ",\n  \"fftResults\": [");
+    for (guint s = 0; s < G_N_ELEMENTS (sizes); s++) {
+        Fft* fft = fftNew (sizes[s]);
+        gfloat* power = g_new (gfloat, sizes[s] / 2);
+
+        for (FftKernel kernel = FFT_KERNEL_SCALAR; kernel <= fftBestKernel(); kernel++) {
+            gint64 start = g_get_monotonic_time();
+            gint64 elapsed;
+            guint passes = 0;
+            gdouble micros;
+
+            do {
+                guint offset = (passes * sizes[s]) % (sampleCount - sizes[s]);
+
+                fftPowerSpectrum (fft, kernel, samples + offset, power);
+                passes++;
+                elapsed = g_get_monotonic_time() - start;
+            } while (elapsed < G_USEC_PER_SEC / 2 || passes < 3);
+            micros = (gdouble) elapsed / passes;
+
+            g_printerr ("%u %s: %.2f us\n", sizes[s], fftKernelName (kernel), micros);
+            fprintf (out, "%s\n    {\n      \"size\": %u", firstResult ? "" : ",", sizes[s]);
+            fprintf (out, ",\n      \"kernel\": \"%s\"", fftKernelName (kernel));
+            fprintf (out, ",\n      \"windowUs\": %.3f", micros);
+            fprintf (out, "\n    }");
+            firstResult = FALSE;
+        }
+        g_free (power);
+        fftFree (fft);
+    }
+    fprintf (out, "\n  ]\n}\n");
+    g_free (samples);
+    g_rand_free (rand);
+    return TRUE;
+}
+
+/* A SubRip file of count cues for --subtitle-bench without --subtitles. Cues
+ * last two to four seconds and every tenth one overlaps the next, as songs
+ * and signs do over dialogue. */
+static gchar* syntheticSubtitles (guint count, GError** error) {
+    GRand* rand = g_rand_new_with_seed (42);
+    gchar* path = NULL;
+    FILE* file;
+    gint fd = g_file_open_tmp ("gliese-bench-XXXXXX.srt", &path, error);
+    guint64 start = 0;
+
+    if (fd < 0) {
+        g_rand_free (rand);
+        return NULL;
+    }
+    file = fdopen (fd, "w");
+    for (guint i = 0; i < count; i++) {
+        guint64 end = start + g_rand_int_range (rand, 2000, 4000);
+
+        if (i % 10 == 9) {
+            end += 3000;
+        }
+        fprintf (file, "%u\n%02u:%02u:%02u,%03u --> %02u:%02u:%02u,%03u\n", i + 1,
+                (guint) (start / 3600000), (guint) (start / 60000 % 60),
+                (guint) (start / 1000 % 60), (guint) (start % 1000),
+                (guint) (end / 3600000), (guint) (end / 60000 % 60),
+                (guint) (end / 1000 % 60), (guint) (end % 1000));
+        fprintf (file, "Line %u of the <i>benchmark</i>\nsecond row\n\n", i + 1);
+        start += g_rand_int_range (rand, 2500, 4500);
+    }
+    fclose (file);
+    g_rand_free (rand);
+    return path;
+}
+
+/* --subtitle-bench: parses and indexes the file, then looks up cues the way
+ * the overlay does, frame after frame through the whole file and at random
+ * positions as after seeks. Both should cost about the same. */
+static gboolean runSubtitleBench (FILE* out) {
+    const guint64 frame = GST_SECOND / 25;
+    const guint seeks = 100000;
+    GError* error = NULL;
+    gchar* generated = NULL;
+    SubtitleFile* file;
+    GRand* rand;
+    guint64 duration;
+    guint64 playFrames = 0;
+    guint64 found = 0;
+    gint64 start;
+    gdouble loadSeconds;
+    gdouble playSeconds;
+    gdouble seekSeconds;
+    gdouble seekMax = 0;
+
+    if (!subtitlePath) {
+        generated = syntheticSubtitles ((guint) MAX (subtitleCues, 1), &error);
+        if (!generated) {
+            g_printerr ("Could not generate subtitles: %s\n", error->message);
+            g_clear_error (&error);
+            return FALSE;
+        }
+    }
+    start = g_get_monotonic_time();
+    file = subtitleFileLoad (subtitlePath ? subtitlePath : generated, &error);
+    loadSeconds = (gdouble) (g_get_monotonic_time() - start) / G_USEC_PER_SEC;
+    if (generated) {
+        g_unlink (generated);
+        g_free (generated);
+    }
+    if (!file) {
+        g_printerr ("Could not load the subtitles: %s\n", error->message);
+        g_clear_error (&error);
+        return FALSE;
+    }
+
+    duration = MAX (subtitleFileGetEnd (file), GST_SECOND);
+
+    start = g_get_monotonic_time();
+    for (guint64 time = 0; time < duration; time += frame) {
+        g_free (subtitleFileMarkupAt (file, time));
+        playFrames++;
+    }
+    playSeconds = (gdouble) (g_get_monotonic_time() - start) / G_USEC_PER_SEC;
+
+    rand = g_rand_new_with_seed (42);
+    start = g_get_monotonic_time();
+    for (guint i = 0; i < seeks; i++) {
+        guint64 time = (guint64) (g_rand_double (rand) * duration);
+        gint64 before = g_get_monotonic_time();
+        gchar* markup = subtitleFileMarkupAt (file, time);
+        gdouble elapsed = (gdouble) (g_get_monotonic_time() - before) / G_USEC_PER_SEC;
+
+        found += markup != NULL;
+        g_free (markup);
+        seekMax = MAX (seekMax, elapsed);
+    }
+    seekSeconds = (gdouble) (g_get_monotonic_time() - start) / G_USEC_PER_SEC;
+    g_rand_free (rand);
+
+    g_printerr ("%u %s cues loaded in %.1f ms, %.2f us per frame, %.2f us per seek\n",
+            subtitleFileGetCount (file), subtitleFileFormatName (subtitleFileGetFormat (file)),
+            loadSeconds * 1000, playSeconds * 1e6 / playFrames, seekSeconds * 1e6 / seeks);
+    fprintf (out, "{\n  \"subtitleFile\": ");
+    if (subtitlePath) {
+        writeJsonString (out, subtitlePath);
+    } else {
+        fprintf (out, "null");
+    }
+    fprintf (out, ",\n  \"format\": \"%s\"",
+            subtitleFileFormatName (subtitleFileGetFormat (file)));
+    fprintf (out, ",\n  \"cues\": %u", subtitleFileGetCount (file));
+    fprintf (out, ",\n  \"durationSeconds\": %.1f", (gdouble) duration / GST_SECOND);
+    fprintf (out, ",\n  \"loadMs\": %.3f", loadSeconds * 1000);
+    fprintf (out, ",\n  \"frameLookups\": %" G_GUINT64_FORMAT, playFrames);
+    fprintf (out, ",\n  \"frameLookupUs\": %.3f", playSeconds * 1e6 / playFrames);
+    fprintf (out, ",\n  \"seekLookups\": %u", seeks);
+    fprintf (out, ",\n  \"seekLookupUs\": %.3f", seekSeconds * 1e6 / seeks);
+    fprintf (out, ",\n  \"seekLookupMaxUs\": %.3f", seekMax * 1e6);
+    fprintf (out, ",\n  \"seeksShowingCues\": %" G_GUINT64_FORMAT, found);
+    fprintf (out, "\n}\n");
+    subtitleFileUnref (file);
+    return TRUE;
+}
+
+/* Parses the --threads list; without it every input runs once with the
+ * decoders' own default */
+static GArray* parseThreadCounts (const gchar* list) {
+    GArray* counts = g_array_new (FALSE, FALSE, sizeof (guint));
+    gchar** items;
+
+    if (!list) {
+        guint automatic = 0;
+        g_array_append_val (counts, automatic);
+        return counts;
+    }
+    items = g_strsplit (list, ",", -1);
+    for (gint i = 0; items[i]; i++) {
+        gchar* end;
+        guint count = (guint) g_ascii_strtoull (g_strstrip (items[i]), &end, 10);
+
+        if (end == items[i] || *end != '\0' || count > 256) {
+            g_strfreev (items);
+            g_array_free (counts, TRUE);
+            return NULL;
+        }
+        g_array_append_val (counts, count);
+    }
+    g_strfreev (items);
+    return counts;
+}
+
+static gboolean parseThreadType (const gchar* name, DecoderThreadType* type) {
+    if (!name || g_str_equal (name, "auto")) {
+        *type = DECODER_THREADS_AUTO;
+    } else if (g_str_equal (name, "frame")) {
+        *type = DECODER_THREADS_FRAME;
+    } else if (g_str_equal (name, "slice")) {
+        *type = DECODER_THREADS_SLICE;
+    } else {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void addResults (GPtrArray* results, const gchar* uri, GArray* threadCounts) {
+    for (guint i = 0; i < threadCounts->len; i++) {
+        BenchResult* result = g_new0 (BenchResult, 1);
+
+        result->uri = g_strdup (uri);
+        result->threads = g_array_index (threadCounts, guint, i);
+        g_ptr_array_add (results, result);
+    }
+}
+
+int main (int argc, char** argv) {
+    GOptionContext* context;
+    GError* error = NULL;
+    GPtrArray* results;
+    GArray* threadCounts;
+    DecoderConfig config = { 0 };
+    SoakResult soak = { 0 };
+    gchar* generated = NULL;
+    FILE* out = stdout;
+    gboolean failed = FALSE;
+
+    context = g_option_context_new ("- benchmark the ProjectGliese playback backend");
+    g_option_context_add_main_entries (context, entries, NULL);
+    g_option_context_add_group (context, gst_init_get_option_group());
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        g_clear_error (&error);
+        g_option_context_free (context);
+        return 2;
+    }
+    g_option_context_free (context);
+
+    threadCounts = parseThreadCounts (threadList);
+    if (!threadCounts) {
+        g_printerr ("Invalid --threads: %s\n", threadList);
+        return 2;
+    }
+    if (!parseThreadType (threadType, &config.threadType)) {
+        g_printerr ("Invalid --thread-type: %s\n", threadType);
+        return 2;
+    }
+    config.queueBytes = (guint) MAX (queueKb, 0) * 1024;
+    config.queueTime = (guint64) MAX (queueMs, 0) * GST_MSECOND;
+
+    backendInit (&argc, &argv);
+    g_set_print_handler (printToStderr);
+
+    if (lutBench || fftBench || subtitleBench) {
+        g_array_free (threadCounts, TRUE);
+        if (outputFile) {
+            out = fopen (outputFile, "w");
+            if (!out) {
+                g_printerr ("Could not open %s for writing\n", outputFile);
+                out = stdout;
+            }
+        }
+        if (lutBench) {
+            failed = !runLutBench (out);
+        } else if (fftBench) {
+            failed = !runFftBench (out);
+        } else {
+            failed = !runSubtitleBench (out);
+        }
+        if (out != stdout) {
+            fclose (out);
+        }
+        return failed ? 1 : 0;
+    }
+
+    results = g_ptr_array_new();
+
+    for (gint i = 0; inputs && inputs[i]; i++) {
+        gchar* uri;
+
+        if (gst_uri_is_valid (inputs[i])) {
+            uri = g_strdup (inputs[i]);
+        } else {
+            uri = gst_filename_to_uri (inputs[i], NULL);
+        }
+        if (uri) {
+            addResults (results, uri, threadCounts);
+            g_free (uri);
+        } else {
+            g_printerr ("Skipping %s: not a file or URI\n", inputs[i]);
+        }
+    }
+
+    if (generateSeconds > 0) {
+        generated = generateMedia (generateSeconds, &error);
+        if (!generated) {
+            g_printerr ("Could not generate test media: %s\n",
+                    error ? error->message : "unknown error");
+            g_clear_error (&error);
+        } else {
+            gchar* uri = gst_filename_to_uri (generated, NULL);
+            addResults (results, uri, threadCounts);
+            g_free (uri);
+        }
+    }
+    g_array_free (threadCounts, TRUE);
+
+    if (results->len == 0) {
+        g_printerr ("Nothing to benchmark; pass files/URIs or --generate N\n");
+        g_ptr_array_free (results, TRUE);
+        return 2;
+    }
+
+    if (g_getenv (PROFILER_ENVIRONMENT)) {
+        profilerStart();
+    }
+    if (soakCycles > 0) {
+        GPtrArray* uris = g_ptr_array_new();
+
+        for (guint i = 0; i < results->len; i++) {
+            g_ptr_array_add (uris, ((BenchResult*) g_ptr_array_index (results, i))->uri);
+        }
+        config.threads = ((BenchResult*) g_ptr_array_index (results, 0))->threads;
+        g_printerr ("Soaking %u inputs for %d cycles\n", uris->len, soakCycles);
+        runSoak (uris, &config, &soak);
+        failed = soak.failed;
+        g_ptr_array_free (uris, TRUE);
+    } else {
+        for (guint i = 0; i < results->len; i++) {
+            BenchResult* result = g_ptr_array_index (results, i);
+
+            g_printerr ("Benchmarking %s with %u decoder threads\n",
+                    result->uri, result->threads);
+            runInput (result, &config);
+            failed |= result->failed;
+        }
+    }
+
+    if (outputFile) {
+        out = fopen (outputFile, "w");
+        if (!out) {
+            g_printerr ("Could not open %s for writing\n", outputFile);
+            out = stdout;
+        }
+    }
+    if (soakCycles > 0) {
+        writeSoakReport (out, &soak);
+    } else {
+        writeReport (out, results, &config);
+    }
+    if (profilerIsRunning()) {
+        gchar* summary = profilerStop (g_getenv (PROFILER_ENVIRONMENT), &error);
+
+        g_printerr ("%s", summary ? summary : error->message);
+        g_clear_error (&error);
+        g_free (summary);
+    }
+    if (out != stdout) {
+        fclose (out);
+    }
+
+    if (generated) {
+        g_unlink (generated);
+        g_free (generated);
+    }
+    for (guint i = 0; i < results->len; i++) {
+        BenchResult* result = g_ptr_array_index (results, i);
+        g_free (result->uri);
+        g_free (result);
+    }
+    g_ptr_array_free (results, TRUE);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,228 @@
+#include <math.h>
+#include <string.h>
+#include "fft.h"
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define FFT_X86
+#include <immintrin.h>
+#endif
+
+/* Iterative decimation in time. Complex values are kept split, real parts
+ * in one array and imaginary parts in another, so that a vector holds the
+ * same part of neighbouring butterflies and a stage needs no shuffles. The
+ * stage with butterflies half apart takes its half twiddles from index
+ * half - 1 on. */
+struct _Fft {
+    guint size;
+    guint* reverse;             /* where each sample goes, bit reversed */
+    gfloat* window;             /* Hann */
+    gfloat* twiddleRe;          /* size - 1, stage after stage */
+    gfloat* twiddleIm;
+    gfloat* re;
+    gfloat* im;
+    gfloat scale;               /* makes a full-scale sine peak at a power of 1 */
+};
+
+Fft* fftNew (guint size) {
+    Fft* fft;
+    guint bits = 0;
+
+    g_return_val_if_fail (size >= 16 && (size & (size - 1)) == 0, NULL);
+    while ((1u << bits) < size) {
+        bits++;
+    }
+    fft = g_new0 (Fft, 1);
+    fft->size = size;
+    fft->reverse = g_new (guint, size);
+    fft->window = g_new (gfloat, size);
+    fft->twiddleRe = g_new (gfloat, size - 1);
+    fft->twiddleIm = g_new (gfloat, size - 1);
+    fft->re = g_new (gfloat, size);
+    fft->im = g_new (gfloat, size);
+
+    for (guint i = 0; i < size; i++) {
+        guint reversed = 0;
+
+        for (guint b = 0; b < bits; b++) {
+            reversed |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        fft->reverse[i] = reversed;
+        fft->window[i] = (gfloat) (0.5 - 0.5 * cos (2 * G_PI * i / size));
+    }
+    for (guint half = 1; half < size; half *= 2) {
+        for (guint k = 0; k < half; k++) {
+            fft->twiddleRe[half - 1 + k] = (gfloat) cos (-G_PI * k / half);
+            fft->twiddleIm[half - 1 + k] = (gfloat) sin (-G_PI * k / half);
+        }
+    }
+    /* A sine of amplitude 1 comes out at size / 2, halved again by the window */
+    fft->scale = 16.0f / ((gfloat) size * (gfloat) size);
+    return fft;
+}
+
+void fftFree (Fft* fft) {
+    if (!fft) {
+        return;
+    }
+    g_free (fft->reverse);
+    g_free (fft->window);
+    g_free (fft->twiddleRe);
+    g_free (fft->twiddleIm);
+    g_free (fft->re);
+    g_free (fft->im);
+    g_free (fft);
+}
+
+guint fftGetSize (const Fft* fft) {
+    return fft->size;
+}
+
+static void stageScalar (Fft* fft, guint half) {
+    const gfloat* wr = fft->twiddleRe + half - 1;
+    const gfloat* wi = fft->twiddleIm + half - 1;
+
+    for (guint start = 0; start < fft->size; start += 2 * half) {
+        gfloat* ar = fft->re + start;
+        gfloat* ai = fft->im + start;
+        gfloat* br = ar + half;
+        gfloat* bi = ai + half;
+
+        for (guint k = 0; k < half; k++) {
+            gfloat tr = br[k] * wr[k] - bi[k] * wi[k];
+            gfloat ti = br[k] * wi[k] + bi[k] * wr[k];
+
+            br[k] = ar[k] - tr;
+            bi[k] = ai[k] - ti;
+            ar[k] += tr;
+            ai[k] += ti;
+        }
+    }
+}
+
+#ifdef FFT_X86
+
+/* The vector stages compute what the scalar one does, a butterfly per lane,
+ * once butterflies are at least a vector apart */
+
+#define AVX __attribute__ ((target ("avx")))
+#define SSE2 __attribute__ ((target ("sse2")))
+
+static SSE2 void stageSse2 (Fft* fft, guint half) {
+    const gfloat* wr = fft->twiddleRe + half - 1;
+    const gfloat* wi = fft->twiddleIm + half - 1;
+
+    for (guint start = 0; start < fft->size; start += 2 * half) {
+        gfloat* ar = fft->re + start;
+        gfloat* ai = fft->im + start;
+        gfloat* br = ar + half;
+        gfloat* bi = ai + half;
+
+        for (guint k = 0; k < half; k += 4) {
+            __m128 xr = _mm_loadu_ps (br + k);
+            __m128 xi = _mm_loadu_ps (bi + k);
+            __m128 cr = _mm_loadu_ps (wr + k);
+            __m128 ci = _mm_loadu_ps (wi + k);
+            __m128 yr = _mm_loadu_ps (ar + k);
+            __m128 yi = _mm_loadu_ps (ai + k);
+            __m128 tr = _mm_sub_ps (_mm_mul_ps (xr, cr), _mm_mul_ps (xi, ci));
+            __m128 ti = _mm_add_ps (_mm_mul_ps (xr, ci), _mm_mul_ps (xi, cr));
+
+            _mm_storeu_ps (br + k, _mm_sub_ps (yr, tr));
+            _mm_storeu_ps (bi + k, _mm_sub_ps (yi, ti));
+            _mm_storeu_ps (ar + k, _mm_add_ps (yr, tr));
+            _mm_storeu_ps (ai + k, _mm_add_ps (yi, ti));
+        }
+    }
+}
+
+static AVX void stageAvx (Fft* fft, guint half) {
+    const gfloat* wr = fft->twiddleRe + half - 1;
+    const gfloat* wi = fft->twiddleIm + half - 1;
+
+    for (guint start = 0; start < fft->size; start += 2 * half) {
+        gfloat* ar = fft->re + start;
+        gfloat* ai = fft->im + start;
+        gfloat* br = ar + half;
+        gfloat* bi = ai + half;
+
+        for (guint k = 0; k < half; k += 8) {
+            __m256 xr = _mm256_loadu_ps (br + k);
+            __m256 xi = _mm256_loadu_ps (bi + k);
+            __m256 cr = _mm256_loadu_ps (wr + k);
+            __m256 ci = _mm256_loadu_ps (wi + k);
+            __m256 yr = _mm256_loadu_ps (ar + k);
+            __m256 yi = _mm256_loadu_ps (ai + k);
+            __m256 tr = _mm256_sub_ps (_mm256_mul_ps (xr, cr), _mm256_mul_ps (xi, ci));
+            __m256 ti = _mm256_add_ps (_mm256_mul_ps (xr, ci), _mm256_mul_ps (xi, cr));
+
+            _mm256_storeu_ps (br + k, _mm256_sub_ps (yr, tr));
+            _mm256_storeu_ps (bi + k, _mm256_sub_ps (yi, ti));
+            _mm256_storeu_ps (ar + k, _mm256_add_ps (yr, tr));
+            _mm256_storeu_ps (ai + k, _mm256_add_ps (yi, ti));
+        }
+    }
+}
+
+#endif
+
+static FftKernel detectBestKernel (void) {
+#ifdef FFT_X86
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx")) {
+        return FFT_KERNEL_AVX;
+    }
+    if (__builtin_cpu_supports ("sse2")) {
+        return FFT_KERNEL_SSE2;
+    }
+#endif
+    return FFT_KERNEL_SCALAR;
+}
+
+/* The fastest kernel this CPU runs, looked up once rather than for every
+ * spectrum fftPowerSpectrum() draws */
+FftKernel fftBestKernel (void) {
+    static gsize best = 0;
+
+    /* 0 means not yet looked up, so the kernel is kept plus one */
+    if (g_once_init_enter (&best)) {
+        g_once_init_leave (&best, (gsize) detectBestKernel() + 1);
+    }
+    return (FftKernel) (best - 1);
+}
+
+const gchar* fftKernelName (FftKernel kernel) {
+    static const gchar* names[] = { "scalar", "sse2", "avx" };
+
+    return names[kernel];
+}
+
+/* Windows size samples and writes the power of the first size / 2 bins,
+ * linear, 1 for a full-scale sine. A kernel the CPU does not run is
+ * replaced by the best one it does. */
+void fftPowerSpectrum (Fft* fft, FftKernel kernel, const gfloat* samples, gfloat* power) {
+    guint size = fft->size;
+
+    kernel = MIN (kernel, fftBestKernel());
+    for (guint i = 0; i < size; i++) {
+        fft->re[fft->reverse[i]] = samples[i] * fft->window[i];
+    }
+    memset (fft->im, 0, size * sizeof (gfloat));
+
+    for (guint half = 1; half < size; half *= 2) {
+#ifdef FFT_X86
+        if (kernel == FFT_KERNEL_AVX && half >= 8) {
+            stageAvx (fft, half);
+            continue;
+        }
+        if (kernel >= FFT_KERNEL_SSE2 && half >= 4) {
+            stageSse2 (fft, half);
+            continue;
+        }
+#endif
+        stageScalar (fft, half);
+    }
+
+    for (guint k = 0; k < size / 2; k++) {
+        power[k] = (fft->re[k] * fft->re[k] + fft->im[k] * fft->im[k]) * fft->scale;
+    }
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <glib.h>
+
+/* A radix-2 FFT of a fixed power-of-two size over real samples, for the
+ * audio visualiser, with vectorised butterflies chosen at run time. A plan
+ * holds its scratch buffers, so one is used by one thread at a time. */
+typedef struct _Fft Fft;
+
+/* The instruction sets the butterflies are written for, slowest first */
+typedef enum _FftKernel {
+    FFT_KERNEL_SCALAR,
+    FFT_KERNEL_SSE2,
+    FFT_KERNEL_AVX
+} FftKernel;
+
+Fft*         fftNew (guint size);
+void         fftFree (Fft* fft);
+guint        fftGetSize (const Fft* fft);
+FftKernel    fftBestKernel (void);
+const gchar* fftKernelName (FftKernel kernel);
+void         fftPowerSpectrum (Fft* fft, FftKernel kernel, const gfloat* samples,
+                               gfloat* power);
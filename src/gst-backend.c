@@ -1,311 +1,3746 @@
 #include <gst/gst.h>
+#include <gst/video/video.h>
 #include <gst/video/videooverlay.h>
 #include <gst/video/colorbalance.h>
-#include <gtk/gtk.h>
 #include <glib/gprintf.h>
+#include <glib/gstdio.h>
+#include <fcntl.h>
+#include <string.h>
 #include "gst-backend.h"
-#include "ui.h"
+#include "lutfilter.h"
+#include "mosaic.h"
+#include "resumestore.h"
+#include "subtitles.h"
+#include "visualiser.h"
 
-typedef struct _CustomData {
+/* What a playbin3 reported of the streams of its file, and which of them it
+ * decodes */
+typedef struct _Streams {
+    GstStreamCollection* collection;
+    gchar** active;             /* ids of the selected streams */
+} Streams;
+
+/* The next playlist entry, prerolled in PAUSED so that advancing to it only
+ * needs a state flip */
+typedef struct _Standby {
+    GstElement* pipeline;
+    gchar* uri;
+    Streams streams;
+    gdouble resumeAt;           /* to seek to once prerolled, negative if nowhere */
+    gulong glSlotProbe;         /* holds the first frame for the GL sink, see createGlSlot() */
+} Standby;
+
+/* A decoded frame kept for stepping back without decoding again */
+typedef struct _CachedFrame {
+    GstBuffer* buffer;
+    GstCaps* caps;
+    GstClockTime position;      /* stream time */
+} CachedFrame;
+
+/* The most recently decoded frames, up to a memory budget. Filled from the
+ * streaming thread, only while paused; the rest belongs to the control
+ * thread, but for the converter, which the caller's thread uses to paint the
+ * shown frame. */
+typedef struct _FrameRing {
+    GMutex lock;
+    GQueue frames;              /* oldest first */
+    gsize bytes;
+    gsize cacheSize;            /* as set by the caller */
+    gsize budget;               /* the cache size within the player's memory budget */
+    GstElement* owner;          /* the active playbin; the standby one is ignored */
+    gboolean filling;           /* paused or stepping, see setFrameRingFilling() */
+    CachedFrame* shown;         /* on screen instead of the sink's frame, set under the lock */
+    GstClockTime liveAtPause;   /* the sink's frame while one is shown */
+    GstClockTime refillTarget;  /* the frame to show once refilled, see refillFrameRing() */
+    gboolean refillStepping;    /* past the seek, stepping back up to liveAtPause */
+    GstVideoConverter* converter;
+    GstVideoInfo converterInfo;
+} FrameRing;
+
+/* A call queued for the control thread. Callers push onto a lock-free stack;
+ * the control thread takes the whole stack at once and runs it oldest first. */
+typedef struct _Command Command;
+
+typedef void (*CommandFunc) (BackendPlayer* player, Command* command);
+
+struct _Command {
+    Command* next;
+    CommandFunc func;
+    gdouble value;
+    gpointer data;
+    gpointer extra;
+    GDestroyNotify freeData;    /* for data and extra, unless taken over */
+};
+
+/* The player as last published by the control thread, for the getters on
+ * the caller's thread. Holds its own references. */
+typedef struct _PlayerView {
+    GstElement* pipeline;
+    GstClock* clock;
+    GstState state;
+    gint64 duration;
+    GstClockTime anchorPosition;
+    GstClockTime anchorClockTime;
+    gchar* uri;
+    gboolean hasNext;
+    gboolean mosaic;
+    gchar* mosaicInfo;
+    gdouble volume;             /* set right away by backendSetVolume() */
+    BackendStats stats;
+    BackendTrack* tracks;
+    guint trackCount;
+} PlayerView;
+
+#define EVENT_COUNT (BACKEND_EVENT_TRACKS + 1)
+#define TRACK_SLOTS (BACKEND_SLOT_SECONDARY_SUBTITLE + 1)
+
+enum {
+    BALANCE_CONTRAST,
+    BALANCE_BRIGHTNESS,
+    BALANCE_HUE,
+    BALANCE_SATURATION,
+    BALANCE_CHANNELS
+};
+
+static const gchar* balanceLabels[] = { "CONTRAST", "BRIGHTNESS", "HUE", "SATURATION" };
+
+/* The shares of the memory budget, as divisors. What is left over is for
+ * what cannot be capped: decoder frame pools, the sinks and the LUT. */
+#define BUDGET_FRAME_RING   4   /* the frames kept for stepping back */
+#define BUDGET_DEMUX_QUEUE  8   /* the multiqueue between demuxer and decoders */
+#define BUDGET_DOWNLOAD     8   /* the queue2 in front of network sources */
+#define BUDGET_STANDBY      8   /* all the prerolled standby pipeline holds */
+#define BUDGET_QUEUE        32  /* each plain queue, e.g. playsink's */
+
+/* Files left closer than this to either end are not resumed */
+#define RESUME_MIN          (10 * GST_SECOND)
+#define RESUME_END          (30 * GST_SECOND)
+
+typedef struct _Subscriber {
+    BackendEventFunc func;
+    gpointer userData;
+} Subscriber;
+
+/* Everything one player owns. Players share nothing but the GStreamer
+ * registry, so any number of them can run side by side in one process.
+ * Apart from the locked fields, all of it belongs to the control thread. */
+struct _BackendPlayer {
+    GstElement* pipeline;
+    GstElement* videoSink;      /* for the next backendPlay() */
+    GstElement* audioSink;
+    BackendSinkFunc sinkFunc;   /* for every other pipeline, the standby one too */
+    gpointer sinkData;
+    GstElement* glSink;         /* kept across playbins, as it owns the caller's widget */
+    guintptr windowHandle;
     GstState state;
     gint64 duration;
     GstStateChangeReturn ret;
-} CustomData;
+    GMutex nextUriLock;
+    gchar* nextUri;             /* queued for a gapless switch on about-to-finish */
+    gint64 switchDue;           /* monotonic time the new stream is expected to start */
+    gint64 switchLatency;       /* last measured URI switch latency, microseconds */
+    gint64 advanceStart;        /* monotonic time of the playlist advance under way */
+    gint64 advanceLatency;      /* from there to the next entry playing, microseconds */
+    GstClock* clock;            /* pipeline clock while playing, for interpolation */
+    GstClockTime anchorPosition;
+    GstClockTime anchorClockTime;
+    guint refreshInterval;      /* position push interval while playing, ms */
+    guint positionSourceId;
+    guint advanceSourceId;
+    GList* subscribers;
+    gboolean seekInFlight;      /* a flushing seek has not reached async-done yet */
+    gdouble pendingSeek;        /* latest superseding target, negative if none */
+    gboolean pendingAccurate;
+    gdouble resumeAt;           /* saved position to seek to once prerolled, negative if none */
+    GstState resumeState;       /* what to go to after that seek, VOID_PENDING when resumed */
+    gint hidePreroll;           /* atomic: sinks keep their preroll frame to themselves */
+    GPtrArray* playlist;
+    guint playlistIndex;
+    Standby standby;
+    gsize standbyMemoryLimit;
+    GMutex decoderConfigLock;   /* also guards the memory budget */
+    DecoderConfig decoderConfig;
+    gsize memoryBudget;         /* bytes all buffering may take, 0 for no cap */
+    FrameRing frameRing;
+    BackendStats stats;
+    gint framesPassed;          /* atomic, counted in the frame ring probe */
+    gboolean statsOverlay;
+    guint statsSourceId;
+    Mosaic* mosaic;             /* set while the pipeline is a mosaic instead of a playbin */
+    MosaicDecode mosaicDecode;
+    gdouble volume;
+    gint videoHidden;           /* atomic: no surface shows the video, decoders are starved */
+    Lut3d* lut;                 /* graded with in every playbin's filter bin, NULL for none */
+    LutInterpolation lutInterpolation;
+    gint surfaceWidth;          /* device pixels of what shows the video, 0 if unknown */
+    gint surfaceHeight;
+    BackendVisualisation visualisation; /* for files without video */
+    guint visualisationRate;    /* frames per second at most, 0 for no cap */
+    guint resizeSourceId;
+    GMutex balanceLock;
+    BackendColorBalance balance; /* under the lock: the latest values asked for */
+    gboolean balanceQueued;     /* under the lock: an update is on its way */
+    GstElement* balanceOwner;   /* the pipeline the channels were looked up on */
+    GstColorBalanceChannel* balanceChannels[BALANCE_CHANNELS];
+    gint balanceApplied[BALANCE_CHANNELS];
+    Streams streams;            /* of the active pipeline */
+    gboolean picked[TRACK_SLOTS];   /* the user chose the slot's track, or none */
+    gchar* chosen[TRACK_SLOTS];     /* stream id picked for the slot, NULL for none */
+    gboolean tracksChanged;     /* the view's tracks are out of date */
+    SubtitleFile* subtitleFile; /* attached to the current file, NULL for none */
+    gchar* subtitleFileId;      /* the track id it goes by */
+    GThread* thread;            /* the control thread */
+    GMainContext* context;      /* run by the control thread: bus watches, timers, commands */
+    GMainLoop* loop;
+    GMainContext* callerContext; /* where subscribers are called */
+    Command* commands;          /* atomic, newest first */
+    GMutex viewLock;            /* guards the view and the pending events */
+    PlayerView view;
+    guint pendingEvents;        /* a bit per BackendEvent */
+    gdouble pendingValues[EVENT_COUNT];
+    GSource* dispatchSource;    /* delivers the pending events on the caller's context */
+};
+
+static void eos_cb (GstBus* bus, GstMessage* msg, BackendPlayer* player);
+static void error_cb (GstBus* bus, GstMessage* msg, BackendPlayer* player);
+static void stateChanged_cb(GstBus* bus, GstMessage* msg, BackendPlayer* player);
+static void streamStart_cb (GstBus* bus, GstMessage* msg, BackendPlayer* player);
+static void durationChanged_cb (GstBus* bus, GstMessage* msg, BackendPlayer* player);
+static void asyncDone_cb (GstBus* bus, GstMessage* msg, BackendPlayer* player);
+static void streamCollection_cb (GstBus* bus, GstMessage* msg, BackendPlayer* player);
+static void streamsSelected_cb (GstBus* bus, GstMessage* msg, BackendPlayer* player);
+static gboolean positionTick_cb (BackendPlayer* player);
+static void recordSwitchLatency (BackendPlayer* player);
+static gboolean playlistAdvance_cb (BackendPlayer* player);
+static void padAdded_cb (GstElement* dec, GstPad* pad, gpointer data);
+static void aboutToFinish_cb (GstElement* playbin, BackendPlayer* player);
+static void elementSetup_cb (GstElement* playbin, GstElement* element, BackendPlayer* player);
+static void standbyElementSetup_cb (GstElement* playbin, GstElement* element,
+                                    BackendPlayer* player);
+static gboolean standbyBus_cb (GstBus* bus, GstMessage* msg, BackendPlayer* player);
+static void emitEvent (BackendPlayer* player, BackendEvent event, gdouble value);
+static void closePlayer (BackendPlayer* player);
+static void stopPipeline (BackendPlayer* player);
+static void resumePipeline (BackendPlayer* player);
+static GstStateChangeReturn startPipeline (BackendPlayer* player, const gchar* uri);
+static gdouble lookupResumePoint (const gchar* uri);
+static gboolean resumeSeek (GstElement* pipeline, gdouble position);
+static void saveResumePoint (BackendPlayer* player);
+static void cancelResume (BackendPlayer* player);
+static void finishResume (BackendPlayer* player);
+static GstClockTime shownPosition (BackendPlayer* player);
+static int  openUri (BackendPlayer* player, const gchar* filename);
+static void publish (BackendPlayer* player);
+static void removeSource (BackendPlayer* player, guint* id);
+static void updateDuration (BackendPlayer* player);
+static void releasePipeline (BackendPlayer* player);
+static void issueSeek (BackendPlayer* player, gdouble value, gboolean accurate);
+static void addVideoFilter (BackendPlayer* player, GstElement* playbin);
+static void addVisualisation (BackendPlayer* player, GstElement* playbin);
+static void applyColorBalance (BackendPlayer* player);
+static void clearFrameRing (FrameRing* ring);
+static void setFrameRingFilling (FrameRing* ring, gboolean filling);
+static void cancelRefill (BackendPlayer* player);
+static void finishRefill (BackendPlayer* player);
+static void trimFrameRing (FrameRing* ring);
+static void showCachedFrame (BackendPlayer* player, CachedFrame* frame);
+static void stepDone_cb (GstBus* bus, GstMessage* msg, BackendPlayer* player);
+static void qos_cb (GstBus* bus, GstMessage* msg, BackendPlayer* player);
+static void latency_cb (GstBus* bus, GstMessage* msg, BackendPlayer* player);
+static void buffering_cb (GstBus* bus, GstMessage* msg, BackendPlayer* player);
+static void updateLatency (BackendPlayer* player);
+static void prepareStandby (BackendPlayer* player);
+static void discardStandby (BackendPlayer* player);
+static gsize budgetShare (BackendPlayer* player, guint divisor);
+static void clearStreams (Streams* streams);
+static void resetTracks (BackendPlayer* player);
+static void takeCollection (BackendPlayer* player, GstStreamCollection* collection);
+
+void backendInit (int* argc, char*** argv){
+    gst_init (argc, argv);
+    lutFilterRegister();
+    subtitlesRegister();
+    visualiserRegister();
+}
+
+/* The control thread. Every player runs its pipelines on a thread of its own,
+ * so that opening a slow network file, a stuck preroll or a flushing seek
+ * never holds up the caller. The public calls only queue a command and
+ * return; getters read the view the control thread last published. */
+
+static gpointer controlThread (BackendPlayer* player) {
+    g_main_context_push_thread_default (player->context);
+    g_main_loop_run (player->loop);
+    g_main_context_pop_thread_default (player->context);
+    return NULL;
+}
+
+static Command* newCommand (CommandFunc func) {
+    Command* command = g_new0 (Command, 1);
+
+    command->func = func;
+    return command;
+}
+
+static void freeCommand (Command* command) {
+    if (command->freeData && command->data) {
+        command->freeData (command->data);
+    }
+    if (command->freeData && command->extra) {
+        command->freeData (command->extra);
+    }
+    g_free (command);
+}
+
+/* Runs everything queued so far, oldest first, then publishes the result */
+static gboolean runCommands_cb (BackendPlayer* player) {
+    Command* command;
+    Command* ordered = NULL;
+
+    do {
+        command = g_atomic_pointer_get (&player->commands);
+    } while (!g_atomic_pointer_compare_and_exchange (&player->commands, command, NULL));
+
+    while (command) {
+        Command* next = command->next;
+
+        command->next = ordered;
+        ordered = command;
+        command = next;
+    }
+    while (ordered) {
+        Command* next = ordered->next;
+
+        ordered->func (player, ordered);
+        freeCommand (ordered);
+        ordered = next;
+    }
+    publish (player);
+    return G_SOURCE_REMOVE;
+}
+
+/* Lock-free for any number of callers. Only the push onto an empty stack
+ * wakes the control thread; later ones ride along with it. */
+static void pushCommand (BackendPlayer* player, Command* command) {
+    Command* head;
+
+    do {
+        head = g_atomic_pointer_get (&player->commands);
+        command->next = head;
+    } while (!g_atomic_pointer_compare_and_exchange (&player->commands, head, command));
+
+    if (!head) {
+        g_main_context_invoke (player->context, (GSourceFunc) runCommands_cb, player);
+    }
+}
+
+static void shutDown_cb (BackendPlayer* player, Command* command) {
+    UNUSED (command);
+
+    closePlayer (player);
+    if (player->statsSourceId) {
+        removeSource (player, &player->statsSourceId);
+    }
+    if (player->advanceSourceId) {
+        removeSource (player, &player->advanceSourceId);
+    }
+    if (player->resizeSourceId) {
+        removeSource (player, &player->resizeSourceId);
+    }
+    g_main_loop_quit (player->loop);
+}
+
+/* Timers and idle callbacks run on the control thread too */
+static guint attachSource (BackendPlayer* player, GSource* source, GSourceFunc func) {
+    guint id;
+
+    g_source_set_callback (source, func, player, NULL);
+    id = g_source_attach (source, player->context);
+    g_source_unref (source);
+    return id;
+}
+
+static guint addTimeout (BackendPlayer* player, guint interval, GSourceFunc func) {
+    return attachSource (player, g_timeout_source_new (interval), func);
+}
+
+static guint addIdle (BackendPlayer* player, GSourceFunc func) {
+    return attachSource (player, g_idle_source_new(), func);
+}
+
+static void removeSource (BackendPlayer* player, guint* id) {
+    GSource* source = g_main_context_find_source_by_id (player->context, *id);
+
+    if (source) {
+        g_source_destroy (source);
+    }
+    *id = 0;
+}
+
+/* Creates an idle player with its control thread. backendInit() is called once
+ * per process before the first one. Events are delivered on the main context
+ * that is the thread default where the player is created, and all calls are
+ * made from that thread. */
+BackendPlayer* backendPlayerNew() {
+    BackendPlayer* player = g_new0 (BackendPlayer, 1);
+
+    g_mutex_init (&player->nextUriLock);
+    g_mutex_init (&player->decoderConfigLock);
+    g_mutex_init (&player->frameRing.lock);
+    g_mutex_init (&player->viewLock);
+    g_mutex_init (&player->balanceLock);
+    g_queue_init (&player->frameRing.frames);
+    player->refreshInterval = 16;
+    player->switchLatency = -1;
+    player->advanceLatency = -1;
+    player->pendingSeek = -1;
+    player->standbyMemoryLimit = 64 * 1024 * 1024;
+    player->frameRing.cacheSize = 256 * 1024 * 1024;
+    player->frameRing.budget = player->frameRing.cacheSize;
+    player->frameRing.refillTarget = GST_CLOCK_TIME_NONE;
+    player->mosaicDecode = MOSAIC_DECODE_REDUCED;
+    player->visualisation = BACKEND_VISUALISATION_SPECTRUM;
+    player->visualisationRate = 30;
+    player->volume = 1.0;
+    player->view.volume = 1.0;
+    player->view.duration = GST_CLOCK_TIME_NONE;
+
+    player->callerContext = g_main_context_ref_thread_default();
+    player->context = g_main_context_new();
+    player->loop = g_main_loop_new (player->context, FALSE);
+    player->thread = g_thread_new ("backend", (GThreadFunc) controlThread, player);
+    return player;
+}
+
+/* Stops playback and frees the player along with its subscriptions. Waits
+ * for the control thread to finish what it is doing. */
+void backendPlayerFree (BackendPlayer* player) {
+    Command* command;
+
+    if (!player) {
+        return;
+    }
+    pushCommand (player, newCommand (shutDown_cb));
+    g_thread_join (player->thread);
+
+    /* Calls that came in after the player was closed */
+    command = g_atomic_pointer_get (&player->commands);
+    while (command) {
+        Command* next = command->next;
+
+        freeCommand (command);
+        command = next;
+    }
+    if (player->dispatchSource) {
+        g_source_destroy (player->dispatchSource);
+        g_source_unref (player->dispatchSource);
+    }
+    if (player->frameRing.converter) {
+        gst_video_converter_free (player->frameRing.converter);
+    }
+    gst_object_replace ((GstObject**) &player->videoSink, NULL);
+    gst_object_replace ((GstObject**) &player->audioSink, NULL);
+    gst_object_replace ((GstObject**) &player->glSink, NULL);
+    gst_object_replace ((GstObject**) &player->view.pipeline, NULL);
+    lut3dUnref (player->lut);
+    gst_object_replace ((GstObject**) &player->view.clock, NULL);
+    g_free (player->view.uri);
+    g_free (player->view.mosaicInfo);
+    backendTracksFree (player->view.tracks, player->view.trackCount);
+    clearStreams (&player->streams);
+    for (guint slot = 0; slot < TRACK_SLOTS; slot++) {
+        g_free (player->chosen[slot]);
+    }
+    subtitleFileUnref (player->subtitleFile);
+    g_free (player->subtitleFileId);
+    g_list_free_full (player->subscribers, g_free);
+    g_free (player->nextUri);
+
+    g_main_loop_unref (player->loop);
+    g_main_context_unref (player->context);
+    g_main_context_unref (player->callerContext);
+    g_mutex_clear (&player->nextUriLock);
+    g_mutex_clear (&player->decoderConfigLock);
+    g_mutex_clear (&player->frameRing.lock);
+    g_mutex_clear (&player->viewLock);
+    g_mutex_clear (&player->balanceLock);
+    g_free (player);
+}
+
+static void setWindow_cb (BackendPlayer* player, Command* command) {
+    guintptr window = (guintptr) command->data;
+
+    player->windowHandle = window;
+    if (player->mosaic) {
+        mosaicSetWindow (player->mosaic, window);
+        return;
+    }
+    if (player->pipeline) {
+        gst_video_overlay_set_window_handle (GST_VIDEO_OVERLAY (player->pipeline), window);
+    }
+    if (player->standby.pipeline) {
+        gst_video_overlay_set_window_handle (GST_VIDEO_OVERLAY (player->standby.pipeline), window);
+    }
+}
+
+int backendSetWindow (BackendPlayer* player, guintptr window) {
+    Command* command = newCommand (setWindow_cb);
+
+    command->data = (gpointer) window;
+    pushCommand (player, command);
+    return 0;
+}
+
+/* Overrides playbin's automatic sinks for the next backendPlay(), e.g. with
+ * fakesinks for headless runs. The backend takes ownership of the elements.
+ * The standby pipeline of the playlist needs sinks of its own, see
+ * backendSetSinkFunc(). */
+static void setSinks_cb (BackendPlayer* player, Command* command) {
+    gst_object_replace ((GstObject**) &player->videoSink, NULL);
+    gst_object_replace ((GstObject**) &player->audioSink, NULL);
+    player->videoSink = command->data;
+    player->audioSink = command->extra;
+    command->data = command->extra = NULL;
+}
+
+void backendSetSinks (BackendPlayer* player, GstElement* video, GstElement* audio) {
+    Command* command = newCommand (setSinks_cb);
+
+    command->data = video ? gst_object_ref_sink (video) : NULL;
+    command->extra = audio ? gst_object_ref_sink (audio) : NULL;
+    command->freeData = gst_object_unref;
+    pushCommand (player, command);
+}
+
+static void setSinkFunc_cb (BackendPlayer* player, Command* command) {
+    player->sinkFunc = (BackendSinkFunc) command->data;
+    player->sinkData = command->extra;
+}
+
+/* Has every pipeline opened from now on, the prerolled next playlist entry
+ * included, play into sinks the function makes. Sinks given to
+ * backendSetSinks() still go first; NULL returns to playbin's automatic
+ * sinks, or to the GL one. */
+void backendSetSinkFunc (BackendPlayer* player, BackendSinkFunc func, gpointer userData) {
+    Command* command = newCommand (setSinkFunc_cb);
+
+    command->data = (gpointer) func;
+    command->extra = userData;
+    pushCommand (player, command);
+}
+
+static GstElement* makeSink (BackendPlayer* player, gboolean video) {
+    return player->sinkFunc ? player->sinkFunc (video, player->sinkData) : NULL;
+}
+
+/* Without a visible surface there is no point in a visualisation either.
+ * Without the vis flag playbin builds no video branch for audio-only files. */
+static const gchar* playFlags (BackendPlayer* player) {
+    return g_atomic_int_get (&player->videoHidden) ||
+           player->visualisation == BACKEND_VISUALISATION_NONE
+            ? "soft-colorbalance+soft-volume+text+audio+video"
+            : "soft-colorbalance+soft-volume+vis+text+audio+video";
+}
+
+static gboolean haveElement (const gchar* name) {
+    GstElementFactory* factory = gst_element_factory_find (name);
+
+    if (!factory) {
+        return FALSE;
+    }
+    gst_object_unref (factory);
+    return TRUE;
+}
+
+static void setGlSink_cb (BackendPlayer* player, Command* command) {
+    gst_object_replace ((GstObject**) &player->glSink, NULL);
+    player->glSink = command->data;
+    command->data = NULL;
+    discardStandby (player);
+}
+
+/* Renders through OpenGL into a GTK widget rather than into the window set
+ * with backendSetWindow(), from the next file opened: glsinkbin uploads each
+ * frame once and converts it and applies the colour balance in shaders.
+ * Returns the GtkWidget to show, owned by the player, or NULL if the GL
+ * elements are not installed. Call from the GTK main thread. */
+gpointer backendEnableGl (BackendPlayer* player) {
+    GstElement* sink;
+    GstElement* gtkSink;
+    gpointer widget = NULL;
+    Command* command;
+
+    if (!haveElement ("glsinkbin") || !haveElement ("gtkglsink")) {
+        return NULL;
+    }
+    sink = gst_object_ref_sink (gst_element_factory_make ("glsinkbin", "glsink"));
+    gtkSink = gst_element_factory_make ("gtkglsink", NULL);
+    g_object_set (sink, "sink", gtkSink, NULL);
+    g_object_get (gtkSink, "widget", &widget, NULL);
+    if (!widget) {
+        gst_object_unref (sink);
+        return NULL;
+    }
+    /* The sink keeps its own reference */
+    g_object_unref (widget);
+
+    command = newCommand (setGlSink_cb);
+    command->data = sink;
+    command->freeData = gst_object_unref;
+    pushCommand (player, command);
+    return widget;
+}
+
+/* Goes back to the window set with backendSetWindow() from the next file
+ * opened, e.g. when the widget could not get a GL context */
+void backendDisableGl (BackendPlayer* player) {
+    pushCommand (player, newCommand (setGlSink_cb));
+}
+
+/* A closed playbin may still hold on to the sink until the view lets go */
+static void releaseGlSink (BackendPlayer* player) {
+    GstObject* parent = gst_object_get_parent (GST_OBJECT (player->glSink));
+
+    if (parent) {
+        gst_element_set_state (player->glSink, GST_STATE_NULL);
+        gst_bin_remove (GST_BIN (parent), player->glSink);
+        gst_object_unref (parent);
+    }
+}
+
+static void takeGlSink (BackendPlayer* player) {
+    releaseGlSink (player);
+    g_object_set (player->pipeline, "video-sink", player->glSink, NULL);
+}
+
+/* playbin3 builds part of its graph as it is created, before element-setup
+ * can be connected */
+static void setupExistingElements (GstElement* playbin, GstIteratorForeachFunction func,
+                                   BackendPlayer* player) {
+    GstIterator* it = gst_bin_iterate_recurse (GST_BIN (playbin));
+
+    gst_iterator_foreach (it, func, player);
+    gst_iterator_free (it);
+}
+
+static void setupElement (const GValue* item, BackendPlayer* player) {
+    elementSetup_cb (NULL, g_value_get_object (item), player);
+}
+
+/* playbin3 rather than playbin: decodebin3 decodes only the streams that are
+ * selected, and switches between them without a flushing seek */
+static GstElement* createPlaybin (BackendPlayer* player, const gchar* uri, const gchar* name) {
+    GstElement* playbin = gst_element_factory_make ("playbin3", name);
+    gsize download = budgetShare (player, BUDGET_DOWNLOAD);
+
+    if (!playbin) {
+        return NULL;
+    }
+    g_object_set (playbin, "uri", uri, NULL);
+    if (download) {
+        g_object_set (playbin, "buffer-size", (gint) MIN (download, G_MAXINT), NULL);
+    }
+    g_signal_connect (playbin, "pad-added", G_CALLBACK (padAdded_cb), NULL);
+    g_signal_connect (playbin, "about-to-finish", G_CALLBACK (aboutToFinish_cb), player);
+    g_signal_connect (playbin, "element-setup", G_CALLBACK (elementSetup_cb), player);
+    setupExistingElements (playbin, (GstIteratorForeachFunction) setupElement, player);
+    addVideoFilter (player, playbin);
+    addVisualisation (player, playbin);
+
+    gst_util_set_object_arg ((GObject *) playbin, "flags", playFlags (player));
+    if (player->windowHandle) {
+        gst_video_overlay_set_window_handle (GST_VIDEO_OVERLAY (playbin), player->windowHandle);
+    }
+    g_object_set (playbin, "volume", player->volume, NULL);
+    return playbin;
+}
+
+static void resetCustomData (BackendPlayer* player) {
+    player->duration = GST_CLOCK_TIME_NONE;
+    player->switchDue = 0;
+    player->switchLatency = -1;
+    player->seekInFlight = FALSE;
+    player->pendingSeek = -1;
+    player->anchorPosition = 0;
+    player->resumeAt = -1;
+    player->resumeState = GST_STATE_VOID_PENDING;
+    g_atomic_int_set (&player->hidePreroll, FALSE);
+
+    memset (&player->stats, 0, sizeof (player->stats));
+    player->stats.proportion = 1.0;
+    player->stats.buffering = 100;
+    g_atomic_int_set (&player->framesPassed, 0);
+    resetTracks (player);
+}
+
+/* Makes the player's pipeline the active one by routing its bus to the
+ * handlers that drive the events */
+static void attachPipeline (BackendPlayer* player) {
+    GstBus* bus = gst_element_get_bus (player->pipeline);
+
+    clearFrameRing (&player->frameRing);
+    g_mutex_lock (&player->frameRing.lock);
+    player->frameRing.owner = player->pipeline;
+    player->frameRing.filling = FALSE;
+    g_mutex_unlock (&player->frameRing.lock);
+    player->frameRing.refillTarget = GST_CLOCK_TIME_NONE;
+    player->frameRing.refillStepping = FALSE;
+
+    gst_bus_add_signal_watch (bus);
+    g_signal_connect (bus, "message::error", (GCallback) error_cb, player);
+    g_signal_connect (bus, "message::eos", (GCallback) eos_cb, player);
+    g_signal_connect (bus, "message::state-changed", (GCallback) stateChanged_cb, player);
+    g_signal_connect (bus, "message::stream-start", (GCallback) streamStart_cb, player);
+    g_signal_connect (bus, "message::duration-changed", (GCallback) durationChanged_cb, player);
+    g_signal_connect (bus, "message::async-done", (GCallback) asyncDone_cb, player);
+    g_signal_connect (bus, "message::step-done", (GCallback) stepDone_cb, player);
+    g_signal_connect (bus, "message::qos", (GCallback) qos_cb, player);
+    g_signal_connect (bus, "message::latency", (GCallback) latency_cb, player);
+    g_signal_connect (bus, "message::buffering", (GCallback) buffering_cb, player);
+    g_signal_connect (bus, "message::stream-collection", (GCallback) streamCollection_cb, player);
+    g_signal_connect (bus, "message::streams-selected", (GCallback) streamsSelected_cb, player);
+    gst_object_unref (bus);
+    applyColorBalance (player);
+}
+
+/* Plays the URIs side by side in one window, each in a tile of a grid. The
+ * first tile has the focus: it is the one heard and decoded in full. */
+static void openMosaic_cb (BackendPlayer* player, Command* command) {
+    gchar** uris = command->data;
+
+    closePlayer (player);
+    resetCustomData (player);
+    player->mosaic = mosaicNew ((const gchar* const*) uris, g_strv_length (uris),
+            player->mosaicDecode);
+    if (!player->mosaic) {
+        emitEvent (player, BACKEND_EVENT_ERROR, 0);
+        return;
+    }
+    player->pipeline = gst_object_ref (mosaicGetPipeline (player->mosaic));
+    mosaicSetWindow (player->mosaic, player->windowHandle);
+    mosaicSetCanvasSize (player->mosaic, player->surfaceWidth, player->surfaceHeight);
+    g_object_set (mosaicGetVolume (player->mosaic), "volume", player->volume, NULL);
+    attachPipeline (player);
+
+    /* A feed that cannot be opened fails the state change; error_cb drops it
+     * and starts the others again */
+    player->ret = gst_element_set_state (player->pipeline, GST_STATE_PLAYING);
+}
+
+int backendPlayMosaic (BackendPlayer* player, const gchar* const* uris, guint count) {
+    Command* command = newCommand (openMosaic_cb);
+    gchar** copy = g_new0 (gchar*, count + 1);
+
+    if (count == 0) {
+        g_free (copy);
+        g_free (command);
+        return -1;
+    }
+    for (guint i = 0; i < count; i++) {
+        copy[i] = g_strdup (uris[i]);
+    }
+    command->data = copy;
+    command->freeData = (GDestroyNotify) g_strfreev;
+    pushCommand (player, command);
+    return 0;
+}
+
+gboolean backendIsMosaic (BackendPlayer* player) {
+    gboolean mosaic;
+
+    g_mutex_lock (&player->viewLock);
+    mosaic = player->view.mosaic;
+    g_mutex_unlock (&player->viewLock);
+    return mosaic;
+}
+
+/* Moves the focus to a tile: its audio is heard and it is decoded in full */
+static void setMosaicFocus_cb (BackendPlayer* player, Command* command) {
+    if (player->mosaic) {
+        mosaicSetFocus (player->mosaic, (guint) command->value);
+    }
+}
+
+void backendSetMosaicFocus (BackendPlayer* player, guint index) {
+    Command* command = newCommand (setMosaicFocus_cb);
+
+    command->value = index;
+    pushCommand (player, command);
+}
+
+/* Sets how the tiles without the focus are decoded, for the current and the
+ * next mosaics */
+static void setMosaicDecode_cb (BackendPlayer* player, Command* command) {
+    player->mosaicDecode = (MosaicDecode) command->value;
+    if (player->mosaic) {
+        mosaicSetDecode (player->mosaic, player->mosaicDecode);
+    }
+}
+
+void backendSetMosaicDecode (BackendPlayer* player, MosaicDecode unfocused) {
+    Command* command = newCommand (setMosaicDecode_cb);
+
+    command->value = unfocused;
+    pushCommand (player, command);
+}
+
+/* Starts a new playlist with the given URI unless it already is the current
+ * entry */
+static void resetPlaylist (BackendPlayer* player, const gchar* uri) {
+    if (player->playlist && player->playlistIndex < player->playlist->len &&
+        g_strcmp0 (g_ptr_array_index (player->playlist, player->playlistIndex), uri) == 0) {
+        return;
+    }
+    discardStandby (player);
+    if (!player->playlist) {
+        player->playlist = g_ptr_array_new_with_free_func (g_free);
+    }
+    g_ptr_array_set_size (player->playlist, 0);
+    g_ptr_array_add (player->playlist, g_strdup (uri));
+    player->playlistIndex = 0;
+}
+
+static int openUri (BackendPlayer* player, const gchar* filename) {
+    GstElement* sink;
+
+    resetPlaylist (player, filename);
+    resetCustomData (player);
+    player->pipeline = createPlaybin (player, filename, "playbin");
+    if (!player->pipeline) {
+        g_printerr ("Not all elements could be created.\n");
+        emitEvent (player, BACKEND_EVENT_ERROR, 0);
+        return -1;
+    }
+
+    if (player->videoSink) {
+        g_object_set (player->pipeline, "video-sink", player->videoSink, NULL);
+        gst_object_replace ((GstObject**) &player->videoSink, NULL);
+    } else if ((sink = makeSink (player, TRUE)) != NULL) {
+        g_object_set (player->pipeline, "video-sink", sink, NULL);
+    } else if (player->glSink) {
+        takeGlSink (player);
+    }
+    if (player->audioSink) {
+        g_object_set (player->pipeline, "audio-sink", player->audioSink, NULL);
+        gst_object_replace ((GstObject**) &player->audioSink, NULL);
+    } else if ((sink = makeSink (player, FALSE)) != NULL) {
+        g_object_set (player->pipeline, "audio-sink", sink, NULL);
+    }
+    attachPipeline (player);
+
+    player->ret = startPipeline (player, filename);
+    if (player->ret == GST_STATE_CHANGE_FAILURE) {
+        g_printerr ("Unable to set the pipeline to the playing state.\n");
+        closePlayer (player);
+        emitEvent (player, BACKEND_EVENT_ERROR, 0);
+        return -1;
+    }
+    return 0;
+}
+
+static void openUri_cb (BackendPlayer* player, Command* command) {
+    closePlayer (player);
+    openUri (player, command->data);
+}
+
+/* Opens the URI as a new playlist and starts playing it. Returns at once;
+ * failures are reported through BACKEND_EVENT_ERROR. */
+int backendPlay (BackendPlayer* player, const gchar* filename) {
+    Command* command = newCommand (openUri_cb);
+
+    command->data = g_strdup (filename);
+    command->freeData = g_free;
+    pushCommand (player, command);
+    return 0;
+}
+
+static void changeUri_cb (BackendPlayer* player, Command* command) {
+    const gchar* filename = command->data;
+
+    if (!player->pipeline || player->mosaic) {
+        closePlayer (player);
+        openUri (player, filename);
+        return;
+    }
+
+    /* An explicit switch replaces whatever was queued for the gapless one */
+    g_mutex_lock (&player->nextUriLock);
+    g_clear_pointer (&player->nextUri, g_free);
+    player->switchDue = g_get_monotonic_time();
+    g_mutex_unlock (&player->nextUriLock);
+
+    resetPlaylist (player, filename);
+    resetTracks (player);
+    stopPipeline (player);
+    g_object_set (player->pipeline, "uri", filename, NULL);
+    startPipeline (player, filename);
+}
+
+/* Switches the playing pipeline over to another URI */
+void backendChangeUri (BackendPlayer* player, const gchar* filename) {
+    Command* command = newCommand (changeUri_cb);
+
+    command->data = g_strdup (filename);
+    command->freeData = g_free;
+    pushCommand (player, command);
+}
+
+/* Queues the URI to play once the current one ends. playbin picks it up from
+ * "about-to-finish" and keeps the existing decoders and sinks when the caps
+ * match, so there is no READY/PLAYING bounce between the two files. */
+void backendQueueUri (BackendPlayer* player, const gchar* filename) {
+    g_mutex_lock (&player->nextUriLock);
+    g_free (player->nextUri);
+    player->nextUri = g_strdup (filename);
+    g_mutex_unlock (&player->nextUriLock);
+}
+
+/* Appends an entry to the playlist. Once the current entry is playing, the
+ * one after it is prerolled in the background. */
+static void appendEntry_cb (BackendPlayer* player, Command* command) {
+    if (!player->playlist) {
+        player->playlist = g_ptr_array_new_with_free_func (g_free);
+    }
+    g_ptr_array_add (player->playlist, command->data);
+    command->data = NULL;
+    if (player->state == GST_STATE_PLAYING) {
+        prepareStandby (player);
+    }
+}
+
+void backendPlaylistAppend (BackendPlayer* player, const gchar* uri) {
+    Command* command = newCommand (appendEntry_cb);
+
+    command->data = g_strdup (uri);
+    command->freeData = g_free;
+    pushCommand (player, command);
+}
+
+/* Returns a copy of the URI of the current playlist entry, or NULL. Free
+ * with g_free(). */
+gchar* backendGetUri (BackendPlayer* player) {
+    gchar* uri;
+
+    g_mutex_lock (&player->viewLock);
+    uri = g_strdup (player->view.uri);
+    g_mutex_unlock (&player->viewLock);
+    return uri;
+}
+
+/* The standby pipeline has plugged its decoders and sized its queues */
+static void restartStandby (BackendPlayer* player) {
+    discardStandby (player);
+    if (player->state == GST_STATE_PLAYING) {
+        prepareStandby (player);
+    }
+}
+
+static void setStandbyMemoryLimit_cb (BackendPlayer* player, Command* command) {
+    player->standbyMemoryLimit = (gsize) command->value;
+    restartStandby (player);
+}
+
+/* Sets how much the standby pipeline may buffer ahead of its first frame */
+void backendSetStandbyMemoryLimit (BackendPlayer* player, gsize bytes) {
+    Command* command = newCommand (setStandbyMemoryLimit_cb);
+
+    command->value = (gdouble) bytes;
+    pushCommand (player, command);
+}
+
+static void restartStandby_cb (BackendPlayer* player, Command* command) {
+    UNUSED (command);
+
+    restartStandby (player);
+}
+
+/* The part of the memory budget one buffer may take, 0 for no cap */
+static gsize budgetShare (BackendPlayer* player, guint divisor) {
+    gsize budget;
+
+    g_mutex_lock (&player->decoderConfigLock);
+    budget = player->memoryBudget;
+    g_mutex_unlock (&player->decoderConfigLock);
+    return budget / divisor;
+}
+
+/* The tighter of two limits, where 0 stands for none */
+static gsize minLimit (gsize a, gsize b) {
+    if (!a || !b) {
+        return a ? a : b;
+    }
+    return MIN (a, b);
+}
+
+static gsize standbyLimit (BackendPlayer* player) {
+    return minLimit (player->standbyMemoryLimit, budgetShare (player, BUDGET_STANDBY));
+}
+
+static void applyFrameRingBudget (BackendPlayer* player) {
+    FrameRing* ring = &player->frameRing;
+    gsize share = budgetShare (player, BUDGET_FRAME_RING);
+
+    g_mutex_lock (&ring->lock);
+    ring->budget = share ? MIN (ring->cacheSize, share) : ring->cacheSize;
+    trimFrameRing (ring);
+    g_mutex_unlock (&ring->lock);
+}
+
+/* Caps all the player buffers, for players that run for weeks on a fixed
+ * amount of memory. The demuxer and download queues, playsink's queues, the
+ * frames kept for stepping back and the standby pipeline each get a share of
+ * it, on top of their own settings; 0 lifts the cap. Queues are sized as
+ * they are created, so they follow from the next file opened. */
+void backendSetMemoryBudget (BackendPlayer* player, gsize bytes) {
+    g_mutex_lock (&player->decoderConfigLock);
+    player->memoryBudget = bytes;
+    g_mutex_unlock (&player->decoderConfigLock);
+
+    applyFrameRingBudget (player);
+    pushCommand (player, newCommand (restartStandby_cb));
+}
+
+gsize backendGetMemoryBudget (BackendPlayer* player) {
+    return budgetShare (player, 1);
+}
+
+/* Sets the decoder threading and queue depths. Decoders are configured when
+ * they are plugged, so this takes effect with the next file opened. */
+void backendSetDecoderConfig (BackendPlayer* player, const DecoderConfig* config) {
+    g_mutex_lock (&player->decoderConfigLock);
+    player->decoderConfig = *config;
+    g_mutex_unlock (&player->decoderConfigLock);
+
+    /* The standby pipeline has plugged its decoders already */
+    pushCommand (player, newCommand (restartStandby_cb));
+}
+
+void backendGetDecoderConfig (BackendPlayer* player, DecoderConfig* config) {
+    g_mutex_lock (&player->decoderConfigLock);
+    *config = player->decoderConfig;
+    g_mutex_unlock (&player->decoderConfigLock);
+}
+
+static gboolean hasProperty (GstElement* element, const gchar* name) {
+    return g_object_class_find_property (G_OBJECT_GET_CLASS (element), name) != NULL;
+}
+
+/* Sets a numeric property whatever its integer type */
+static void setNumber (GstElement* element, const gchar* name, guint64 value) {
+    gchar str[24];
+
+    g_snprintf (str, sizeof (str), "%" G_GUINT64_FORMAT, value);
+    gst_util_set_object_arg (G_OBJECT (element), name, str);
+}
+
+/* Lowers a queue's byte limit to the given share of the budget, if it has one */
+static void capQueue (GstElement* element, gsize limit) {
+    guint bytes = 0;
+
+    if (!limit || !hasProperty (element, "max-size-bytes")) {
+        return;
+    }
+    g_object_get (element, "max-size-bytes", &bytes, NULL);
+    if (bytes == 0 || bytes > limit) {
+        g_object_set (element, "max-size-bytes", (guint) MIN (limit, G_MAXUINT), NULL);
+    }
+}
+
+/* Keeps compressed video away from the decoder while nothing shows it. A gap
+ * goes on in place of each buffer so that the sink still prerolls and the
+ * pipeline keeps running on the audio; the decoder has nothing to do. */
+static GstPadProbeReturn hiddenVideo_cb (GstPad* pad, GstPadProbeInfo* info,
+                                         BackendPlayer* player) {
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+    GstClockTime timestamp;
+
+    if (!g_atomic_int_get (&player->videoHidden)) {
+        return GST_PAD_PROBE_OK;
+    }
+    timestamp = GST_BUFFER_PTS_IS_VALID (buffer) ? GST_BUFFER_PTS (buffer)
+                                                 : GST_BUFFER_DTS (buffer);
+    if (GST_CLOCK_TIME_IS_VALID (timestamp)) {
+        gst_pad_send_event (pad, gst_event_new_gap (timestamp, GST_BUFFER_DURATION (buffer)));
+    }
+    return GST_PAD_PROBE_DROP;
+}
+
+static void watchVideoDecoder (BackendPlayer* player, GstElement* decoder) {
+    GstPad* pad = gst_element_get_static_pad (decoder, "sink");
+
+    if (pad) {
+        gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+                (GstPadProbeCallback) hiddenVideo_cb, player, NULL);
+        gst_object_unref (pad);
+    }
+}
+
+/* Called from playbin, often in a streaming thread, for every element it
+ * plugs. The thread count property differs between decoder plugins: libav
+ * and libde265 use max-threads, dav1d n-threads and vpx threads. */
+static void elementSetup_cb (GstElement* playbin, GstElement* element, BackendPlayer* player) {
+    UNUSED (playbin);
+
+    GstElementFactory* factory = gst_element_get_factory (element);
+    const gchar* name;
+    const gchar* klass;
+    DecoderConfig config;
+    gsize queueBytes;
+
+    if (!factory) {
+        return;
+    }
+    if (g_atomic_int_get (&player->hidePreroll) && hasProperty (element, "show-preroll-frame")) {
+        g_object_set (element, "show-preroll-frame", FALSE, NULL);
+        return;
+    }
+    name = GST_OBJECT_NAME (factory);
+    backendGetDecoderConfig (player, &config);
+
+    if (g_str_equal (name, "multiqueue")) {
+        /* decodebin3's, between the demuxers and the decoders */
+        queueBytes = minLimit (config.queueBytes, budgetShare (player, BUDGET_DEMUX_QUEUE));
+        if (queueBytes) {
+            setNumber (element, "max-size-bytes", MIN (queueBytes, G_MAXUINT));
+        }
+        if (config.queueTime) {
+            setNumber (element, "max-size-time", config.queueTime);
+        }
+        return;
+    }
+    if (g_str_equal (name, "queue")) {
+        capQueue (element, budgetShare (player, BUDGET_QUEUE));
+        return;
+    }
+
+    klass = gst_element_factory_get_metadata (factory, GST_ELEMENT_METADATA_KLASS);
+    if (!klass || !strstr (klass, "Decoder")) {
+        return;
+    }
+    if (config.threads) {
+        if (hasProperty (element, "max-threads")) {
+            setNumber (element, "max-threads", config.threads);
+        } else if (hasProperty (element, "n-threads")) {
+            setNumber (element, "n-threads", config.threads);
+        } else if (hasProperty (element, "threads")) {
+            setNumber (element, "threads", config.threads);
+        }
+    }
+    if (config.threadType != DECODER_THREADS_AUTO && hasProperty (element, "thread-type")) {
+        gst_util_set_object_arg (G_OBJECT (element), "thread-type",
+                config.threadType == DECODER_THREADS_FRAME ? "frame" : "slice");
+    }
+    if (strstr (klass, "Video")) {
+        watchVideoDecoder (player, element);
+    }
+}
+
+/* Asks the kernel to start reading the head of a local file into the page
+ * cache, so the first seconds after the switch do not wait on the disk */
+static void readAhead (const gchar* uri, gsize bytes) {
+#ifdef POSIX_FADV_WILLNEED
+    gchar* path = g_filename_from_uri (uri, NULL, NULL);
+    int fd;
+
+    if (!path) {
+        return;
+    }
+    fd = g_open (path, O_RDONLY, 0);
+    if (fd >= 0) {
+        posix_fadvise (fd, 0, (off_t) bytes, POSIX_FADV_WILLNEED);
+        g_close (fd, NULL);
+    }
+    g_free (path);
+#else
+    UNUSED (uri);
+    UNUSED (bytes);
+#endif
+}
+
+static void setShowPrerollFrame (const GValue* item, gpointer show) {
+    GObject* element = g_value_get_object (item);
+
+    if (g_object_class_find_property (G_OBJECT_GET_CLASS (element), "show-preroll-frame")) {
+        g_object_set (element, "show-preroll-frame", GPOINTER_TO_INT (show), NULL);
+    }
+}
+
+/* Resuming. Where each file was left is kept in the resume store. A file
+ * that has a resume point is prerolled with the sinks keeping the frame to
+ * themselves, seeked there while still paused and only then played, so that
+ * nothing of its beginning is shown or heard and the first frame on screen
+ * is the one at the resume point. */
+
+/* Whether the sinks, those there already and those still to be plugged,
+ * keep the frame they preroll with to themselves */
+static void hidePrerollFrames (BackendPlayer* player, gboolean hide) {
+    GstIterator* it = gst_bin_iterate_recurse (GST_BIN (player->pipeline));
+
+    g_atomic_int_set (&player->hidePreroll, hide);
+    gst_iterator_foreach (it, setShowPrerollFrame, GINT_TO_POINTER (!hide));
+    gst_iterator_free (it);
+}
+
+/* Returns where the URI was left in seconds, or -1 */
+static gdouble lookupResumePoint (const gchar* uri) {
+    gint64 position = resumeStoreLookup (uri);
+
+    return position > 0 ? (gdouble) position / GST_SECOND : -1;
+}
+
+/* To the keyframe at or before the point, with a moment of what led up to it */
+static gboolean resumeSeek (GstElement* pipeline, gdouble position) {
+    return gst_element_seek_simple (pipeline, GST_FORMAT_TIME,
+            GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_BEFORE,
+            (gint64) (position * GST_SECOND));
+}
+
+/* Sets a newly opened file going, through its resume point if it has one;
+ * asyncDone_cb() takes it on from there */
+static GstStateChangeReturn startPipeline (BackendPlayer* player, const gchar* uri) {
+    /* A frame kept from the previous file is of no use */
+    showCachedFrame (player, NULL);
+    player->resumeAt = lookupResumePoint (uri);
+    if (player->resumeAt < 0) {
+        return gst_element_set_state (player->pipeline, GST_STATE_PLAYING);
+    }
+    player->resumeState = GST_STATE_PLAYING;
+    hidePrerollFrames (player, TRUE);
+    return gst_element_set_state (player->pipeline, GST_STATE_PAUSED);
+}
+
+/* Prerolled at the resume point: shows the frame and goes on as asked */
+static void finishResume (BackendPlayer* player) {
+    GstState state = player->resumeState;
+
+    player->resumeState = GST_STATE_VOID_PENDING;
+    hidePrerollFrames (player, FALSE);
+    setFrameRingFilling (&player->frameRing, state == GST_STATE_PAUSED);
+    gst_element_set_state (player->pipeline, state);
+}
+
+static void cancelResume (BackendPlayer* player) {
+    player->resumeAt = -1;
+    if (player->resumeState != GST_STATE_VOID_PENDING) {
+        player->resumeState = GST_STATE_VOID_PENDING;
+        hidePrerollFrames (player, FALSE);
+    }
+}
+
+/* Saves where the playing file is, or forgets it when it is close to either
+ * end. A file that has not reached its resume point keeps the old one. */
+static void saveResumePoint (BackendPlayer* player) {
+    GstClockTime position;
+    gint64 duration;
+    gchar* uri = NULL;
+
+    if (!player->pipeline || player->mosaic || player->state < GST_STATE_PAUSED ||
+        player->resumeState != GST_STATE_VOID_PENDING || !resumeStoreIsOpen()) {
+        return;
+    }
+    position = shownPosition (player);
+    if (!GST_CLOCK_TIME_IS_VALID (position)) {
+        return;
+    }
+    if (!gst_element_query_duration (player->pipeline, GST_FORMAT_TIME, &duration)) {
+        duration = -1;
+    }
+    /* Not the playlist entry: a queued URI may have taken over gaplessly */
+    g_object_get (player->pipeline, "current-uri", &uri, NULL);
+    if (!uri) {
+        return;
+    }
+    if (position < RESUME_MIN ||
+        (duration > 0 && position + RESUME_END > (GstClockTime) duration)) {
+        resumeStoreSave (uri, -1);
+    } else {
+        resumeStoreSave (uri, (gint64) position);
+    }
+    g_free (uri);
+}
+
+/* Keeps the standby pipeline from drawing over the current video and bounds
+ * what its queues may hold while it sits in PAUSED */
+static void standbyElementSetup_cb (GstElement* playbin, GstElement* element,
+                                    BackendPlayer* player) {
+    UNUSED (playbin);
+
+    GstElementFactory* factory = gst_element_get_factory (element);
+    const gchar* name = factory ? GST_OBJECT_NAME (factory) : "";
+
+    if (g_object_class_find_property (G_OBJECT_GET_CLASS (element), "show-preroll-frame")) {
+        g_object_set (element, "show-preroll-frame", FALSE, NULL);
+    } else if (g_str_equal (name, "multiqueue")) {
+        /* The one between the demuxer and the decoders, unless the decoder
+         * configuration already keeps it smaller */
+        guint limit = (guint) MIN (standbyLimit (player), G_MAXUINT);
+
+        g_mutex_lock (&player->decoderConfigLock);
+        if (player->decoderConfig.queueBytes) {
+            limit = MIN (limit, player->decoderConfig.queueBytes);
+        }
+        g_mutex_unlock (&player->decoderConfigLock);
+        g_object_set (element, "max-size-bytes", limit, NULL);
+    } else if (g_str_equal (name, "urisourcebin")) {
+        /* The download buffer in front of network sources */
+        g_object_set (element, "buffer-size",
+                (gint) MIN (standbyLimit (player), G_MAXINT), NULL);
+    }
+}
+
+static void setupStandbyElement (const GValue* item, BackendPlayer* player) {
+    standbyElementSetup_cb (NULL, g_value_get_object (item), player);
+}
+
+static gchar** selectedStreamIds (GstMessage* msg) {
+    guint count = gst_message_streams_selected_get_size (msg);
+    gchar** ids = g_new0 (gchar*, count + 1);
+
+    for (guint i = 0; i < count; i++) {
+        GstStream* stream = gst_message_streams_selected_get_stream (msg, i);
+
+        ids[i] = g_strdup (gst_stream_get_stream_id (stream));
+        gst_object_unref (stream);
+    }
+    return ids;
+}
+
+static gboolean standbyBus_cb (GstBus* bus, GstMessage* msg, BackendPlayer* player) {
+    UNUSED (bus);
+
+    GError* err;
+
+    switch (GST_MESSAGE_TYPE (msg)) {
+        case GST_MESSAGE_ASYNC_DONE:
+            if (player->standby.resumeAt >= 0) {
+                /* Prerolled again at the resume point, still in the background */
+                resumeSeek (player->standby.pipeline, player->standby.resumeAt);
+                player->standby.resumeAt = -1;
+                break;
+            }
+            break;
+        case GST_MESSAGE_STREAM_COLLECTION:
+            /* Kept for when the entry becomes the active one */
+            if (player->standby.streams.collection) {
+                gst_object_unref (player->standby.streams.collection);
+            }
+            player->standby.streams.collection = NULL;
+            gst_message_parse_stream_collection (msg, &player->standby.streams.collection);
+            break;
+        case GST_MESSAGE_STREAMS_SELECTED:
+            g_strfreev (player->standby.streams.active);
+            player->standby.streams.active = selectedStreamIds (msg);
+            break;
+        case GST_MESSAGE_ERROR:
+            /* The entry is opened again, and the error reported, on advance */
+            gst_message_parse_error (msg, &err, NULL);
+            g_printerr ("Could not preroll %s: %s\n", player->standby.uri, err->message);
+            g_clear_error (&err);
+            discardStandby (player);
+            return G_SOURCE_REMOVE;
+        default:
+            break;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static GstPadProbeReturn holdFrame_cb (GstPad* pad, GstPadProbeInfo* info, gpointer data) {
+    UNUSED (pad);
+    UNUSED (info);
+    UNUSED (data);
+
+    return GST_PAD_PROBE_OK;
+}
+
+/* The one GL sink belongs to the playing pipeline, so the standby one plays
+ * into a slot instead: its first frame waits at a blocked pad until the GL
+ * sink is moved in as the entry is swapped in, without a seek */
+static GstElement* createGlSlot (BackendPlayer* player) {
+    GstElement* bin = gst_bin_new ("glslot");
+    GstElement* slot = gst_element_factory_make ("identity", "slot");
+    GstPad* pad;
+
+    if (!slot) {
+        gst_object_unref (gst_object_ref_sink (bin));
+        return NULL;
+    }
+    g_object_set (slot, "silent", TRUE, NULL);
+    gst_bin_add (GST_BIN (bin), slot);
+    pad = gst_element_get_static_pad (slot, "sink");
+    gst_element_add_pad (bin, gst_ghost_pad_new ("sink", pad));
+    gst_object_unref (pad);
+    pad = gst_element_get_static_pad (slot, "src");
+    player->standby.glSlotProbe = gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM,
+            holdFrame_cb, NULL, NULL);
+    gst_object_unref (pad);
+    return bin;
+}
+
+/* Moves the GL sink into the swapped in pipeline's slot and lets the frame
+ * held there through */
+static void fillGlSlot (BackendPlayer* player, gulong probe) {
+    GstElement* bin = NULL;
+    GstElement* slot = NULL;
+    GstObject* parent = NULL;
+    GstPad* pad;
+
+    g_object_get (player->pipeline, "video-sink", &bin, NULL);
+    if (bin && GST_IS_BIN (bin)) {
+        slot = gst_bin_get_by_name (GST_BIN (bin), "slot");
+        parent = gst_object_get_parent (GST_OBJECT (bin));
+    }
+    /* Not plugged by playsink, as for a file without video */
+    if (slot && parent) {
+        releaseGlSink (player);
+        gst_bin_add (GST_BIN (bin), player->glSink);
+        gst_element_link (slot, player->glSink);
+        gst_element_sync_state_with_parent (player->glSink);
+
+        pad = gst_element_get_static_pad (slot, "src");
+        gst_pad_remove_probe (pad, probe);
+        gst_object_unref (pad);
+        /* The slot took any caps and offered no GL memory; ask again */
+        pad = gst_element_get_static_pad (slot, "sink");
+        gst_pad_push_event (pad, gst_event_new_reconfigure());
+        gst_object_unref (pad);
+    }
+    g_clear_object (&parent);
+    g_clear_object (&slot);
+    g_clear_object (&bin);
+}
+
+/* The standby pipeline prerolls into sinks of its own, the real ones, so
+ * that swapping it in is no more than setting it to PLAYING; only the GL
+ * sink, of which there is one, is moved over then */
+static void setStandbySinks (BackendPlayer* player) {
+    GstElement* video = makeSink (player, TRUE);
+    GstElement* audio = makeSink (player, FALSE);
+
+    player->standby.glSlotProbe = 0;
+    if (!video && player->glSink) {
+        video = createGlSlot (player);
+    }
+    if (video) {
+        g_object_set (player->standby.pipeline, "video-sink", video, NULL);
+    }
+    if (audio) {
+        g_object_set (player->standby.pipeline, "audio-sink", audio, NULL);
+    }
+}
+
+/* Builds a second playbin for the entry after the current one and prerolls
+ * it: the source is opened, typefound, demuxed and the first frame decoded */
+static void prepareStandby (BackendPlayer* player) {
+    const gchar* uri;
+    GstBus* bus;
+
+    if (player->mosaic || !player->playlist ||
+        player->playlistIndex + 1 >= player->playlist->len) {
+        discardStandby (player);
+        return;
+    }
+    uri = g_ptr_array_index (player->playlist, player->playlistIndex + 1);
+    if (player->standby.pipeline && g_strcmp0 (player->standby.uri, uri) == 0) {
+        return;
+    }
+    discardStandby (player);
+
+    player->standby.pipeline = createPlaybin (player, uri, "standby");
+    if (!player->standby.pipeline) {
+        return;
+    }
+    setStandbySinks (player);
+    player->standby.uri = g_strdup (uri);
+    player->standby.resumeAt = lookupResumePoint (uri);
+    g_signal_connect (player->standby.pipeline, "element-setup",
+            G_CALLBACK (standbyElementSetup_cb), player);
+    setupExistingElements (player->standby.pipeline,
+            (GstIteratorForeachFunction) setupStandbyElement, player);
+
+    bus = gst_element_get_bus (player->standby.pipeline);
+    gst_bus_add_watch (bus, (GstBusFunc) standbyBus_cb, player);
+    gst_object_unref (bus);
+
+    readAhead (uri, standbyLimit (player));
+    if (gst_element_set_state (player->standby.pipeline, GST_STATE_PAUSED) ==
+        GST_STATE_CHANGE_FAILURE) {
+        discardStandby (player);
+    }
+}
+
+static void discardStandby (BackendPlayer* player) {
+    GstBus* bus;
+
+    if (!player->standby.pipeline) {
+        return;
+    }
+    bus = gst_element_get_bus (player->standby.pipeline);
+    gst_bus_remove_watch (bus);
+    gst_object_unref (bus);
+
+    gst_element_set_state (player->standby.pipeline, GST_STATE_NULL);
+    gst_object_unref (player->standby.pipeline);
+    player->standby.pipeline = NULL;
+    player->standby.glSlotProbe = 0;
+    g_clear_pointer (&player->standby.uri, g_free);
+    clearStreams (&player->standby.streams);
+}
+
+/* Carries the user's volume over to the next pipeline; the colour balance is
+ * applied to it as it is attached */
+static void copySettings (GstElement* from, GstElement* to) {
+    gdouble volume;
+    gboolean mute;
+
+    g_object_get (from, "volume", &volume, "mute", &mute, NULL);
+    g_object_set (to, "volume", volume, "mute", mute, NULL);
+}
+
+/* Replaces the active pipeline with the prerolled standby one */
+static void swapInStandby (BackendPlayer* player) {
+    GstElement* next = player->standby.pipeline;
+    GstBus* bus = gst_element_get_bus (next);
+    Streams streams = player->standby.streams;
+    gulong glSlotProbe = player->standby.glSlotProbe;
+    GstIterator* it;
+    GstState state = GST_STATE_NULL;
+
+    gst_bus_remove_watch (bus);
+    gst_object_unref (bus);
+    g_signal_handlers_disconnect_by_func (next, standbyElementSetup_cb, player);
+    player->standby.pipeline = NULL;
+    player->standby.glSlotProbe = 0;
+    g_clear_pointer (&player->standby.uri, g_free);
+    memset (&player->standby.streams, 0, sizeof (Streams));
+
+    copySettings (player->pipeline, next);
+    releasePipeline (player);
+    resetCustomData (player);
+    player->switchDue = g_get_monotonic_time();
+
+    player->pipeline = next;
+    attachPipeline (player);
+    player->streams.active = streams.active;
+    if (streams.collection) {
+        takeCollection (player, streams.collection);
+    }
+    it = gst_bin_iterate_recurse (GST_BIN (player->pipeline));
+    gst_iterator_foreach (it, setShowPrerollFrame, GINT_TO_POINTER (TRUE));
+    gst_iterator_free (it);
+
+    /* The preroll messages went to the standby watch, so pick up from them */
+    gst_element_get_state (player->pipeline, &state, NULL, 0);
+    player->state = state;
+    if (state == GST_STATE_PAUSED) {
+        updateDuration (player);
+    }
+    if (glSlotProbe) {
+        fillGlSlot (player, glSlotProbe);
+    }
+    gst_element_set_state (player->pipeline, GST_STATE_PLAYING);
+}
+
+static gboolean nextEntry (BackendPlayer* player) {
+    const gchar* uri;
+
+    if (!player->playlist || player->playlistIndex + 1 >= player->playlist->len) {
+        return FALSE;
+    }
+    player->playlistIndex++;
+    player->advanceStart = g_get_monotonic_time();
+    uri = g_ptr_array_index (player->playlist, player->playlistIndex);
+    if (player->mosaic) {
+        releasePipeline (player);
+    }
+
+    if (player->pipeline && player->standby.pipeline && g_strcmp0 (player->standby.uri, uri) == 0) {
+        swapInStandby (player);
+    } else if (player->pipeline) {
+        discardStandby (player);
+        resetTracks (player);
+        player->switchDue = g_get_monotonic_time();
+        stopPipeline (player);
+        g_object_set (player->pipeline, "uri", uri, NULL);
+        startPipeline (player, uri);
+    } else if (openUri (player, uri) != 0) {
+        return FALSE;
+    }
+    emitEvent (player, BACKEND_EVENT_TRACK_CHANGED, player->playlistIndex);
+    return TRUE;
+}
+
+static void nextEntry_cb (BackendPlayer* player, Command* command) {
+    UNUSED (command);
+
+    nextEntry (player);
+}
+
+/* Advances to the next playlist entry. Returns FALSE if, as far as the
+ * player has published, the current entry is the last. */
+gboolean backendPlaylistNext (BackendPlayer* player) {
+    gboolean hasNext;
+
+    g_mutex_lock (&player->viewLock);
+    hasNext = player->view.hasNext;
+    g_mutex_unlock (&player->viewLock);
+
+    pushCommand (player, newCommand (nextEntry_cb));
+    return hasNext;
+}
+
+static gboolean playlistAdvance_cb (BackendPlayer* player) {
+    player->advanceSourceId = 0;
+    if (!nextEntry (player)) {
+        emitEvent (player, BACKEND_EVENT_EOS, 0);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+/* Returns the latency of the last URI switch in seconds, or a negative value
+ * if no switch has been measured yet. For a queued switch it is the time the
+ * new stream started later than the previous one was due to end. */
+gdouble backendGetSwitchLatency (BackendPlayer* player) {
+    gint64 latency;
+
+    g_mutex_lock (&player->nextUriLock);
+    latency = player->switchLatency;
+    g_mutex_unlock (&player->nextUriLock);
+
+    if (latency < 0) {
+        return -1;
+    }
+    return (gdouble) latency / G_USEC_PER_SEC;
+}
+
+/* Returns the seconds the last playlist advance took, from being asked for
+ * to the next entry playing, or a negative value if there has been none.
+ * With the entry prerolled in the background it is a state change. */
+gdouble backendGetAdvanceLatency (BackendPlayer* player) {
+    gint64 latency;
+
+    g_mutex_lock (&player->nextUriLock);
+    latency = player->advanceLatency;
+    g_mutex_unlock (&player->nextUriLock);
+
+    if (latency < 0) {
+        return -1;
+    }
+    return (gdouble) latency / G_USEC_PER_SEC;
+}
+
+/* Listeners are called on the context the player was created on whenever the
+ * duration changes, the position moves or the playing state flips. Nothing is
+ * pushed while stopped. */
+void backendSubscribe (BackendPlayer* player, BackendEventFunc func, gpointer userData) {
+    Subscriber* subscriber = g_new0 (Subscriber, 1);
+
+    subscriber->func = func;
+    subscriber->userData = userData;
+    player->subscribers = g_list_append (player->subscribers, subscriber);
+}
+
+void backendUnsubscribe (BackendPlayer* player, BackendEventFunc func, gpointer userData) {
+    for (GList* l = player->subscribers; l != NULL; l = l->next) {
+        Subscriber* subscriber = (Subscriber*) l->data;
+
+        if (subscriber->func == func && subscriber->userData == userData) {
+            player->subscribers = g_list_delete_link (player->subscribers, l);
+            g_free (subscriber);
+            return;
+        }
+    }
+}
+
+static const gchar* currentUri (BackendPlayer* player) {
+    if (!player->playlist || player->playlistIndex >= player->playlist->len) {
+        return NULL;
+    }
+    return g_ptr_array_index (player->playlist, player->playlistIndex);
+}
+
+static void publishTracks (BackendPlayer* player);
+
+/* Must be called with the view locked */
+static void publishView (BackendPlayer* player) {
+    PlayerView* view = &player->view;
+    const gchar* uri = currentUri (player);
+
+    gst_object_replace ((GstObject**) &view->pipeline, (GstObject*) player->pipeline);
+    gst_object_replace ((GstObject**) &view->clock, (GstObject*) player->clock);
+    view->state = player->state;
+    view->duration = player->duration;
+    view->anchorPosition = player->anchorPosition;
+    view->anchorClockTime = player->anchorClockTime;
+    if (g_strcmp0 (view->uri, uri) != 0) {
+        g_free (view->uri);
+        view->uri = g_strdup (uri);
+    }
+    view->hasNext = player->playlist && player->playlistIndex + 1 < player->playlist->len;
+    view->mosaic = player->mosaic != NULL;
+    g_free (view->mosaicInfo);
+    view->mosaicInfo = player->mosaic ? mosaicDescribe (player->mosaic) : NULL;
+    view->stats = player->stats;
+    if (player->tracksChanged) {
+        publishTracks (player);
+    }
+}
+
+static void publish (BackendPlayer* player) {
+    g_mutex_lock (&player->viewLock);
+    publishView (player);
+    g_mutex_unlock (&player->viewLock);
+}
+
+/* Runs on the caller's context with whatever piled up since the last run,
+ * the latest value of each event, in the order of BackendEvent */
+static gboolean dispatchEvents_cb (BackendPlayer* player) {
+    gdouble values[EVENT_COUNT];
+    guint pending;
+
+    g_mutex_lock (&player->viewLock);
+    pending = player->pendingEvents;
+    player->pendingEvents = 0;
+    memcpy (values, player->pendingValues, sizeof (values));
+    g_source_unref (player->dispatchSource);
+    player->dispatchSource = NULL;
+    g_mutex_unlock (&player->viewLock);
+
+    for (guint event = 0; event < EVENT_COUNT; event++) {
+        if (!(pending & (1u << event))) {
+            continue;
+        }
+        for (GList* l = player->subscribers; l != NULL; l = l->next) {
+            Subscriber* subscriber = (Subscriber*) l->data;
+            subscriber->func ((BackendEvent) event, values[event], subscriber->userData);
+        }
+    }
+    return G_SOURCE_REMOVE;
+}
+
+/* Called on the control thread. Events are coalesced until the caller's
+ * context gets round to them, so a busy UI sees the last position rather
+ * than a backlog of them. */
+static void emitEvent (BackendPlayer* player, BackendEvent event, gdouble value) {
+    g_mutex_lock (&player->viewLock);
+    publishView (player);
+    player->pendingEvents |= 1u << event;
+    player->pendingValues[event] = value;
+    if (!player->dispatchSource) {
+        player->dispatchSource = g_idle_source_new();
+        g_source_set_priority (player->dispatchSource, G_PRIORITY_DEFAULT);
+        g_source_set_callback (player->dispatchSource, (GSourceFunc) dispatchEvents_cb,
+                player, NULL);
+        g_source_attach (player->dispatchSource, player->callerContext);
+    }
+    g_mutex_unlock (&player->viewLock);
+}
+
+/* Takes a reference to the pipeline as last published, NULL if there is
+ * none or it is a mosaic */
+static GstElement* viewPipeline (BackendPlayer* player) {
+    GstElement* pipeline = NULL;
+
+    g_mutex_lock (&player->viewLock);
+    if (player->view.pipeline && !player->view.mosaic) {
+        pipeline = gst_object_ref (player->view.pipeline);
+    }
+    g_mutex_unlock (&player->viewLock);
+    return pipeline;
+}
+
+/* Sets how often the position is pushed while playing, normally the display
+ * refresh rate */
+static void setRefreshRate_cb (BackendPlayer* player, Command* command) {
+    player->refreshInterval = MAX (1, (guint) (1000.0 / command->value));
+
+    if (player->positionSourceId) {
+        removeSource (player, &player->positionSourceId);
+        player->positionSourceId = addTimeout (player, player->refreshInterval,
+                (GSourceFunc) positionTick_cb);
+    }
+}
+
+void backendSetRefreshRate (BackendPlayer* player, gdouble hz) {
+    Command* command;
+
+    if (hz <= 0) {
+        return;
+    }
+    command = newCommand (setRefreshRate_cb);
+    command->value = hz;
+    pushCommand (player, command);
+}
+
+/* Takes a fresh position from the pipeline; everything until the next anchor
+ * is interpolated from the pipeline clock */
+static void anchorPosition (BackendPlayer* player) {
+    gint64 position;
+
+    if (!gst_element_query_position (player->pipeline, GST_FORMAT_TIME, &position)) {
+        return;
+    }
+    player->anchorPosition = position;
+    player->anchorClockTime = player->clock ? gst_clock_get_time (player->clock)
+                                            : GST_CLOCK_TIME_NONE;
+}
+
+static GstClockTime interpolatePosition (GstClock* clock, GstClockTime anchorPosition,
+                                        GstClockTime anchorClockTime, gint64 duration) {
+    GstClockTime position = anchorPosition;
+
+    if (clock && GST_CLOCK_TIME_IS_VALID (anchorClockTime)) {
+        GstClockTime now = gst_clock_get_time (clock);
+
+        if (now > anchorClockTime) {
+            position += now - anchorClockTime;
+        }
+    }
+    if (GST_CLOCK_TIME_IS_VALID (duration) && position > (GstClockTime) duration) {
+        position = duration;
+    }
+    return position;
+}
+
+static gboolean positionTick_cb (BackendPlayer* player) {
+    GstClockTime position = interpolatePosition (player->clock, player->anchorPosition,
+            player->anchorClockTime, player->duration);
+
+    emitEvent (player, BACKEND_EVENT_POSITION, (gdouble) position / GST_SECOND);
+    return G_SOURCE_CONTINUE;
+}
+
+static void updateDuration (BackendPlayer* player) {
+    gint64 duration;
+
+    if (!gst_element_query_duration (player->pipeline, GST_FORMAT_TIME, &duration)) {
+        return;
+    }
+    if (duration != player->duration) {
+        player->duration = duration;
+        emitEvent (player, BACKEND_EVENT_DURATION, (gdouble) duration / GST_SECOND);
+    }
+}
+
+/* Returns the duration as last published */
+gdouble backendQueryDuration (BackendPlayer* player) {
+    gint64 duration;
+
+    g_mutex_lock (&player->viewLock);
+    duration = player->view.duration;
+    g_mutex_unlock (&player->viewLock);
+
+    if (!GST_CLOCK_TIME_IS_VALID (duration)) {
+        g_printerr ("Could not query current duration.\n");
+        return GST_CLOCK_TIME_NONE;
+    }
+    return (gdouble) duration / GST_SECOND;
+}
+
+/* Interpolates the position from the pipeline clock, like the position events */
+gboolean backendQueryPosition (BackendPlayer* player, gdouble* current) {
+    PlayerView* view = &player->view;
+    GstClockTime position = 0;
+    gboolean res;
+
+    g_mutex_lock (&player->viewLock);
+    res = view->pipeline && view->state >= GST_STATE_PAUSED;
+    if (res) {
+        position = interpolatePosition (view->clock, view->anchorPosition,
+                view->anchorClockTime, view->duration);
+    }
+    g_mutex_unlock (&player->viewLock);
+
+    *current = (gdouble) position / GST_SECOND;
+    return res;
+}
+
+void backendFormatTime (gdouble seconds, gchar* str) {
+    if (seconds < 0) {
+        g_sprintf (str, "-:--:--");
+        return;
+    }
+    g_sprintf (str, "%u:%02u:%02u", GST_TIME_ARGS ((GstClockTime) (seconds * GST_SECOND)));
+}
+
+gboolean backendDurationIsValid (BackendPlayer* player) {
+    gboolean valid;
+
+    g_mutex_lock (&player->viewLock);
+    valid = GST_CLOCK_TIME_IS_VALID (player->view.duration);
+    g_mutex_unlock (&player->viewLock);
+    return valid;
+}
+
+static GstState viewState (BackendPlayer* player) {
+    GstState state;
+
+    g_mutex_lock (&player->viewLock);
+    state = player->view.state;
+    g_mutex_unlock (&player->viewLock);
+    return state;
+}
+
+gboolean backendIsPausedOrPlaying (BackendPlayer* player) {
+    if (viewState (player) < GST_STATE_PAUSED) {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+gboolean backendIsPlaying (BackendPlayer* player) {
+    return viewState (player) == GST_STATE_PLAYING;
+}
+
+static void stopPipeline (BackendPlayer* player) {
+    if (player->pipeline) {
+        saveResumePoint (player);
+        cancelResume (player);
+        gst_element_set_state (player->pipeline, GST_STATE_READY);
+    }
+}
+
+static void resumePipeline (BackendPlayer* player) {
+    if (!player->pipeline) {
+        return;
+    }
+    if (player->frameRing.shown) {
+        /* Carry on from the kept frame rather than from where the sink is */
+        gdouble position = (gdouble) player->frameRing.shown->position / GST_SECOND;
+
+        showCachedFrame (player, NULL);
+        issueSeek (player, position, TRUE);
+    }
+    cancelRefill (player);
+    setFrameRingFilling (&player->frameRing, FALSE);
+    gst_element_set_state (player->pipeline, GST_STATE_PLAYING);
+}
+
+static void stop_cb (BackendPlayer* player, Command* command) {
+    UNUSED (command);
+
+    stopPipeline (player);
+}
+
+static void resume_cb (BackendPlayer* player, Command* command) {
+    UNUSED (command);
+
+    if (player->resumeState != GST_STATE_VOID_PENDING) {
+        /* Played once at the resume point rather than from the start */
+        player->resumeState = GST_STATE_PLAYING;
+        return;
+    }
+    resumePipeline (player);
+}
+
+static void pause_cb (BackendPlayer* player, Command* command) {
+    UNUSED (command);
+
+    if (player->resumeState != GST_STATE_VOID_PENDING) {
+        player->resumeState = GST_STATE_PAUSED;
+        return;
+    }
+    if (player->pipeline) {
+        setFrameRingFilling (&player->frameRing, TRUE);
+        gst_element_set_state (player->pipeline, GST_STATE_PAUSED);
+        saveResumePoint (player);
+    }
+}
+
+void backendStop (BackendPlayer* player) {
+    pushCommand (player, newCommand (stop_cb));
+}
+
+void backendResume (BackendPlayer* player) {
+    pushCommand (player, newCommand (resume_cb));
+}
+
+void backendPause (BackendPlayer* player) {
+    pushCommand (player, newCommand (pause_cb));
+}
+
+/* Frame stepping. Recently decoded frames are kept in a ring, bounded by a
+ * memory budget, so stepping back or scrubbing a short way back while paused
+ * shows a kept frame instead of seeking and decoding the GOP again. */
+
+static CachedFrame* cachedFrameNew (GstBuffer* buffer, GstCaps* caps, GstClockTime position) {
+    CachedFrame* frame = g_new (CachedFrame, 1);
+
+    frame->buffer = buffer;
+    frame->caps = caps;
+    frame->position = position;
+    return frame;
+}
+
+static CachedFrame* cachedFrameCopy (const CachedFrame* frame) {
+    return cachedFrameNew (gst_buffer_ref (frame->buffer), gst_caps_ref (frame->caps),
+            frame->position);
+}
+
+static void cachedFrameFree (CachedFrame* frame) {
+    gst_buffer_unref (frame->buffer);
+    gst_caps_unref (frame->caps);
+    g_free (frame);
+}
+
+/* Must be called with the ring locked */
+static void trimFrameRing (FrameRing* ring) {
+    while (ring->bytes > ring->budget && !g_queue_is_empty (&ring->frames)) {
+        CachedFrame* frame = g_queue_pop_head (&ring->frames);
+
+        ring->bytes -= gst_buffer_get_size (frame->buffer);
+        cachedFrameFree (frame);
+    }
+}
+
+static void clearFrameRing (FrameRing* ring) {
+    CachedFrame* frame;
+
+    g_mutex_lock (&ring->lock);
+    while ((frame = g_queue_pop_head (&ring->frames)) != NULL) {
+        cachedFrameFree (frame);
+    }
+    ring->bytes = 0;
+    g_mutex_unlock (&ring->lock);
+}
+
+/* Referencing a frame is free, but it keeps the buffer from returning to a
+ * fixed size pool; frames in sink or hardware memory are copied out */
+static gboolean isSystemMemory (GstBuffer* buffer) {
+    for (guint i = 0; i < gst_buffer_n_memory (buffer); i++) {
+        if (!gst_memory_is_type (gst_buffer_peek_memory (buffer, i), GST_ALLOCATOR_SYSMEM)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* Frames are kept only from the pause on. Holding on to one while playing
+ * keeps it from going back to a bounded decoder pool, and makes it read-only
+ * to the elements after the filter that would otherwise work in place, so
+ * every frame would be copied for a step back that mostly never comes. */
+static void setFrameRingFilling (FrameRing* ring, gboolean filling) {
+    g_mutex_lock (&ring->lock);
+    ring->filling = filling;
+    g_mutex_unlock (&ring->lock);
+    if (!filling) {
+        clearFrameRing (ring);
+    }
+}
+
+/* Both of the player's playbins carry this probe; only the active one's
+ * frames are kept */
+static GstPadProbeReturn frameRing_cb (GstPad* pad, GstPadProbeInfo* info, BackendPlayer* player) {
+    FrameRing* ring = &player->frameRing;
+    GstBuffer* buffer;
+    GstEvent* event;
+    const GstSegment* segment;
+    GstClockTime position = GST_CLOCK_TIME_NONE;
+    gboolean active;
+    gsize budget;
+
+    g_mutex_lock (&ring->lock);
+    active = ring->owner && gst_object_has_as_ancestor (GST_OBJECT (pad), GST_OBJECT (ring->owner));
+    budget = ring->filling ? ring->budget : 0;
+    g_mutex_unlock (&ring->lock);
+    if (!active) {
+        return GST_PAD_PROBE_OK;
+    }
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+        g_atomic_int_inc (&player->framesPassed);
+    }
+    if (!budget) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    if (!(info->type & GST_PAD_PROBE_TYPE_BUFFER)) {
+        /* Kept frames must be contiguous with what is on screen */
+        event = GST_PAD_PROBE_INFO_EVENT (info);
+        if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP ||
+            GST_EVENT_TYPE (event) == GST_EVENT_STREAM_START) {
+            clearFrameRing (ring);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+    event = gst_pad_get_sticky_event (pad, GST_EVENT_SEGMENT, 0);
+    if (event) {
+        gst_event_parse_segment (event, &segment);
+        position = gst_segment_to_stream_time (segment, GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+        gst_event_unref (event);
+    }
+    if (!GST_CLOCK_TIME_IS_VALID (position) || gst_buffer_get_size (buffer) > budget) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    buffer = isSystemMemory (buffer) ? gst_buffer_ref (buffer) : gst_buffer_copy_deep (buffer);
+
+    g_mutex_lock (&ring->lock);
+    g_queue_push_tail (&ring->frames,
+            cachedFrameNew (buffer, gst_pad_get_current_caps (pad), position));
+    ring->bytes += gst_buffer_get_size (buffer);
+    trimFrameRing (ring);
+    g_mutex_unlock (&ring->lock);
+    return GST_PAD_PROBE_OK;
+}
+
+/* Scales down to the surface, keeping the aspect ratio, and never up */
+static GstCaps* scaleCaps (BackendPlayer* player) {
+    if (player->surfaceWidth <= 0 || player->surfaceHeight <= 0) {
+        return gst_caps_new_empty_simple ("video/x-raw");
+    }
+    return gst_caps_new_simple ("video/x-raw",
+            "width", GST_TYPE_INT_RANGE, 1, player->surfaceWidth,
+            "height", GST_TYPE_INT_RANGE, 1, player->surfaceHeight, NULL);
+}
+
+/* Puts a scaler at the head of the filter bin, so that a frame larger than
+ * the surface is scaled down before anything else touches it */
+static GstElement* addScaler (BackendPlayer* player, GstElement* filter, GstElement* next) {
+    GstElement* scale = gst_element_factory_make ("videoscale", "scale");
+    GstElement* size = gst_element_factory_make ("capsfilter", "scalesize");
+    GstCaps* caps;
+
+    if (!scale || !size) {
+        g_clear_pointer (&scale, gst_object_unref);
+        g_clear_pointer (&size, gst_object_unref);
+        return next;
+    }
+    caps = scaleCaps (player);
+    g_object_set (size, "caps", caps, NULL);
+    gst_caps_unref (caps);
+    gst_bin_add_many (GST_BIN (filter), scale, size, NULL);
+    gst_element_link_many (scale, size, next, NULL);
+    return scale;
+}
+
+/* Fills playbin's video filter slot, after the decoders and playsink's
+ * converter and ahead of the colour balance: the scaler, the LUT, which
+ * passes frames through while none is set, the subtitle overlay, fed by
+ * playbin's text stream combiner, a pass-through element for the ring to
+ * watch, and the statistics overlay, which stays silent until it is
+ * switched on */
+static void addVideoFilter (BackendPlayer* player, GstElement* playbin) {
+    GstElement* lut = gst_element_factory_make ("glieselut", "lut");
+    GstElement* subtitles = gst_element_factory_make ("gliesesubtitles", "subtitles");
+    GstElement* mixer = gst_element_factory_make ("gliesesubmix", NULL);
+    GstElement* tap = gst_element_factory_make ("identity", "framering");
+    GstElement* overlay = gst_element_factory_make ("textoverlay", "stats");
+    GstElement* filter;
+    GstElement* first;
+    GstElement* last;
+    GstPad* pad;
+
+    if (!tap) {
+        g_clear_pointer (&lut, gst_object_unref);
+        g_clear_pointer (&subtitles, gst_object_unref);
+        g_clear_pointer (&mixer, gst_object_unref);
+        g_clear_pointer (&overlay, gst_object_unref);
+        return;
+    }
+    g_object_set (tap, "silent", TRUE, NULL);
+    pad = gst_element_get_static_pad (tap, "src");
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM |
+            GST_PAD_PROBE_TYPE_EVENT_FLUSH, (GstPadProbeCallback) frameRing_cb, player, NULL);
+    gst_object_unref (pad);
+
+    filter = gst_bin_new ("videofilter");
+    first = last = tap;
+    gst_bin_add (GST_BIN (filter), tap);
+    if (subtitles) {
+        gst_bin_add (GST_BIN (filter), subtitles);
+        gst_element_link (subtitles, first);
+        first = subtitles;
+    }
+    if (lut) {
+        lutFilterSetLut (lut, player->lut, player->lutInterpolation);
+        gst_bin_add (GST_BIN (filter), lut);
+        gst_element_link (lut, first);
+        first = lut;
+    }
+    if (overlay) {
+        g_object_set (overlay, "silent", !player->statsOverlay, "shaded-background", TRUE,
+                "font-desc", "Monospace 10", NULL);
+        gst_util_set_object_arg (G_OBJECT (overlay), "halignment", "left");
+        gst_util_set_object_arg (G_OBJECT (overlay), "valignment", "top");
+        gst_bin_add (GST_BIN (filter), overlay);
+        gst_element_link (tap, overlay);
+        last = overlay;
+    }
+    first = addScaler (player, filter, first);
+
+    pad = gst_element_get_static_pad (first, "sink");
+    gst_element_add_pad (filter, gst_ghost_pad_new ("sink", pad));
+    gst_object_unref (pad);
+    pad = gst_element_get_static_pad (last, "src");
+    gst_element_add_pad (filter, gst_ghost_pad_new ("src", pad));
+    gst_object_unref (pad);
+    g_object_set (playbin, "video-filter", filter, NULL);
+
+    if (subtitles && mixer) {
+        subtitleMixerAttach (mixer, subtitles);
+        g_object_set (playbin, "text-stream-combiner", mixer, NULL);
+    } else {
+        g_clear_pointer (&mixer, gst_object_unref);
+    }
+}
+
+/* The visualisation's frames: the surface's size, or the element's default
+ * while that is not known, at the rate cap */
+static GstCaps* visualisationCaps (BackendPlayer* player) {
+    GstCaps* caps = gst_caps_new_empty_simple ("video/x-raw");
+
+    if (player->surfaceWidth > 0 && player->surfaceHeight > 0) {
+        gst_caps_set_simple (caps, "width", G_TYPE_INT, player->surfaceWidth,
+                "height", G_TYPE_INT, player->surfaceHeight, NULL);
+    }
+    if (player->visualisationRate) {
+        gst_caps_set_simple (caps, "framerate", GST_TYPE_FRACTION,
+                (gint) player->visualisationRate, 1, NULL);
+    }
+    return caps;
+}
+
+/* Fills playbin's visualisation slot with the built-in visualiser and a
+ * capsfilter that sets what it draws. playbin only plugs it while the vis
+ * flag is set and the file has no video. */
+static void addVisualisation (BackendPlayer* player, GstElement* playbin) {
+    GstElement* vis = gst_element_factory_make ("gliesevis", "vis");
+    GstElement* size = gst_element_factory_make ("capsfilter", "vissize");
+    GstElement* bin;
+    GstCaps* caps;
+    GstPad* pad;
+
+    if (!vis || !size) {
+        g_clear_pointer (&vis, gst_object_unref);
+        g_clear_pointer (&size, gst_object_unref);
+        return;
+    }
+    if (player->visualisation != BACKEND_VISUALISATION_NONE) {
+        g_object_set (vis, "style", player->visualisation, NULL);
+    }
+    caps = visualisationCaps (player);
+    g_object_set (size, "caps", caps, NULL);
+    gst_caps_unref (caps);
+
+    bin = gst_bin_new ("visualisation");
+    gst_bin_add_many (GST_BIN (bin), vis, size, NULL);
+    gst_element_link (vis, size);
+    pad = gst_element_get_static_pad (vis, "sink");
+    gst_element_add_pad (bin, gst_ghost_pad_new ("sink", pad));
+    gst_object_unref (pad);
+    pad = gst_element_get_static_pad (size, "src");
+    gst_element_add_pad (bin, gst_ghost_pad_new ("src", pad));
+    gst_object_unref (pad);
+    g_object_set (playbin, "vis-plugin", bin, NULL);
+}
+
+/* Passes a new style, size or rate cap on to the visualisation; the
+ * capsfilter asks it to renegotiate */
+static void applyVisualisation (BackendPlayer* player, GstElement* playbin) {
+    GstElement* bin = NULL;
+    GstElement* vis;
+    GstElement* size;
+    GstCaps* caps;
+
+    if (!playbin) {
+        return;
+    }
+    g_object_get (playbin, "vis-plugin", &bin, NULL);
+    if (!bin) {
+        return;
+    }
+    vis = gst_bin_get_by_name (GST_BIN (bin), "vis");
+    size = gst_bin_get_by_name (GST_BIN (bin), "vissize");
+    if (vis && player->visualisation != BACKEND_VISUALISATION_NONE) {
+        g_object_set (vis, "style", player->visualisation, NULL);
+    }
+    if (size) {
+        caps = visualisationCaps (player);
+        g_object_set (size, "caps", caps, NULL);
+        gst_caps_unref (caps);
+    }
+    g_clear_pointer (&vis, gst_object_unref);
+    g_clear_pointer (&size, gst_object_unref);
+    gst_object_unref (bin);
+}
+
+static void applyLut (BackendPlayer* player, GstElement* playbin) {
+    GstElement* filter = NULL;
+    GstElement* lut;
+
+    if (!playbin) {
+        return;
+    }
+    g_object_get (playbin, "video-filter", &filter, NULL);
+    if (!filter) {
+        return;
+    }
+    lut = gst_bin_get_by_name (GST_BIN (filter), "lut");
+    if (lut) {
+        lutFilterSetLut (lut, player->lut, player->lutInterpolation);
+        gst_object_unref (lut);
+    }
+    gst_object_unref (filter);
+}
+
+static void setLut_cb (BackendPlayer* player, Command* command) {
+    lut3dUnref (player->lut);
+    player->lut = command->data;
+    command->data = NULL;
+    player->lutInterpolation = (LutInterpolation) command->value;
+    if (!player->mosaic) {
+        applyLut (player, player->pipeline);
+    }
+    applyLut (player, player->standby.pipeline);
+}
+
+/* Grades the video through the 3D LUT in a .cube file, or stops grading with
+ * NULL. The file is read before returning, so that a bad one is reported
+ * here; the LUT applies to the playing file at once and to every one after.
+ * Mosaics are not graded. */
+gboolean backendSetLut (BackendPlayer* player, const gchar* path,
+                        LutInterpolation interpolation, GError** error) {
+    Lut3d* lut = NULL;
+    Command* command;
+
+    if (path) {
+        lut = lut3dLoad (path, error);
+        if (!lut) {
+            return FALSE;
+        }
+    }
+    command = newCommand (setLut_cb);
+    command->value = interpolation;
+    command->data = lut;
+    command->freeData = (GDestroyNotify) lut3dUnref;
+    pushCommand (player, command);
+    return TRUE;
+}
+
+static void applyScaleCaps (BackendPlayer* player, GstElement* playbin) {
+    GstElement* filter = NULL;
+    GstElement* size = NULL;
+    GstCaps* caps;
+
+    if (!playbin) {
+        return;
+    }
+    g_object_get (playbin, "video-filter", &filter, NULL);
+    if (filter) {
+        size = gst_bin_get_by_name (GST_BIN (filter), "scalesize");
+        gst_object_unref (filter);
+    }
+    if (!size) {
+        return;
+    }
+    /* The capsfilter asks upstream to renegotiate */
+    caps = scaleCaps (player);
+    g_object_set (size, "caps", caps, NULL);
+    gst_caps_unref (caps);
+    gst_object_unref (size);
+}
+
+static gboolean applyVideoSize_cb (BackendPlayer* player) {
+    player->resizeSourceId = 0;
+    if (player->mosaic) {
+        mosaicSetCanvasSize (player->mosaic, player->surfaceWidth, player->surfaceHeight);
+    } else {
+        applyScaleCaps (player, player->pipeline);
+        applyVisualisation (player, player->pipeline);
+    }
+    applyScaleCaps (player, player->standby.pipeline);
+    applyVisualisation (player, player->standby.pipeline);
+    return G_SOURCE_REMOVE;
+}
+
+/* A window being dragged to a new size renegotiates ten times a second at
+ * most, with the size it has by then */
+static void setVideoSize_cb (BackendPlayer* player, Command* command) {
+    player->surfaceWidth = (gint) command->value;
+    player->surfaceHeight = GPOINTER_TO_INT (command->data);
+    if (!player->resizeSourceId) {
+        player->resizeSourceId = addTimeout (player, 100, (GSourceFunc) applyVideoSize_cb);
+    }
+}
+
+/* Tells the player the size in device pixels of the surface showing the
+ * video, or 0x0 if it is not known. Larger frames are scaled down to it
+ * before the colour balance, the conversion and the sink, and mosaics are
+ * composed onto a canvas no larger. */
+void backendSetVideoSize (BackendPlayer* player, gint width, gint height) {
+    Command* command = newCommand (setVideoSize_cb);
+
+    command->value = MAX (width, 0);
+    command->data = GINT_TO_POINTER (MAX (height, 0));
+    pushCommand (player, command);
+}
+
+static void setVisualisation_cb (BackendPlayer* player, Command* command) {
+    BackendVisualisation style = (BackendVisualisation) command->value;
+    gboolean toggled = (style == BACKEND_VISUALISATION_NONE) !=
+                       (player->visualisation == BACKEND_VISUALISATION_NONE);
+
+    player->visualisation = style;
+    player->visualisationRate = GPOINTER_TO_UINT (command->data);
+    if (player->pipeline && !player->mosaic) {
+        applyVisualisation (player, player->pipeline);
+        if (toggled) {
+            gst_util_set_object_arg (G_OBJECT (player->pipeline), "flags", playFlags (player));
+        }
+    }
+    applyVisualisation (player, player->standby.pipeline);
+    if (toggled) {
+        /* The standby pipeline was prerolled for the other case */
+        restartStandby (player);
+    }
+}
+
+/* Chooses what files without video show, drawn at the size given to
+ * backendSetVideoSize() and at no more than fps frames a second, 0 for no
+ * cap. With BACKEND_VISUALISATION_NONE no video branch is built for them. */
+void backendSetVisualisation (BackendPlayer* player, BackendVisualisation style, guint fps) {
+    Command* command = newCommand (setVisualisation_cb);
+
+    command->value = style;
+    command->data = GUINT_TO_POINTER (fps);
+    pushCommand (player, command);
+}
+
+/* Sets how much memory the kept frames may use; 0 disables the ring */
+void backendSetFrameCacheSize (BackendPlayer* player, gsize bytes) {
+    FrameRing* ring = &player->frameRing;
+
+    g_mutex_lock (&ring->lock);
+    ring->cacheSize = bytes;
+    g_mutex_unlock (&ring->lock);
+    applyFrameRingBudget (player);
+}
+
+/* Switches between a kept frame, painted by the caller from backendGetFrame(),
+ * and the sink's own output */
+static void showCachedFrame (BackendPlayer* player, CachedFrame* frame) {
+    FrameRing* ring = &player->frameRing;
+    CachedFrame* previous = ring->shown;
+
+    /* Swapped under the lock for backendGetFrame() on the caller's thread */
+    g_mutex_lock (&ring->lock);
+    ring->shown = frame;
+    g_mutex_unlock (&ring->lock);
+    if (previous) {
+        cachedFrameFree (previous);
+    }
+
+    if (frame) {
+        /* Keep the sink from drawing its own frame over it on expose */
+        gst_video_overlay_handle_events (GST_VIDEO_OVERLAY (player->pipeline), FALSE);
+        emitEvent (player, BACKEND_EVENT_FRAME, (gdouble) frame->position / GST_SECOND);
+    } else if (previous) {
+        gst_video_overlay_handle_events (GST_VIDEO_OVERLAY (player->pipeline), TRUE);
+        gst_video_overlay_expose (GST_VIDEO_OVERLAY (player->pipeline));
+        emitEvent (player, BACKEND_EVENT_FRAME, -1);
+    }
+}
+
+/* Converts on the caller's thread, which is the only one to use the converter */
+static gboolean convertFrame (FrameRing* ring, CachedFrame* shown, GstVideoInfo* inInfo,
+                              BackendFrame* frame) {
+    GstVideoInfo outInfo;
+    GstVideoFrame in, out;
+    GstBuffer* outBuffer;
+    GstMapInfo map;
+    gint width;
+
+    /* Square pixels, so the caller only has to scale to fit */
+    width = (gint) gst_util_uint64_scale_int (GST_VIDEO_INFO_WIDTH (inInfo),
+            GST_VIDEO_INFO_PAR_N (inInfo), MAX (GST_VIDEO_INFO_PAR_D (inInfo), 1));
+    gst_video_info_set_format (&outInfo,
+            G_BYTE_ORDER == G_LITTLE_ENDIAN ? GST_VIDEO_FORMAT_BGRx : GST_VIDEO_FORMAT_xRGB,
+            width, GST_VIDEO_INFO_HEIGHT (inInfo));
+
+    if (!ring->converter || !gst_video_info_is_equal (inInfo, &ring->converterInfo)) {
+        if (ring->converter) {
+            gst_video_converter_free (ring->converter);
+        }
+        ring->converter = gst_video_converter_new (inInfo, &outInfo, NULL);
+        ring->converterInfo = *inInfo;
+    }
+    if (!ring->converter) {
+        return FALSE;
+    }
+
+    outBuffer = gst_buffer_new_allocate (NULL, GST_VIDEO_INFO_SIZE (&outInfo), NULL);
+    if (!gst_video_frame_map (&in, inInfo, shown->buffer, GST_MAP_READ)) {
+        gst_buffer_unref (outBuffer);
+        return FALSE;
+    }
+    gst_video_frame_map (&out, &outInfo, outBuffer, GST_MAP_WRITE);
+    gst_video_converter_frame (ring->converter, &in, &out);
+    gst_video_frame_unmap (&out);
+    gst_video_frame_unmap (&in);
+
+    gst_buffer_map (outBuffer, &map, GST_MAP_READ);
+    frame->pixels = g_bytes_new (map.data, map.size);
+    gst_buffer_unmap (outBuffer, &map);
+    gst_buffer_unref (outBuffer);
+
+    frame->position = (gdouble) shown->position / GST_SECOND;
+    frame->width = GST_VIDEO_INFO_WIDTH (&outInfo);
+    frame->height = GST_VIDEO_INFO_HEIGHT (&outInfo);
+    frame->stride = GST_VIDEO_INFO_PLANE_STRIDE (&outInfo, 0);
+    return TRUE;
+}
+
+/* Returns the kept frame on screen as native endian xRGB, or FALSE while the
+ * live video is showing */
+gboolean backendGetFrame (BackendPlayer* player, BackendFrame* frame) {
+    FrameRing* ring = &player->frameRing;
+    CachedFrame* shown = NULL;
+    GstVideoInfo inInfo;
+    gboolean converted = FALSE;
+
+    g_mutex_lock (&ring->lock);
+    if (ring->shown) {
+        shown = cachedFrameCopy (ring->shown);
+    }
+    g_mutex_unlock (&ring->lock);
+    if (!shown) {
+        return FALSE;
+    }
+    if (gst_video_info_from_caps (&inInfo, shown->caps)) {
+        converted = convertFrame (ring, shown, &inInfo, frame);
+    }
+    cachedFrameFree (shown);
+    return converted;
+}
+
+void backendFrameClear (BackendFrame* frame) {
+    g_clear_pointer (&frame->pixels, g_bytes_unref);
+}
+
+/* Stream time of the frame on screen, the kept one if any */
+static GstClockTime shownPosition (BackendPlayer* player) {
+    gint64 position;
+
+    if (player->frameRing.shown) {
+        return player->frameRing.shown->position;
+    }
+    if (!gst_element_query_position (player->pipeline, GST_FORMAT_TIME, &position)) {
+        return GST_CLOCK_TIME_NONE;
+    }
+    return position;
+}
+
+/* Looks up the kept frame at or just before the target, not past what the
+ * sink showed when paused. Returns a copy, or NULL if the target is outside
+ * the ring. */
+static CachedFrame* findCachedFrame (FrameRing* ring, GstClockTime target, gboolean before) {
+    CachedFrame* found = NULL;
+    CachedFrame* first;
+
+    g_mutex_lock (&ring->lock);
+    first = g_queue_peek_head (&ring->frames);
+    if (first && first->position <= target) {
+        for (GList* l = ring->frames.tail; l != NULL; l = l->prev) {
+            CachedFrame* frame = (CachedFrame*) l->data;
+
+            if (frame->position > target || (before && frame->position == target)) {
+                continue;
+            }
+            if (frame->position > ring->liveAtPause) {
+                continue;
+            }
+            found = cachedFrameCopy (frame);
+            break;
+        }
+    }
+    g_mutex_unlock (&ring->lock);
+    return found;
+}
+
+static CachedFrame* findNextCachedFrame (FrameRing* ring, GstClockTime after) {
+    CachedFrame* found = NULL;
+
+    g_mutex_lock (&ring->lock);
+    for (GList* l = ring->frames.head; l != NULL; l = l->next) {
+        CachedFrame* frame = (CachedFrame*) l->data;
+
+        if (frame->position > after) {
+            found = cachedFrameCopy (frame);
+            break;
+        }
+    }
+    g_mutex_unlock (&ring->lock);
+    return found;
+}
+
+static GstClockTime frameDuration (const CachedFrame* frame) {
+    GstVideoInfo info;
+
+    if (frame && GST_BUFFER_DURATION_IS_VALID (frame->buffer)) {
+        return GST_BUFFER_DURATION (frame->buffer);
+    }
+    if (frame && gst_video_info_from_caps (&info, frame->caps) && info.fps_n > 0) {
+        return gst_util_uint64_scale_int (GST_SECOND, info.fps_d, info.fps_n);
+    }
+    return 40 * GST_MSECOND;
+}
+
+/* Stepping back past the start of the ring. A seek to the keyframe before
+ * the target and a step of the sink back up to the frame it was paused on
+ * decode the group of pictures once, through the ring, which then serves
+ * the steps back that follow. The frame on screen stays up meanwhile. */
+static void refillFrameRing (BackendPlayer* player, GstClockTime target) {
+    FrameRing* ring = &player->frameRing;
+
+    hidePrerollFrames (player, TRUE);
+    ring->refillTarget = target;
+    ring->refillStepping = FALSE;
+    player->seekInFlight = gst_element_seek_simple (player->pipeline, GST_FORMAT_TIME,
+            GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_BEFORE,
+            (gint64) target);
+    if (!player->seekInFlight) {
+        cancelRefill (player);
+        showCachedFrame (player, NULL);
+        issueSeek (player, (gdouble) target / GST_SECOND, TRUE);
+    }
+}
+
+static void cancelRefill (BackendPlayer* player) {
+    if (GST_CLOCK_TIME_IS_VALID (player->frameRing.refillTarget)) {
+        player->frameRing.refillTarget = GST_CLOCK_TIME_NONE;
+        player->frameRing.refillStepping = FALSE;
+        hidePrerollFrames (player, FALSE);
+    }
+}
+
+/* At the keyframe: steps the sink forward to where it was paused, the frames
+ * on the way being dropped by the sink but kept by the ring */
+static void stepThroughGop (BackendPlayer* player) {
+    FrameRing* ring = &player->frameRing;
+    GstClockTime duration;
+    gint64 position;
+    guint64 frames = 0;
+
+    g_mutex_lock (&ring->lock);
+    duration = MAX (frameDuration (g_queue_peek_tail (&ring->frames)), 1);
+    g_mutex_unlock (&ring->lock);
+    if (gst_element_query_position (player->pipeline, GST_FORMAT_TIME, &position) &&
+        position >= 0 && (GstClockTime) position < ring->liveAtPause) {
+        frames = (ring->liveAtPause - position + duration / 2) / duration;
+    }
+    ring->refillStepping = frames > 0 && gst_element_send_event (player->pipeline,
+            gst_event_new_step (GST_FORMAT_BUFFERS, frames, 1.0, TRUE, FALSE));
+    if (!ring->refillStepping) {
+        finishRefill (player);
+    }
+}
+
+/* Shows the target from the refilled ring, or seeks to it if the group of
+ * pictures was too large to keep */
+static void finishRefill (BackendPlayer* player) {
+    FrameRing* ring = &player->frameRing;
+    CachedFrame* frame = findCachedFrame (ring, ring->refillTarget, FALSE);
+    GstClockTime target = ring->refillTarget;
+
+    cancelRefill (player);
+    if (frame) {
+        showCachedFrame (player, frame);
+        return;
+    }
+    showCachedFrame (player, NULL);
+    issueSeek (player, (gdouble) target / GST_SECOND, TRUE);
+}
+
+static void pauseForStepping (BackendPlayer* player) {
+    setFrameRingFilling (&player->frameRing, TRUE);
+    if (player->state == GST_STATE_PLAYING) {
+        gst_element_set_state (player->pipeline, GST_STATE_PAUSED);
+        gst_element_get_state (player->pipeline, NULL, NULL, 100 * GST_MSECOND);
+    }
+}
+
+/* Steps one frame forward or back while paused. Backwards inside the ring is
+ * served from kept frames; past its start the ring is refilled with the group
+ * of pictures before, see refillFrameRing(). */
+static void stepFrame_cb (BackendPlayer* player, Command* command) {
+    gboolean forward = command->value > 0;
+    FrameRing* ring = &player->frameRing;
+    CachedFrame* frame;
+    GstClockTime position, step;
+
+    if (!player->pipeline) {
+        return;
+    }
+    if (GST_CLOCK_TIME_IS_VALID (ring->refillTarget)) {
+        /* Still decoding the previous step's group of pictures */
+        return;
+    }
+    pauseForStepping (player);
+    position = shownPosition (player);
+    if (!GST_CLOCK_TIME_IS_VALID (position)) {
+        return;
+    }
+
+    if (forward) {
+        if (!ring->shown) {
+            gst_element_send_event (player->pipeline,
+                    gst_event_new_step (GST_FORMAT_BUFFERS, 1, 1.0, TRUE, FALSE));
+            return;
+        }
+        /* Back at the frame the sink holds, its own output takes over */
+        frame = findNextCachedFrame (ring, position);
+        if (frame && frame->position < ring->liveAtPause) {
+            showCachedFrame (player, frame);
+        } else {
+            if (frame) {
+                cachedFrameFree (frame);
+            }
+            showCachedFrame (player, NULL);
+        }
+        return;
+    }
+
+    if (!ring->shown) {
+        ring->liveAtPause = position;
+    }
+    frame = findCachedFrame (ring, position, TRUE);
+    if (frame) {
+        showCachedFrame (player, frame);
+        return;
+    }
+    step = frameDuration (ring->shown);
+    refillFrameRing (player, position > step ? position - step : 0);
+}
+
+void backendStepFrame (BackendPlayer* player, gboolean forward) {
+    Command* command = newCommand (stepFrame_cb);
+
+    command->value = forward ? 1 : -1;
+    pushCommand (player, command);
+}
+
+/* Serves a seek from the ring when paused and the target was decoded
+ * recently. Returns FALSE if the pipeline has to seek. */
+static gboolean seekInFrameRing (BackendPlayer* player, gdouble value) {
+    FrameRing* ring = &player->frameRing;
+    GstClockTime target = (GstClockTime) (MAX (value, 0) * GST_SECOND);
+    CachedFrame* frame;
+
+    if (player->state != GST_STATE_PAUSED || player->seekInFlight) {
+        return FALSE;
+    }
+    if (!ring->shown) {
+        ring->liveAtPause = shownPosition (player);
+    }
+    if (target >= ring->liveAtPause) {
+        /* Within a frame of the sink's own, which needs no seek either */
+        if (ring->shown && target < ring->liveAtPause + frameDuration (ring->shown)) {
+            showCachedFrame (player, NULL);
+            return TRUE;
+        }
+        return FALSE;
+    }
+    frame = findCachedFrame (ring, target, FALSE);
+    if (!frame) {
+        return FALSE;
+    }
+    showCachedFrame (player, frame);
+    return TRUE;
+}
+
+static void issueSeek (BackendPlayer* player, gdouble value, gboolean accurate) {
+    GstSeekFlags flags = GST_SEEK_FLAG_FLUSH;
+
+    flags |= accurate ? GST_SEEK_FLAG_ACCURATE
+                      : GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_NEAREST;
+    player->seekInFlight = gst_element_seek_simple (player->pipeline, GST_FORMAT_TIME,
+            flags, (gint64)(value * GST_SECOND));
+}
+
+/* Only one flushing seek is in flight at a time. Requests arriving meanwhile
+ * replace each other and the last one is issued on async-done. */
+static void scheduleSeek (BackendPlayer* player, gdouble value, gboolean accurate) {
+    if (!player->pipeline || seekInFrameRing (player, value)) {
+        return;
+    }
+    /* The user's position wins over the saved one, and over a step back */
+    player->resumeAt = -1;
+    cancelRefill (player);
+    showCachedFrame (player, NULL);
+    if (player->seekInFlight) {
+        player->pendingSeek = value;
+        player->pendingAccurate = accurate;
+        return;
+    }
+    issueSeek (player, value, accurate);
+}
+
+static void seek_cb (BackendPlayer* player, Command* command) {
+    scheduleSeek (player, command->value, TRUE);
+}
+
+static void scrub_cb (BackendPlayer* player, Command* command) {
+    scheduleSeek (player, command->value, FALSE);
+}
+
+static void pushSeek (BackendPlayer* player, CommandFunc func, gdouble value) {
+    Command* command = newCommand (func);
+
+    command->value = value;
+    pushCommand (player, command);
+}
+
+/* Seeks exactly to the given position, e.g. when a slider drag ends */
+void backendSeek (BackendPlayer* player, gdouble value) {
+    pushSeek (player, seek_cb, value);
+}
+
+/* Seeks to the nearest keyframe; cheap enough to follow a slider drag */
+void backendScrub (BackendPlayer* player, gdouble value) {
+    pushSeek (player, scrub_cb, value);
+}
+
+/* Applied to playbin, or to the volume element after the mosaic's mixer, and
+ * to every pipeline opened after */
+static void setVolume_cb (BackendPlayer* player, Command* command) {
+    player->volume = command->value;
+    if (player->mosaic) {
+        g_object_set (mosaicGetVolume (player->mosaic), "volume", player->volume, NULL);
+    } else if (player->pipeline) {
+        g_object_set (player->pipeline, "volume", player->volume, NULL);
+    }
+}
+
+void backendSetVolume (BackendPlayer* player, gdouble volume) {
+    Command* command = newCommand (setVolume_cb);
+
+    g_mutex_lock (&player->viewLock);
+    player->view.volume = volume;
+    g_mutex_unlock (&player->viewLock);
+
+    command->value = volume;
+    pushCommand (player, command);
+}
+
+gdouble backendGetVolume (BackendPlayer* player) {
+    gdouble value;
+
+    g_mutex_lock (&player->viewLock);
+    value = player->view.volume;
+    g_mutex_unlock (&player->viewLock);
+    return value;
+}
+
+/* Tracks. playbin3 posts the streams of each file as a collection and which
+ * of them it decodes once it has selected them; both arrive on the control
+ * thread. The user's choice per slot outlives the file where it can: a
+ * track id is forgotten once a file without it is opened, subtitles turned
+ * off stay off. An attached subtitle file is a track of its own that
+ * playbin3 never sees; the subtitle overlay draws it from its index. */
+
+static void clearStreams (Streams* streams) {
+    if (streams->collection) {
+        gst_object_unref (streams->collection);
+    }
+    g_strfreev (streams->active);
+    memset (streams, 0, sizeof (Streams));
+}
+
+static void resetTracks (BackendPlayer* player) {
+    clearStreams (&player->streams);
+    g_clear_pointer (&player->subtitleFile, subtitleFileUnref);
+    g_clear_pointer (&player->subtitleFileId, g_free);
+    player->tracksChanged = TRUE;
+}
+
+static gboolean isExternal (BackendPlayer* player, const gchar* id) {
+    return id && g_strcmp0 (id, player->subtitleFileId) == 0;
+}
+
+static gboolean isActive (BackendPlayer* player, const gchar* id) {
+    return id && player->streams.active &&
+           g_strv_contains ((const gchar* const*) player->streams.active, id);
+}
+
+static GstStream* findStream (GstStreamCollection* collection, const gchar* id) {
+    for (guint i = 0; i < gst_stream_collection_get_size (collection); i++) {
+        GstStream* stream = gst_stream_collection_get_stream (collection, i);
+
+        if (g_strcmp0 (gst_stream_get_stream_id (stream), id) == 0) {
+            return stream;
+        }
+    }
+    return NULL;
+}
+
+static BackendTrackSlot trackSlot (BackendPlayer* player, const BackendTrack* track) {
+    static const BackendTrackSlot slots[] = {
+        BACKEND_SLOT_VIDEO, BACKEND_SLOT_AUDIO, BACKEND_SLOT_SUBTITLE
+    };
+
+    if (track->type == BACKEND_TRACK_SUBTITLE &&
+        g_strcmp0 (track->id, player->chosen[BACKEND_SLOT_SECONDARY_SUBTITLE]) == 0) {
+        return BACKEND_SLOT_SECONDARY_SUBTITLE;
+    }
+    if (isActive (player, track->id) ||
+        (isExternal (player, track->id) &&
+         g_strcmp0 (track->id, player->chosen[BACKEND_SLOT_SUBTITLE]) == 0)) {
+        return slots[track->type];
+    }
+    return BACKEND_SLOT_NONE;
+}
+
+static void describeTrack (BackendTrack* track, GstStream* stream) {
+    static const gchar* codecTags[] = {
+        GST_TAG_VIDEO_CODEC, GST_TAG_AUDIO_CODEC, GST_TAG_SUBTITLE_CODEC
+    };
+    GstTagList* tags = gst_stream_get_tags (stream);
+    GstCaps* caps;
+
+    if (tags) {
+        gst_tag_list_get_string (tags, GST_TAG_TITLE, &track->title);
+        gst_tag_list_get_string (tags, GST_TAG_LANGUAGE_CODE, &track->language);
+        gst_tag_list_get_string (tags, codecTags[track->type], &track->codec);
+        gst_tag_list_get_uint (tags, GST_TAG_BITRATE, &track->bitrate);
+        gst_tag_list_unref (tags);
+    }
+    caps = gst_stream_get_caps (stream);
+    if (!track->codec && caps && gst_caps_get_size (caps) > 0) {
+        track->codec = g_strdup (gst_structure_get_name (gst_caps_get_structure (caps, 0)));
+    }
+    if (caps) {
+        gst_caps_unref (caps);
+    }
+}
+
+/* Must be called with the view locked */
+static void publishTracks (BackendPlayer* player) {
+    PlayerView* view = &player->view;
+    GstStreamCollection* collection = player->streams.collection;
+    guint streams = collection ? gst_stream_collection_get_size (collection) : 0;
+    BackendTrack* track;
+
+    backendTracksFree (view->tracks, view->trackCount);
+    view->tracks = NULL;
+    view->trackCount = 0;
+    player->tracksChanged = FALSE;
+    if (!streams && !player->subtitleFile) {
+        return;
+    }
+    view->tracks = g_new0 (BackendTrack, streams + 1);
+    for (guint i = 0; i < streams; i++) {
+        GstStream* stream = gst_stream_collection_get_stream (collection, i);
+        GstStreamType type = gst_stream_get_stream_type (stream);
+
+        track = &view->tracks[view->trackCount];
+        if (type & GST_STREAM_TYPE_VIDEO) {
+            track->type = BACKEND_TRACK_VIDEO;
+        } else if (type & GST_STREAM_TYPE_AUDIO) {
+            track->type = BACKEND_TRACK_AUDIO;
+        } else if (type & GST_STREAM_TYPE_TEXT) {
+            track->type = BACKEND_TRACK_SUBTITLE;
+        } else {
+            continue;
+        }
+        track->id = g_strdup (gst_stream_get_stream_id (stream));
+        track->slot = trackSlot (player, track);
+        describeTrack (track, stream);
+        view->trackCount++;
+    }
+    if (player->subtitleFile) {
+        track = &view->tracks[view->trackCount++];
+        track->type = BACKEND_TRACK_SUBTITLE;
+        track->id = g_strdup (player->subtitleFileId);
+        track->slot = trackSlot (player, track);
+        track->title = g_path_get_basename (subtitleFileGetPath (player->subtitleFile));
+        track->codec = g_strdup (subtitleFileFormatName (
+                subtitleFileGetFormat (player->subtitleFile)));
+    }
+}
+
+void backendTracksFree (BackendTrack* tracks, guint count) {
+    for (guint i = 0; i < count; i++) {
+        g_free (tracks[i].id);
+        g_free (tracks[i].title);
+        g_free (tracks[i].language);
+        g_free (tracks[i].codec);
+    }
+    g_free (tracks);
+}
+
+/* Returns a copy of the tracks of the current file in the order the file has
+ * them, NULL until playbin3 has posted them. Free with backendTracksFree(). */
+BackendTrack* backendGetTracks (BackendPlayer* player, guint* count) {
+    BackendTrack* tracks;
+
+    g_mutex_lock (&player->viewLock);
+    *count = player->view.trackCount;
+    tracks = *count ? g_new (BackendTrack, *count) : NULL;
+    for (guint i = 0; i < *count; i++) {
+        tracks[i] = player->view.tracks[i];
+        tracks[i].id = g_strdup (tracks[i].id);
+        tracks[i].title = g_strdup (tracks[i].title);
+        tracks[i].language = g_strdup (tracks[i].language);
+        tracks[i].codec = g_strdup (tracks[i].codec);
+    }
+    g_mutex_unlock (&player->viewLock);
+    return tracks;
+}
+
+/* The stream for a slot: the picked one, else the one playing, else the
+ * first of its type. NULL for subtitles turned off. */
+static const gchar* pickStream (BackendPlayer* player, BackendTrackSlot slot, GstStreamType type) {
+    GstStreamCollection* collection = player->streams.collection;
+    const gchar* current = NULL;
+    const gchar* first = NULL;
+
+    if (player->picked[slot] && type == GST_STREAM_TYPE_TEXT &&
+        (!player->chosen[slot] || isExternal (player, player->chosen[slot]))) {
+        return NULL;
+    }
+    for (guint i = 0; i < gst_stream_collection_get_size (collection); i++) {
+        GstStream* stream = gst_stream_collection_get_stream (collection, i);
+        const gchar* id = gst_stream_get_stream_id (stream);
 
-static GstElement* pipeline;
-static CustomData customData;
+        if (!(gst_stream_get_stream_type (stream) & type)) {
+            continue;
+        }
+        if (player->picked[slot] && g_strcmp0 (id, player->chosen[slot]) == 0) {
+            return id;
+        }
+        if (!current && isActive (player, id)) {
+            current = id;
+        }
+        if (!first) {
+            first = id;
+        }
+    }
+    return current ? current : first;
+}
 
-static void eos_cb (GstBus* bus, GstMessage* msg, CustomData* data);
-static void error_cb (GstBus* bus, GstMessage* msg, CustomData* data);
-static void stateChanged_cb(GstBus* bus, GstMessage* msg, CustomData* data);
-static void padAdded_cb (GstElement* dec, GstPad* pad, gpointer data);
+/* decodebin3 tears down the decoders of the streams that are dropped and
+ * plugs the new ones in place, without a flush: the switch shows from the
+ * next frame on. The secondary subtitle is selected alongside the primary
+ * one; the text stream combiner hands both to the subtitle overlay. */
+static void selectStreams (BackendPlayer* player) {
+    const gchar* secondary = player->chosen[BACKEND_SLOT_SECONDARY_SUBTITLE];
+    GList* ids = NULL;
+    const gchar* id;
 
-void backendInit (int* argc, char*** argv){
-    gst_init (argc, argv);
+    if (!player->pipeline || player->mosaic || !player->streams.collection) {
+        return;
+    }
+    if ((id = pickStream (player, BACKEND_SLOT_VIDEO, GST_STREAM_TYPE_VIDEO)) != NULL) {
+        ids = g_list_append (ids, (gpointer) id);
+    }
+    if ((id = pickStream (player, BACKEND_SLOT_AUDIO, GST_STREAM_TYPE_AUDIO)) != NULL) {
+        ids = g_list_append (ids, (gpointer) id);
+    }
+    if ((id = pickStream (player, BACKEND_SLOT_SUBTITLE, GST_STREAM_TYPE_TEXT)) != NULL) {
+        ids = g_list_append (ids, (gpointer) id);
+    }
+    if (secondary && !isExternal (player, secondary) && g_strcmp0 (secondary, id) != 0) {
+        ids = g_list_append (ids, (gpointer) secondary);
+    }
+    gst_element_send_event (player->pipeline, gst_event_new_select_streams (ids));
+    g_list_free (ids);
 }
 
-int backendSetWindow (guintptr window) {
-    gst_video_overlay_set_window_handle (GST_VIDEO_OVERLAY (pipeline), window);
-    return 0;
+static GstElement* subtitleOverlay (GstElement* playbin) {
+    GstElement* filter = NULL;
+    GstElement* overlay = NULL;
+
+    g_object_get (playbin, "video-filter", &filter, NULL);
+    if (filter) {
+        overlay = gst_bin_get_by_name (GST_BIN (filter), "subtitles");
+        gst_object_unref (filter);
+    }
+    return overlay;
 }
 
-int backendPlay (const gchar* filename) {
-    GstBus* bus;
+/* Tells the subtitle overlay which of the text streams playbin3 decodes go
+ * at the bottom and which at the top */
+static void updateSubtitleStreams (BackendPlayer* player) {
+    GstStreamCollection* collection = player->streams.collection;
+    const gchar* secondary = player->chosen[BACKEND_SLOT_SECONDARY_SUBTITLE];
+    const gchar* primary = player->chosen[BACKEND_SLOT_SUBTITLE];
+    GstElement* overlay;
 
-    customData.duration = GST_CLOCK_TIME_NONE;
-    pipeline = gst_element_factory_make ("playbin", "playbin");
-    if (!pipeline) {
-        g_printerr ("Not all elements could be created.\n");
-        return -1;
+    if (!player->pipeline || player->mosaic) {
+        return;
+    }
+    if (!isActive (player, secondary) && !isExternal (player, secondary)) {
+        secondary = NULL;
     }
+    if (!isExternal (player, primary)) {
+        primary = NULL;
+    }
+    for (guint i = 0; collection && i < gst_stream_collection_get_size (collection) &&
+                      !primary; i++) {
+        GstStream* stream = gst_stream_collection_get_stream (collection, i);
+        const gchar* id = gst_stream_get_stream_id (stream);
 
-    g_object_set (pipeline, "uri", filename, NULL);
-    g_signal_connect (pipeline, "pad-added", G_CALLBACK (padAdded_cb), NULL);
+        if ((gst_stream_get_stream_type (stream) & GST_STREAM_TYPE_TEXT) &&
+            isActive (player, id) && g_strcmp0 (id, secondary) != 0) {
+            primary = id;
+        }
+    }
+    overlay = subtitleOverlay (player->pipeline);
+    if (overlay) {
+        subtitleOverlaySetFile (overlay, player->subtitleFile, player->subtitleFileId);
+        subtitleOverlaySetStreams (overlay, primary, secondary);
+        gst_object_unref (overlay);
+    }
+}
 
-    gst_util_set_object_arg ((GObject *) pipeline, "flags",
-            "soft-colorbalance+soft-volume+vis+text+audio+video");
+/* Takes over the collection; once it is known, what the user picked for the
+ * previous file is asked for again, where this one has it */
+static void takeCollection (BackendPlayer* player, GstStreamCollection* collection) {
+    gboolean picked = FALSE;
 
-    bus = gst_element_get_bus (pipeline);
-    gst_bus_add_signal_watch (bus);
-    g_signal_connect (bus, "message::error", (GCallback) error_cb, &customData);
-    g_signal_connect (bus, "message::eos", (GCallback) eos_cb, &customData);
-    g_signal_connect (bus, "message::state-changed", (GCallback) stateChanged_cb, &customData);
-    gst_object_unref (bus);
+    if (player->streams.collection) {
+        gst_object_unref (player->streams.collection);
+    }
+    player->streams.collection = collection;
+    for (guint slot = 0; slot < TRACK_SLOTS; slot++) {
+        if (player->chosen[slot] && !findStream (collection, player->chosen[slot]) &&
+            !isExternal (player, player->chosen[slot])) {
+            g_clear_pointer (&player->chosen[slot], g_free);
+            player->picked[slot] = FALSE;
+        }
+        picked |= player->picked[slot];
+    }
+    if (picked) {
+        selectStreams (player);
+    }
+    updateSubtitleStreams (player);
+    player->tracksChanged = TRUE;
+    emitEvent (player, BACKEND_EVENT_TRACKS, gst_stream_collection_get_size (collection));
+}
 
-    customData.ret = gst_element_set_state (pipeline, GST_STATE_PLAYING);
-    if (customData.ret == GST_STATE_CHANGE_FAILURE) {
-        g_printerr ("Unable to set the pipeline to the playing state.\n");
-        gst_object_unref (pipeline);
-        return -1;
+static void streamCollection_cb (GstBus* bus, GstMessage* msg, BackendPlayer* player) {
+    UNUSED (bus);
+
+    GstStreamCollection* collection = NULL;
+
+    gst_message_parse_stream_collection (msg, &collection);
+    if (collection) {
+        takeCollection (player, collection);
     }
-    return 0;
 }
 
-void backendChangeUri (const gchar* filename) {
-    backendStop();
-    g_object_set (pipeline, "uri", filename, NULL);
-    backendResume();
+static void streamsSelected_cb (GstBus* bus, GstMessage* msg, BackendPlayer* player) {
+    UNUSED (bus);
+
+    g_strfreev (player->streams.active);
+    player->streams.active = selectedStreamIds (msg);
+    updateSubtitleStreams (player);
+    player->tracksChanged = TRUE;
+    emitEvent (player, BACKEND_EVENT_TRACKS, g_strv_length (player->streams.active));
 }
 
-gdouble backendQueryDuration() {
-    gboolean result;
+static void selectTrack_cb (BackendPlayer* player, Command* command) {
+    BackendTrackSlot slot = (BackendTrackSlot) command->value;
 
-    result = gst_element_query_duration (pipeline, GST_FORMAT_TIME, &customData.duration);
-    if (!result) {
-        g_printerr ("Could not query current duration.\n");
-        return GST_CLOCK_TIME_NONE;
+    if (slot <= BACKEND_SLOT_NONE || slot >= TRACK_SLOTS) {
+        return;
     }
-    return (gdouble) customData.duration / GST_SECOND;
+    player->picked[slot] = TRUE;
+    g_free (player->chosen[slot]);
+    player->chosen[slot] = command->data;
+    command->data = NULL;
+    selectStreams (player);
+    updateSubtitleStreams (player);
+    player->tracksChanged = TRUE;
+    emitEvent (player, BACKEND_EVENT_TRACKS, player->streams.collection
+            ? gst_stream_collection_get_size (player->streams.collection) : 0);
 }
 
-gboolean backendQueryPosition (gdouble* current) {
-    gboolean res;
-    gint64 cur;
-    res = gst_element_query_position (pipeline, GST_FORMAT_TIME, &cur);
-    *current = (gdouble) cur / GST_SECOND;
-    g_print ("Position %" GST_TIME_FORMAT " / %" GST_TIME_FORMAT "\r\n",
-             GST_TIME_ARGS (cur), GST_TIME_ARGS (customData.duration));
-    return res;
+/* Plays the track with the given stream id in the slot. NULL turns subtitles
+ * off and puts the first track back for video and audio. */
+void backendSelectTrack (BackendPlayer* player, BackendTrackSlot slot, const gchar* id) {
+    Command* command = newCommand (selectTrack_cb);
+
+    command->value = slot;
+    command->data = g_strdup (id);
+    command->freeData = g_free;
+    pushCommand (player, command);
 }
 
-void backendGetDuration (gchar* str) {
-    gdouble duration = backendQueryDuration();
-    duration *= GST_SECOND;
+static void attachSubtitles_cb (BackendPlayer* player, Command* command) {
+    guint slot;
+
+    for (slot = BACKEND_SLOT_SUBTITLE; slot < TRACK_SLOTS; slot++) {
+        if (isExternal (player, player->chosen[slot])) {
+            g_clear_pointer (&player->chosen[slot], g_free);
+        }
+    }
+    subtitleFileUnref (player->subtitleFile);
+    g_free (player->subtitleFileId);
+    player->subtitleFile = command->data;
+    command->data = NULL;
+    player->subtitleFileId = g_strdup_printf ("external:%s",
+            subtitleFileGetPath (player->subtitleFile));
 
-    g_sprintf (str, "%u:%02u:%02u", GST_TIME_ARGS (duration));
+    /* Shown at once, in place of the primary track */
+    player->picked[BACKEND_SLOT_SUBTITLE] = TRUE;
+    g_free (player->chosen[BACKEND_SLOT_SUBTITLE]);
+    player->chosen[BACKEND_SLOT_SUBTITLE] = g_strdup (player->subtitleFileId);
+    selectStreams (player);
+    updateSubtitleStreams (player);
+    player->tracksChanged = TRUE;
+    emitEvent (player, BACKEND_EVENT_TRACKS, subtitleFileGetCount (player->subtitleFile));
 }
 
-void backendGetPosition (gchar* str) {
-    gdouble position;
+/* Attaches a SubRip, SubStation Alpha or WebVTT file to the current file as a
+ * subtitle track of its own, and shows it as the primary one. The file is
+ * read and indexed before returning, so that a bad one is reported here; it
+ * is dropped once another file is opened. */
+gboolean backendAttachSubtitles (BackendPlayer* player, const gchar* path, GError** error) {
+    SubtitleFile* file = subtitleFileLoad (path, error);
+    Command* command;
 
-    if (!backendQueryPosition (&position)) {
-        g_sprintf (str, "-:--:--");
+    if (!file) {
+        return FALSE;
+    }
+    command = newCommand (attachSubtitles_cb);
+    command->data = file;
+    command->freeData = (GDestroyNotify) subtitleFileUnref;
+    pushCommand (player, command);
+    return TRUE;
+}
+
+/* Returns the titles of the audio tracks, "" where there is none, as a NULL
+ * terminated array. Free with g_strfreev(). */
+gchar** backendGetTitleAudioStreams (BackendPlayer* player) {
+    guint count;
+    BackendTrack* tracks = backendGetTracks (player, &count);
+    gchar** titles = g_new0 (gchar*, count + 1);
+    guint n = 0;
+
+    for (guint i = 0; i < count; i++) {
+        if (tracks[i].type == BACKEND_TRACK_AUDIO) {
+            titles[n++] = g_strdup (tracks[i].title ? tracks[i].title : "");
+        }
+    }
+    backendTracksFree (tracks, count);
+    return titles;
+}
+
+gint backendGetAmountOfAudioStreams (BackendPlayer* player) {
+    guint count;
+    BackendTrack* tracks = backendGetTracks (player, &count);
+    gint n = 0;
+
+    for (guint i = 0; i < count; i++) {
+        n += tracks[i].type == BACKEND_TRACK_AUDIO;
+    }
+    backendTracksFree (tracks, count);
+    return n;
+}
+
+/* Returns a human readable description of the streams in the current file.
+ * Free with g_free(). */
+gchar* backendGetInformationAboutStreams (BackendPlayer* player) {
+    static const gchar* headings[] = { "video stream", "audio stream", "subtitle stream" };
+    guint numbers[3] = { 0, 0, 0 };
+    BackendTrack* tracks;
+    guint count;
+    GString* info;
+    gchar* str;
+
+    g_mutex_lock (&player->viewLock);
+    if (player->view.mosaic) {
+        str = g_strdup (player->view.mosaicInfo);
+        g_mutex_unlock (&player->viewLock);
+        return str;
+    }
+    g_mutex_unlock (&player->viewLock);
+
+    tracks = backendGetTracks (player, &count);
+    info = g_string_new (NULL);
+    for (guint i = 0; i < count; i++) {
+        BackendTrack* track = &tracks[i];
+
+        g_string_append_printf (info, "%s%s %u:\n", info->len ? "\n" : "",
+                headings[track->type], numbers[track->type]++);
+        if (track->type != BACKEND_TRACK_SUBTITLE || track->codec) {
+            g_string_append_printf (info, "  codec: %s\n", track->codec ? track->codec : "unknown");
+        }
+        if (track->language) {
+            g_string_append_printf (info, "  language: %s\n", track->language);
+        }
+        if (track->title) {
+            g_string_append_printf (info, "  title: %s\n", track->title);
+        }
+        if (track->bitrate) {
+            g_string_append_printf (info, "  bitrate: %u\n", track->bitrate);
+        }
+    }
+    backendTracksFree (tracks, count);
+    return g_string_free (info, FALSE);
+}
+
+/* QoS is posted by video sinks for frames they drop for being late, and by
+ * decoders for frames they skip to catch up. Audio sinks count samples and
+ * are left out. */
+static void qos_cb (GstBus* bus, GstMessage* msg, BackendPlayer* player) {
+    UNUSED (bus);
+
+    GstFormat format;
+    guint64 processed, dropped;
+    gint64 jitter;
+    gdouble proportion;
+    gint quality;
+
+    gst_message_parse_qos_stats (msg, &format, &processed, &dropped);
+    if (format != GST_FORMAT_BUFFERS) {
         return;
     }
+    gst_message_parse_qos_values (msg, &jitter, &proportion, &quality);
 
-    g_sprintf (str, "%u:%02u:%02u", GST_TIME_ARGS (position * GST_SECOND));
+    if (GST_OBJECT_FLAG_IS_SET (GST_MESSAGE_SRC (msg), GST_ELEMENT_FLAG_SINK)) {
+        player->stats.dropped = dropped;
+        player->stats.jitter = (gdouble) jitter / GST_SECOND;
+        player->stats.proportion = proportion;
+    } else {
+        player->stats.decoderDropped = dropped;
+    }
+    player->stats.qosMessages++;
 }
 
-gboolean backendDurationIsValid() {
-    return GST_CLOCK_TIME_IS_VALID (customData.duration);
+static void updateLatency (BackendPlayer* player) {
+    GstQuery* query = gst_query_new_latency();
+    GstClockTime min, max;
+    gboolean live;
+
+    if (gst_element_query (player->pipeline, query)) {
+        gst_query_parse_latency (query, &live, &min, &max);
+        player->stats.latency = (gdouble) min / GST_SECOND;
+    }
+    gst_query_unref (query);
 }
 
-gboolean backendIsPausedOrPlaying() {
-    if (customData.state < GST_STATE_PAUSED) {
-        return FALSE;
+static void latency_cb (GstBus* bus, GstMessage* msg, BackendPlayer* player) {
+    UNUSED (bus);
+    UNUSED (msg);
+
+    gst_bin_recalculate_latency (GST_BIN (player->pipeline));
+    updateLatency (player);
+}
+
+static void buffering_cb (GstBus* bus, GstMessage* msg, BackendPlayer* player) {
+    UNUSED (bus);
+
+    GstBufferingMode mode;
+    gint64 left;
+
+    gst_message_parse_buffering (msg, &player->stats.buffering);
+    gst_message_parse_buffering_stats (msg, &mode, &player->stats.inputRate, NULL, &left);
+    player->stats.bufferingLeft = (gint) left;
+}
+
+static void copyCapsString (const GstStructure* structure, const gchar* field,
+                            gchar* dest, gsize size) {
+    const gchar* value = gst_structure_get_string (structure, field);
+
+    g_strlcpy (dest, value ? value : "", size);
+}
+
+static gint compareAudioSink (const GValue* item, gpointer data) {
+    UNUSED (data);
+
+    GstElement* element = g_value_get_object (item);
+    GstElementFactory* factory = gst_element_get_factory (element);
+    const gchar* klass = factory
+            ? gst_element_factory_get_metadata (factory, GST_ELEMENT_METADATA_KLASS) : NULL;
+
+    return GST_OBJECT_FLAG_IS_SET (element, GST_ELEMENT_FLAG_SINK) && klass &&
+           strstr (klass, "Sink") && strstr (klass, "Audio") ? 0 : 1;
+}
+
+static GstCaps* sinkCaps (GstElement* element) {
+    GstPad* pad = gst_element_get_static_pad (element, "sink");
+    GstCaps* caps = NULL;
+
+    if (pad) {
+        caps = gst_pad_get_current_caps (pad);
+        gst_object_unref (pad);
     }
-    return TRUE;
+    return caps;
 }
 
-gboolean backendIsPlaying() {
-    return customData.state == GST_STATE_PLAYING;
+/* The negotiated caps of the current streams: video as the decoder put it
+ * out, where the video filter takes it, and audio at the sink */
+static void updateStreamCaps (GstElement* playbin, BackendStats* stats) {
+    GstElement* filter = gst_bin_get_by_name (GST_BIN (playbin), "videofilter");
+    GstIterator* it = gst_bin_iterate_recurse (GST_BIN (playbin));
+    GValue item = G_VALUE_INIT;
+    GstCaps* caps = NULL;
+    const GstStructure* structure;
+    gint n, d;
+
+    if (filter) {
+        caps = sinkCaps (filter);
+        gst_object_unref (filter);
+    }
+    if (caps && gst_caps_get_size (caps) > 0) {
+        structure = gst_caps_get_structure (caps, 0);
+        gst_structure_get_int (structure, "width", &stats->width);
+        gst_structure_get_int (structure, "height", &stats->height);
+        if (gst_structure_get_fraction (structure, "framerate", &n, &d) && d > 0) {
+            stats->framerate = (gdouble) n / d;
+        }
+        copyCapsString (structure, "format", stats->videoFormat, sizeof (stats->videoFormat));
+    }
+    g_clear_pointer (&caps, gst_caps_unref);
+
+    if (gst_iterator_find_custom (it, (GCompareFunc) compareAudioSink, &item, NULL)) {
+        caps = sinkCaps (g_value_get_object (&item));
+        g_value_unset (&item);
+    }
+    gst_iterator_free (it);
+    if (caps && gst_caps_get_size (caps) > 0) {
+        structure = gst_caps_get_structure (caps, 0);
+        gst_structure_get_int (structure, "rate", &stats->audioRate);
+        gst_structure_get_int (structure, "channels", &stats->audioChannels);
+        copyCapsString (structure, "format", stats->audioFormat, sizeof (stats->audioFormat));
+    }
+    g_clear_pointer (&caps, gst_caps_unref);
 }
 
-void backendStop() {
+/* Copies out the playback statistics. Counters are kept up to date from the
+ * bus and published with the events; only the caps are looked up here. */
+void backendGetStats (BackendPlayer* player, BackendStats* out) {
+    GstElement* pipeline = viewPipeline (player);
+
+    g_mutex_lock (&player->viewLock);
+    *out = player->view.stats;
+    g_mutex_unlock (&player->viewLock);
+
     if (pipeline) {
-        gst_element_set_state (pipeline, GST_STATE_READY);
+        updateStreamCaps (pipeline, out);
+        gst_object_unref (pipeline);
+    }
+    out->frames = (guint) g_atomic_int_get (&player->framesPassed);
+}
+
+gchar* backendFormatStats (const BackendStats* s) {
+    return g_strdup_printf (
+            "video   %dx%d %s %.3f fps\n"
+            "audio   %s %d Hz %d ch\n"
+            "frames  %" G_GUINT64_FORMAT " decoded, %" G_GUINT64_FORMAT " dropped late, %"
+            G_GUINT64_FORMAT " skipped by decoder\n"
+            "qos     jitter %+.1f ms, proportion %.2f (%u reports)\n"
+            "latency %.1f ms\n"
+            "buffer  %d%%, %d ms left, in %d kB/s",
+            s->width, s->height, s->videoFormat, s->framerate,
+            s->audioFormat, s->audioRate, s->audioChannels,
+            s->frames, s->dropped, s->decoderDropped,
+            s->jitter * 1000, s->proportion, s->qosMessages,
+            s->latency * 1000,
+            s->buffering, s->bufferingLeft, s->inputRate / 1024);
+}
+
+static gboolean statsOverlay_cb (BackendPlayer* player) {
+    GstElement* filter = NULL;
+    GstElement* overlay = NULL;
+    BackendStats current;
+    gchar* text;
+
+    if (!player->pipeline || player->mosaic) {
+        return G_SOURCE_CONTINUE;
     }
+    g_object_get (player->pipeline, "video-filter", &filter, NULL);
+    if (filter && GST_IS_BIN (filter)) {
+        overlay = gst_bin_get_by_name (GST_BIN (filter), "stats");
+    }
+    if (overlay) {
+        current = player->stats;
+        updateStreamCaps (player->pipeline, &current);
+        current.frames = (guint) g_atomic_int_get (&player->framesPassed);
+        text = backendFormatStats (&current);
+        g_object_set (overlay, "text", text, "silent", !player->statsOverlay, NULL);
+        g_free (text);
+        gst_object_unref (overlay);
+    }
+    if (filter) {
+        gst_object_unref (filter);
+    }
+    return player->statsOverlay ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
 }
 
-void backendResume() {
-    gst_element_set_state (pipeline, GST_STATE_PLAYING);
+static void setStatsOverlay_cb (BackendPlayer* player, Command* command) {
+    player->statsOverlay = command->value > 0;
+    if (player->statsSourceId) {
+        removeSource (player, &player->statsSourceId);
+    }
+    /* Once more to apply the state, then twice a second while shown */
+    statsOverlay_cb (player);
+    if (player->statsOverlay) {
+        player->statsSourceId = addTimeout (player, 500, (GSourceFunc) statsOverlay_cb);
+    }
 }
 
-void backendPause() {
-    gst_element_set_state (pipeline, GST_STATE_PAUSED);
+static void setVideoVisible_cb (BackendPlayer* player, Command* command) {
+    gboolean hidden = command->value <= 0;
+    gint64 position;
+
+    if (hidden == g_atomic_int_get (&player->videoHidden)) {
+        return;
+    }
+    g_atomic_int_set (&player->videoHidden, hidden);
+    if (!player->pipeline || player->mosaic) {
+        return;
+    }
+    gst_util_set_object_arg (G_OBJECT (player->pipeline), "flags", playFlags (player));
+    /* The standby pipeline was prerolled for the other case */
+    restartStandby (player);
+
+    /* The decoders have missed everything since they were starved: start them
+     * again from a keyframe, up to where the audio is */
+    if (!hidden && player->state >= GST_STATE_PAUSED &&
+        gst_element_query_position (player->pipeline, GST_FORMAT_TIME, &position)) {
+        scheduleSeek (player, (gdouble) position / GST_SECOND, TRUE);
+    }
 }
 
-void backendSeek (gdouble value) {
-    gst_element_seek_simple (pipeline, GST_FORMAT_TIME,
-            GST_SEEK_FLAG_FLUSH, (gint64)(value * GST_SECOND));
+/* Tells the player whether any surface shows the video. While none does, the
+ * video is no longer decoded nor rendered and playback carries on with the
+ * audio alone; once shown again, the picture resumes at the current position. */
+void backendSetVideoVisible (BackendPlayer* player, gboolean visible) {
+    Command* command = newCommand (setVideoVisible_cb);
+
+    command->value = visible;
+    pushCommand (player, command);
 }
 
-void backendSetVolume (gdouble volume) {
-    g_object_set(pipeline, "volume", volume, NULL);
+/* Shows or hides the statistics on top of the video */
+void backendSetStatsOverlay (BackendPlayer* player, gboolean enabled) {
+    Command* command = newCommand (setStatsOverlay_cb);
+
+    command->value = enabled;
+    pushCommand (player, command);
 }
 
-gdouble backendGetVolume() {
-    gdouble value = 0;
-    g_object_get(pipeline, "volume", &value, NULL);
-    return value;
+/* The colour balance lives in the player and is applied to every pipeline it
+ * opens. The channels are looked up once per pipeline, and only those whose
+ * value changed are set: with soft colour balance each set rebuilds
+ * videobalance's tables. */
+
+static void resetBalanceChannels (BackendPlayer* player) {
+    for (guint c = 0; c < BALANCE_CHANNELS; c++) {
+        g_clear_object (&player->balanceChannels[c]);
+    }
+    player->balanceOwner = NULL;
 }
 
-gchar** backendGetTitleAudioStreams() {
-    GstTagList* tags = NULL;
-    gint n_audio;
-    g_object_get (pipeline, "n-audio", &n_audio, NULL);
-    gchar** audioTitlesArray = (gchar**) g_malloc(sizeof(gchar) * n_audio);
-
-    for (int i = 0; i < n_audio; i++) {
-        g_signal_emit_by_name (pipeline, "get-audio-tags", i, &tags);
-        gst_tag_list_get_string (tags, GST_TAG_TITLE, &audioTitlesArray[i]);
-    }
-    return audioTitlesArray;
-}
-
-gint backendGetAmountOfAudioStreams() {
-    gint n_audio;
-    g_object_get (pipeline, "n-audio", &n_audio, NULL);
-    return n_audio;
-}
-
-void backendGetInformationAboutStreams(GtkTextBuffer *textBuffer) {
-    gint i;
-    GstTagList* tags;
-    gchar *str, *total_str;
-    guint rate;
-    gint n_video, n_audio, n_text;
-
-    /* Read some properties */
-    g_object_get (pipeline, "n-video", &n_video, NULL);
-    g_object_get (pipeline, "n-audio", &n_audio, NULL);
-    g_object_get (pipeline, "n-text", &n_text, NULL);
-
-    for (i = 0; i < n_video; i++) {
-        tags = NULL;
-        /* Retrieve the stream's video tags */
-        g_signal_emit_by_name (pipeline, "get-video-tags", i, &tags);
-        if (tags) {
-            total_str = g_strdup_printf ("video stream %d:\n", i);
-            gtk_text_buffer_insert_at_cursor (textBuffer, total_str, -1);
-            g_free (total_str);
-            gst_tag_list_get_string (tags, GST_TAG_VIDEO_CODEC, &str);
-            total_str = g_strdup_printf ("  codec: %s\n", str ? str : "unknown");
-            gtk_text_buffer_insert_at_cursor (textBuffer, total_str, -1);
-            g_free (total_str);
-            g_free (str);
-            gst_tag_list_free (tags);
-        }
-    }
-
-    for (i = 0; i < n_audio; i++) {
-        tags = NULL;
-        /* Retrieve the stream's audio tags */
-        g_signal_emit_by_name (pipeline, "get-audio-tags", i, &tags);
-        if (tags) {
-            total_str = g_strdup_printf ("\naudio stream %d:\n", i);
-            gtk_text_buffer_insert_at_cursor (textBuffer, total_str, -1);
-            g_free (total_str);
-            if (gst_tag_list_get_string (tags, GST_TAG_AUDIO_CODEC, &str)) {
-                total_str = g_strdup_printf ("  codec: %s\n", str);
-                gtk_text_buffer_insert_at_cursor (textBuffer, total_str, -1);
-                g_free (total_str);
-                g_free (str);
-            }
-            if (gst_tag_list_get_string (tags, GST_TAG_LANGUAGE_CODE, &str)) {
-                total_str = g_strdup_printf ("  language: %s\n", str);
-                gtk_text_buffer_insert_at_cursor (textBuffer, total_str, -1);
-                g_free (total_str);
-                g_free (str);
-            }
-            if (gst_tag_list_get_uint (tags, GST_TAG_BITRATE, &rate)) {
-                total_str = g_strdup_printf ("  bitrate: %d\n", rate);
-                gtk_text_buffer_insert_at_cursor (textBuffer, total_str, -1);
-                g_free (total_str);
-            }
-            gst_tag_list_free (tags);
-        }
-    }
-
-    for (i = 0; i < n_text; i++) {
-        tags = NULL;
-        /* Retrieve the stream's subtitle tags */
-        g_signal_emit_by_name (pipeline, "get-text-tags", i, &tags);
-        if (tags) {
-            total_str = g_strdup_printf ("\nsubtitle stream %d:\n", i);
-            gtk_text_buffer_insert_at_cursor (textBuffer, total_str, -1);
-            g_free (total_str);
-            if (gst_tag_list_get_string (tags, GST_TAG_LANGUAGE_CODE, &str)) {
-                total_str = g_strdup_printf ("  language: %s\n", str);
-                gtk_text_buffer_insert_at_cursor (textBuffer, total_str, -1);
-                g_free (total_str);
-                g_free (str);
+static gboolean resolveBalanceChannels (BackendPlayer* player) {
+    GstColorBalance* colorBalance;
+    const GList* l;
+
+    if (player->balanceOwner && player->balanceOwner == player->pipeline) {
+        return TRUE;
+    }
+    resetBalanceChannels (player);
+    if (!player->pipeline || !GST_IS_COLOR_BALANCE (player->pipeline)) {
+        return FALSE;
+    }
+    colorBalance = GST_COLOR_BALANCE (player->pipeline);
+    for (l = gst_color_balance_list_channels (colorBalance); l != NULL; l = l->next) {
+        GstColorBalanceChannel* channel = (GstColorBalanceChannel*) l->data;
+
+        for (guint c = 0; c < BALANCE_CHANNELS; c++) {
+            if (!player->balanceChannels[c] && g_strrstr (channel->label, balanceLabels[c])) {
+                player->balanceChannels[c] = g_object_ref (channel);
+                player->balanceApplied[c] = gst_color_balance_get_value (colorBalance, channel);
             }
-            gst_tag_list_free (tags);
         }
     }
+    player->balanceOwner = player->pipeline;
+    return TRUE;
 }
 
-void backendGetColorBalance (gchar* channelName, gdouble* value) {
-    GstColorBalance* colorBalance = GST_COLOR_BALANCE(pipeline);
-    GstColorBalanceChannel* channel = NULL;
-    const GList* channels, *l;
+static void applyColorBalance (BackendPlayer* player) {
+    BackendColorBalance balance;
+    gdouble values[BALANCE_CHANNELS];
 
-    channels = gst_color_balance_list_channels (colorBalance);
-    for (l = channels; l != NULL; l = l->next) {
-        GstColorBalanceChannel* tmp = (GstColorBalanceChannel*) l->data;
+    g_mutex_lock (&player->balanceLock);
+    balance = player->balance;
+    player->balanceQueued = FALSE;
+    g_mutex_unlock (&player->balanceLock);
 
-        if (g_strrstr (tmp->label, channelName)) {
-            channel = tmp;
-            break;
-        }
+    if (!resolveBalanceChannels (player)) {
+        return;
     }
+    values[BALANCE_CONTRAST] = balance.contrast;
+    values[BALANCE_BRIGHTNESS] = balance.brightness;
+    values[BALANCE_HUE] = balance.hue;
+    values[BALANCE_SATURATION] = balance.saturation;
+    for (guint c = 0; c < BALANCE_CHANNELS; c++) {
+        gint value = (gint) values[c];
 
-    if (!channel) {
-        return;
+        if (player->balanceChannels[c] && player->balanceApplied[c] != value) {
+            gst_color_balance_set_value (GST_COLOR_BALANCE (player->pipeline),
+                    player->balanceChannels[c], value);
+            player->balanceApplied[c] = value;
+        }
     }
-    *value = gst_color_balance_get_value (colorBalance, channel);
 }
 
-void backendSetColorBalance (gchar* channelName, const gdouble value) {
-    GstColorBalance* colorBalance = GST_COLOR_BALANCE (pipeline);
-    GstColorBalanceChannel* channel = NULL;
-    const GList* channels, *l;
+static void applyColorBalance_cb (BackendPlayer* player, Command* command) {
+    UNUSED (command);
+
+    applyColorBalance (player);
+}
+
+/* Called with the balance lock held, after changing the values. However
+ * fast they come, one update is queued at a time and applies the latest. */
+static gboolean queueColorBalance (BackendPlayer* player) {
+    gboolean queued = player->balanceQueued;
 
-    channels = gst_color_balance_list_channels (colorBalance);
-    for (l = channels; l != NULL; l = l->next) {
-        GstColorBalanceChannel* tmp = (GstColorBalanceChannel*) l->data;
+    player->balanceQueued = TRUE;
+    return !queued;
+}
 
-        if (g_strrstr (tmp->label, channelName)) {
-            channel = tmp;
-            break;
+void backendGetColorBalanceValues (BackendPlayer* player, BackendColorBalance* balance) {
+    g_mutex_lock (&player->balanceLock);
+    *balance = player->balance;
+    g_mutex_unlock (&player->balanceLock);
+}
+
+/* Sets all four adjustments in one update */
+void backendSetColorBalanceValues (BackendPlayer* player, const BackendColorBalance* balance) {
+    gboolean push;
+
+    g_mutex_lock (&player->balanceLock);
+    player->balance = *balance;
+    push = queueColorBalance (player);
+    g_mutex_unlock (&player->balanceLock);
+    if (push) {
+        pushCommand (player, newCommand (applyColorBalance_cb));
+    }
+}
+
+static gdouble* balanceValue (BackendColorBalance* balance, const gchar* channelName) {
+    gdouble* values[BALANCE_CHANNELS] = {
+        &balance->contrast, &balance->brightness, &balance->hue, &balance->saturation
+    };
+
+    for (guint c = 0; c < BALANCE_CHANNELS; c++) {
+        if (g_strrstr (balanceLabels[c], channelName)) {
+            return values[c];
         }
     }
+    return NULL;
+}
+
+/* One channel by name: "CONTRAST", "BRIGHTNESS", "HUE" or "SATURATION" */
+void backendGetColorBalance (BackendPlayer* player, gchar* channelName, gdouble* value) {
+    gdouble* field;
+
+    g_mutex_lock (&player->balanceLock);
+    field = balanceValue (&player->balance, channelName);
+    if (field) {
+        *value = *field;
+    }
+    g_mutex_unlock (&player->balanceLock);
+}
 
-    if(!channel) {
-        return;
+void backendSetColorBalance (BackendPlayer* player, gchar* channelName, const gdouble value) {
+    gdouble* field;
+    gboolean push = FALSE;
+
+    g_mutex_lock (&player->balanceLock);
+    field = balanceValue (&player->balance, channelName);
+    if (field) {
+        *field = value;
+        push = queueColorBalance (player);
+    }
+    g_mutex_unlock (&player->balanceLock);
+    if (push) {
+        pushCommand (player, newCommand (applyColorBalance_cb));
+    }
+}
+
+static void closePlayer (BackendPlayer* player) {
+    discardStandby (player);
+    if (player->playlist) {
+        g_ptr_array_unref (player->playlist);
+        player->playlist = NULL;
     }
-    gst_color_balance_set_value (colorBalance, channel, (gint) value);
+    player->playlistIndex = 0;
+    releasePipeline (player);
+}
+
+static void closePlayer_cb (BackendPlayer* player, Command* command) {
+    UNUSED (command);
+
+    closePlayer (player);
+}
+
+/* Stops playback and drops the playlist */
+void backendDeInit (BackendPlayer* player) {
+    pushCommand (player, newCommand (closePlayer_cb));
 }
 
-void backendDeInit() {
-    gst_element_set_state (pipeline, GST_STATE_NULL);
-    gst_object_unref (pipeline);
+static void releasePipeline (BackendPlayer* player) {
+    GstBus* bus;
+
+    if (!player->pipeline) {
+        return;
+    }
+    saveResumePoint (player);
+    showCachedFrame (player, NULL);
+    if (player->positionSourceId) {
+        removeSource (player, &player->positionSourceId);
+    }
+    gst_element_set_state (player->pipeline, GST_STATE_NULL);
+    player->state = GST_STATE_NULL;
+    gst_object_replace ((GstObject**) &player->clock, NULL);
+
+    bus = gst_element_get_bus (player->pipeline);
+    gst_bus_remove_signal_watch (bus);
+    gst_object_unref (bus);
+    resetBalanceChannels (player);
+    gst_object_unref (player->pipeline);
+    player->pipeline = NULL;
+    g_clear_pointer (&player->mosaic, mosaicFree);
+
+    g_mutex_lock (&player->frameRing.lock);
+    player->frameRing.owner = NULL;
+    g_mutex_unlock (&player->frameRing.lock);
+    clearFrameRing (&player->frameRing);
 }
 
-static void eos_cb (GstBus* bus, GstMessage* msg, CustomData* data) {
+static void eos_cb (GstBus* bus, GstMessage* msg, BackendPlayer* player) {
     UNUSED (bus);
     UNUSED (msg);
-    UNUSED (data);
 
     g_print ("End-Of-Stream reached.\n");
-    gst_element_set_state (pipeline, GST_STATE_READY);
+    if (!player->mosaic && resumeStoreIsOpen()) {
+        /* Seen to the end, so the next time starts from the beginning */
+        gchar* uri = NULL;
+
+        g_object_get (player->pipeline, "current-uri", &uri, NULL);
+        if (uri) {
+            resumeStoreSave (uri, -1);
+            g_free (uri);
+        }
+    }
+    if (player->playlist && player->playlistIndex + 1 < player->playlist->len) {
+        /* Not from within the bus handler, the swap removes its watch */
+        player->advanceSourceId = addIdle (player, (GSourceFunc) playlistAdvance_cb);
+        return;
+    }
+    gst_element_set_state (player->pipeline, GST_STATE_READY);
+    emitEvent (player, BACKEND_EVENT_EOS, 0);
 }
 
 /* This function is called when an error message is posted on the bus */
-static void error_cb (GstBus* bus, GstMessage* msg, CustomData* data) {
+static void error_cb (GstBus* bus, GstMessage* msg, BackendPlayer* player) {
     UNUSED (bus);
-    UNUSED (data);
 
     GError* err;
     gchar* debug_info;
@@ -318,28 +3753,193 @@ static void error_cb (GstBus* bus, GstMessage* msg, CustomData* data) {
     g_clear_error (&err);
     g_free (debug_info);
 
+    if (player->mosaic && mosaicHandleError (player->mosaic, msg)) {
+        /* The feed is dropped; if it failed to open, so did the state change */
+        if (player->state < GST_STATE_PAUSED) {
+            gst_element_set_state (player->pipeline, GST_STATE_PLAYING);
+        }
+        return;
+    }
+
     /* Set the pipeline to READY (which stops playback) */
-    gst_element_set_state (pipeline, GST_STATE_READY);
+    gst_element_set_state (player->pipeline, GST_STATE_READY);
+    emitEvent (player, BACKEND_EVENT_ERROR, 0);
 }
 
 /* This function is called when the pipeline changes states. We use it to
  * keep track of the current state. */
-static void stateChanged_cb(GstBus* bus, GstMessage* msg, CustomData* data) {
+static void stateChanged_cb(GstBus* bus, GstMessage* msg, BackendPlayer* player) {
     UNUSED (bus);
 
     GstState old_state, new_state, pending_state;
     gst_message_parse_state_changed (msg, &old_state, &new_state, &pending_state);
-    if (GST_MESSAGE_SRC (msg) == GST_OBJECT (pipeline)) {
-        data->state = new_state;
+    if (GST_MESSAGE_SRC (msg) == GST_OBJECT (player->pipeline)) {
+        player->state = new_state;
         g_print ("State set to %s\n", gst_element_state_get_name (new_state));
+
+        if (new_state == GST_STATE_PLAYING) {
+            GstClock* clock = gst_element_get_clock (player->pipeline);
+
+            gst_object_replace ((GstObject**) &player->clock, (GstObject*) clock);
+            if (clock) {
+                gst_object_unref (clock);
+            }
+            recordSwitchLatency (player);
+            if (player->advanceStart != 0) {
+                g_mutex_lock (&player->nextUriLock);
+                player->advanceLatency = g_get_monotonic_time() - player->advanceStart;
+                g_mutex_unlock (&player->nextUriLock);
+                player->advanceStart = 0;
+            }
+            anchorPosition (player);
+            if (!player->positionSourceId) {
+                player->positionSourceId = addTimeout (player, player->refreshInterval,
+                        (GSourceFunc) positionTick_cb);
+            }
+            prepareStandby (player);
+        } else {
+            if (player->positionSourceId) {
+                removeSource (player, &player->positionSourceId);
+            }
+            gst_object_replace ((GstObject**) &player->clock, NULL);
+
+            if (new_state == GST_STATE_PAUSED) {
+                anchorPosition (player);
+                emitEvent (player, BACKEND_EVENT_POSITION,
+                        (gdouble) player->anchorPosition / GST_SECOND);
+            } else if (old_state >= GST_STATE_PAUSED) {
+                showCachedFrame (player, NULL);
+                player->seekInFlight = FALSE;
+                player->pendingSeek = -1;
+                player->anchorPosition = 0;
+                emitEvent (player, BACKEND_EVENT_POSITION, 0);
+            }
+        }
         if (old_state == GST_STATE_READY && new_state == GST_STATE_PAUSED) {
-            refreshUi();
+            updateDuration (player);
+        }
+        if ((old_state == GST_STATE_PLAYING) != (new_state == GST_STATE_PLAYING)) {
+            emitEvent (player, BACKEND_EVENT_STATE, new_state == GST_STATE_PLAYING);
+        }
+    }
+}
+
+/* This function is called from a streaming thread when playbin has read the
+ * whole current URI. Setting "uri" here makes the switch gapless. */
+static void aboutToFinish_cb (GstElement* playbin, BackendPlayer* player) {
+    gint64 position, duration;
+    gint64 remaining = 0;
+
+    g_mutex_lock (&player->nextUriLock);
+    if (!player->nextUri) {
+        g_mutex_unlock (&player->nextUriLock);
+        return;
+    }
+
+    /* The queued decoders still hold the tail of the current file, so the new
+     * stream is only due once that has played out */
+    if (gst_element_query_position (playbin, GST_FORMAT_TIME, &position) &&
+        gst_element_query_duration (playbin, GST_FORMAT_TIME, &duration) &&
+        duration > position) {
+        remaining = (duration - position) / GST_USECOND;
+    }
+    player->switchDue = g_get_monotonic_time() + remaining;
+
+    g_object_set (playbin, "uri", player->nextUri, NULL);
+    g_clear_pointer (&player->nextUri, g_free);
+    g_mutex_unlock (&player->nextUriLock);
+}
+
+/* Stream-start marks a switch within the pipeline; a swapped in standby
+ * pipeline has started its stream already and completes on PLAYING */
+static void recordSwitchLatency (BackendPlayer* player) {
+    g_mutex_lock (&player->nextUriLock);
+    if (player->switchDue != 0) {
+        player->switchLatency = MAX (0, g_get_monotonic_time() - player->switchDue);
+        player->switchDue = 0;
+    }
+    g_mutex_unlock (&player->nextUriLock);
+}
+
+/* This function is called when a new stream has started at the sinks, either
+ * after backendPlay()/backendChangeUri() or after a gapless switch */
+static void streamStart_cb (GstBus* bus, GstMessage* msg, BackendPlayer* player) {
+    UNUSED (bus);
+    UNUSED (msg);
+
+    recordSwitchLatency (player);
+
+    /* The new stream has its own duration and timeline */
+    player->duration = GST_CLOCK_TIME_NONE;
+    updateDuration (player);
+    anchorPosition (player);
+}
+
+static void durationChanged_cb (GstBus* bus, GstMessage* msg, BackendPlayer* player) {
+    UNUSED (bus);
+    UNUSED (msg);
+
+    player->duration = GST_CLOCK_TIME_NONE;
+    updateDuration (player);
+}
+
+/* Posted once a state change or a flushing seek has prerolled; the position
+ * is exact again at this point */
+static void asyncDone_cb (GstBus* bus, GstMessage* msg, BackendPlayer* player) {
+    UNUSED (bus);
+    UNUSED (msg);
+
+    player->seekInFlight = FALSE;
+    if (player->pendingSeek >= 0) {
+        gdouble target = player->pendingSeek;
+
+        player->pendingSeek = -1;
+        issueSeek (player, target, player->pendingAccurate);
+        if (player->seekInFlight) {
+            /* The position is reported once the superseding seek is done */
+            return;
+        }
+    }
+    if (GST_CLOCK_TIME_IS_VALID (player->frameRing.refillTarget) &&
+        !player->frameRing.refillStepping) {
+        stepThroughGop (player);
+        if (player->frameRing.refillStepping) {
+            return;
         }
     }
+    if (player->resumeAt >= 0) {
+        /* Prerolled from the start, unseen; now to where the file was left */
+        player->seekInFlight = resumeSeek (player->pipeline, player->resumeAt);
+        player->resumeAt = -1;
+        if (player->seekInFlight) {
+            return;
+        }
+    }
+    if (player->resumeState != GST_STATE_VOID_PENDING) {
+        finishResume (player);
+    }
+
+    if (!GST_CLOCK_TIME_IS_VALID (player->duration)) {
+        updateDuration (player);
+    }
+    updateLatency (player);
+    anchorPosition (player);
+    emitEvent (player, BACKEND_EVENT_POSITION, (gdouble) player->anchorPosition / GST_SECOND);
+}
+
+static void stepDone_cb (GstBus* bus, GstMessage* msg, BackendPlayer* player) {
+    UNUSED (bus);
+    UNUSED (msg);
+
+    if (player->frameRing.refillStepping) {
+        finishRefill (player);
+    }
+
+    anchorPosition (player);
+    emitEvent (player, BACKEND_EVENT_POSITION, (gdouble) player->anchorPosition / GST_SECOND);
 }
 
 static void padAdded_cb (GstElement* dec, GstPad* pad, gpointer data) {
-    UNUSED (dec);
     UNUSED (data);
 
     GstCaps* caps;
@@ -353,7 +3953,7 @@ static void padAdded_cb (GstElement* dec, GstPad* pad, gpointer data) {
     structure = gst_caps_get_structure (caps, 0);
     name = gst_structure_get_name (structure);
 
-    class = GST_ELEMENT_GET_CLASS (pipeline);
+    class = GST_ELEMENT_GET_CLASS (dec);
 
     if (g_str_has_prefix (name, "audio")) {
         template = gst_element_class_get_pad_template (class, "audio_sink");
@@ -368,7 +3968,7 @@ static void padAdded_cb (GstElement* dec, GstPad* pad, gpointer data) {
     if (template) {
         GstPad* sinkpad;
 
-        sinkpad = gst_element_request_pad (pipeline, template, NULL, NULL);
+        sinkpad = gst_element_request_pad (dec, template, NULL, NULL);
 
         if (!gst_pad_is_linked (sinkpad)) {
             gst_pad_link (pad, sinkpad);
@@ -376,4 +3976,5 @@ static void padAdded_cb (GstElement* dec, GstPad* pad, gpointer data) {
 
         gst_object_unref (sinkpad);
     }
+    gst_caps_unref (caps);
 }
\ No newline at end of file
@@ -1,23 +1,196 @@
 #pragma once
+#include <gst/gst.h>
+
+#ifndef UNUSED
+#define UNUSED(x) (void)(x)
+#endif
+
+typedef enum _BackendEvent {
+    BACKEND_EVENT_DURATION,     /* value: duration in seconds */
+    BACKEND_EVENT_POSITION,     /* value: position in seconds */
+    BACKEND_EVENT_STATE,        /* value: 1 when playing, 0 otherwise */
+    BACKEND_EVENT_EOS,
+    BACKEND_EVENT_ERROR,
+    BACKEND_EVENT_TRACK_CHANGED, /* value: playlist index of the new entry */
+    BACKEND_EVENT_FRAME,        /* value: position of the kept frame to paint, negative
+                                 * once the sink's own output is back */
+    BACKEND_EVENT_TRACKS        /* value: number of tracks; they or their selection changed */
+} BackendEvent;
+
+typedef enum _DecoderThreadType {
+    DECODER_THREADS_AUTO,
+    DECODER_THREADS_FRAME,      /* one frame per thread, adds a frame of latency each */
+    DECODER_THREADS_SLICE       /* threads share a frame, no added latency */
+} DecoderThreadType;
+
+/* Applied to decoders and queues as playbin plugs them; zero keeps the
+ * element's own default */
+typedef struct _DecoderConfig {
+    guint threads;
+    DecoderThreadType threadType;
+    guint queueBytes;           /* between demuxer and decoders */
+    guint64 queueTime;          /* nanoseconds, same queues */
+} DecoderConfig;
+
+/* How the tiles of a mosaic without the focus are decoded */
+typedef enum _MosaicDecode {
+    MOSAIC_DECODE_FULL,
+    MOSAIC_DECODE_REDUCED,      /* lower resolution and no non-reference frames, where
+                                 * the decoder supports it */
+    MOSAIC_DECODE_KEYFRAMES     /* keyframes only */
+} MosaicDecode;
+
+/* How a 3D LUT is sampled between its grid points */
+typedef enum _LutInterpolation {
+    LUT_INTERPOLATION_TETRAHEDRAL,  /* four points per pixel, the usual choice for grading */
+    LUT_INTERPOLATION_TRILINEAR     /* all eight corners of the cell */
+} LutInterpolation;
+
+/* What is shown while a file has no video */
+typedef enum _BackendVisualisation {
+    BACKEND_VISUALISATION_NONE,     /* nothing, and no video branch is built for it */
+    BACKEND_VISUALISATION_SPECTRUM, /* bars over log frequency */
+    BACKEND_VISUALISATION_SCOPE     /* the waveform */
+} BackendVisualisation;
+
+/* Picture adjustments, each from -1000 to 1000; 0 leaves the picture as is */
+typedef struct _BackendColorBalance {
+    gdouble contrast;
+    gdouble brightness;
+    gdouble hue;
+    gdouble saturation;
+} BackendColorBalance;
+
+typedef enum _BackendTrackType {
+    BACKEND_TRACK_VIDEO,
+    BACKEND_TRACK_AUDIO,
+    BACKEND_TRACK_SUBTITLE
+} BackendTrackType;
+
+/* Where a track plays; each slot takes one track at a time */
+typedef enum _BackendTrackSlot {
+    BACKEND_SLOT_NONE = -1,
+    BACKEND_SLOT_VIDEO,
+    BACKEND_SLOT_AUDIO,
+    BACKEND_SLOT_SUBTITLE,
+    BACKEND_SLOT_SECONDARY_SUBTITLE
+} BackendTrackSlot;
+
+/* A stream of the current file, as its stream collection describes it */
+typedef struct _BackendTrack {
+    BackendTrackType type;
+    BackendTrackSlot slot;      /* BACKEND_SLOT_NONE while it is not decoded */
+    gchar*  id;                 /* stream id, for backendSelectTrack() */
+    gchar*  title;              /* NULL where the file does not say */
+    gchar*  language;
+    gchar*  codec;
+    guint   bitrate;            /* bits per second, 0 if unknown */
+} BackendTrack;
+
+/* A kept frame for painting by the caller, native endian xRGB */
+typedef struct _BackendFrame {
+    gdouble position;
+    gint    width;
+    gint    height;
+    gint    stride;
+    GBytes* pixels;
+} BackendFrame;
+
+/* Playback statistics since the current file was opened */
+typedef struct _BackendStats {
+    guint64 frames;             /* decoded frames that reached the video sink chain */
+    guint64 dropped;            /* dropped by the video sink for being late */
+    guint64 decoderDropped;     /* skipped by decoders to catch up */
+    guint   qosMessages;
+    gdouble jitter;             /* seconds the last late frame missed its time by */
+    gdouble proportion;         /* rate upstream was last asked to run at */
+    gdouble latency;            /* pipeline latency, seconds */
+    gint    buffering;          /* percent, 100 unless a network source is buffering */
+    gint    bufferingLeft;      /* estimated ms until buffering completes */
+    gint    inputRate;          /* bytes per second into the buffer */
+    gint    width;
+    gint    height;
+    gdouble framerate;
+    gchar   videoFormat[16];
+    gint    audioRate;
+    gint    audioChannels;
+    gchar   audioFormat[16];
+} BackendStats;
+
+typedef void (*BackendEventFunc) (BackendEvent event, gdouble value, gpointer userData);
+
+/* Makes a new video or audio sink, called on the player's control thread */
+typedef GstElement* (*BackendSinkFunc) (gboolean video, gpointer userData);
+
+/* One playback pipeline with its own bus watch, playlist and state. Any number
+ * of players can share the process; gst_init() is done once by backendInit().
+ * Each player drives its pipeline from a control thread of its own: calls
+ * queue a command and return at once, getters read what the control thread
+ * last published, and events arrive on the creating thread's main context. */
+typedef struct _BackendPlayer BackendPlayer;
 
 void backendInit (int* argc, char*** argv);
-void backendDeInit();
-int  backendSetWindow (guintptr window);
-int  backendPlay (const gchar* filename);
-void backendPause();
-void backendStop();
-void backendResume();
-void backendChangeUri (const gchar* filename);
-void backendSeek (gdouble value);
-void backendSetVolume (gdouble volume);
-void backendGetInformationAboutStreams(GtkTextBuffer* textBuffer);
-void backendGetDuration (gchar* str);
-void backendGetPosition (gchar* str);
-void backendGetColorBalance (gchar* channelName, gdouble* value);
-void backendSetColorBalance (gchar* channelName, gdouble value);
-gdouble backendQueryDuration();
-gdouble backendGetVolume();
-gboolean backendQueryPosition (gdouble* current);
-gboolean backendDurationIsValid();
-gboolean backendIsPausedOrPlaying();
-gboolean backendIsPlaying();
\ No newline at end of file
+BackendPlayer* backendPlayerNew();
+void backendPlayerFree (BackendPlayer* player);
+void backendDeInit (BackendPlayer* player);
+int  backendSetWindow (BackendPlayer* player, guintptr window);
+void backendSetSinks (BackendPlayer* player, GstElement* video, GstElement* audio);
+void backendSetSinkFunc (BackendPlayer* player, BackendSinkFunc func, gpointer userData);
+gpointer backendEnableGl (BackendPlayer* player);
+void backendDisableGl (BackendPlayer* player);
+int  backendPlay (BackendPlayer* player, const gchar* filename);
+int  backendPlayMosaic (BackendPlayer* player, const gchar* const* uris, guint count);
+gboolean backendIsMosaic (BackendPlayer* player);
+void backendSetMosaicFocus (BackendPlayer* player, guint index);
+void backendSetMosaicDecode (BackendPlayer* player, MosaicDecode unfocused);
+void backendPause (BackendPlayer* player);
+void backendStop (BackendPlayer* player);
+void backendResume (BackendPlayer* player);
+void backendChangeUri (BackendPlayer* player, const gchar* filename);
+void backendQueueUri (BackendPlayer* player, const gchar* filename);
+void backendPlaylistAppend (BackendPlayer* player, const gchar* uri);
+gboolean backendPlaylistNext (BackendPlayer* player);
+gchar* backendGetUri (BackendPlayer* player);
+void backendSetStandbyMemoryLimit (BackendPlayer* player, gsize bytes);
+void backendSetDecoderConfig (BackendPlayer* player, const DecoderConfig* config);
+void backendGetDecoderConfig (BackendPlayer* player, DecoderConfig* config);
+void backendSetFrameCacheSize (BackendPlayer* player, gsize bytes);
+void backendSetMemoryBudget (BackendPlayer* player, gsize bytes);
+gsize backendGetMemoryBudget (BackendPlayer* player);
+void backendStepFrame (BackendPlayer* player, gboolean forward);
+gboolean backendGetFrame (BackendPlayer* player, BackendFrame* frame);
+void backendFrameClear (BackendFrame* frame);
+void backendGetStats (BackendPlayer* player, BackendStats* stats);
+gchar* backendFormatStats (const BackendStats* stats);
+void backendSetStatsOverlay (BackendPlayer* player, gboolean enabled);
+void backendSetVideoVisible (BackendPlayer* player, gboolean visible);
+void backendSetVideoSize (BackendPlayer* player, gint width, gint height);
+void backendSetVisualisation (BackendPlayer* player, BackendVisualisation style, guint fps);
+gboolean backendSetLut (BackendPlayer* player, const gchar* path,
+                        LutInterpolation interpolation, GError** error);
+void backendSeek (BackendPlayer* player, gdouble value);
+void backendScrub (BackendPlayer* player, gdouble value);
+void backendSetVolume (BackendPlayer* player, gdouble volume);
+gchar* backendGetInformationAboutStreams (BackendPlayer* player);
+gchar** backendGetTitleAudioStreams (BackendPlayer* player);
+gint backendGetAmountOfAudioStreams (BackendPlayer* player);
+BackendTrack* backendGetTracks (BackendPlayer* player, guint* count);
+void backendTracksFree (BackendTrack* tracks, guint count);
+void backendSelectTrack (BackendPlayer* player, BackendTrackSlot slot, const gchar* id);
+gboolean backendAttachSubtitles (BackendPlayer* player, const gchar* path, GError** error);
+void backendSubscribe (BackendPlayer* player, BackendEventFunc func, gpointer userData);
+void backendUnsubscribe (BackendPlayer* player, BackendEventFunc func, gpointer userData);
+void backendSetRefreshRate (BackendPlayer* player, gdouble hz);
+void backendFormatTime (gdouble seconds, gchar* str);
+void backendGetColorBalance (BackendPlayer* player, gchar* channelName, gdouble* value);
+void backendSetColorBalance (BackendPlayer* player, gchar* channelName, gdouble value);
+void backendGetColorBalanceValues (BackendPlayer* player, BackendColorBalance* balance);
+void backendSetColorBalanceValues (BackendPlayer* player, const BackendColorBalance* balance);
+gdouble backendQueryDuration (BackendPlayer* player);
+gdouble backendGetVolume (BackendPlayer* player);
+gdouble backendGetSwitchLatency (BackendPlayer* player);
+gdouble backendGetAdvanceLatency (BackendPlayer* player);
+gboolean backendQueryPosition (BackendPlayer* player, gdouble* current);
+gboolean backendDurationIsValid (BackendPlayer* player);
+gboolean backendIsPausedOrPlaying (BackendPlayer* player);
+gboolean backendIsPlaying (BackendPlayer* player);
\ No newline at end of file
@@ -0,0 +1,615 @@
+#include <gst/gst.h>
+#include <gst/pbutils/pbutils.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include "gst-backend.h"
+#include "library.h"
+
+/* Media library index. libraryScan() runs GstDiscoverer on every core over a
+ * directory tree and writes the stream information into a compact index file
+ * that is memory-mapped for O(1) lookups without building any pipeline.
+ *
+ * Layout, native endian:
+ *   IndexHeader
+ *   guint32 buckets[bucketCount]   entry offsets, 0 = empty, linear probing
+ *   IndexEntry + IndexStream[nStreams], each entry 8-byte aligned
+ *   string pool, offsets relative to its start, offset 0 is ""
+ */
+
+#define INDEX_MAGIC      "GLIX"
+#define INDEX_VERSION    1
+#define DISCOVER_TIMEOUT (10 * GST_SECOND)
+
+typedef struct _IndexHeader {
+    gchar   magic[4];
+    guint32 version;
+    guint32 bucketCount;
+    guint32 entryCount;
+    guint32 stringsOffset;
+    guint32 stringsSize;
+} IndexHeader;
+
+typedef struct _IndexEntry {
+    guint32 hash;
+    guint32 uri;
+    gint64  size;
+    gint64  mtime;
+    guint64 duration;
+    guint32 nStreams;
+    guint32 reserved;
+} IndexEntry;
+
+typedef struct _IndexStream {
+    guint32 type;
+    guint32 codec;
+    guint32 language;
+    guint32 title;
+    guint32 bitrate;
+} IndexStream;
+
+typedef struct _IndexView {
+    GMappedFile*       file;
+    const guint8*      data;
+    gsize              size;
+    const IndexHeader* header;
+    const guint32*     buckets;
+    const gchar*       strings;
+} IndexView;
+
+typedef struct _ScanStream {
+    LibraryStreamType type;
+    gchar*  codec;
+    gchar*  language;
+    gchar*  title;
+    guint   bitrate;
+} ScanStream;
+
+typedef struct _ScanRecord {
+    gchar*  uri;
+    gint64  size;
+    gint64  mtime;
+    guint64 duration;
+    GArray* streams;
+} ScanRecord;
+
+typedef struct _ScanData {
+    GMutex     lock;
+    GPtrArray* records;
+    IndexView  previous;
+} ScanData;
+
+static IndexView library;
+static GPrivate threadDiscoverer = G_PRIVATE_INIT (g_object_unref);
+
+static const gchar* mediaExtensions[] = {
+    "aac", "avi", "flac", "flv", "m2ts", "m4a", "m4v", "mka", "mkv", "mov", "mp3",
+    "mp4", "mpeg", "mpg", "mts", "oga", "ogg", "ogv", "opus", "ts", "wav", "webm",
+    "wma", "wmv", NULL
+};
+
+/* FNV-1a, stable across runs and GLib versions unlike g_str_hash() */
+static guint32 hashUri (const gchar* uri) {
+    guint32 hash = 2166136261u;
+
+    for (const guchar* c = (const guchar*) uri; *c; c++) {
+        hash = (hash ^ *c) * 16777619u;
+    }
+    return hash;
+}
+
+static void indexViewClear (IndexView* view) {
+    if (view->file) {
+        g_mapped_file_unref (view->file);
+    }
+    memset (view, 0, sizeof (IndexView));
+}
+
+static gboolean indexViewOpen (IndexView* view, const gchar* path) {
+    const IndexHeader* header;
+    gsize bucketsEnd;
+
+    memset (view, 0, sizeof (IndexView));
+    view->file = g_mapped_file_new (path, FALSE, NULL);
+    if (!view->file) {
+        return FALSE;
+    }
+    view->data = (const guint8*) g_mapped_file_get_contents (view->file);
+    view->size = g_mapped_file_get_length (view->file);
+    header = (const IndexHeader*) view->data;
+
+    if (view->size < sizeof (IndexHeader) ||
+        memcmp (header->magic, INDEX_MAGIC, 4) != 0 ||
+        header->version != INDEX_VERSION ||
+        header->bucketCount == 0 ||
+        (header->bucketCount & (header->bucketCount - 1)) != 0) {
+        indexViewClear (view);
+        return FALSE;
+    }
+
+    bucketsEnd = sizeof (IndexHeader) + (gsize) header->bucketCount * sizeof (guint32);
+    if (bucketsEnd > header->stringsOffset ||
+        header->stringsSize == 0 ||
+        (gsize) header->stringsOffset + header->stringsSize != view->size ||
+        view->data[view->size - 1] != '\0') {
+        indexViewClear (view);
+        return FALSE;
+    }
+
+    view->header = header;
+    view->buckets = (const guint32*) (view->data + sizeof (IndexHeader));
+    view->strings = (const gchar*) (view->data + header->stringsOffset);
+    return TRUE;
+}
+
+static const gchar* indexViewString (const IndexView* view, guint32 offset) {
+    if (offset >= view->header->stringsSize) {
+        return "";
+    }
+    return view->strings + offset;
+}
+
+static const IndexEntry* indexViewFind (const IndexView* view, const gchar* uri) {
+    guint32 hash;
+    guint32 mask;
+    gsize entriesStart;
+
+    if (!view->header) {
+        return NULL;
+    }
+    hash = hashUri (uri);
+    mask = view->header->bucketCount - 1;
+    entriesStart = sizeof (IndexHeader) + (gsize) view->header->bucketCount * sizeof (guint32);
+
+    for (guint32 i = 0; i <= mask; i++) {
+        guint32 offset = view->buckets[(hash + i) & mask];
+        const IndexEntry* entry;
+
+        if (offset == 0) {
+            return NULL;
+        }
+        if (offset < entriesStart ||
+            offset + sizeof (IndexEntry) > view->header->stringsOffset) {
+            return NULL;
+        }
+        entry = (const IndexEntry*) (view->data + offset);
+        if (offset + sizeof (IndexEntry) + (gsize) entry->nStreams * sizeof (IndexStream) >
+            view->header->stringsOffset) {
+            return NULL;
+        }
+        if (entry->hash == hash && strcmp (indexViewString (view, entry->uri), uri) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+gchar* libraryDefaultPath() {
+    return g_build_filename (g_get_user_cache_dir(), "projectgliese", "library.idx", NULL);
+}
+
+gboolean libraryOpen (const gchar* indexPath) {
+    indexViewClear (&library);
+    return indexViewOpen (&library, indexPath);
+}
+
+void libraryClose() {
+    indexViewClear (&library);
+}
+
+/* Whether the file behind the URI is still the one the entry was made from,
+ * by the size and mtime it had when scanned */
+static gboolean entryIsCurrent (const gchar* uri, const IndexEntry* entry) {
+    gchar* path = g_filename_from_uri (uri, NULL, NULL);
+    gboolean current = FALSE;
+    GStatBuf st;
+
+    if (path && g_stat (path, &st) == 0) {
+        current = entry->size == (gint64) st.st_size && entry->mtime == (gint64) st.st_mtime;
+    }
+    g_free (path);
+    return current;
+}
+
+/* An entry for a file edited or replaced since the scan is a miss */
+gboolean libraryLookup (const gchar* uri, LibraryEntry* entry) {
+    const IndexEntry* found = indexViewFind (&library, uri);
+
+    if (!found || !entryIsCurrent (uri, found)) {
+        return FALSE;
+    }
+    entry->uri = indexViewString (&library, found->uri);
+    entry->duration = GST_CLOCK_TIME_IS_VALID (found->duration) ?
+            (gdouble) found->duration / GST_SECOND : -1;
+    entry->nStreams = found->nStreams;
+    entry->streams = found + 1;
+    return TRUE;
+}
+
+gboolean libraryGetStream (const LibraryEntry* entry, guint index, LibraryStream* stream) {
+    const IndexStream* streams = (const IndexStream*) entry->streams;
+
+    if (index >= entry->nStreams) {
+        return FALSE;
+    }
+    stream->type = (LibraryStreamType) streams[index].type;
+    stream->codec = indexViewString (&library, streams[index].codec);
+    stream->language = indexViewString (&library, streams[index].language);
+    stream->title = indexViewString (&library, streams[index].title);
+    stream->bitrate = streams[index].bitrate;
+    return TRUE;
+}
+
+/* Formats an entry like backendGetInformationAboutStreams(). Free with g_free(). */
+gchar* libraryDescribe (const LibraryEntry* entry) {
+    static const gchar* names[] = { "video", "audio", "subtitle" };
+    GString* info = g_string_new (NULL);
+    guint counts[3] = { 0, 0, 0 };
+    LibraryStream stream;
+    gchar duration[30];
+
+    backendFormatTime (entry->duration, duration);
+    g_string_append_printf (info, "duration: %s\n", duration);
+
+    for (guint i = 0; libraryGetStream (entry, i, &stream); i++) {
+        if (stream.type > LIBRARY_STREAM_SUBTITLE) {
+            continue;
+        }
+        g_string_append_printf (info, "\n%s stream %u:\n", names[stream.type], counts[stream.type]++);
+        g_string_append_printf (info, "  codec: %s\n", *stream.codec ? stream.codec : "unknown");
+        if (*stream.title) {
+            g_string_append_printf (info, "  title: %s\n", stream.title);
+        }
+        if (*stream.language) {
+            g_string_append_printf (info, "  language: %s\n", stream.language);
+        }
+        if (stream.bitrate) {
+            g_string_append_printf (info, "  bitrate: %u\n", stream.bitrate);
+        }
+    }
+    return g_string_free (info, FALSE);
+}
+
+static void scanStreamClear (ScanStream* stream) {
+    g_free (stream->codec);
+    g_free (stream->language);
+    g_free (stream->title);
+}
+
+static void scanRecordFree (ScanRecord* record) {
+    g_free (record->uri);
+    g_array_unref (record->streams);
+    g_free (record);
+}
+
+static ScanRecord* scanRecordNew (const gchar* uri, gint64 size, gint64 mtime) {
+    ScanRecord* record = g_new0 (ScanRecord, 1);
+
+    record->uri = g_strdup (uri);
+    record->size = size;
+    record->mtime = mtime;
+    record->duration = GST_CLOCK_TIME_NONE;
+    record->streams = g_array_new (FALSE, TRUE, sizeof (ScanStream));
+    g_array_set_clear_func (record->streams, (GDestroyNotify) scanStreamClear);
+    return record;
+}
+
+/* Reuses what the previous index knows about an unchanged file */
+static ScanRecord* recordFromIndex (const IndexView* view, const IndexEntry* entry) {
+    const IndexStream* streams = (const IndexStream*) (entry + 1);
+    ScanRecord* record = scanRecordNew (indexViewString (view, entry->uri),
+            entry->size, entry->mtime);
+
+    record->duration = entry->duration;
+    for (guint32 i = 0; i < entry->nStreams; i++) {
+        ScanStream stream = {
+            .type     = (LibraryStreamType) streams[i].type,
+            .codec    = g_strdup (indexViewString (view, streams[i].codec)),
+            .language = g_strdup (indexViewString (view, streams[i].language)),
+            .title    = g_strdup (indexViewString (view, streams[i].title)),
+            .bitrate  = streams[i].bitrate
+        };
+        g_array_append_val (record->streams, stream);
+    }
+    return record;
+}
+
+static void addStreams (ScanRecord* record, GList* list, LibraryStreamType type) {
+    static const gchar* codecTags[] = {
+        GST_TAG_VIDEO_CODEC, GST_TAG_AUDIO_CODEC, GST_TAG_SUBTITLE_CODEC
+    };
+
+    for (GList* l = list; l != NULL; l = l->next) {
+        GstDiscovererStreamInfo* info = (GstDiscovererStreamInfo*) l->data;
+        const GstTagList* tags = gst_discoverer_stream_info_get_tags (info);
+        const gchar* language = NULL;
+        ScanStream stream = { .type = type };
+
+        if (tags) {
+            gst_tag_list_get_string (tags, codecTags[type], &stream.codec);
+            gst_tag_list_get_string (tags, GST_TAG_TITLE, &stream.title);
+            gst_tag_list_get_string (tags, GST_TAG_LANGUAGE_CODE, &stream.language);
+            gst_tag_list_get_uint (tags, GST_TAG_BITRATE, &stream.bitrate);
+        }
+        if (!stream.codec) {
+            GstCaps* caps = gst_discoverer_stream_info_get_caps (info);
+            if (caps) {
+                stream.codec = gst_pb_utils_get_codec_description (caps);
+                gst_caps_unref (caps);
+            }
+        }
+
+        if (type == LIBRARY_STREAM_AUDIO) {
+            GstDiscovererAudioInfo* audio = (GstDiscovererAudioInfo*) info;
+            language = gst_discoverer_audio_info_get_language (audio);
+            if (gst_discoverer_audio_info_get_bitrate (audio)) {
+                stream.bitrate = gst_discoverer_audio_info_get_bitrate (audio);
+            }
+        } else if (type == LIBRARY_STREAM_SUBTITLE) {
+            language = gst_discoverer_subtitle_info_get_language ((GstDiscovererSubtitleInfo*) info);
+        } else if (gst_discoverer_video_info_get_bitrate ((GstDiscovererVideoInfo*) info)) {
+            stream.bitrate = gst_discoverer_video_info_get_bitrate ((GstDiscovererVideoInfo*) info);
+        }
+        if (language && !stream.language) {
+            stream.language = g_strdup (language);
+        }
+
+        g_array_append_val (record->streams, stream);
+    }
+    gst_discoverer_stream_info_list_free (list);
+}
+
+/* Thread pool worker, one file per call. Every worker thread keeps its own
+ * synchronous discoverer. */
+static void scanFile (gchar* path, ScanData* data) {
+    GstDiscoverer* discoverer;
+    GstDiscovererInfo* info;
+    const IndexEntry* previous;
+    ScanRecord* record = NULL;
+    GStatBuf st;
+    gchar* uri;
+
+    uri = gst_filename_to_uri (path, NULL);
+    if (!uri || g_stat (path, &st) != 0) {
+        goto out;
+    }
+
+    previous = indexViewFind (&data->previous, uri);
+    if (previous && previous->size == (gint64) st.st_size && previous->mtime == (gint64) st.st_mtime) {
+        record = recordFromIndex (&data->previous, previous);
+        goto out;
+    }
+
+    discoverer = g_private_get (&threadDiscoverer);
+    if (!discoverer) {
+        discoverer = gst_discoverer_new (DISCOVER_TIMEOUT, NULL);
+        if (!discoverer) {
+            goto out;
+        }
+        g_private_set (&threadDiscoverer, discoverer);
+    }
+
+    info = gst_discoverer_discover_uri (discoverer, uri, NULL);
+    if (info && gst_discoverer_info_get_result (info) == GST_DISCOVERER_OK) {
+        record = scanRecordNew (uri, st.st_size, st.st_mtime);
+        record->duration = gst_discoverer_info_get_duration (info);
+        addStreams (record, gst_discoverer_info_get_video_streams (info), LIBRARY_STREAM_VIDEO);
+        addStreams (record, gst_discoverer_info_get_audio_streams (info), LIBRARY_STREAM_AUDIO);
+        addStreams (record, gst_discoverer_info_get_subtitle_streams (info), LIBRARY_STREAM_SUBTITLE);
+    }
+    if (info) {
+        gst_discoverer_info_unref (info);
+    }
+
+out:
+    if (record) {
+        g_mutex_lock (&data->lock);
+        g_ptr_array_add (data->records, record);
+        g_mutex_unlock (&data->lock);
+    }
+    g_free (uri);
+    g_free (path);
+}
+
+static gboolean isMediaFile (const gchar* name) {
+    const gchar* dot = strrchr (name, '.');
+
+    if (!dot) {
+        return FALSE;
+    }
+    for (gint i = 0; mediaExtensions[i]; i++) {
+        if (g_ascii_strcasecmp (dot + 1, mediaExtensions[i]) == 0) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static void collectFiles (const gchar* directory, GThreadPool* pool) {
+    GDir* dir = g_dir_open (directory, 0, NULL);
+    const gchar* name;
+
+    if (!dir) {
+        return;
+    }
+    while ((name = g_dir_read_name (dir)) != NULL) {
+        gchar* path = g_build_filename (directory, name, NULL);
+
+        if (g_file_test (path, G_FILE_TEST_IS_DIR) && !g_file_test (path, G_FILE_TEST_IS_SYMLINK)) {
+            collectFiles (path, pool);
+            g_free (path);
+        } else if (isMediaFile (name)) {
+            g_thread_pool_push (pool, path, NULL);
+        } else {
+            g_free (path);
+        }
+    }
+    g_dir_close (dir);
+}
+
+static guint32 internString (GString* strings, GHashTable* offsets, const gchar* str) {
+    gpointer offset;
+
+    if (!str || !*str) {
+        return 0;
+    }
+    if (g_hash_table_lookup_extended (offsets, str, NULL, &offset)) {
+        return GPOINTER_TO_UINT (offset);
+    }
+    guint32 result = strings->len;
+    g_string_append_len (strings, str, strlen (str) + 1);
+    g_hash_table_insert (offsets, g_strdup (str), GUINT_TO_POINTER (result));
+    return result;
+}
+
+static gboolean writeIndex (GPtrArray* records, const gchar* indexPath, GError** error) {
+    IndexHeader header = { .magic = INDEX_MAGIC, .version = INDEX_VERSION };
+    GByteArray* entries = g_byte_array_new();
+    GString* strings = g_string_new (NULL);
+    GHashTable* offsets = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    guint32* buckets;
+    GByteArray* file;
+    gsize entriesStart;
+    gboolean result;
+    gchar* dir;
+
+    /* Offset 0 of the pool is the empty string */
+    g_string_append_c (strings, '\0');
+
+    header.bucketCount = 16;
+    while (header.bucketCount < records->len * 2) {
+        header.bucketCount *= 2;
+    }
+    header.entryCount = records->len;
+    buckets = g_new0 (guint32, header.bucketCount);
+    entriesStart = sizeof (IndexHeader) + (gsize) header.bucketCount * sizeof (guint32);
+
+    for (guint i = 0; i < records->len; i++) {
+        ScanRecord* record = g_ptr_array_index (records, i);
+        IndexEntry entry = {
+            .hash     = hashUri (record->uri),
+            .uri      = internString (strings, offsets, record->uri),
+            .size     = record->size,
+            .mtime    = record->mtime,
+            .duration = record->duration,
+            .nStreams = record->streams->len
+        };
+        guint32 offset = entriesStart + entries->len;
+        guint32 mask = header.bucketCount - 1;
+        guint32 slot = entry.hash & mask;
+
+        while (buckets[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        buckets[slot] = offset;
+
+        g_byte_array_append (entries, (const guint8*) &entry, sizeof (entry));
+        for (guint j = 0; j < record->streams->len; j++) {
+            ScanStream* scanned = &g_array_index (record->streams, ScanStream, j);
+            IndexStream stream = {
+                .type     = scanned->type,
+                .codec    = internString (strings, offsets, scanned->codec),
+                .language = internString (strings, offsets, scanned->language),
+                .title    = internString (strings, offsets, scanned->title),
+                .bitrate  = scanned->bitrate
+            };
+            g_byte_array_append (entries, (const guint8*) &stream, sizeof (stream));
+        }
+        /* Keep the next entry's 64-bit fields aligned */
+        while (entries->len % 8) {
+            guint8 zero = 0;
+            g_byte_array_append (entries, &zero, 1);
+        }
+    }
+
+    header.stringsOffset = entriesStart + entries->len;
+    header.stringsSize = strings->len;
+
+    file = g_byte_array_sized_new (header.stringsOffset + header.stringsSize);
+    g_byte_array_append (file, (const guint8*) &header, sizeof (header));
+    g_byte_array_append (file, (const guint8*) buckets, header.bucketCount * sizeof (guint32));
+    g_byte_array_append (file, entries->data, entries->len);
+    g_byte_array_append (file, (const guint8*) strings->str, strings->len);
+
+    dir = g_path_get_dirname (indexPath);
+    g_mkdir_with_parents (dir, 0700);
+    /* Replaces the file atomically; readers keep their old mapping */
+    result = g_file_set_contents (indexPath, (const gchar*) file->data, file->len, error);
+
+    g_free (dir);
+    g_byte_array_unref (file);
+    g_free (buckets);
+    g_hash_table_destroy (offsets);
+    g_string_free (strings, TRUE);
+    g_byte_array_unref (entries);
+    return result;
+}
+
+/* Scans a directory tree with one discoverer per core and rewrites the index.
+ * Files already in the index with the same size and mtime are not probed
+ * again. Blocks until done, so run it off the main thread. */
+gboolean libraryScan (const gchar* directory, const gchar* indexPath, GError** error) {
+    ScanData data;
+    GThreadPool* pool;
+    gboolean result;
+
+    gst_pb_utils_init();
+
+    g_mutex_init (&data.lock);
+    data.records = g_ptr_array_new_with_free_func ((GDestroyNotify) scanRecordFree);
+    indexViewOpen (&data.previous, indexPath);
+
+    pool = g_thread_pool_new ((GFunc) scanFile, &data, g_get_num_processors(), TRUE, error);
+    if (!pool) {
+        indexViewClear (&data.previous);
+        g_ptr_array_unref (data.records);
+        g_mutex_clear (&data.lock);
+        return FALSE;
+    }
+    collectFiles (directory, pool);
+    /* Waits for every queued file */
+    g_thread_pool_free (pool, FALSE, TRUE);
+
+    /* Keep entries from elsewhere in the library that this scan did not
+     * visit; ones under the scanned directory are gone from disk */
+    if (data.previous.header) {
+        GHashTable* scanned = g_hash_table_new (g_str_hash, g_str_equal);
+        gchar* directoryUri = gst_filename_to_uri (directory, NULL);
+        gchar* prefix = g_strconcat (directoryUri ? directoryUri : "", "/", NULL);
+        gsize entriesStart = sizeof (IndexHeader) +
+                (gsize) data.previous.header->bucketCount * sizeof (guint32);
+
+        for (guint i = 0; i < data.records->len; i++) {
+            ScanRecord* record = g_ptr_array_index (data.records, i);
+            g_hash_table_add (scanned, record->uri);
+        }
+        for (guint32 i = 0; i < data.previous.header->bucketCount; i++) {
+            guint32 offset = data.previous.buckets[i];
+            const IndexEntry* entry;
+            const gchar* uri;
+
+            if (offset < entriesStart ||
+                offset + sizeof (IndexEntry) > data.previous.header->stringsOffset) {
+                continue;
+            }
+            entry = (const IndexEntry*) (data.previous.data + offset);
+            if (offset + sizeof (IndexEntry) + (gsize) entry->nStreams * sizeof (IndexStream) >
+                data.previous.header->stringsOffset) {
+                continue;
+            }
+            uri = indexViewString (&data.previous, entry->uri);
+            if (!g_hash_table_contains (scanned, uri) && !g_str_has_prefix (uri, prefix)) {
+                g_ptr_array_add (data.records, recordFromIndex (&data.previous, entry));
+            }
+        }
+        g_hash_table_destroy (scanned);
+        g_free (prefix);
+        g_free (directoryUri);
+    }
+
+    result = writeIndex (data.records, indexPath, error);
+
+    indexViewClear (&data.previous);
+    g_ptr_array_unref (data.records);
+    g_mutex_clear (&data.lock);
+    return result;
+}
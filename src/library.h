@@ -0,0 +1,32 @@
+#pragma once
+#include <gst/gst.h>
+
+typedef enum _LibraryStreamType {
+    LIBRARY_STREAM_VIDEO,
+    LIBRARY_STREAM_AUDIO,
+    LIBRARY_STREAM_SUBTITLE
+} LibraryStreamType;
+
+/* Strings point into the mapped index and stay valid until libraryClose() */
+typedef struct _LibraryStream {
+    LibraryStreamType type;
+    const gchar* codec;
+    const gchar* language;
+    const gchar* title;
+    guint        bitrate;
+} LibraryStream;
+
+typedef struct _LibraryEntry {
+    const gchar*  uri;
+    gdouble       duration;
+    guint         nStreams;
+    gconstpointer streams;
+} LibraryEntry;
+
+gchar*   libraryDefaultPath();
+gboolean libraryOpen (const gchar* indexPath);
+void     libraryClose();
+gboolean libraryLookup (const gchar* uri, LibraryEntry* entry);
+gboolean libraryGetStream (const LibraryEntry* entry, guint index, LibraryStream* stream);
+gchar*   libraryDescribe (const LibraryEntry* entry);
+gboolean libraryScan (const gchar* directory, const gchar* indexPath, GError** error);
@@ -0,0 +1,807 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lut3d.h"
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define LUT_X86
+#include <immintrin.h>
+#endif
+
+/* The kernels work in fixed point. An 8-bit input is scaled to a grid
+ * position in 16.16, of which the top 8 fraction bits weight the corners.
+ * Entries hold the three output components in 10 bits each, as 8-bit values
+ * times four, so that one 32-bit load fetches a whole grid point. */
+#define ENTRY_MAX 1020
+#define ENTRY_MASK 0x3FF
+
+struct _Lut3d {
+    gint refCount;
+    guint size;                 /* grid points per axis in the file */
+    gfloat* grid;               /* size³ RGB triplets as read, red fastest; NULL if derived */
+    gfloat domainMin[3];
+    gfloat domainMax[3];
+    guint tableSize;            /* grid points per axis in the table */
+    guint stride;               /* tableSize + 1: the last point is repeated on each axis,
+                                 * so that the upper corner of a cell is always there */
+    guint32 scale;              /* 8-bit input to a table position in 16.16 */
+    guint32* table;
+};
+
+static Lut3d* lutNew (guint size) {
+    Lut3d* lut = g_new0 (Lut3d, 1);
+
+    lut->refCount = 1;
+    lut->size = size;
+    for (guint c = 0; c < 3; c++) {
+        lut->domainMax[c] = 1.0f;
+    }
+    return lut;
+}
+
+Lut3d* lut3dRef (Lut3d* lut) {
+    g_atomic_int_inc (&lut->refCount);
+    return lut;
+}
+
+void lut3dUnref (Lut3d* lut) {
+    if (!lut || !g_atomic_int_dec_and_test (&lut->refCount)) {
+        return;
+    }
+    g_free (lut->grid);
+    g_free (lut->table);
+    g_free (lut);
+}
+
+guint lut3dGetSize (const Lut3d* lut) {
+    return lut->size;
+}
+
+static gfloat clamp01 (gfloat value) {
+    return value < 0.0f ? 0.0f : (value > 1.0f ? 1.0f : value);
+}
+
+/* Samples the file's grid at full precision, for building tables */
+static void sampleGrid (const Lut3d* lut, const gfloat in[3], gfloat out[3]) {
+    guint n = lut->size;
+    guint index[3];
+    gfloat frac[3];
+
+    for (guint c = 0; c < 3; c++) {
+        gfloat range = lut->domainMax[c] - lut->domainMin[c];
+        gfloat position = clamp01 ((in[c] - lut->domainMin[c]) / range) * (gfloat) (n - 1);
+
+        index[c] = MIN ((guint) position, n - 2);
+        frac[c] = position - (gfloat) index[c];
+    }
+    for (guint c = 0; c < 3; c++) {
+        gfloat value = 0;
+
+        for (guint corner = 0; corner < 8; corner++) {
+            guint r = index[0] + (corner & 1);
+            guint g = index[1] + ((corner >> 1) & 1);
+            guint b = index[2] + ((corner >> 2) & 1);
+            gfloat weight = ((corner & 1) ? frac[0] : 1 - frac[0]) *
+                            (((corner >> 1) & 1) ? frac[1] : 1 - frac[1]) *
+                            (((corner >> 2) & 1) ? frac[2] : 1 - frac[2]);
+
+            value += weight * lut->grid[((b * n + g) * n + r) * 3 + c];
+        }
+        out[c] = value;
+    }
+}
+
+static guint32 packEntry (const gfloat value[3]) {
+    guint32 entry = 0;
+
+    for (guint c = 0; c < 3; c++) {
+        entry |= (guint32) lrintf (clamp01 (value[c]) * ENTRY_MAX) << (10 * c);
+    }
+    return entry;
+}
+
+typedef void (*TableFunc) (const Lut3d* source, const gfloat in[3], gfloat out[3],
+                           gconstpointer data);
+
+/* Fills the table by evaluating func at every point of a size³ grid over the
+ * whole 8-bit input range */
+static void buildTable (Lut3d* lut, guint size, TableFunc func, const Lut3d* source,
+                        gconstpointer data) {
+    guint s = size + 1;
+
+    lut->tableSize = size;
+    lut->stride = s;
+    lut->scale = ((size - 1) << 16) / 255;
+    lut->table = g_new (guint32, s * s * s);
+
+    for (guint b = 0; b < s; b++) {
+        for (guint g = 0; g < s; g++) {
+            for (guint r = 0; r < s; r++) {
+                gfloat in[3], out[3];
+
+                in[0] = (gfloat) MIN (r, size - 1) / (gfloat) (size - 1);
+                in[1] = (gfloat) MIN (g, size - 1) / (gfloat) (size - 1);
+                in[2] = (gfloat) MIN (b, size - 1) / (gfloat) (size - 1);
+                func (source, in, out, data);
+                lut->table[(b * s + g) * s + r] = packEntry (out);
+            }
+        }
+    }
+}
+
+static void sampleRgb (const Lut3d* source, const gfloat in[3], gfloat out[3],
+                       gconstpointer data) {
+    UNUSED (data);
+
+    sampleGrid (source, in, out);
+}
+
+/* Takes over a size³ grid of RGB triplets, red changing fastest */
+Lut3d* lut3dNewFromGrid (guint size, const gfloat* rgb) {
+    Lut3d* lut;
+
+    if (size < 2) {
+        return NULL;
+    }
+    lut = lutNew (size);
+    lut->grid = g_new (gfloat, size * size * size * 3);
+    memcpy (lut->grid, rgb, size * size * size * 3 * sizeof (gfloat));
+    buildTable (lut, size, sampleRgb, lut, NULL);
+    return lut;
+}
+
+static gboolean parseTriplet (const gchar* str, gfloat out[3]) {
+    gchar* end;
+
+    for (guint c = 0; c < 3; c++) {
+        out[c] = (gfloat) g_ascii_strtod (str, &end);
+        if (end == str) {
+            return FALSE;
+        }
+        str = end;
+    }
+    return TRUE;
+}
+
+/* Reads a .cube file: an optional TITLE, LUT_3D_SIZE, optional DOMAIN_MIN and
+ * DOMAIN_MAX, then size³ lines of RGB with red changing fastest */
+Lut3d* lut3dLoad (const gchar* path, GError** error) {
+    gchar* contents;
+    gchar** lines;
+    gfloat* grid = NULL;
+    gfloat domainMin[3] = { 0, 0, 0 };
+    gfloat domainMax[3] = { 1, 1, 1 };
+    guint size = 0;
+    guint count = 0;
+    Lut3d* lut = NULL;
+
+    if (!g_file_get_contents (path, &contents, NULL, error)) {
+        return NULL;
+    }
+    lines = g_strsplit (contents, "\n", -1);
+    g_free (contents);
+
+    for (guint i = 0; lines[i]; i++) {
+        gchar* line = g_strstrip (lines[i]);
+
+        if (!*line || *line == '#' || g_str_has_prefix (line, "TITLE")) {
+            continue;
+        }
+        if (g_str_has_prefix (line, "LUT_3D_SIZE")) {
+            size = (guint) g_ascii_strtoull (line + strlen ("LUT_3D_SIZE"), NULL, 10);
+            if (size < 2 || size > 256 || grid) {
+                break;
+            }
+            grid = g_new (gfloat, size * size * size * 3);
+        } else if (g_str_has_prefix (line, "LUT_1D_SIZE")) {
+            break;
+        } else if (g_str_has_prefix (line, "DOMAIN_MIN")) {
+            parseTriplet (line + strlen ("DOMAIN_MIN"), domainMin);
+        } else if (g_str_has_prefix (line, "DOMAIN_MAX")) {
+            parseTriplet (line + strlen ("DOMAIN_MAX"), domainMax);
+        } else if (!grid || count >= size * size * size ||
+                   !parseTriplet (line, grid + count++ * 3)) {
+            break;
+        }
+    }
+    g_strfreev (lines);
+
+    for (guint c = 0; c < 3; c++) {
+        if (domainMax[c] <= domainMin[c]) {
+            count = 0;
+        }
+    }
+    if (!grid || count != size * size * size) {
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                "%s is not a 3D LUT in .cube format", path);
+        g_free (grid);
+        return NULL;
+    }
+
+    lut = lutNew (size);
+    lut->grid = grid;
+    memcpy (lut->domainMin, domainMin, sizeof (domainMin));
+    memcpy (lut->domainMax, domainMax, sizeof (domainMax));
+    buildTable (lut, size, sampleRgb, lut, NULL);
+    return lut;
+}
+
+typedef struct _YuvMatrix {
+    gdouble kr;
+    gdouble kb;
+    gboolean fullRange;
+} YuvMatrix;
+
+/* Y'CbCr codes to R'G'B', through the LUT and back */
+static void sampleYuv (const Lut3d* source, const gfloat in[3], gfloat out[3],
+                       gconstpointer data) {
+    const YuvMatrix* m = data;
+    gdouble kg = 1.0 - m->kr - m->kb;
+    gdouble y, cb, cr;
+    gfloat rgb[3], graded[3];
+
+    if (m->fullRange) {
+        y = in[0];
+        cb = (in[1] * 255.0 - 128.0) / 255.0;
+        cr = (in[2] * 255.0 - 128.0) / 255.0;
+    } else {
+        y = (in[0] * 255.0 - 16.0) / 219.0;
+        cb = (in[1] * 255.0 - 128.0) / 224.0;
+        cr = (in[2] * 255.0 - 128.0) / 224.0;
+    }
+    rgb[0] = clamp01 ((gfloat) (y + 2.0 * (1.0 - m->kr) * cr));
+    rgb[2] = clamp01 ((gfloat) (y + 2.0 * (1.0 - m->kb) * cb));
+    rgb[1] = clamp01 ((gfloat) ((y - m->kr * rgb[0] - m->kb * rgb[2]) / kg));
+    sampleGrid (source, rgb, graded);
+
+    y = m->kr * graded[0] + kg * graded[1] + m->kb * graded[2];
+    cb = (graded[2] - y) / (2.0 * (1.0 - m->kb));
+    cr = (graded[0] - y) / (2.0 * (1.0 - m->kr));
+    if (m->fullRange) {
+        out[0] = (gfloat) y;
+        out[1] = (gfloat) ((128.0 + 255.0 * cb) / 255.0);
+        out[2] = (gfloat) ((128.0 + 255.0 * cr) / 255.0);
+    } else {
+        out[0] = (gfloat) ((16.0 + 219.0 * y) / 255.0);
+        out[1] = (gfloat) ((128.0 + 224.0 * cb) / 255.0);
+        out[2] = (gfloat) ((128.0 + 224.0 * cr) / 255.0);
+    }
+}
+
+/* The same grading as a table indexed by Y'CbCr, so that YUV frames need no
+ * conversion per pixel. kr and kb give the matrix, e.g. 0.2126 and 0.0722
+ * for BT.709. The composite is sampled at least 33 points per axis. */
+Lut3d* lut3dToYuv (const Lut3d* rgb, gdouble kr, gdouble kb, gboolean fullRange) {
+    YuvMatrix matrix = { kr, kb, fullRange };
+    Lut3d* lut;
+
+    if (!rgb->grid) {
+        return NULL;
+    }
+    lut = lutNew (rgb->size);
+    buildTable (lut, MAX (rgb->size, 33), sampleYuv, rgb, &matrix);
+    return lut;
+}
+
+/* Scalar kernels, also used for the pixels left over by the vector ones */
+
+static inline guint32 component (guint32 entry, guint c) {
+    return (entry >> (10 * c)) & ENTRY_MASK;
+}
+
+static guint32 keepMask (const guint shift[3]) {
+    return ~((0xFFu << shift[0]) | (0xFFu << shift[1]) | (0xFFu << shift[2]));
+}
+
+/* Walks the cell from its lower to its upper corner along the axes in order
+ * of decreasing fraction: four points, weighted by the fraction differences */
+static void tetrahedralScalar (const Lut3d* lut, guint32* pixels, gint count,
+                               const guint shift[3]) {
+    const guint32* table = lut->table;
+    const guint32 scale = lut->scale;
+    const guint32 s1 = lut->stride;
+    const guint32 s2 = s1 * s1;
+    const guint32 keep = keepMask (shift);
+    const guint sh[3] = { shift[0], shift[1], shift[2] };
+
+    for (gint i = 0; i < count; i++) {
+        guint32 p = pixels[i];
+        guint32 pr = ((p >> sh[0]) & 0xFF) * scale;
+        guint32 pg = ((p >> sh[1]) & 0xFF) * scale;
+        guint32 pb = ((p >> sh[2]) & 0xFF) * scale;
+        guint32 base = (pr >> 16) + (pg >> 16) * s1 + (pb >> 16) * s2;
+        gint fr = (pr >> 8) & 0xFF;
+        gint fg = (pg >> 8) & 0xFF;
+        gint fb = (pb >> 8) & 0xFF;
+        gint a = MAX (fr, MAX (fg, fb));
+        gint c = MIN (fr, MIN (fg, fb));
+        gint b = fr + fg + fb - a - c;
+        guint32 first = (fr >= fg && fr >= fb) ? 1 : (fg >= fb ? s1 : s2);
+        guint32 last = (fr <= fg && fr <= fb) ? 1 : (fg <= fb ? s1 : s2);
+        guint32 c0 = table[base];
+        guint32 c1 = table[base + first];
+        guint32 c2 = table[base + 1 + s1 + s2 - last];
+        guint32 c3 = table[base + 1 + s1 + s2];
+        guint32 out = p & keep;
+
+        for (guint k = 0; k < 3; k++) {
+            guint32 v = component (c0, k) * (guint32) (256 - a) +
+                        component (c1, k) * (guint32) (a - b) +
+                        component (c2, k) * (guint32) (b - c) +
+                        component (c3, k) * (guint32) c;
+
+            out |= ((v + 512) >> 10) << sh[k];
+        }
+        pixels[i] = out;
+    }
+}
+
+/* Three rounds of linear interpolation over the eight corners. Intermediate
+ * values are kept to 14 bits so that everything fits 16-bit multiplies. */
+static void trilinearScalar (const Lut3d* lut, guint32* pixels, gint count,
+                             const guint shift[3]) {
+    const guint32* table = lut->table;
+    const guint32 scale = lut->scale;
+    const guint32 s1 = lut->stride;
+    const guint32 s2 = s1 * s1;
+    const guint32 keep = keepMask (shift);
+    const guint sh[3] = { shift[0], shift[1], shift[2] };
+
+    for (gint i = 0; i < count; i++) {
+        guint32 p = pixels[i];
+        guint32 pr = ((p >> sh[0]) & 0xFF) * scale;
+        guint32 pg = ((p >> sh[1]) & 0xFF) * scale;
+        guint32 pb = ((p >> sh[2]) & 0xFF) * scale;
+        guint32 base = (pr >> 16) + (pg >> 16) * s1 + (pb >> 16) * s2;
+        guint32 fr = (pr >> 8) & 0xFF;
+        guint32 fg = (pg >> 8) & 0xFF;
+        guint32 fb = (pb >> 8) & 0xFF;
+        const guint32* c = table + base;
+        guint32 out = p & keep;
+
+        for (guint k = 0; k < 3; k++) {
+            guint32 x00 = (component (c[0], k) * (256 - fr) + component (c[1], k) * fr) >> 4;
+            guint32 x10 = (component (c[s1], k) * (256 - fr) +
+                           component (c[s1 + 1], k) * fr) >> 4;
+            guint32 x01 = (component (c[s2], k) * (256 - fr) +
+                           component (c[s2 + 1], k) * fr) >> 4;
+            guint32 x11 = (component (c[s1 + s2], k) * (256 - fr) +
+                           component (c[s1 + s2 + 1], k) * fr) >> 4;
+            guint32 y0 = (x00 * (256 - fg) + x10 * fg) >> 8;
+            guint32 y1 = (x01 * (256 - fg) + x11 * fg) >> 8;
+            guint32 v = y0 * (256 - fb) + y1 * fb;
+
+            out |= ((v + 8192) >> 14) << sh[k];
+        }
+        pixels[i] = out;
+    }
+}
+
+#ifdef LUT_X86
+
+/* The vector kernels compute exactly what the scalar ones do, lane by lane.
+ * madd multiplies pairs of 16-bit values and adds each pair, so two corners
+ * of one component are packed into the halves of a lane and weighted in one
+ * instruction. */
+
+#define AVX2 __attribute__ ((target ("avx2")))
+#define SSE41 __attribute__ ((target ("sse4.1")))
+
+/* Component k of two entries, lo in the low half of each lane, hi in the high */
+static inline AVX2 __m256i pairAvx2 (__m256i lo, __m256i hi, guint k) {
+    const __m256i mask = _mm256_set1_epi32 (ENTRY_MASK);
+    const __m256i maskHigh = _mm256_set1_epi32 (ENTRY_MASK << 16);
+
+    switch (k) {
+    case 0:
+        return _mm256_or_si256 (_mm256_and_si256 (lo, mask),
+                                _mm256_and_si256 (_mm256_slli_epi32 (hi, 16), maskHigh));
+    case 1:
+        return _mm256_or_si256 (_mm256_and_si256 (_mm256_srli_epi32 (lo, 10), mask),
+                                _mm256_and_si256 (_mm256_slli_epi32 (hi, 6), maskHigh));
+    default:
+        return _mm256_or_si256 (_mm256_and_si256 (_mm256_srli_epi32 (lo, 20), mask),
+                                _mm256_and_si256 (_mm256_srli_epi32 (hi, 4), maskHigh));
+    }
+}
+
+static inline AVX2 __m256i weightsAvx2 (__m256i w0, __m256i w1) {
+    return _mm256_or_si256 (w0, _mm256_slli_epi32 (w1, 16));
+}
+
+static AVX2 void tetrahedralAvx2 (const Lut3d* lut, guint32* pixels, gint count,
+                                  const guint shift[3]) {
+    const int* table = (const int*) lut->table;
+    const gint s1 = (gint) lut->stride;
+    const gint s2 = s1 * s1;
+    const __m128i shift0 = _mm_cvtsi32_si128 ((int) shift[0]);
+    const __m128i shift1 = _mm_cvtsi32_si128 ((int) shift[1]);
+    const __m128i shift2 = _mm_cvtsi32_si128 ((int) shift[2]);
+    const __m256i byte = _mm256_set1_epi32 (0xFF);
+    const __m256i scale = _mm256_set1_epi32 ((int) lut->scale);
+    const __m256i step1 = _mm256_set1_epi32 (s1);
+    const __m256i step2 = _mm256_set1_epi32 (s2);
+    const __m256i one = _mm256_set1_epi32 (1);
+    const __m256i corner = _mm256_set1_epi32 (1 + s1 + s2);
+    const __m256i full = _mm256_set1_epi32 (256);
+    const __m256i round = _mm256_set1_epi32 (512);
+    const __m256i keep = _mm256_set1_epi32 ((int) keepMask (shift));
+    gint i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m256i p = _mm256_loadu_si256 ((const __m256i*) (pixels + i));
+        __m256i pr = _mm256_mullo_epi32 (_mm256_and_si256 (_mm256_srl_epi32 (p, shift0), byte), scale);
+        __m256i pg = _mm256_mullo_epi32 (_mm256_and_si256 (_mm256_srl_epi32 (p, shift1), byte), scale);
+        __m256i pb = _mm256_mullo_epi32 (_mm256_and_si256 (_mm256_srl_epi32 (p, shift2), byte), scale);
+        __m256i base = _mm256_add_epi32 (_mm256_srli_epi32 (pr, 16),
+                _mm256_add_epi32 (_mm256_mullo_epi32 (_mm256_srli_epi32 (pg, 16), step1),
+                                  _mm256_mullo_epi32 (_mm256_srli_epi32 (pb, 16), step2)));
+        __m256i fr = _mm256_and_si256 (_mm256_srli_epi32 (pr, 8), byte);
+        __m256i fg = _mm256_and_si256 (_mm256_srli_epi32 (pg, 8), byte);
+        __m256i fb = _mm256_and_si256 (_mm256_srli_epi32 (pb, 8), byte);
+        __m256i a = _mm256_max_epi32 (fr, _mm256_max_epi32 (fg, fb));
+        __m256i c = _mm256_min_epi32 (fr, _mm256_min_epi32 (fg, fb));
+        __m256i b = _mm256_sub_epi32 (_mm256_add_epi32 (fr, _mm256_add_epi32 (fg, fb)),
+                                      _mm256_add_epi32 (a, c));
+        __m256i rNotMax = _mm256_or_si256 (_mm256_cmpgt_epi32 (fg, fr), _mm256_cmpgt_epi32 (fb, fr));
+        __m256i rNotMin = _mm256_or_si256 (_mm256_cmpgt_epi32 (fr, fg), _mm256_cmpgt_epi32 (fr, fb));
+        __m256i first = _mm256_blendv_epi8 (one,
+                _mm256_blendv_epi8 (step1, step2, _mm256_cmpgt_epi32 (fb, fg)), rNotMax);
+        __m256i last = _mm256_blendv_epi8 (one,
+                _mm256_blendv_epi8 (step1, step2, _mm256_cmpgt_epi32 (fg, fb)), rNotMin);
+        __m256i c0 = _mm256_i32gather_epi32 (table, base, 4);
+        __m256i c1 = _mm256_i32gather_epi32 (table, _mm256_add_epi32 (base, first), 4);
+        __m256i c2 = _mm256_i32gather_epi32 (table,
+                _mm256_add_epi32 (base, _mm256_sub_epi32 (corner, last)), 4);
+        __m256i c3 = _mm256_i32gather_epi32 (table, _mm256_add_epi32 (base, corner), 4);
+        __m256i w01 = weightsAvx2 (_mm256_sub_epi32 (full, a), _mm256_sub_epi32 (a, b));
+        __m256i w23 = weightsAvx2 (_mm256_sub_epi32 (b, c), c);
+        __m256i out[3];
+
+        for (guint k = 0; k < 3; k++) {
+            __m256i v = _mm256_add_epi32 (_mm256_madd_epi16 (pairAvx2 (c0, c1, k), w01),
+                                          _mm256_madd_epi16 (pairAvx2 (c2, c3, k), w23));
+
+            out[k] = _mm256_srli_epi32 (_mm256_add_epi32 (v, round), 10);
+        }
+        p = _mm256_or_si256 (_mm256_and_si256 (p, keep),
+                _mm256_or_si256 (_mm256_sll_epi32 (out[0], shift0),
+                        _mm256_or_si256 (_mm256_sll_epi32 (out[1], shift1),
+                                         _mm256_sll_epi32 (out[2], shift2))));
+        _mm256_storeu_si256 ((__m256i*) (pixels + i), p);
+    }
+    tetrahedralScalar (lut, pixels + i, count - i, shift);
+}
+
+static AVX2 void trilinearAvx2 (const Lut3d* lut, guint32* pixels, gint count,
+                                const guint shift[3]) {
+    const int* table = (const int*) lut->table;
+    const gint s1 = (gint) lut->stride;
+    const gint s2 = s1 * s1;
+    const __m128i shift0 = _mm_cvtsi32_si128 ((int) shift[0]);
+    const __m128i shift1 = _mm_cvtsi32_si128 ((int) shift[1]);
+    const __m128i shift2 = _mm_cvtsi32_si128 ((int) shift[2]);
+    const __m256i byte = _mm256_set1_epi32 (0xFF);
+    const __m256i scale = _mm256_set1_epi32 ((int) lut->scale);
+    const __m256i step1 = _mm256_set1_epi32 (s1);
+    const __m256i step2 = _mm256_set1_epi32 (s2);
+    const __m256i one = _mm256_set1_epi32 (1);
+    const __m256i full = _mm256_set1_epi32 (256);
+    const __m256i round = _mm256_set1_epi32 (8192);
+    const __m256i keep = _mm256_set1_epi32 ((int) keepMask (shift));
+    gint i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m256i p = _mm256_loadu_si256 ((const __m256i*) (pixels + i));
+        __m256i pr = _mm256_mullo_epi32 (_mm256_and_si256 (_mm256_srl_epi32 (p, shift0), byte), scale);
+        __m256i pg = _mm256_mullo_epi32 (_mm256_and_si256 (_mm256_srl_epi32 (p, shift1), byte), scale);
+        __m256i pb = _mm256_mullo_epi32 (_mm256_and_si256 (_mm256_srl_epi32 (p, shift2), byte), scale);
+        __m256i c000 = _mm256_add_epi32 (_mm256_srli_epi32 (pr, 16),
+                _mm256_add_epi32 (_mm256_mullo_epi32 (_mm256_srli_epi32 (pg, 16), step1),
+                                  _mm256_mullo_epi32 (_mm256_srli_epi32 (pb, 16), step2)));
+        __m256i c010 = _mm256_add_epi32 (c000, step1);
+        __m256i c001 = _mm256_add_epi32 (c000, step2);
+        __m256i c011 = _mm256_add_epi32 (c010, step2);
+        __m256i fr = _mm256_and_si256 (_mm256_srli_epi32 (pr, 8), byte);
+        __m256i fg = _mm256_and_si256 (_mm256_srli_epi32 (pg, 8), byte);
+        __m256i fb = _mm256_and_si256 (_mm256_srli_epi32 (pb, 8), byte);
+        __m256i wr = weightsAvx2 (_mm256_sub_epi32 (full, fr), fr);
+        __m256i wg = weightsAvx2 (_mm256_sub_epi32 (full, fg), fg);
+        __m256i wb = weightsAvx2 (_mm256_sub_epi32 (full, fb), fb);
+        __m256i e[8];
+        __m256i out[3];
+
+        e[0] = _mm256_i32gather_epi32 (table, c000, 4);
+        e[1] = _mm256_i32gather_epi32 (table, _mm256_add_epi32 (c000, one), 4);
+        e[2] = _mm256_i32gather_epi32 (table, c010, 4);
+        e[3] = _mm256_i32gather_epi32 (table, _mm256_add_epi32 (c010, one), 4);
+        e[4] = _mm256_i32gather_epi32 (table, c001, 4);
+        e[5] = _mm256_i32gather_epi32 (table, _mm256_add_epi32 (c001, one), 4);
+        e[6] = _mm256_i32gather_epi32 (table, c011, 4);
+        e[7] = _mm256_i32gather_epi32 (table, _mm256_add_epi32 (c011, one), 4);
+
+        for (guint k = 0; k < 3; k++) {
+            __m256i x00 = _mm256_srli_epi32 (_mm256_madd_epi16 (pairAvx2 (e[0], e[1], k), wr), 4);
+            __m256i x10 = _mm256_srli_epi32 (_mm256_madd_epi16 (pairAvx2 (e[2], e[3], k), wr), 4);
+            __m256i x01 = _mm256_srli_epi32 (_mm256_madd_epi16 (pairAvx2 (e[4], e[5], k), wr), 4);
+            __m256i x11 = _mm256_srli_epi32 (_mm256_madd_epi16 (pairAvx2 (e[6], e[7], k), wr), 4);
+            __m256i y0 = _mm256_srli_epi32 (_mm256_madd_epi16 (weightsAvx2 (x00, x10), wg), 8);
+            __m256i y1 = _mm256_srli_epi32 (_mm256_madd_epi16 (weightsAvx2 (x01, x11), wg), 8);
+            __m256i v = _mm256_madd_epi16 (weightsAvx2 (y0, y1), wb);
+
+            out[k] = _mm256_srli_epi32 (_mm256_add_epi32 (v, round), 14);
+        }
+        p = _mm256_or_si256 (_mm256_and_si256 (p, keep),
+                _mm256_or_si256 (_mm256_sll_epi32 (out[0], shift0),
+                        _mm256_or_si256 (_mm256_sll_epi32 (out[1], shift1),
+                                         _mm256_sll_epi32 (out[2], shift2))));
+        _mm256_storeu_si256 ((__m256i*) (pixels + i), p);
+    }
+    trilinearScalar (lut, pixels + i, count - i, shift);
+}
+
+/* SSE4.1 has no gather; the four loads are done one by one */
+static inline SSE41 __m128i gatherSse41 (const guint32* table, __m128i index) {
+    return _mm_set_epi32 ((int) table[_mm_extract_epi32 (index, 3)],
+                          (int) table[_mm_extract_epi32 (index, 2)],
+                          (int) table[_mm_extract_epi32 (index, 1)],
+                          (int) table[_mm_cvtsi128_si32 (index)]);
+}
+
+static inline SSE41 __m128i pairSse41 (__m128i lo, __m128i hi, guint k) {
+    const __m128i mask = _mm_set1_epi32 (ENTRY_MASK);
+    const __m128i maskHigh = _mm_set1_epi32 (ENTRY_MASK << 16);
+
+    switch (k) {
+    case 0:
+        return _mm_or_si128 (_mm_and_si128 (lo, mask),
+                             _mm_and_si128 (_mm_slli_epi32 (hi, 16), maskHigh));
+    case 1:
+        return _mm_or_si128 (_mm_and_si128 (_mm_srli_epi32 (lo, 10), mask),
+                             _mm_and_si128 (_mm_slli_epi32 (hi, 6), maskHigh));
+    default:
+        return _mm_or_si128 (_mm_and_si128 (_mm_srli_epi32 (lo, 20), mask),
+                             _mm_and_si128 (_mm_srli_epi32 (hi, 4), maskHigh));
+    }
+}
+
+static inline SSE41 __m128i weightsSse41 (__m128i w0, __m128i w1) {
+    return _mm_or_si128 (w0, _mm_slli_epi32 (w1, 16));
+}
+
+static SSE41 void tetrahedralSse41 (const Lut3d* lut, guint32* pixels, gint count,
+                                    const guint shift[3]) {
+    const guint32* table = lut->table;
+    const gint s1 = (gint) lut->stride;
+    const gint s2 = s1 * s1;
+    const __m128i shift0 = _mm_cvtsi32_si128 ((int) shift[0]);
+    const __m128i shift1 = _mm_cvtsi32_si128 ((int) shift[1]);
+    const __m128i shift2 = _mm_cvtsi32_si128 ((int) shift[2]);
+    const __m128i byte = _mm_set1_epi32 (0xFF);
+    const __m128i scale = _mm_set1_epi32 ((int) lut->scale);
+    const __m128i step1 = _mm_set1_epi32 (s1);
+    const __m128i step2 = _mm_set1_epi32 (s2);
+    const __m128i one = _mm_set1_epi32 (1);
+    const __m128i corner = _mm_set1_epi32 (1 + s1 + s2);
+    const __m128i full = _mm_set1_epi32 (256);
+    const __m128i round = _mm_set1_epi32 (512);
+    const __m128i keep = _mm_set1_epi32 ((int) keepMask (shift));
+    gint i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m128i p = _mm_loadu_si128 ((const __m128i*) (pixels + i));
+        __m128i pr = _mm_mullo_epi32 (_mm_and_si128 (_mm_srl_epi32 (p, shift0), byte), scale);
+        __m128i pg = _mm_mullo_epi32 (_mm_and_si128 (_mm_srl_epi32 (p, shift1), byte), scale);
+        __m128i pb = _mm_mullo_epi32 (_mm_and_si128 (_mm_srl_epi32 (p, shift2), byte), scale);
+        __m128i base = _mm_add_epi32 (_mm_srli_epi32 (pr, 16),
+                _mm_add_epi32 (_mm_mullo_epi32 (_mm_srli_epi32 (pg, 16), step1),
+                               _mm_mullo_epi32 (_mm_srli_epi32 (pb, 16), step2)));
+        __m128i fr = _mm_and_si128 (_mm_srli_epi32 (pr, 8), byte);
+        __m128i fg = _mm_and_si128 (_mm_srli_epi32 (pg, 8), byte);
+        __m128i fb = _mm_and_si128 (_mm_srli_epi32 (pb, 8), byte);
+        __m128i a = _mm_max_epi32 (fr, _mm_max_epi32 (fg, fb));
+        __m128i c = _mm_min_epi32 (fr, _mm_min_epi32 (fg, fb));
+        __m128i b = _mm_sub_epi32 (_mm_add_epi32 (fr, _mm_add_epi32 (fg, fb)),
+                                   _mm_add_epi32 (a, c));
+        __m128i rNotMax = _mm_or_si128 (_mm_cmpgt_epi32 (fg, fr), _mm_cmpgt_epi32 (fb, fr));
+        __m128i rNotMin = _mm_or_si128 (_mm_cmpgt_epi32 (fr, fg), _mm_cmpgt_epi32 (fr, fb));
+        __m128i first = _mm_blendv_epi8 (one,
+                _mm_blendv_epi8 (step1, step2, _mm_cmpgt_epi32 (fb, fg)), rNotMax);
+        __m128i last = _mm_blendv_epi8 (one,
+                _mm_blendv_epi8 (step1, step2, _mm_cmpgt_epi32 (fg, fb)), rNotMin);
+        __m128i c0 = gatherSse41 (table, base);
+        __m128i c1 = gatherSse41 (table, _mm_add_epi32 (base, first));
+        __m128i c2 = gatherSse41 (table, _mm_add_epi32 (base, _mm_sub_epi32 (corner, last)));
+        __m128i c3 = gatherSse41 (table, _mm_add_epi32 (base, corner));
+        __m128i w01 = weightsSse41 (_mm_sub_epi32 (full, a), _mm_sub_epi32 (a, b));
+        __m128i w23 = weightsSse41 (_mm_sub_epi32 (b, c), c);
+        __m128i out[3];
+
+        for (guint k = 0; k < 3; k++) {
+            __m128i v = _mm_add_epi32 (_mm_madd_epi16 (pairSse41 (c0, c1, k), w01),
+                                       _mm_madd_epi16 (pairSse41 (c2, c3, k), w23));
+
+            out[k] = _mm_srli_epi32 (_mm_add_epi32 (v, round), 10);
+        }
+        p = _mm_or_si128 (_mm_and_si128 (p, keep),
+                _mm_or_si128 (_mm_sll_epi32 (out[0], shift0),
+                        _mm_or_si128 (_mm_sll_epi32 (out[1], shift1),
+                                      _mm_sll_epi32 (out[2], shift2))));
+        _mm_storeu_si128 ((__m128i*) (pixels + i), p);
+    }
+    tetrahedralScalar (lut, pixels + i, count - i, shift);
+}
+
+static SSE41 void trilinearSse41 (const Lut3d* lut, guint32* pixels, gint count,
+                                  const guint shift[3]) {
+    const guint32* table = lut->table;
+    const gint s1 = (gint) lut->stride;
+    const gint s2 = s1 * s1;
+    const __m128i shift0 = _mm_cvtsi32_si128 ((int) shift[0]);
+    const __m128i shift1 = _mm_cvtsi32_si128 ((int) shift[1]);
+    const __m128i shift2 = _mm_cvtsi32_si128 ((int) shift[2]);
+    const __m128i byte = _mm_set1_epi32 (0xFF);
+    const __m128i scale = _mm_set1_epi32 ((int) lut->scale);
+    const __m128i step1 = _mm_set1_epi32 (s1);
+    const __m128i step2 = _mm_set1_epi32 (s2);
+    const __m128i one = _mm_set1_epi32 (1);
+    const __m128i full = _mm_set1_epi32 (256);
+    const __m128i round = _mm_set1_epi32 (8192);
+    const __m128i keep = _mm_set1_epi32 ((int) keepMask (shift));
+    gint i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m128i p = _mm_loadu_si128 ((const __m128i*) (pixels + i));
+        __m128i pr = _mm_mullo_epi32 (_mm_and_si128 (_mm_srl_epi32 (p, shift0), byte), scale);
+        __m128i pg = _mm_mullo_epi32 (_mm_and_si128 (_mm_srl_epi32 (p, shift1), byte), scale);
+        __m128i pb = _mm_mullo_epi32 (_mm_and_si128 (_mm_srl_epi32 (p, shift2), byte), scale);
+        __m128i c000 = _mm_add_epi32 (_mm_srli_epi32 (pr, 16),
+                _mm_add_epi32 (_mm_mullo_epi32 (_mm_srli_epi32 (pg, 16), step1),
+                               _mm_mullo_epi32 (_mm_srli_epi32 (pb, 16), step2)));
+        __m128i c010 = _mm_add_epi32 (c000, step1);
+        __m128i c001 = _mm_add_epi32 (c000, step2);
+        __m128i c011 = _mm_add_epi32 (c010, step2);
+        __m128i fr = _mm_and_si128 (_mm_srli_epi32 (pr, 8), byte);
+        __m128i fg = _mm_and_si128 (_mm_srli_epi32 (pg, 8), byte);
+        __m128i fb = _mm_and_si128 (_mm_srli_epi32 (pb, 8), byte);
+        __m128i wr = weightsSse41 (_mm_sub_epi32 (full, fr), fr);
+        __m128i wg = weightsSse41 (_mm_sub_epi32 (full, fg), fg);
+        __m128i wb = weightsSse41 (_mm_sub_epi32 (full, fb), fb);
+        __m128i e[8];
+        __m128i out[3];
+
+        e[0] = gatherSse41 (table, c000);
+        e[1] = gatherSse41 (table, _mm_add_epi32 (c000, one));
+        e[2] = gatherSse41 (table, c010);
+        e[3] = gatherSse41 (table, _mm_add_epi32 (c010, one));
+        e[4] = gatherSse41 (table, c001);
+        e[5] = gatherSse41 (table, _mm_add_epi32 (c001, one));
+        e[6] = gatherSse41 (table, c011);
+        e[7] = gatherSse41 (table, _mm_add_epi32 (c011, one));
+
+        for (guint k = 0; k < 3; k++) {
+            __m128i x00 = _mm_srli_epi32 (_mm_madd_epi16 (pairSse41 (e[0], e[1], k), wr), 4);
+            __m128i x10 = _mm_srli_epi32 (_mm_madd_epi16 (pairSse41 (e[2], e[3], k), wr), 4);
+            __m128i x01 = _mm_srli_epi32 (_mm_madd_epi16 (pairSse41 (e[4], e[5], k), wr), 4);
+            __m128i x11 = _mm_srli_epi32 (_mm_madd_epi16 (pairSse41 (e[6], e[7], k), wr), 4);
+            __m128i y0 = _mm_srli_epi32 (_mm_madd_epi16 (weightsSse41 (x00, x10), wg), 8);
+            __m128i y1 = _mm_srli_epi32 (_mm_madd_epi16 (weightsSse41 (x01, x11), wg), 8);
+            __m128i v = _mm_madd_epi16 (weightsSse41 (y0, y1), wb);
+
+            out[k] = _mm_srli_epi32 (_mm_add_epi32 (v, round), 14);
+        }
+        p = _mm_or_si128 (_mm_and_si128 (p, keep),
+                _mm_or_si128 (_mm_sll_epi32 (out[0], shift0),
+                        _mm_or_si128 (_mm_sll_epi32 (out[1], shift1),
+                                      _mm_sll_epi32 (out[2], shift2))));
+        _mm_storeu_si128 ((__m128i*) (pixels + i), p);
+    }
+    trilinearScalar (lut, pixels + i, count - i, shift);
+}
+
+#endif
+
+static LutKernel detectBestKernel (void) {
+#ifdef LUT_X86
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx2")) {
+        return LUT_KERNEL_AVX2;
+    }
+    if (__builtin_cpu_supports ("sse4.1")) {
+        return LUT_KERNEL_SSE41;
+    }
+#endif
+    return LUT_KERNEL_SCALAR;
+}
+
+/* The fastest kernel this CPU runs. Detected once, as lut3dApply() clamps
+ * to it on every row. */
+LutKernel lut3dBestKernel (void) {
+    static gsize best = 0;
+
+    /* Kept plus one, since g_once_init_leave() takes no 0 */
+    if (g_once_init_enter (&best)) {
+        g_once_init_leave (&best, (gsize) detectBestKernel() + 1);
+    }
+    return (LutKernel) (best - 1);
+}
+
+const gchar* lut3dKernelName (LutKernel kernel) {
+    static const gchar* names[] = { "scalar", "sse4.1", "avx2" };
+
+    return names[kernel];
+}
+
+/* Grades count pixels in place, each a native endian word with the three
+ * components at the given bit positions. Other bits are kept. A kernel the
+ * CPU does not run is replaced by the best one it does. */
+void lut3dApply (const Lut3d* lut, LutInterpolation interpolation, LutKernel kernel,
+                 guint32* pixels, gint count, const guint shift[3]) {
+    gboolean tetrahedral = interpolation == LUT_INTERPOLATION_TETRAHEDRAL;
+
+    kernel = MIN (kernel, lut3dBestKernel());
+    switch (kernel) {
+#ifdef LUT_X86
+    case LUT_KERNEL_AVX2:
+        (tetrahedral ? tetrahedralAvx2 : trilinearAvx2) (lut, pixels, count, shift);
+        break;
+    case LUT_KERNEL_SSE41:
+        (tetrahedral ? tetrahedralSse41 : trilinearSse41) (lut, pixels, count, shift);
+        break;
+#endif
+    default:
+        (tetrahedral ? tetrahedralScalar : trilinearScalar) (lut, pixels, count, shift);
+        break;
+    }
+}
+
+/* Gathers each row into words for the kernels and scatters the result back.
+ * With subsampled chroma, all rows of a block are graded with the chroma as
+ * it was, and the block takes its new chroma from its top left pixel. */
+static void applyPlanar (const Lut3d* lut, LutInterpolation interpolation, LutKernel kernel,
+                         const LutImage* image) {
+    static const guint shift[3] = { 0, 8, 16 };
+    const gint* ps = image->pixelStride;
+    guint sx = image->subsampleX;
+    guint sy = image->subsampleY;
+    gint chromaWidth = (image->width + (1 << sx) - 1) >> sx;
+    guint32* first = g_new (guint32, image->width);
+    guint32* row = g_new (guint32, image->width);
+
+    for (gint cy = 0; (cy << sy) < image->height; cy++) {
+        guint8* u = image->data[1] + cy * image->stride[1];
+        guint8* v = image->data[2] + cy * image->stride[2];
+
+        for (gint line = 0; line < (1 << sy) && (cy << sy) + line < image->height; line++) {
+            guint8* y = image->data[0] + ((cy << sy) + line) * image->stride[0];
+            guint32* words = line == 0 ? first : row;
+
+            for (gint x = 0; x < image->width; x++) {
+                words[x] = (guint32) y[x * ps[0]] | (guint32) u[(x >> sx) * ps[1]] << 8 |
+                           (guint32) v[(x >> sx) * ps[2]] << 16;
+            }
+            lut3dApply (lut, interpolation, kernel, words, image->width, shift);
+            for (gint x = 0; x < image->width; x++) {
+                y[x * ps[0]] = (guint8) words[x];
+            }
+        }
+        for (gint x = 0; x < chromaWidth; x++) {
+            u[x * ps[1]] = (guint8) (first[x << sx] >> 8);
+            v[x * ps[2]] = (guint8) (first[x << sx] >> 16);
+        }
+    }
+    g_free (first);
+    g_free (row);
+}
+
+void lut3dApplyImage (const Lut3d* lut, LutInterpolation interpolation, LutKernel kernel,
+                      const LutImage* image) {
+    if (image->layout == LUT_LAYOUT_PLANAR) {
+        applyPlanar (lut, interpolation, kernel, image);
+        return;
+    }
+    for (gint y = 0; y < image->height; y++) {
+        lut3dApply (lut, interpolation, kernel,
+                (guint32*) (image->data[0] + y * image->stride[0]), image->width, image->shift);
+    }
+}
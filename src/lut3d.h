@@ -0,0 +1,47 @@
+#pragma once
+#include <glib.h>
+#include "gst-backend.h"
+
+/* A 3D colour lookup table from an Adobe/Resolve .cube file, applied to 8-bit
+ * frames by vectorised kernels. Tables are immutable once built and shared
+ * by reference between threads. */
+typedef struct _Lut3d Lut3d;
+
+/* The instruction sets the kernels are written for, slowest first */
+typedef enum _LutKernel {
+    LUT_KERNEL_SCALAR,
+    LUT_KERNEL_SSE41,
+    LUT_KERNEL_AVX2
+} LutKernel;
+
+typedef enum _LutLayout {
+    LUT_LAYOUT_PACKED,          /* one 32-bit word per pixel, e.g. RGBx or AYUV */
+    LUT_LAYOUT_PLANAR           /* a plane per component or interleaved chroma, e.g. I420 or NV12 */
+} LutLayout;
+
+/* An 8-bit frame as the kernels see it. Components are in the order of the
+ * table: R, G, B or Y, U, V. */
+typedef struct _LutImage {
+    LutLayout layout;
+    gint   width;
+    gint   height;
+    guint8* data[3];            /* first sample of each component; packed uses data[0] */
+    gint   stride[3];           /* bytes from one row to the next */
+    gint   pixelStride[3];      /* planar: bytes from one sample to the next */
+    guint  shift[3];            /* packed: bit position of each component in a native word */
+    guint  subsampleX;          /* planar: log2 of the chroma subsampling */
+    guint  subsampleY;
+} LutImage;
+
+Lut3d*       lut3dLoad (const gchar* path, GError** error);
+Lut3d*       lut3dNewFromGrid (guint size, const gfloat* rgb);
+Lut3d*       lut3dToYuv (const Lut3d* rgb, gdouble kr, gdouble kb, gboolean fullRange);
+Lut3d*       lut3dRef (Lut3d* lut);
+void         lut3dUnref (Lut3d* lut);
+guint        lut3dGetSize (const Lut3d* lut);
+LutKernel    lut3dBestKernel (void);
+const gchar* lut3dKernelName (LutKernel kernel);
+void         lut3dApply (const Lut3d* lut, LutInterpolation interpolation, LutKernel kernel,
+                         guint32* pixels, gint count, const guint shift[3]);
+void         lut3dApplyImage (const Lut3d* lut, LutInterpolation interpolation,
+                              LutKernel kernel, const LutImage* image);
@@ -0,0 +1,305 @@
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gst/video/gstvideofilter.h>
+#include <string.h>
+#include "lutfilter.h"
+
+#define LUT_TYPE_FILTER (lutFilter_get_type())
+#define LUT_FILTER(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), LUT_TYPE_FILTER, LutFilter))
+
+typedef struct _LutFilter {
+    GstVideoFilter parent;
+    /* Under the object lock, set from any thread */
+    Lut3d* lut;
+    LutInterpolation interpolation;
+    gchar* location;
+    gboolean supported;         /* the negotiated format is one the kernels take */
+    /* The streaming thread's, set up by setInfo() */
+    LutImage image;             /* the layout of a frame; data and strides come per frame */
+    gboolean yuv;
+    gdouble kr;
+    gdouble kb;
+    gboolean fullRange;
+    Lut3d* yuvSource;           /* the LUT yuvLut was derived from */
+    Lut3d* yuvLut;
+    LutKernel kernel;
+} LutFilter;
+
+typedef struct _LutFilterClass {
+    GstVideoFilterClass parent;
+} LutFilterClass;
+
+enum {
+    PROP_0,
+    PROP_LOCATION,
+    PROP_INTERPOLATION
+};
+
+G_DEFINE_TYPE (LutFilter, lutFilter, GST_TYPE_VIDEO_FILTER)
+
+/* The formats are checked in setInfo(), so that anything else, GL memory
+ * included, can pass through rather than fail to link */
+static GstStaticPadTemplate sinkTemplate = GST_STATIC_PAD_TEMPLATE ("sink",
+        GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS ("video/x-raw(ANY)"));
+
+static GstStaticPadTemplate srcTemplate = GST_STATIC_PAD_TEMPLATE ("src",
+        GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS ("video/x-raw(ANY)"));
+
+static GType interpolationGetType (void) {
+    static gsize type = 0;
+    static const GEnumValue values[] = {
+        { LUT_INTERPOLATION_TETRAHEDRAL, "Tetrahedral", "tetrahedral" },
+        { LUT_INTERPOLATION_TRILINEAR, "Trilinear", "trilinear" },
+        { 0, NULL, NULL }
+    };
+
+    if (g_once_init_enter (&type)) {
+        g_once_init_leave (&type, g_enum_register_static ("GlieseLutInterpolation", values));
+    }
+    return type;
+}
+
+/* Passes frames through without mapping them while there is nothing to do */
+static void updatePassthrough (LutFilter* self) {
+    gboolean passthrough;
+
+    GST_OBJECT_LOCK (self);
+    passthrough = !self->lut || !self->supported;
+    GST_OBJECT_UNLOCK (self);
+    gst_base_transform_set_passthrough (GST_BASE_TRANSFORM (self), passthrough);
+}
+
+void lutFilterSetLut (GstElement* filter, Lut3d* lut, LutInterpolation interpolation) {
+    LutFilter* self = LUT_FILTER (filter);
+    Lut3d* old;
+
+    GST_OBJECT_LOCK (self);
+    old = self->lut;
+    self->lut = lut ? lut3dRef (lut) : NULL;
+    self->interpolation = interpolation;
+    GST_OBJECT_UNLOCK (self);
+    lut3dUnref (old);
+    updatePassthrough (self);
+}
+
+static void setProperty (GObject* object, guint id, const GValue* value, GParamSpec* pspec) {
+    LutFilter* self = LUT_FILTER (object);
+    const gchar* location;
+    Lut3d* lut = NULL;
+    GError* error = NULL;
+
+    switch (id) {
+    case PROP_LOCATION:
+        location = g_value_get_string (value);
+        if (location) {
+            lut = lut3dLoad (location, &error);
+            if (!lut) {
+                GST_WARNING_OBJECT (self, "%s", error->message);
+                g_error_free (error);
+            }
+        }
+        GST_OBJECT_LOCK (self);
+        g_free (self->location);
+        self->location = g_strdup (location);
+        GST_OBJECT_UNLOCK (self);
+        lutFilterSetLut (GST_ELEMENT (self), lut, self->interpolation);
+        lut3dUnref (lut);
+        break;
+    case PROP_INTERPOLATION:
+        GST_OBJECT_LOCK (self);
+        self->interpolation = g_value_get_enum (value);
+        GST_OBJECT_UNLOCK (self);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, id, pspec);
+        break;
+    }
+}
+
+static void getProperty (GObject* object, guint id, GValue* value, GParamSpec* pspec) {
+    LutFilter* self = LUT_FILTER (object);
+
+    GST_OBJECT_LOCK (self);
+    switch (id) {
+    case PROP_LOCATION:
+        g_value_set_string (value, self->location);
+        break;
+    case PROP_INTERPOLATION:
+        g_value_set_enum (value, self->interpolation);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, id, pspec);
+        break;
+    }
+    GST_OBJECT_UNLOCK (self);
+}
+
+static void clearYuvLut (LutFilter* self) {
+    g_clear_pointer (&self->yuvSource, lut3dUnref);
+    g_clear_pointer (&self->yuvLut, lut3dUnref);
+}
+
+static void finalize (GObject* object) {
+    LutFilter* self = LUT_FILTER (object);
+
+    lut3dUnref (self->lut);
+    clearYuvLut (self);
+    g_free (self->location);
+    G_OBJECT_CLASS (lutFilter_parent_class)->finalize (object);
+}
+
+/* Bit position of a byte of a pixel in a native endian word */
+static guint byteShift (guint offset) {
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+    return offset * 8;
+#else
+    return (3 - offset) * 8;
+#endif
+}
+
+/* Works out whether and how the kernels can take the negotiated frames */
+static gboolean setInfo (GstVideoFilter* filter, GstCaps* incaps, GstVideoInfo* inInfo,
+                         GstCaps* outcaps, GstVideoInfo* outInfo) {
+    LutFilter* self = LUT_FILTER (filter);
+    GstCapsFeatures* features = gst_caps_get_features (incaps, 0);
+    const GstVideoFormatInfo* format = inInfo->finfo;
+    LutImage* image = &self->image;
+    gboolean supported = TRUE;
+    UNUSED (outcaps);
+    UNUSED (outInfo);
+
+    memset (image, 0, sizeof (LutImage));
+    switch (GST_VIDEO_INFO_FORMAT (inInfo)) {
+    case GST_VIDEO_FORMAT_RGBx:
+    case GST_VIDEO_FORMAT_BGRx:
+    case GST_VIDEO_FORMAT_xRGB:
+    case GST_VIDEO_FORMAT_xBGR:
+    case GST_VIDEO_FORMAT_RGBA:
+    case GST_VIDEO_FORMAT_BGRA:
+    case GST_VIDEO_FORMAT_ARGB:
+    case GST_VIDEO_FORMAT_ABGR:
+    case GST_VIDEO_FORMAT_AYUV:
+        image->layout = LUT_LAYOUT_PACKED;
+        for (guint c = 0; c < 3; c++) {
+            image->shift[c] = byteShift (GST_VIDEO_INFO_COMP_POFFSET (inInfo, c));
+        }
+        break;
+    case GST_VIDEO_FORMAT_I420:
+    case GST_VIDEO_FORMAT_YV12:
+    case GST_VIDEO_FORMAT_Y42B:
+    case GST_VIDEO_FORMAT_Y444:
+    case GST_VIDEO_FORMAT_NV12:
+    case GST_VIDEO_FORMAT_NV21:
+    case GST_VIDEO_FORMAT_GBR:
+        image->layout = LUT_LAYOUT_PLANAR;
+        image->subsampleX = GST_VIDEO_FORMAT_INFO_W_SUB (format, 1);
+        image->subsampleY = GST_VIDEO_FORMAT_INFO_H_SUB (format, 1);
+        break;
+    default:
+        supported = FALSE;
+        break;
+    }
+    if (features && !gst_caps_features_contains (features, GST_CAPS_FEATURE_MEMORY_SYSTEM_MEMORY)) {
+        supported = FALSE;
+    }
+
+    self->yuv = GST_VIDEO_INFO_IS_YUV (inInfo);
+    self->fullRange = inInfo->colorimetry.range == GST_VIDEO_COLOR_RANGE_0_255;
+    if (!gst_video_color_matrix_get_Kr_Kb (inInfo->colorimetry.matrix, &self->kr, &self->kb)) {
+        /* Unspecified: what the stream's size suggests */
+        gst_video_color_matrix_get_Kr_Kb (GST_VIDEO_INFO_HEIGHT (inInfo) > 576
+                ? GST_VIDEO_COLOR_MATRIX_BT709 : GST_VIDEO_COLOR_MATRIX_BT601,
+                &self->kr, &self->kb);
+    }
+    clearYuvLut (self);
+    self->kernel = lut3dBestKernel();
+
+    GST_OBJECT_LOCK (self);
+    self->supported = supported;
+    GST_OBJECT_UNLOCK (self);
+    updatePassthrough (self);
+    return TRUE;
+}
+
+static GstFlowReturn transformFrame (GstVideoFilter* filter, GstVideoFrame* frame) {
+    LutFilter* self = LUT_FILTER (filter);
+    LutImage image = self->image;
+    LutInterpolation interpolation;
+    Lut3d* lut;
+
+    GST_OBJECT_LOCK (self);
+    lut = self->lut ? lut3dRef (self->lut) : NULL;
+    interpolation = self->interpolation;
+    GST_OBJECT_UNLOCK (self);
+    if (!lut) {
+        return GST_FLOW_OK;
+    }
+
+    /* YUV frames are graded through a table of their own, built once per
+     * LUT and matrix rather than converting every pixel to RGB and back */
+    if (self->yuv) {
+        if (self->yuvSource != lut) {
+            clearYuvLut (self);
+            self->yuvSource = lut3dRef (lut);
+            self->yuvLut = lut3dToYuv (lut, self->kr, self->kb, self->fullRange);
+        }
+        if (!self->yuvLut) {
+            lut3dUnref (lut);
+            return GST_FLOW_OK;
+        }
+    }
+
+    image.width = GST_VIDEO_FRAME_WIDTH (frame);
+    image.height = GST_VIDEO_FRAME_HEIGHT (frame);
+    if (image.layout == LUT_LAYOUT_PACKED) {
+        image.data[0] = GST_VIDEO_FRAME_PLANE_DATA (frame, 0);
+        image.stride[0] = GST_VIDEO_FRAME_PLANE_STRIDE (frame, 0);
+    } else {
+        for (guint c = 0; c < 3; c++) {
+            image.data[c] = GST_VIDEO_FRAME_COMP_DATA (frame, c);
+            image.stride[c] = GST_VIDEO_FRAME_COMP_STRIDE (frame, c);
+            image.pixelStride[c] = GST_VIDEO_FRAME_COMP_PSTRIDE (frame, c);
+        }
+    }
+    lut3dApplyImage (self->yuv ? self->yuvLut : lut, interpolation, self->kernel, &image);
+    lut3dUnref (lut);
+    return GST_FLOW_OK;
+}
+
+static void lutFilter_class_init (LutFilterClass* klass) {
+    GObjectClass* objectClass = G_OBJECT_CLASS (klass);
+    GstElementClass* elementClass = GST_ELEMENT_CLASS (klass);
+    GstBaseTransformClass* transformClass = GST_BASE_TRANSFORM_CLASS (klass);
+    GstVideoFilterClass* filterClass = GST_VIDEO_FILTER_CLASS (klass);
+
+    objectClass->set_property = setProperty;
+    objectClass->get_property = getProperty;
+    objectClass->finalize = finalize;
+
+    g_object_class_install_property (objectClass, PROP_LOCATION,
+            g_param_spec_string ("location", "Location", "A .cube file to grade with",
+                    NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property (objectClass, PROP_INTERPOLATION,
+            g_param_spec_enum ("interpolation", "Interpolation",
+                    "How the table is sampled between its grid points",
+                    interpolationGetType(), LUT_INTERPOLATION_TETRAHEDRAL,
+                    G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    gst_element_class_set_static_metadata (elementClass, "3D LUT", "Filter/Effect/Video",
+            "Grades video through a 3D colour lookup table", "Project Gliese");
+    gst_element_class_add_static_pad_template (elementClass, &sinkTemplate);
+    gst_element_class_add_static_pad_template (elementClass, &srcTemplate);
+
+    transformClass->transform_ip_on_passthrough = FALSE;
+    filterClass->set_info = setInfo;
+    filterClass->transform_frame_ip = transformFrame;
+}
+
+static void lutFilter_init (LutFilter* self) {
+    self->interpolation = LUT_INTERPOLATION_TETRAHEDRAL;
+    gst_base_transform_set_passthrough (GST_BASE_TRANSFORM (self), TRUE);
+}
+
+void lutFilterRegister (void) {
+    gst_element_register (NULL, "glieselut", GST_RANK_NONE, LUT_TYPE_FILTER);
+}
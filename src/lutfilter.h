@@ -0,0 +1,11 @@
+#pragma once
+#include <gst/gst.h>
+#include "gst-backend.h"
+#include "lut3d.h"
+
+/* "glieselut": a video filter that grades frames in place through a 3D LUT.
+ * Takes packed RGB and AYUV as well as planar and semi-planar YUV in system
+ * memory, and passes anything else through untouched, as it does while no
+ * LUT is set. Registered with the process by lutFilterRegister(). */
+void lutFilterRegister (void);
+void lutFilterSetLut (GstElement* filter, Lut3d* lut, LutInterpolation interpolation);
@@ -0,0 +1,608 @@
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gst/video/videooverlay.h>
+#include <gst/video/navigation.h>
+#include <math.h>
+#include <string.h>
+#include "mosaic.h"
+
+/* Multi-feed mosaic. Every feed gets a uridecodebin whose video goes straight
+ * into one compositor, which scales it into its tile, and whose audio goes
+ * into one audiomixer. Both run on the pipeline clock and feed a single pair
+ * of sinks, so N feeds cost one render path instead of N. Only the focused
+ * tile is heard. The others can be decoded at reduced resolution, without
+ * non-reference frames or keyframes only, which keeps the decoding cost of a
+ * large wall close to linear in the number of tiles. */
+
+/* The largest canvas; it shrinks to the surface showing it */
+#define CANVAS_WIDTH  1920
+#define CANVAS_HEIGHT 1080
+
+typedef struct _MosaicTile {
+    Mosaic*     mosaic;
+    guint       index;
+    gchar*      uri;
+    GstElement* source;         /* uridecodebin */
+    GstElement* audioConvert;   /* added once the source exposes audio */
+    GstElement* audioResample;
+    GstPad*     videoPad;       /* compositor sink pad */
+    GstPad*     audioPad;       /* audiomixer sink pad */
+    GstElement* decoder;        /* the video decoder, once plugged */
+    gint        focused;        /* atomic, read in the decoder's streaming thread */
+    gint        waitKeyframe;   /* atomic, set once delta frames were dropped */
+    gboolean    dropped;
+} MosaicTile;
+
+struct _Mosaic {
+    GstElement* pipeline;
+    GstElement* compositor;
+    GstElement* audioMixer;
+    GstElement* volume;
+    GstElement* canvas;         /* capsfilter setting the compositor's output size */
+    gint        canvasWidth;    /* atomic, also read in the decoders' streaming threads */
+    gint        canvasHeight;
+    GMutex      lock;           /* guards the pads, decoders and focus of the tiles */
+    MosaicTile* tiles;
+    guint       count;
+    guint       columns;
+    guint       rows;
+    guint       focus;
+    gint        unfocused;      /* atomic, a MosaicDecode */
+    guintptr    window;
+};
+
+static gboolean hasProperty (gpointer object, const gchar* name) {
+    return g_object_class_find_property (G_OBJECT_GET_CLASS (object), name) != NULL;
+}
+
+static gboolean isVideoDecoder (GstElement* element) {
+    GstElementFactory* factory = gst_element_get_factory (element);
+    const gchar* klass;
+
+    if (!factory) {
+        return FALSE;
+    }
+    klass = gst_element_factory_get_metadata (factory, GST_ELEMENT_METADATA_KLASS);
+    return klass && strstr (klass, "Decoder") && strstr (klass, "Video");
+}
+
+/* libav can leave out the non-reference frames of unfocused tiles. Must be
+ * called with the lock held. */
+static void applySkipFrame (MosaicTile* tile) {
+    gboolean skip = !g_atomic_int_get (&tile->focused) &&
+                    g_atomic_int_get (&tile->mosaic->unfocused) == MOSAIC_DECODE_REDUCED;
+
+    if (tile->decoder && hasProperty (tile->decoder, "skip-frame")) {
+        gst_util_set_object_arg (G_OBJECT (tile->decoder), "skip-frame", skip ? "1" : "0");
+    }
+}
+
+/* Decodes at a half or a quarter of the stream size as long as that still
+ * covers the tile. libav only supports it for some codecs and reads it when
+ * the decoder opens, which is right after this caps event. */
+static void setLowres (MosaicTile* tile, GstElement* decoder, GstEvent* event) {
+    Mosaic* mosaic = tile->mosaic;
+    gint tileWidth = g_atomic_int_get (&mosaic->canvasWidth) / (gint) mosaic->columns;
+    gint tileHeight = g_atomic_int_get (&mosaic->canvasHeight) / (gint) mosaic->rows;
+    GstStructure* structure;
+    GstCaps* caps;
+    gint width, height;
+    gint level = 0;
+    gchar str[4];
+
+    if (!hasProperty (decoder, "lowres")) {
+        return;
+    }
+    gst_event_parse_caps (event, &caps);
+    structure = gst_caps_get_structure (caps, 0);
+    if (!gst_structure_get_int (structure, "width", &width) ||
+        !gst_structure_get_int (structure, "height", &height)) {
+        return;
+    }
+    while (level < 2 && (width >> (level + 1)) >= tileWidth &&
+           (height >> (level + 1)) >= tileHeight) {
+        level++;
+    }
+    g_snprintf (str, sizeof (str), "%d", level);
+    gst_util_set_object_arg (G_OBJECT (decoder), "lowres", str);
+}
+
+/* Sits in front of the video decoder of a tile. Dropping delta frames works
+ * with any decoder; after regaining the focus the frames up to the next
+ * keyframe are dropped too, as their references are missing. */
+static GstPadProbeReturn decoderInput_cb (GstPad* pad, GstPadProbeInfo* info, MosaicTile* tile) {
+    gint unfocused = g_atomic_int_get (&tile->mosaic->unfocused);
+    GstBuffer* buffer;
+    GstEvent* event;
+
+    if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        event = GST_PAD_PROBE_INFO_EVENT (info);
+        if (GST_EVENT_TYPE (event) == GST_EVENT_CAPS && unfocused != MOSAIC_DECODE_FULL) {
+            setLowres (tile, GST_PAD_PARENT (pad), event);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+    if (!GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+        g_atomic_int_set (&tile->waitKeyframe, FALSE);
+        return GST_PAD_PROBE_OK;
+    }
+    if (unfocused == MOSAIC_DECODE_KEYFRAMES && !g_atomic_int_get (&tile->focused)) {
+        g_atomic_int_set (&tile->waitKeyframe, TRUE);
+        return GST_PAD_PROBE_DROP;
+    }
+    return g_atomic_int_get (&tile->waitKeyframe) ? GST_PAD_PROBE_DROP : GST_PAD_PROBE_OK;
+}
+
+static void deepElementAdded_cb (GstBin* bin, GstBin* subBin, GstElement* element,
+                                 MosaicTile* tile) {
+    UNUSED (bin);
+    UNUSED (subBin);
+
+    GstPad* pad;
+
+    if (!isVideoDecoder (element)) {
+        return;
+    }
+    g_mutex_lock (&tile->mosaic->lock);
+    gst_object_replace ((GstObject**) &tile->decoder, GST_OBJECT (element));
+    applySkipFrame (tile);
+    g_mutex_unlock (&tile->mosaic->lock);
+
+    pad = gst_element_get_static_pad (element, "sink");
+    if (pad) {
+        gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                (GstPadProbeCallback) decoderInput_cb, tile, NULL);
+        gst_object_unref (pad);
+    }
+}
+
+static GstPad* requestSinkPad (GstElement* aggregator) {
+    GstPadTemplate* template = gst_element_get_pad_template (aggregator, "sink_%u");
+
+    return gst_element_request_pad (aggregator, template, NULL, NULL);
+}
+
+/* Renegotiates the compositor's output; the tiles are placed separately */
+static void setCanvasCaps (Mosaic* mosaic, gint width, gint height) {
+    GstCaps* caps = gst_caps_new_simple ("video/x-raw",
+            "width", G_TYPE_INT, width, "height", G_TYPE_INT, height,
+            "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1, NULL);
+
+    g_atomic_int_set (&mosaic->canvasWidth, width);
+    g_atomic_int_set (&mosaic->canvasHeight, height);
+    g_object_set (mosaic->canvas, "caps", caps, NULL);
+    gst_caps_unref (caps);
+}
+
+/* Places the tile's picture in its cell of the grid. Must be called with
+ * the lock held. */
+static void placeTile (MosaicTile* tile) {
+    Mosaic* mosaic = tile->mosaic;
+    gint width = g_atomic_int_get (&mosaic->canvasWidth) / (gint) mosaic->columns;
+    gint height = g_atomic_int_get (&mosaic->canvasHeight) / (gint) mosaic->rows;
+
+    g_object_set (tile->videoPad,
+            "xpos", (gint) (tile->index % mosaic->columns) * width,
+            "ypos", (gint) (tile->index / mosaic->columns) * height,
+            "width", width, "height", height, NULL);
+}
+
+static void linkVideo (MosaicTile* tile, GstPad* pad) {
+    Mosaic* mosaic = tile->mosaic;
+    GstPad* sink;
+
+    /* One video stream per tile, further ones are left unlinked */
+    g_mutex_lock (&mosaic->lock);
+    if (tile->videoPad || tile->dropped) {
+        g_mutex_unlock (&mosaic->lock);
+        return;
+    }
+    sink = tile->videoPad = requestSinkPad (mosaic->compositor);
+    placeTile (tile);
+    g_mutex_unlock (&mosaic->lock);
+
+    if (gst_pad_link (pad, sink) != GST_PAD_LINK_OK) {
+        g_printerr ("Could not link the video of %s\n", tile->uri);
+    }
+}
+
+static void linkAudio (MosaicTile* tile, GstPad* pad) {
+    Mosaic* mosaic = tile->mosaic;
+    GstElement* convert;
+    GstElement* resample;
+    GstPad* src;
+    GstPad* sink;
+
+    g_mutex_lock (&mosaic->lock);
+    if (tile->audioPad || tile->dropped) {
+        g_mutex_unlock (&mosaic->lock);
+        return;
+    }
+    convert = gst_element_factory_make ("audioconvert", NULL);
+    resample = gst_element_factory_make ("audioresample", NULL);
+    if (!convert || !resample) {
+        g_mutex_unlock (&mosaic->lock);
+        g_printerr ("Not all elements could be created.\n");
+        if (convert) {
+            gst_object_unref (gst_object_ref_sink (convert));
+        }
+        if (resample) {
+            gst_object_unref (gst_object_ref_sink (resample));
+        }
+        return;
+    }
+    gst_bin_add_many (GST_BIN (mosaic->pipeline), convert, resample, NULL);
+    gst_element_link (convert, resample);
+    tile->audioConvert = convert;
+    tile->audioResample = resample;
+
+    tile->audioPad = requestSinkPad (mosaic->audioMixer);
+    g_object_set (tile->audioPad, "mute", !g_atomic_int_get (&tile->focused), NULL);
+    src = gst_element_get_static_pad (resample, "src");
+    gst_pad_link (src, tile->audioPad);
+    gst_object_unref (src);
+    g_mutex_unlock (&mosaic->lock);
+
+    gst_element_sync_state_with_parent (resample);
+    gst_element_sync_state_with_parent (convert);
+    sink = gst_element_get_static_pad (convert, "sink");
+    if (gst_pad_link (pad, sink) != GST_PAD_LINK_OK) {
+        g_printerr ("Could not link the audio of %s\n", tile->uri);
+    }
+    gst_object_unref (sink);
+}
+
+static void padAdded_cb (GstElement* source, GstPad* pad, MosaicTile* tile) {
+    UNUSED (source);
+
+    GstCaps* caps = gst_pad_get_current_caps (pad);
+    const gchar* name;
+
+    if (!caps) {
+        caps = gst_pad_query_caps (pad, NULL);
+    }
+    name = gst_structure_get_name (gst_caps_get_structure (caps, 0));
+    if (g_str_has_prefix (name, "video/")) {
+        linkVideo (tile, pad);
+    } else if (g_str_has_prefix (name, "audio/")) {
+        linkAudio (tile, pad);
+    }
+    gst_caps_unref (caps);
+}
+
+/* Mutes all but the focused tile and sets how the others are decoded. Must be
+ * called with the lock held. */
+static void applyFocus (Mosaic* mosaic) {
+    for (guint i = 0; i < mosaic->count; i++) {
+        MosaicTile* tile = &mosaic->tiles[i];
+        gboolean focused = i == mosaic->focus;
+
+        g_atomic_int_set (&tile->focused, focused);
+        if (tile->audioPad) {
+            g_object_set (tile->audioPad, "mute", !focused, NULL);
+        }
+        applySkipFrame (tile);
+    }
+}
+
+/* Clicks on the video come back from the sink as navigation events, already
+ * in canvas coordinates */
+static GstPadProbeReturn navigation_cb (GstPad* pad, GstPadProbeInfo* info, Mosaic* mosaic) {
+    UNUSED (pad);
+
+    GstEvent* event = GST_PAD_PROBE_INFO_EVENT (info);
+    gdouble x, y;
+    gint button;
+    gint tile;
+
+    if (GST_EVENT_TYPE (event) != GST_EVENT_NAVIGATION ||
+        gst_navigation_event_get_type (event) != GST_NAVIGATION_EVENT_MOUSE_BUTTON_PRESS ||
+        !gst_navigation_event_parse_mouse_button_event (event, &button, &x, &y)) {
+        return GST_PAD_PROBE_OK;
+    }
+    tile = mosaicTileAt (mosaic, x, y);
+    if (button == 1 && tile >= 0) {
+        mosaicSetFocus (mosaic, (guint) tile);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static GstBusSyncReply busSync_cb (GstBus* bus, GstMessage* msg, Mosaic* mosaic) {
+    UNUSED (bus);
+
+    guintptr window;
+
+    if (!gst_is_video_overlay_prepare_window_handle_message (msg)) {
+        return GST_BUS_PASS;
+    }
+    g_mutex_lock (&mosaic->lock);
+    window = mosaic->window;
+    g_mutex_unlock (&mosaic->lock);
+    if (window) {
+        gst_video_overlay_set_window_handle (GST_VIDEO_OVERLAY (GST_MESSAGE_SRC (msg)), window);
+    }
+    return GST_BUS_PASS;
+}
+
+/* Builds the mosaic pipeline in NULL state, laid out as a grid as close to
+ * square as the count allows. The first tile has the focus. */
+Mosaic* mosaicNew (const gchar* const* uris, guint count, MosaicDecode unfocused) {
+    Mosaic* mosaic;
+    GstElement* silence;
+    GstPad* pad;
+    GstBus* bus;
+    gboolean complete = TRUE;
+
+    if (count == 0) {
+        return NULL;
+    }
+    mosaic = g_new0 (Mosaic, 1);
+    g_mutex_init (&mosaic->lock);
+    mosaic->count = count;
+    mosaic->columns = (guint) ceil (sqrt (count));
+    mosaic->rows = (count + mosaic->columns - 1) / mosaic->columns;
+    mosaic->unfocused = unfocused;
+    mosaic->tiles = g_new0 (MosaicTile, count);
+    mosaic->pipeline = gst_pipeline_new ("mosaic");
+
+    GstElement* elements[] = {
+        mosaic->compositor = gst_element_factory_make ("compositor", NULL),
+        mosaic->canvas = gst_element_factory_make ("capsfilter", NULL),
+        gst_element_factory_make ("videoconvert", NULL),
+        gst_element_factory_make ("autovideosink", NULL),
+        /* Keeps the audio running while no tile has any */
+        silence = gst_element_factory_make ("audiotestsrc", NULL),
+        mosaic->audioMixer = gst_element_factory_make ("audiomixer", NULL),
+        gst_element_factory_make ("audioconvert", NULL),
+        mosaic->volume = gst_element_factory_make ("volume", NULL),
+        gst_element_factory_make ("autoaudiosink", NULL)
+    };
+
+    for (guint i = 0; i < G_N_ELEMENTS (elements); i++) {
+        if (elements[i]) {
+            gst_bin_add (GST_BIN (mosaic->pipeline), elements[i]);
+        } else {
+            complete = FALSE;
+        }
+    }
+    if (!complete) {
+        g_printerr ("Not all elements could be created.\n");
+        mosaicFree (mosaic);
+        return NULL;
+    }
+
+    gst_util_set_object_arg (G_OBJECT (mosaic->compositor), "background", "black");
+    setCanvasCaps (mosaic, CANVAS_WIDTH, CANVAS_HEIGHT);
+    gst_util_set_object_arg (G_OBJECT (silence), "wave", "silence");
+
+    gst_element_link_many (elements[0], elements[1], elements[2], elements[3], NULL);
+    gst_element_link_many (elements[4], elements[5], elements[6], elements[7], elements[8], NULL);
+
+    pad = gst_element_get_static_pad (mosaic->canvas, "src");
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM,
+            (GstPadProbeCallback) navigation_cb, mosaic, NULL);
+    gst_object_unref (pad);
+
+    for (guint i = 0; i < count; i++) {
+        MosaicTile* tile = &mosaic->tiles[i];
+
+        tile->mosaic = mosaic;
+        tile->index = i;
+        tile->uri = g_strdup (uris[i]);
+        tile->focused = i == 0;
+        tile->source = gst_element_factory_make ("uridecodebin", NULL);
+        if (!tile->source) {
+            g_printerr ("Not all elements could be created.\n");
+            mosaicFree (mosaic);
+            return NULL;
+        }
+        g_object_set (tile->source, "uri", uris[i], NULL);
+        g_signal_connect (tile->source, "pad-added", G_CALLBACK (padAdded_cb), tile);
+        g_signal_connect (tile->source, "deep-element-added",
+                G_CALLBACK (deepElementAdded_cb), tile);
+        gst_bin_add (GST_BIN (mosaic->pipeline), tile->source);
+    }
+
+    bus = gst_element_get_bus (mosaic->pipeline);
+    gst_bus_set_sync_handler (bus, (GstBusSyncHandler) busSync_cb, mosaic, NULL);
+    gst_object_unref (bus);
+    return mosaic;
+}
+
+void mosaicFree (Mosaic* mosaic) {
+    GstBus* bus;
+
+    if (!mosaic) {
+        return;
+    }
+    gst_element_set_state (mosaic->pipeline, GST_STATE_NULL);
+    bus = gst_element_get_bus (mosaic->pipeline);
+    gst_bus_set_sync_handler (bus, NULL, NULL, NULL);
+    gst_object_unref (bus);
+
+    for (guint i = 0; i < mosaic->count; i++) {
+        MosaicTile* tile = &mosaic->tiles[i];
+
+        g_clear_object (&tile->videoPad);
+        g_clear_object (&tile->audioPad);
+        g_clear_object (&tile->decoder);
+        g_free (tile->uri);
+    }
+    gst_object_unref (mosaic->pipeline);
+    g_free (mosaic->tiles);
+    g_mutex_clear (&mosaic->lock);
+    g_free (mosaic);
+}
+
+GstElement* mosaicGetPipeline (Mosaic* mosaic) {
+    return mosaic->pipeline;
+}
+
+/* The volume element after the mixer, in place of playbin's volume */
+GstElement* mosaicGetVolume (Mosaic* mosaic) {
+    return mosaic->volume;
+}
+
+void mosaicSetWindow (Mosaic* mosaic, guintptr window) {
+    GstElement* sink;
+
+    g_mutex_lock (&mosaic->lock);
+    mosaic->window = window;
+    g_mutex_unlock (&mosaic->lock);
+
+    /* Until the sink exists it asks for the window from the bus */
+    sink = gst_bin_get_by_interface (GST_BIN (mosaic->pipeline), GST_TYPE_VIDEO_OVERLAY);
+    if (sink) {
+        gst_video_overlay_set_window_handle (GST_VIDEO_OVERLAY (sink), window);
+        gst_object_unref (sink);
+    }
+}
+
+void mosaicSetFocus (Mosaic* mosaic, guint index) {
+    if (index >= mosaic->count) {
+        return;
+    }
+    g_mutex_lock (&mosaic->lock);
+    mosaic->focus = index;
+    applyFocus (mosaic);
+    g_mutex_unlock (&mosaic->lock);
+}
+
+guint mosaicGetFocus (Mosaic* mosaic) {
+    guint focus;
+
+    g_mutex_lock (&mosaic->lock);
+    focus = mosaic->focus;
+    g_mutex_unlock (&mosaic->lock);
+    return focus;
+}
+
+/* Sets how the tiles without the focus are decoded. Reduced resolution only
+ * applies to decoders opened from then on. */
+void mosaicSetDecode (Mosaic* mosaic, MosaicDecode unfocused) {
+    g_atomic_int_set (&mosaic->unfocused, unfocused);
+    g_mutex_lock (&mosaic->lock);
+    applyFocus (mosaic);
+    g_mutex_unlock (&mosaic->lock);
+}
+
+/* Composes onto a canvas no larger than the surface showing it, with the
+ * proportions of the full one, so that every tile is scaled once to about
+ * the size it is seen at. 0 stands for an unknown surface. Decoders opened
+ * from then on pick their reduced resolution for the new tile size. */
+void mosaicSetCanvasSize (Mosaic* mosaic, gint width, gint height) {
+    gdouble scale = 1.0;
+
+    if (width > 0 && height > 0) {
+        scale = MIN (1.0, MIN ((gdouble) width / CANVAS_WIDTH, (gdouble) height / CANVAS_HEIGHT));
+    }
+    /* Even sizes, for the 4:2:0 formats the sinks prefer */
+    width = MAX (2, (gint) (CANVAS_WIDTH * scale) & ~1);
+    height = MAX (2, (gint) (CANVAS_HEIGHT * scale) & ~1);
+    if (width == g_atomic_int_get (&mosaic->canvasWidth) &&
+        height == g_atomic_int_get (&mosaic->canvasHeight)) {
+        return;
+    }
+    g_mutex_lock (&mosaic->lock);
+    setCanvasCaps (mosaic, width, height);
+    for (guint i = 0; i < mosaic->count; i++) {
+        if (mosaic->tiles[i].videoPad) {
+            placeTile (&mosaic->tiles[i]);
+        }
+    }
+    g_mutex_unlock (&mosaic->lock);
+}
+
+/* Returns the tile at a point of the canvas, or -1 */
+gint mosaicTileAt (Mosaic* mosaic, gdouble x, gdouble y) {
+    gint column = (gint) floor (x * mosaic->columns / g_atomic_int_get (&mosaic->canvasWidth));
+    gint row = (gint) floor (y * mosaic->rows / g_atomic_int_get (&mosaic->canvasHeight));
+    guint index;
+
+    if (column < 0 || row < 0 || column >= (gint) mosaic->columns || row >= (gint) mosaic->rows) {
+        return -1;
+    }
+    index = (guint) row * mosaic->columns + (guint) column;
+    return index < mosaic->count ? (gint) index : -1;
+}
+
+/* Returns a human readable list of the tiles. Free with g_free(). */
+gchar* mosaicDescribe (Mosaic* mosaic) {
+    GString* info = g_string_new (NULL);
+
+    g_mutex_lock (&mosaic->lock);
+    g_string_append_printf (info, "mosaic of %u feeds, %ux%u grid:\n",
+            mosaic->count, mosaic->columns, mosaic->rows);
+    for (guint i = 0; i < mosaic->count; i++) {
+        MosaicTile* tile = &mosaic->tiles[i];
+
+        g_string_append_printf (info, "  tile %u%s: %s%s\n", i + 1,
+                i == mosaic->focus ? " (focus)" : "", tile->uri,
+                tile->dropped ? " (failed)" : "");
+    }
+    g_mutex_unlock (&mosaic->lock);
+    return g_string_free (info, FALSE);
+}
+
+/* Takes a failed feed out of the mosaic; the remaining ones carry on */
+static void dropTile (MosaicTile* tile) {
+    Mosaic* mosaic = tile->mosaic;
+    GstElement* elements[3];
+    GstPad* pads[2];
+
+    /* Stops the streaming threads that could still be linking pads */
+    gst_element_set_state (tile->source, GST_STATE_NULL);
+
+    g_mutex_lock (&mosaic->lock);
+    tile->dropped = TRUE;
+    elements[0] = tile->source;
+    elements[1] = tile->audioConvert;
+    elements[2] = tile->audioResample;
+    pads[0] = tile->videoPad;
+    pads[1] = tile->audioPad;
+    tile->source = tile->audioConvert = tile->audioResample = NULL;
+    tile->videoPad = tile->audioPad = NULL;
+    g_clear_object (&tile->decoder);
+    g_mutex_unlock (&mosaic->lock);
+
+    for (guint i = 0; i < G_N_ELEMENTS (elements); i++) {
+        if (elements[i]) {
+            gst_element_set_state (elements[i], GST_STATE_NULL);
+            gst_bin_remove (GST_BIN (mosaic->pipeline), elements[i]);
+        }
+    }
+    if (pads[0]) {
+        gst_element_release_request_pad (mosaic->compositor, pads[0]);
+        gst_object_unref (pads[0]);
+    }
+    if (pads[1]) {
+        gst_element_release_request_pad (mosaic->audioMixer, pads[1]);
+        gst_object_unref (pads[1]);
+    }
+}
+
+/* Called from the bus for every error. Returns TRUE if it came from one of
+ * the feeds, which is then dropped instead of stopping the whole mosaic. */
+gboolean mosaicHandleError (Mosaic* mosaic, GstMessage* msg) {
+    /* Further errors queued by a feed that was already dropped */
+    if (!gst_object_has_as_ancestor (GST_MESSAGE_SRC (msg), GST_OBJECT (mosaic->pipeline))) {
+        return TRUE;
+    }
+    for (guint i = 0; i < mosaic->count; i++) {
+        MosaicTile* tile = &mosaic->tiles[i];
+        GError* err;
+
+        if (!tile->source ||
+            !gst_object_has_as_ancestor (GST_MESSAGE_SRC (msg), GST_OBJECT (tile->source))) {
+            continue;
+        }
+        gst_message_parse_error (msg, &err, NULL);
+        g_printerr ("Dropping tile %u (%s): %s\n", i + 1, tile->uri, err->message);
+        g_clear_error (&err);
+        dropTile (tile);
+        return TRUE;
+    }
+    return FALSE;
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <gst/gst.h>
+#include "gst-backend.h"
+
+/* Several URIs composited into one picture in a single pipeline. Driven by
+ * the backend through backendPlayMosaic(); the player owns the bus. */
+typedef struct _Mosaic Mosaic;
+
+Mosaic*     mosaicNew (const gchar* const* uris, guint count, MosaicDecode unfocused);
+void        mosaicFree (Mosaic* mosaic);
+GstElement* mosaicGetPipeline (Mosaic* mosaic);
+GstElement* mosaicGetVolume (Mosaic* mosaic);
+void        mosaicSetWindow (Mosaic* mosaic, guintptr window);
+void        mosaicSetFocus (Mosaic* mosaic, guint index);
+guint       mosaicGetFocus (Mosaic* mosaic);
+void        mosaicSetDecode (Mosaic* mosaic, MosaicDecode unfocused);
+void        mosaicSetCanvasSize (Mosaic* mosaic, gint width, gint height);
+gint        mosaicTileAt (Mosaic* mosaic, gdouble x, gdouble y);
+gchar*      mosaicDescribe (Mosaic* mosaic);
+gboolean    mosaicHandleError (Mosaic* mosaic, GstMessage* msg);
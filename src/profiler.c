@@ -0,0 +1,503 @@
+#define GST_USE_UNSTABLE_API
+#include <gst/gst.h>
+#include <gst/gsttracer.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include "gst-backend.h"
+#include "profiler.h"
+
+/* Built-in profiler. A tracer registered at runtime hooks every buffer push
+ * in the process. Pushes are synchronous up to the next queue, so the time
+ * between a push and its return, minus the pushes made from inside it, is
+ * the time the receiving element spent on the buffer. Each streaming thread
+ * records into its own log, which is merged into a Chrome/Perfetto trace and
+ * a summary table when profiling stops. */
+
+#define MAX_EVENTS_PER_THREAD (1 << 20)
+
+typedef struct _TraceEvent {
+    const gchar* name;          /* owned by the thread's element table */
+    GstClockTime start;
+    GstClockTime duration;
+} TraceEvent;
+
+typedef struct _ElementStats {
+    gchar*  name;
+    gchar*  factory;
+    guint64 calls;
+    guint64 totalNs;            /* including elements it pushed into */
+    guint64 selfNs;
+    guint64 maxNs;
+} ElementStats;
+
+typedef struct _PadStats {
+    gchar*       name;
+    guint64      buffers;
+    guint64      bytes;
+    GstClockTime first;
+    GstClockTime last;
+} PadStats;
+
+typedef struct _Frame {
+    ElementStats* element;      /* NULL for bins, which only forward */
+    GstClockTime  start;
+    GstClockTime  childNs;
+} Frame;
+
+typedef struct _ThreadLog {
+    GMutex      lock;
+    guint       id;
+    gchar       name[17];
+    gint        generation;
+    GArray*     events;
+    guint64     overflow;
+    GHashTable* elements;       /* GstElement* -> ElementStats* */
+    GHashTable* pads;           /* GstPad* -> PadStats* */
+    GArray*     stack;
+    gint64      cpuStart;       /* thread CPU time, ns, -1 until sampled */
+    gint64      cpuLast;
+} ThreadLog;
+
+typedef struct _ProfilerTracer {
+    GstTracer parent;
+} ProfilerTracer;
+
+typedef struct _ProfilerTracerClass {
+    GstTracerClass parent_class;
+} ProfilerTracerClass;
+
+static GType profiler_tracer_get_type();
+G_DEFINE_TYPE (ProfilerTracer, profiler_tracer, GST_TYPE_TRACER)
+
+static GMutex logsLock;
+static GPtrArray* logs;
+static GPrivate threadLog;
+static GstTracer* tracer;
+static gint recording;          /* atomic */
+static gint generation;         /* atomic, bumped on every start */
+static GstClockTime startTime;
+static GstClockTime stopTime;
+
+static void elementStatsFree (ElementStats* stats) {
+    g_free (stats->name);
+    g_free (stats->factory);
+    g_free (stats);
+}
+
+static void padStatsFree (PadStats* stats) {
+    g_free (stats->name);
+    g_free (stats);
+}
+
+static gint64 threadCpuTime() {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    struct timespec ts;
+
+    if (clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+        return (gint64) ts.tv_sec * GST_SECOND + ts.tv_nsec;
+    }
+#endif
+    return -1;
+}
+
+/* Must be called with the log locked */
+static void resetLog (ThreadLog* log, gint currentGeneration) {
+    g_array_set_size (log->events, 0);
+    g_array_set_size (log->stack, 0);
+    g_hash_table_remove_all (log->elements);
+    g_hash_table_remove_all (log->pads);
+    log->overflow = 0;
+    log->cpuStart = -1;
+    log->cpuLast = -1;
+    log->generation = currentGeneration;
+}
+
+/* Returns the calling thread's log, locked */
+static ThreadLog* lockThreadLog() {
+    ThreadLog* log = g_private_get (&threadLog);
+    gint currentGeneration = g_atomic_int_get (&generation);
+
+    if (!log) {
+        g_mutex_lock (&logsLock);
+        log = g_new0 (ThreadLog, 1);
+        g_mutex_init (&log->lock);
+        log->id = logs->len + 1;
+#ifdef __linux__
+        prctl (PR_GET_NAME, log->name, 0, 0, 0);
+#endif
+        if (!log->name[0]) {
+            g_snprintf (log->name, sizeof (log->name), "thread-%u", log->id);
+        }
+        log->events = g_array_new (FALSE, FALSE, sizeof (TraceEvent));
+        log->stack = g_array_new (FALSE, FALSE, sizeof (Frame));
+        log->elements = g_hash_table_new_full (NULL, NULL, NULL,
+                (GDestroyNotify) elementStatsFree);
+        log->pads = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify) padStatsFree);
+        resetLog (log, currentGeneration);
+        g_ptr_array_add (logs, log);
+        g_private_set (&threadLog, log);
+        g_mutex_unlock (&logsLock);
+    }
+
+    g_mutex_lock (&log->lock);
+    if (log->generation != currentGeneration) {
+        resetLog (log, currentGeneration);
+    }
+    return log;
+}
+
+/* The element behind a pad, looking through ghost and proxy pads */
+static GstObject* padOwner (GstPad* pad) {
+    GstObject* parent = pad ? GST_OBJECT_PARENT (pad) : NULL;
+
+    if (parent && GST_IS_PAD (parent)) {
+        parent = GST_OBJECT_PARENT (parent);
+    }
+    return parent && GST_IS_ELEMENT (parent) ? parent : NULL;
+}
+
+static ElementStats* elementStats (ThreadLog* log, GstObject* element) {
+    ElementStats* stats = g_hash_table_lookup (log->elements, element);
+
+    if (!stats) {
+        GstElementFactory* factory = gst_element_get_factory (GST_ELEMENT (element));
+
+        stats = g_new0 (ElementStats, 1);
+        stats->name = g_strdup (GST_OBJECT_NAME (element));
+        stats->factory = g_strdup (factory ? GST_OBJECT_NAME (factory) : "");
+        g_hash_table_insert (log->elements, element, stats);
+    }
+    return stats;
+}
+
+static void countPad (ThreadLog* log, GstPad* pad, GstClockTime ts, gsize bytes, guint buffers) {
+    PadStats* stats = g_hash_table_lookup (log->pads, pad);
+
+    if (!stats) {
+        GstObject* owner = padOwner (pad);
+
+        stats = g_new0 (PadStats, 1);
+        stats->name = g_strdup_printf ("%s:%s", owner ? GST_OBJECT_NAME (owner) : "?",
+                GST_OBJECT_NAME (pad));
+        stats->first = ts;
+        g_hash_table_insert (log->pads, pad, stats);
+    }
+    stats->buffers += buffers;
+    stats->bytes += bytes;
+    stats->last = ts;
+}
+
+static void pushPre (ThreadLog* log, GstClockTime ts, GstPad* pad, gsize bytes, guint buffers) {
+    GstObject* receiver = padOwner (GST_PAD_PEER (pad));
+    Frame frame = { NULL, ts, 0 };
+
+    countPad (log, pad, ts, bytes, buffers);
+    if (receiver && !GST_IS_BIN (receiver)) {
+        frame.element = elementStats (log, receiver);
+    }
+    if (log->stack->len == 0 && log->cpuStart < 0) {
+        log->cpuStart = threadCpuTime();
+    }
+    g_array_append_val (log->stack, frame);
+}
+
+static void pushPost (ThreadLog* log, GstClockTime ts) {
+    Frame* frame;
+    GstClockTime duration;
+
+    /* Pushes already under way when recording started have no frame */
+    if (log->stack->len == 0) {
+        return;
+    }
+    frame = &g_array_index (log->stack, Frame, log->stack->len - 1);
+    duration = ts > frame->start ? ts - frame->start : 0;
+
+    if (frame->element) {
+        ElementStats* stats = frame->element;
+        GstClockTime self = duration > frame->childNs ? duration - frame->childNs : 0;
+
+        stats->calls++;
+        stats->totalNs += duration;
+        stats->selfNs += self;
+        stats->maxNs = MAX (stats->maxNs, self);
+
+        if (log->events->len < MAX_EVENTS_PER_THREAD) {
+            TraceEvent event = { stats->name, frame->start, duration };
+            g_array_append_val (log->events, event);
+        } else {
+            log->overflow++;
+        }
+    }
+    g_array_set_size (log->stack, log->stack->len - 1);
+
+    if (log->stack->len > 0) {
+        g_array_index (log->stack, Frame, log->stack->len - 1).childNs += duration;
+    } else {
+        log->cpuLast = threadCpuTime();
+    }
+}
+
+static void padPushPre_cb (GObject* self, GstClockTime ts, GstPad* pad, GstBuffer* buffer) {
+    UNUSED (self);
+
+    ThreadLog* log;
+
+    if (!g_atomic_int_get (&recording)) {
+        return;
+    }
+    log = lockThreadLog();
+    pushPre (log, ts, pad, gst_buffer_get_size (buffer), 1);
+    g_mutex_unlock (&log->lock);
+}
+
+static gboolean addBufferSize (GstBuffer** buffer, guint index, gpointer bytes) {
+    UNUSED (index);
+
+    *(gsize*) bytes += gst_buffer_get_size (*buffer);
+    return TRUE;
+}
+
+static void padPushListPre_cb (GObject* self, GstClockTime ts, GstPad* pad, GstBufferList* list) {
+    UNUSED (self);
+
+    ThreadLog* log;
+    gsize bytes = 0;
+
+    if (!g_atomic_int_get (&recording)) {
+        return;
+    }
+    gst_buffer_list_foreach (list, addBufferSize, &bytes);
+    log = lockThreadLog();
+    pushPre (log, ts, pad, bytes, gst_buffer_list_length (list));
+    g_mutex_unlock (&log->lock);
+}
+
+static void padPushPost_cb (GObject* self, GstClockTime ts, GstPad* pad, GstFlowReturn res) {
+    UNUSED (self);
+    UNUSED (pad);
+    UNUSED (res);
+
+    ThreadLog* log;
+
+    if (!g_atomic_int_get (&recording)) {
+        return;
+    }
+    log = lockThreadLog();
+    pushPost (log, ts);
+    g_mutex_unlock (&log->lock);
+}
+
+static void profiler_tracer_class_init (ProfilerTracerClass* klass) {
+    UNUSED (klass);
+}
+
+static void profiler_tracer_init (ProfilerTracer* self) {
+    GstTracer* base = GST_TRACER (self);
+
+    gst_tracing_register_hook (base, "pad-push-pre", G_CALLBACK (padPushPre_cb));
+    gst_tracing_register_hook (base, "pad-push-post", G_CALLBACK (padPushPost_cb));
+    gst_tracing_register_hook (base, "pad-push-list-pre", G_CALLBACK (padPushListPre_cb));
+    gst_tracing_register_hook (base, "pad-push-list-post", G_CALLBACK (padPushPost_cb));
+}
+
+/* Starts recording. The tracer hooks stay registered once added; while not
+ * recording they return straight away. */
+void profilerStart() {
+    g_mutex_lock (&logsLock);
+    if (!logs) {
+        logs = g_ptr_array_new();
+    }
+    g_mutex_unlock (&logsLock);
+    g_atomic_int_inc (&generation);
+
+    if (!tracer) {
+        tracer = g_object_new (profiler_tracer_get_type(), NULL);
+    }
+    startTime = gst_util_get_timestamp();
+    g_atomic_int_set (&recording, 1);
+}
+
+gboolean profilerIsRunning() {
+    return g_atomic_int_get (&recording) != 0;
+}
+
+/* Element and pad names come from the pipeline, and may be derived from a
+ * URI, so they are escaped into the trace */
+static void writeJsonString (FILE* out, const gchar* str) {
+    fputc ('"', out);
+    for (const guchar* c = (const guchar*) str; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf (out, "\\%c", *c);
+        } else if (*c < 0x20) {
+            fprintf (out, "\\u%04x", *c);
+        } else {
+            fputc (*c, out);
+        }
+    }
+    fputc ('"', out);
+}
+
+static void writeTrace (FILE* out) {
+    gboolean first = TRUE;
+
+    fprintf (out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (guint i = 0; i < logs->len; i++) {
+        ThreadLog* log = g_ptr_array_index (logs, i);
+
+        g_mutex_lock (&log->lock);
+        if (log->generation == generation && log->events->len > 0) {
+            fprintf (out, "%s\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%u,"
+                    "\"args\":{\"name\":", first ? "" : ",", log->id);
+            writeJsonString (out, log->name);
+            fprintf (out, "}}");
+            first = FALSE;
+
+            for (guint j = 0; j < log->events->len; j++) {
+                TraceEvent* event = &g_array_index (log->events, TraceEvent, j);
+
+                fprintf (out, ",\n{\"ph\":\"X\",\"cat\":\"buffer\",\"name\":");
+                writeJsonString (out, event->name);
+                fprintf (out, ",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", log->id,
+                        (gdouble) (event->start - startTime) / GST_USECOND,
+                        (gdouble) event->duration / GST_USECOND);
+            }
+        }
+        g_mutex_unlock (&log->lock);
+    }
+    fprintf (out, "\n]}\n");
+}
+
+static gint compareSelfTime (gconstpointer a, gconstpointer b) {
+    const ElementStats* x = *(ElementStats* const*) a;
+    const ElementStats* y = *(ElementStats* const*) b;
+
+    return x->selfNs < y->selfNs ? 1 : x->selfNs > y->selfNs ? -1 : 0;
+}
+
+/* Merges the per-thread element and pad statistics into a table */
+static gchar* summarize() {
+    GString* summary = g_string_new (NULL);
+    GHashTable* merged = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_free);
+    GPtrArray* sorted = g_ptr_array_new();
+    gdouble wall = (gdouble) (stopTime - startTime) / GST_SECOND;
+    guint64 overflow = 0;
+    GHashTableIter iter;
+    gpointer value;
+
+    g_string_append_printf (summary, "%-32s %-16s %9s %10s %10s %9s %9s\n", "element", "factory",
+            "buffers", "total ms", "self ms", "mean us", "max us");
+    for (guint i = 0; i < logs->len; i++) {
+        ThreadLog* log = g_ptr_array_index (logs, i);
+
+        g_mutex_lock (&log->lock);
+        if (log->generation == generation) {
+            overflow += log->overflow;
+            g_hash_table_iter_init (&iter, log->elements);
+            while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                ElementStats* stats = value;
+                ElementStats* total = g_hash_table_lookup (merged, stats->name);
+
+                if (!total) {
+                    total = g_new0 (ElementStats, 1);
+                    total->name = stats->name;
+                    total->factory = stats->factory;
+                    g_hash_table_insert (merged, stats->name, total);
+                    g_ptr_array_add (sorted, total);
+                }
+                total->calls += stats->calls;
+                total->totalNs += stats->totalNs;
+                total->selfNs += stats->selfNs;
+                total->maxNs = MAX (total->maxNs, stats->maxNs);
+            }
+        }
+        g_mutex_unlock (&log->lock);
+    }
+
+    /* Names point into the thread logs, which stay put until the next start */
+    g_ptr_array_sort (sorted, compareSelfTime);
+    for (guint i = 0; i < sorted->len; i++) {
+        ElementStats* stats = g_ptr_array_index (sorted, i);
+
+        g_string_append_printf (summary, "%-32s %-16s %9" G_GUINT64_FORMAT " %10.1f %10.1f %9.1f %9.1f\n",
+                stats->name, stats->factory, stats->calls,
+                (gdouble) stats->totalNs / GST_MSECOND, (gdouble) stats->selfNs / GST_MSECOND,
+                stats->calls ? (gdouble) stats->selfNs / stats->calls / GST_USECOND : 0,
+                (gdouble) stats->maxNs / GST_USECOND);
+    }
+
+    g_string_append_printf (summary, "\n%-40s %9s %10s %10s\n", "pad", "buffers", "MB", "MB/s");
+    for (guint i = 0; i < logs->len; i++) {
+        ThreadLog* log = g_ptr_array_index (logs, i);
+
+        g_mutex_lock (&log->lock);
+        if (log->generation == generation) {
+            g_hash_table_iter_init (&iter, log->pads);
+            while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                PadStats* stats = value;
+                gdouble seconds = (gdouble) (stats->last - stats->first) / GST_SECOND;
+                gdouble megabytes = (gdouble) stats->bytes / (1024 * 1024);
+
+                g_string_append_printf (summary, "%-40s %9" G_GUINT64_FORMAT " %10.1f %10.1f\n",
+                        stats->name, stats->buffers, megabytes,
+                        seconds > 0 ? megabytes / seconds : 0);
+            }
+        }
+        g_mutex_unlock (&log->lock);
+    }
+
+    g_string_append_printf (summary, "\n%-20s %10s %8s\n", "thread", "cpu ms", "cpu %");
+    for (guint i = 0; i < logs->len; i++) {
+        ThreadLog* log = g_ptr_array_index (logs, i);
+
+        g_mutex_lock (&log->lock);
+        if (log->generation == generation && log->cpuStart >= 0 && log->cpuLast >= 0) {
+            gdouble cpu = (gdouble) (log->cpuLast - log->cpuStart) / GST_SECOND;
+
+            g_string_append_printf (summary, "%-20s %10.1f %8.1f\n", log->name, cpu * 1000,
+                    wall > 0 ? cpu / wall * 100 : 0);
+        }
+        g_mutex_unlock (&log->lock);
+    }
+    if (overflow) {
+        g_string_append_printf (summary, "\n%" G_GUINT64_FORMAT
+                " events beyond the per-thread limit were left out of the trace\n", overflow);
+    }
+
+    g_ptr_array_free (sorted, TRUE);
+    g_hash_table_destroy (merged);
+    return g_string_free (summary, FALSE);
+}
+
+/* Stops recording, writes the trace if a path is given and returns the
+ * summary table. Free with g_free(). */
+gchar* profilerStop (const gchar* tracePath, GError** error) {
+    FILE* out;
+    gchar* summary = NULL;
+
+    if (!g_atomic_int_get (&recording)) {
+        return g_strdup ("Profiler was not running\n");
+    }
+    g_atomic_int_set (&recording, 0);
+    stopTime = gst_util_get_timestamp();
+
+    /* Threads starting meanwhile would add to the list */
+    g_mutex_lock (&logsLock);
+    if (tracePath) {
+        out = fopen (tracePath, "w");
+        if (!out) {
+            g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                    "Could not open %s for writing", tracePath);
+            g_mutex_unlock (&logsLock);
+            return NULL;
+        }
+        writeTrace (out);
+        fclose (out);
+    }
+    summary = summarize();
+    g_mutex_unlock (&logsLock);
+    return summary;
+}
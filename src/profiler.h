@@ -0,0 +1,8 @@
+#pragma once
+#include <gst/gst.h>
+
+#define PROFILER_ENVIRONMENT "GLIESE_PROFILE"
+
+void     profilerStart();
+gchar*   profilerStop (const gchar* tracePath, GError** error);
+gboolean profilerIsRunning();
@@ -0,0 +1,281 @@
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include "resumestore.h"
+
+/* Resume positions, keyed by URI and by the size and modification time of
+ * the file behind it. The store is a log that is only ever appended to: a
+ * save writes one small record, the last record for a URI wins, and a crash
+ * loses at most the record being written. Opening maps the log and walks it
+ * once into a hash table whose keys point into the mapping, so that starting
+ * up copies nothing and a lookup is a hash probe and a stat(). A log with
+ * many more records than files is compacted as it is opened.
+ *
+ * Layout, native endian:
+ *   LogHeader
+ *   LogRecord + URI + NUL, each padded to 8 bytes
+ */
+
+#define LOG_MAGIC   "GLRS"
+#define LOG_VERSION 1
+#define COMPACT_MIN 256         /* records before compacting is worth it */
+
+typedef struct _LogHeader {
+    gchar   magic[4];
+    guint32 version;
+} LogHeader;
+
+typedef struct _LogRecord {
+    guint32 uriLength;
+    guint32 reserved;
+    gint64  size;               /* of the file when saved, 0 if not a local one */
+    gint64  mtime;
+    gint64  position;           /* nanoseconds, negative once forgotten */
+} LogRecord;
+
+typedef struct _ResumePoint {
+    gint64 size;
+    gint64 mtime;
+    gint64 position;
+} ResumePoint;
+
+typedef struct _ResumeStore {
+    GMutex        lock;         /* players save from their control threads */
+    gchar*        path;
+    GMappedFile*  file;         /* the log as it was opened */
+    FILE*         log;          /* appended to, NULL while closed */
+    GHashTable*   points;       /* URI -> ResumePoint */
+    GStringChunk* names;        /* URIs first saved since opening; the rest are mapped */
+    guint         records;      /* in the log, stale ones included */
+} ResumeStore;
+
+static ResumeStore store;
+
+/* Identifies the file behind a URI, so that a position saved for one file
+ * is not applied to another copied over it */
+static void sourceIdentity (const gchar* uri, gint64* size, gint64* mtime) {
+    gchar* filename = g_filename_from_uri (uri, NULL, NULL);
+    GStatBuf st;
+
+    *size = *mtime = 0;
+    if (filename && g_stat (filename, &st) == 0) {
+        *size = st.st_size;
+        *mtime = st.st_mtime;
+    }
+    g_free (filename);
+}
+
+static gsize recordSize (guint32 uriLength) {
+    return (sizeof (LogRecord) + uriLength + 1 + 7) & ~(gsize) 7;
+}
+
+/* Keys are copied into names if given, or else must outlive the table */
+static void setPoint (const gchar* uri, const ResumePoint* point, GStringChunk* names) {
+    ResumePoint* existing = g_hash_table_lookup (store.points, uri);
+
+    if (point->position < 0) {
+        g_hash_table_remove (store.points, uri);
+        return;
+    }
+    if (!existing) {
+        existing = g_new (ResumePoint, 1);
+        g_hash_table_insert (store.points,
+                names ? g_string_chunk_insert_const (names, uri) : (gchar*) uri, existing);
+    }
+    *existing = *point;
+}
+
+/* Indexes the records of the mapped log and returns where the intact ones
+ * end; anything after that was cut off by a crash */
+static gsize indexLog (const guint8* data, gsize size) {
+    gsize offset = sizeof (LogHeader);
+
+    while (offset + sizeof (LogRecord) <= size) {
+        const LogRecord* record = (const LogRecord*) (data + offset);
+        const gchar* uri = (const gchar*) (record + 1);
+        gsize length = recordSize (record->uriLength);
+        ResumePoint point = { record->size, record->mtime, record->position };
+
+        if (length > size - offset || uri[record->uriLength] != '\0') {
+            break;
+        }
+        setPoint (uri, &point, NULL);
+        store.records++;
+        offset += length;
+    }
+    return offset;
+}
+
+static gboolean writeRecord (FILE* out, const gchar* uri, const ResumePoint* point) {
+    static const gchar padding[8] = { 0 };
+    LogRecord record = {
+        .uriLength = (guint32) strlen (uri),
+        .size      = point->size,
+        .mtime     = point->mtime,
+        .position  = point->position
+    };
+    gsize tail = recordSize (record.uriLength) - sizeof (LogRecord) - record.uriLength;
+
+    return fwrite (&record, sizeof (LogRecord), 1, out) == 1 &&
+           fwrite (uri, 1, record.uriLength, out) == record.uriLength &&
+           fwrite (padding, 1, tail, out) == tail;
+}
+
+/* Rewrites the log with a record per remembered file, next to it and then
+ * over it, so that a crash leaves either log whole */
+static gboolean compactLog() {
+    LogHeader header = { .magic = LOG_MAGIC, .version = LOG_VERSION };
+    gchar* tmpPath = g_strconcat (store.path, ".tmp", NULL);
+    FILE* out = g_fopen (tmpPath, "wb");
+    gboolean ok = out && fwrite (&header, sizeof (LogHeader), 1, out) == 1;
+    GHashTableIter iter;
+    gpointer uri;
+    gpointer point;
+
+    g_hash_table_iter_init (&iter, store.points);
+    while (ok && g_hash_table_iter_next (&iter, &uri, &point)) {
+        ok = writeRecord (out, uri, point);
+    }
+    if (out) {
+        ok = fclose (out) == 0 && ok;
+    }
+    ok = ok && g_rename (tmpPath, store.path) == 0;
+    if (ok) {
+        store.records = g_hash_table_size (store.points);
+    } else {
+        g_unlink (tmpPath);
+    }
+    g_free (tmpPath);
+    return ok;
+}
+
+static void closeStore() {
+    if (store.log) {
+        fclose (store.log);
+        store.log = NULL;
+    }
+    g_clear_pointer (&store.points, g_hash_table_destroy);
+    if (store.names) {
+        g_string_chunk_free (store.names);
+        store.names = NULL;
+    }
+    g_clear_pointer (&store.file, g_mapped_file_unref);
+    g_clear_pointer (&store.path, g_free);
+    store.records = 0;
+}
+
+gchar* resumeStoreDefaultPath() {
+    return g_build_filename (g_get_user_data_dir(), "projectgliese", "resume.log", NULL);
+}
+
+gboolean resumeStoreOpen (const gchar* path) {
+    LogHeader header = { .magic = LOG_MAGIC, .version = LOG_VERSION };
+    gchar* directory = g_path_get_dirname (path);
+    gboolean ok = TRUE;
+
+    g_mutex_lock (&store.lock);
+    closeStore();
+    store.path = g_strdup (path);
+    store.points = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_free);
+    store.names = g_string_chunk_new (4096);
+    g_mkdir_with_parents (directory, 0700);
+    g_free (directory);
+
+    store.file = g_mapped_file_new (path, FALSE, NULL);
+    if (store.file) {
+        const guint8* data = (const guint8*) g_mapped_file_get_contents (store.file);
+        gsize size = g_mapped_file_get_length (store.file);
+        gsize intact = 0;
+
+        if (size >= sizeof (LogHeader) &&
+            memcmp (((const LogHeader*) data)->magic, LOG_MAGIC, 4) == 0 &&
+            ((const LogHeader*) data)->version == LOG_VERSION) {
+            intact = indexLog (data, size);
+        }
+        /* Appending after a torn record or a foreign header would lose the
+         * new records too */
+        if (intact != size ||
+            (store.records > COMPACT_MIN &&
+             store.records > 2 * g_hash_table_size (store.points))) {
+            ok = compactLog();
+        }
+    }
+
+    if (ok) {
+        store.log = g_fopen (path, "ab");
+    }
+    if (store.log && fseek (store.log, 0, SEEK_END) == 0 && ftell (store.log) == 0) {
+        ok = fwrite (&header, sizeof (LogHeader), 1, store.log) == 1 &&
+             fflush (store.log) == 0;
+    }
+    if (!store.log || !ok) {
+        g_printerr ("Could not open the resume store %s\n", path);
+        closeStore();
+        ok = FALSE;
+    }
+    g_mutex_unlock (&store.lock);
+    return ok;
+}
+
+void resumeStoreClose() {
+    g_mutex_lock (&store.lock);
+    closeStore();
+    g_mutex_unlock (&store.lock);
+}
+
+gboolean resumeStoreIsOpen() {
+    gboolean open;
+
+    g_mutex_lock (&store.lock);
+    open = store.log != NULL;
+    g_mutex_unlock (&store.lock);
+    return open;
+}
+
+/* Returns where the URI was left in nanoseconds, or -1 if it was not, or if
+ * the file has changed since */
+gint64 resumeStoreLookup (const gchar* uri) {
+    ResumePoint point = { .position = -1 };
+    ResumePoint* found;
+    gint64 size;
+    gint64 mtime;
+
+    g_mutex_lock (&store.lock);
+    found = store.points ? g_hash_table_lookup (store.points, uri) : NULL;
+    if (found) {
+        point = *found;
+    }
+    g_mutex_unlock (&store.lock);
+
+    if (point.position < 0) {
+        return -1;
+    }
+    sourceIdentity (uri, &size, &mtime);
+    return size == point.size && mtime == point.mtime ? point.position : -1;
+}
+
+/* Remembers the position in nanoseconds for the URI, or forgets the URI if
+ * it is negative */
+void resumeStoreSave (const gchar* uri, gint64 position) {
+    ResumePoint point = { .position = position };
+    ResumePoint* existing;
+
+    sourceIdentity (uri, &point.size, &point.mtime);
+    g_mutex_lock (&store.lock);
+    if (!store.log) {
+        g_mutex_unlock (&store.lock);
+        return;
+    }
+    existing = g_hash_table_lookup (store.points, uri);
+    if (position < 0 ? existing != NULL
+                     : !existing || memcmp (existing, &point, sizeof (point)) != 0) {
+        if (writeRecord (store.log, uri, &point) && fflush (store.log) == 0) {
+            setPoint (uri, &point, store.names);
+            store.records++;
+        } else {
+            g_printerr ("Could not write to the resume store %s\n", store.path);
+        }
+    }
+    g_mutex_unlock (&store.lock);
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include <glib.h>
+
+/* Where each file was left, for starting it there the next time. Closed, the
+ * store remembers nothing and every file starts from the beginning. */
+gchar*   resumeStoreDefaultPath();
+gboolean resumeStoreOpen (const gchar* path);
+void     resumeStoreClose();
+gboolean resumeStoreIsOpen();
+gint64   resumeStoreLookup (const gchar* uri);
+void     resumeStoreSave (const gchar* uri, gint64 position);
@@ -0,0 +1,557 @@
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "subtitlefile.h"
+
+#define SECOND  G_GUINT64_CONSTANT (1000000000)
+#define NO_TIME G_MAXUINT64
+#define MAX_SHOWN 16            /* cues joined by subtitleFileMarkupAt() */
+
+enum {
+    STYLE_ITALIC    = 1 << 0,
+    STYLE_BOLD      = 1 << 1,
+    STYLE_UNDERLINE = 1 << 2
+};
+
+typedef struct _FileCue {
+    guint64 start;
+    guint64 end;
+    const gchar* markup;        /* in the file's string chunk */
+} FileCue;
+
+struct _SubtitleFile {
+    gint refCount;
+    gchar* path;
+    SubtitleFormat format;
+    guint count;
+    FileCue* cues;              /* by start time */
+    guint64* maxEnd;            /* the latest end in the subtree each cue is the root of */
+    GStringChunk* text;
+};
+
+/* What the parser carries from one line to the next */
+typedef struct _Parser {
+    SubtitleFormat format;
+    GArray* cues;
+    GStringChunk* text;
+    GString* body;              /* the lines of the cue being read */
+    guint64 start;              /* of that cue, NO_TIME between cues */
+    guint64 end;
+    gboolean events;            /* ASS: in the [Events] section */
+    gint startField;            /* ASS: positions in a Dialogue line, per its Format line */
+    gint endField;
+    gint textField;
+} Parser;
+
+/* Reads a line of any length, without its line break. FALSE at the end. */
+static gboolean readLine (FILE* input, GString* line) {
+    gchar chunk[4096];
+    gboolean read = FALSE;
+
+    g_string_truncate (line, 0);
+    while (fgets (chunk, sizeof (chunk), input)) {
+        read = TRUE;
+        g_string_append (line, chunk);
+        if (line->len && line->str[line->len - 1] == '\n') {
+            break;
+        }
+    }
+    while (line->len && (line->str[line->len - 1] == '\n' || line->str[line->len - 1] == '\r')) {
+        g_string_truncate (line, line->len - 1);
+    }
+    return read;
+}
+
+static gboolean isBlank (const gchar* line) {
+    while (g_ascii_isspace (*line)) {
+        line++;
+    }
+    return !*line;
+}
+
+/* [[h:]m:]s[.fraction], with a comma for SubRip; NO_TIME if it is not one */
+static guint64 parseTime (const gchar* s) {
+    guint64 seconds = 0;
+    guint64 fraction = 0;
+    guint64 scale = SECOND;
+    guint fields = 0;
+
+    while (*s == ' ' || *s == '\t') {
+        s++;
+    }
+    for (;;) {
+        guint64 value = 0;
+
+        if (!g_ascii_isdigit (*s) || ++fields > 3) {
+            return NO_TIME;
+        }
+        while (g_ascii_isdigit (*s)) {
+            value = value * 10 + (guint64) (*s++ - '0');
+        }
+        seconds = seconds * 60 + value;
+        if (*s != ':') {
+            break;
+        }
+        s++;
+    }
+    if (*s == ',' || *s == '.') {
+        for (s++; g_ascii_isdigit (*s); s++) {
+            scale /= 10;
+            fraction += (guint64) (*s - '0') * scale;
+        }
+    }
+    return seconds * SECOND + fraction;
+}
+
+/* Closes the styles that are open and opens the wanted ones, so that the
+ * tags always nest however the file toggles them */
+static void applyStyle (GString* markup, guint* current, guint wanted) {
+    if (*current == wanted) {
+        return;
+    }
+    if (*current & STYLE_UNDERLINE) {
+        g_string_append (markup, "</u>");
+    }
+    if (*current & STYLE_BOLD) {
+        g_string_append (markup, "</b>");
+    }
+    if (*current & STYLE_ITALIC) {
+        g_string_append (markup, "</i>");
+    }
+    if (wanted & STYLE_ITALIC) {
+        g_string_append (markup, "<i>");
+    }
+    if (wanted & STYLE_BOLD) {
+        g_string_append (markup, "<b>");
+    }
+    if (wanted & STYLE_UNDERLINE) {
+        g_string_append (markup, "<u>");
+    }
+    *current = wanted;
+}
+
+static void appendEscaped (GString* markup, gchar c) {
+    switch (c) {
+    case '<':
+        g_string_append (markup, "&lt;");
+        break;
+    case '>':
+        g_string_append (markup, "&gt;");
+        break;
+    case '&':
+        g_string_append (markup, "&amp;");
+        break;
+    default:
+        g_string_append_c (markup, c);
+        break;
+    }
+}
+
+/* The italic and bold of an ASS override block, e.g. {\i1\b0} */
+static guint overrideStyle (const gchar* block, const gchar* end, guint style) {
+    for (const gchar* p = block; p + 2 < end; p++) {
+        guint flag = p[1] == 'i' ? STYLE_ITALIC : p[1] == 'b' ? STYLE_BOLD : 0;
+
+        if (p[0] != '\\' || !flag || (p[2] != '0' && p[2] != '1') ||
+            (p + 3 < end && g_ascii_isalnum (p[3]))) {
+            continue;
+        }
+        style = p[2] == '1' ? style | flag : style & ~flag;
+    }
+    return style;
+}
+
+/* ASS dialogue text to Pango markup: override blocks give italic and bold
+ * and are dropped otherwise, \N is a line break and \h a space */
+static gchar* assMarkup (const gchar* text) {
+    GString* markup = g_string_new (NULL);
+    guint current = 0;
+    guint style = 0;
+
+    for (const gchar* p = text; *p; p++) {
+        const gchar* close;
+
+        if (*p == '{' && (close = strchr (p, '}')) != NULL) {
+            style = overrideStyle (p + 1, close, style);
+            p = close;
+        } else if (*p == '\\' && (p[1] == 'N' || p[1] == 'n')) {
+            applyStyle (markup, &current, 0);
+            g_string_append_c (markup, '\n');
+            p++;
+        } else if (*p == '\\' && p[1] == 'h') {
+            g_string_append_c (markup, ' ');
+            p++;
+        } else {
+            applyStyle (markup, &current, style);
+            appendEscaped (markup, *p);
+        }
+    }
+    applyStyle (markup, &current, 0);
+    return g_string_free (markup, FALSE);
+}
+
+static guint tagStyle (const gchar* tag, gsize length) {
+    if (length != 1) {
+        return 0;
+    }
+    switch (g_ascii_tolower (*tag)) {
+    case 'i':
+        return STYLE_ITALIC;
+    case 'b':
+        return STYLE_BOLD;
+    case 'u':
+        return STYLE_UNDERLINE;
+    default:
+        return 0;
+    }
+}
+
+/* SubRip and WebVTT text to Pango markup: <i>, <b> and <u> are kept, other
+ * tags such as <font>, <c.class> or <v Speaker> and {\an8} style position
+ * codes are dropped. WebVTT escapes its text; SubRip does not. */
+static gchar* htmlMarkup (const gchar* text, gboolean vtt) {
+    static const gchar* entities[] = { "&amp;", "&lt;", "&gt;" };
+    GString* markup = g_string_new (NULL);
+    guint current = 0;
+    guint style = 0;
+
+    for (const gchar* p = text; *p; p++) {
+        const gchar* close;
+        gboolean entity = FALSE;
+
+        if (*p == '<' && (close = strchr (p, '>')) != NULL) {
+            gboolean closing = p[1] == '/';
+            const gchar* tag = p + 1 + closing;
+            guint flag = tagStyle (tag, close - tag);
+
+            style = closing ? style & ~flag : style | flag;
+            p = close;
+            continue;
+        }
+        if (*p == '{' && p[1] == '\\' && (close = strchr (p, '}')) != NULL) {
+            p = close;
+            continue;
+        }
+        applyStyle (markup, &current, style);
+        if (vtt && *p == '&') {
+            for (guint i = 0; i < G_N_ELEMENTS (entities) && !entity; i++) {
+                if (g_str_has_prefix (p, entities[i])) {
+                    g_string_append (markup, entities[i]);
+                    p += strlen (entities[i]) - 1;
+                    entity = TRUE;
+                }
+            }
+            if (!entity && g_str_has_prefix (p, "&nbsp;")) {
+                g_string_append_c (markup, ' ');
+                p += strlen ("&nbsp;") - 1;
+                entity = TRUE;
+            }
+        }
+        if (!entity) {
+            appendEscaped (markup, *p);
+        }
+    }
+    applyStyle (markup, &current, 0);
+    return g_string_free (markup, FALSE);
+}
+
+static void addCue (Parser* parser, guint64 start, guint64 end, gchar* markup) {
+    FileCue cue;
+
+    if (end > start && *markup) {
+        cue.start = start;
+        cue.end = end;
+        cue.markup = g_string_chunk_insert (parser->text, markup);
+        g_array_append_val (parser->cues, cue);
+    }
+    g_free (markup);
+}
+
+static void finishCue (Parser* parser) {
+    if (parser->start != NO_TIME && parser->body->len) {
+        addCue (parser, parser->start, parser->end,
+                htmlMarkup (parser->body->str, parser->format == SUBTITLE_FORMAT_VTT));
+    }
+    parser->start = NO_TIME;
+    g_string_truncate (parser->body, 0);
+}
+
+/* SubRip and WebVTT: a cue is a timing line and the text up to a blank line.
+ * Counters, cue ids, the header and NOTE or STYLE blocks have no timing
+ * line and are passed over. */
+static void parseTextLine (Parser* parser, const gchar* line) {
+    const gchar* arrow = strstr (line, "-->");
+
+    if (arrow) {
+        finishCue (parser);
+        parser->start = parseTime (line);
+        parser->end = parseTime (arrow + 3);
+        if (parser->end == NO_TIME) {
+            parser->start = NO_TIME;
+        }
+    } else if (isBlank (line)) {
+        finishCue (parser);
+    } else if (parser->start != NO_TIME) {
+        if (parser->body->len) {
+            g_string_append_c (parser->body, '\n');
+        }
+        g_string_append (parser->body, line);
+    }
+}
+
+static void parseAssFormat (Parser* parser, const gchar* line) {
+    gchar** fields = g_strsplit (line, ",", -1);
+
+    for (gint i = 0; fields[i]; i++) {
+        gchar* field = g_strstrip (fields[i]);
+
+        if (g_ascii_strcasecmp (field, "Start") == 0) {
+            parser->startField = i;
+        } else if (g_ascii_strcasecmp (field, "End") == 0) {
+            parser->endField = i;
+        } else if (g_ascii_strcasecmp (field, "Text") == 0) {
+            parser->textField = i;
+        }
+    }
+    g_strfreev (fields);
+}
+
+/* ASS and SSA: Dialogue lines of the [Events] section, whose last field,
+ * the text, may hold commas of its own */
+static void parseAssLine (Parser* parser, const gchar* line) {
+    guint64 start = NO_TIME;
+    guint64 end = NO_TIME;
+    const gchar* p;
+
+    if (*line == '[') {
+        parser->events = g_ascii_strncasecmp (line, "[Events]", strlen ("[Events]")) == 0;
+        return;
+    }
+    if (!parser->events) {
+        return;
+    }
+    if (g_str_has_prefix (line, "Format:")) {
+        parseAssFormat (parser, line + strlen ("Format:"));
+        return;
+    }
+    if (!g_str_has_prefix (line, "Dialogue:")) {
+        return;
+    }
+    p = line + strlen ("Dialogue:");
+    for (gint field = 0; field < parser->textField; field++) {
+        const gchar* comma = strchr (p, ',');
+
+        if (!comma) {
+            return;
+        }
+        if (field == parser->startField) {
+            start = parseTime (p);
+        } else if (field == parser->endField) {
+            end = parseTime (p);
+        }
+        p = comma + 1;
+    }
+    if (start != NO_TIME && end != NO_TIME) {
+        addCue (parser, start, end, assMarkup (p));
+    }
+}
+
+static SubtitleFormat guessFormat (const gchar* path, const gchar* firstLine) {
+    gchar* lower = g_ascii_strdown (path, -1);
+    SubtitleFormat format = SUBTITLE_FORMAT_SRT;
+
+    if (g_str_has_suffix (lower, ".ass") || g_str_has_suffix (lower, ".ssa") ||
+        g_str_has_prefix (firstLine, "[Script Info]")) {
+        format = SUBTITLE_FORMAT_ASS;
+    } else if (g_str_has_suffix (lower, ".vtt") || g_str_has_prefix (firstLine, "WEBVTT")) {
+        format = SUBTITLE_FORMAT_VTT;
+    }
+    g_free (lower);
+    return format;
+}
+
+static gint compareCues (gconstpointer a, gconstpointer b) {
+    const FileCue* first = a;
+    const FileCue* second = b;
+
+    if (first->start != second->start) {
+        return first->start < second->start ? -1 : 1;
+    }
+    return first->end < second->end ? -1 : first->end > second->end;
+}
+
+/* The interval tree is implicit in the sorted cues: the middle cue of a
+ * range is the root of the subtree over it. Each root keeps the latest end
+ * below it, which lets a lookup skip whole subtrees. */
+static guint64 buildIndex (SubtitleFile* file, guint lo, guint hi) {
+    guint mid;
+    guint64 maxEnd;
+
+    if (lo >= hi) {
+        return 0;
+    }
+    mid = lo + (hi - lo) / 2;
+    maxEnd = file->cues[mid].end;
+    maxEnd = MAX (maxEnd, buildIndex (file, lo, mid));
+    maxEnd = MAX (maxEnd, buildIndex (file, mid + 1, hi));
+    file->maxEnd[mid] = maxEnd;
+    return maxEnd;
+}
+
+SubtitleFile* subtitleFileLoad (const gchar* path, GError** error) {
+    FILE* input = g_fopen (path, "rb");
+    GString* line;
+    Parser parser;
+    SubtitleFile* file;
+    gboolean first = TRUE;
+
+    if (!input) {
+        gint saved = errno;
+
+        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved),
+                "Could not open %s: %s", path, g_strerror (saved));
+        return NULL;
+    }
+    memset (&parser, 0, sizeof (Parser));
+    parser.cues = g_array_new (FALSE, FALSE, sizeof (FileCue));
+    parser.text = g_string_chunk_new (64 * 1024);
+    parser.body = g_string_new (NULL);
+    parser.start = NO_TIME;
+    parser.startField = 1;
+    parser.endField = 2;
+    parser.textField = 9;
+
+    line = g_string_new (NULL);
+    while (readLine (input, line)) {
+        const gchar* text = line->str;
+
+        if (first) {
+            if (g_str_has_prefix (text, "\xEF\xBB\xBF")) {
+                text += 3;
+            }
+            parser.format = guessFormat (path, text);
+            first = FALSE;
+        }
+        if (parser.format == SUBTITLE_FORMAT_ASS) {
+            parseAssLine (&parser, text);
+        } else {
+            parseTextLine (&parser, text);
+        }
+    }
+    finishCue (&parser);
+    fclose (input);
+    g_string_free (line, TRUE);
+    g_string_free (parser.body, TRUE);
+
+    if (parser.cues->len == 0) {
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                "%s has no subtitles in SubRip, SubStation Alpha or WebVTT format", path);
+        g_array_free (parser.cues, TRUE);
+        g_string_chunk_free (parser.text);
+        return NULL;
+    }
+
+    g_array_sort (parser.cues, compareCues);
+    file = g_new0 (SubtitleFile, 1);
+    file->refCount = 1;
+    file->path = g_strdup (path);
+    file->format = parser.format;
+    file->count = parser.cues->len;
+    file->cues = (FileCue*) g_array_free (parser.cues, FALSE);
+    file->maxEnd = g_new (guint64, file->count);
+    file->text = parser.text;
+    buildIndex (file, 0, file->count);
+    return file;
+}
+
+SubtitleFile* subtitleFileRef (SubtitleFile* file) {
+    g_atomic_int_inc (&file->refCount);
+    return file;
+}
+
+void subtitleFileUnref (SubtitleFile* file) {
+    if (!file || !g_atomic_int_dec_and_test (&file->refCount)) {
+        return;
+    }
+    g_free (file->path);
+    g_free (file->cues);
+    g_free (file->maxEnd);
+    g_string_chunk_free (file->text);
+    g_free (file);
+}
+
+const gchar* subtitleFileGetPath (const SubtitleFile* file) {
+    return file->path;
+}
+
+SubtitleFormat subtitleFileGetFormat (const SubtitleFile* file) {
+    return file->format;
+}
+
+const gchar* subtitleFileFormatName (SubtitleFormat format) {
+    static const gchar* names[] = { "SubRip", "SubStation Alpha", "WebVTT" };
+
+    return names[format];
+}
+
+guint subtitleFileGetCount (const SubtitleFile* file) {
+    return file->count;
+}
+
+/* When the last cue ends, the latest end below the root of the tree */
+guint64 subtitleFileGetEnd (const SubtitleFile* file) {
+    return file->count ? file->maxEnd[file->count / 2] : 0;
+}
+
+/* Everything right of a root starts no earlier than it, so the walk goes
+ * right only past roots that have started, and down a subtree only if
+ * something in it is still showing: O(log n) plus the cues found */
+static void findCues (const SubtitleFile* file, guint lo, guint hi, guint64 time,
+                      guint* indices, guint max, guint* found) {
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+
+        if (file->maxEnd[mid] <= time) {
+            return;
+        }
+        findCues (file, lo, mid, time, indices, max, found);
+        if (file->cues[mid].start > time) {
+            return;
+        }
+        if (file->cues[mid].end > time) {
+            if (*found < max) {
+                indices[*found] = mid;
+            }
+            (*found)++;
+        }
+        lo = mid + 1;
+    }
+}
+
+/* Stores the indices of up to max cues showing at the time, by start time,
+ * and returns how many there are in all */
+guint subtitleFileFind (const SubtitleFile* file, guint64 time, guint* indices, guint max) {
+    guint found = 0;
+
+    findCues (file, 0, file->count, time, indices, max, &found);
+    return found;
+}
+
+/* Returns the Pango markup of the cues showing at the time, a line each, or
+ * NULL for none. Free with g_free(). */
+gchar* subtitleFileMarkupAt (const SubtitleFile* file, guint64 time) {
+    guint indices[MAX_SHOWN];
+    guint found = MIN (subtitleFileFind (file, time, indices, MAX_SHOWN), MAX_SHOWN);
+    GString* markup;
+
+    if (!found) {
+        return NULL;
+    }
+    markup = g_string_new (file->cues[indices[0]].markup);
+    for (guint i = 1; i < found; i++) {
+        g_string_append_printf (markup, "\n%s", file->cues[indices[i]].markup);
+    }
+    return g_string_free (markup, FALSE);
+}
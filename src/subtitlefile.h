@@ -0,0 +1,27 @@
+#pragma once
+#include <glib.h>
+
+/* An external SubRip, SubStation Alpha or WebVTT file. It is read line by
+ * line, and its cues are indexed in an interval tree over their times, so
+ * that the cues showing at any position are found in O(log n) however far
+ * the last lookup was. Files are immutable once loaded and shared by
+ * reference between threads. Times are in nanoseconds. */
+typedef struct _SubtitleFile SubtitleFile;
+
+typedef enum _SubtitleFormat {
+    SUBTITLE_FORMAT_SRT,
+    SUBTITLE_FORMAT_ASS,        /* also SSA */
+    SUBTITLE_FORMAT_VTT
+} SubtitleFormat;
+
+SubtitleFile*  subtitleFileLoad (const gchar* path, GError** error);
+SubtitleFile*  subtitleFileRef (SubtitleFile* file);
+void           subtitleFileUnref (SubtitleFile* file);
+const gchar*   subtitleFileGetPath (const SubtitleFile* file);
+SubtitleFormat subtitleFileGetFormat (const SubtitleFile* file);
+const gchar*   subtitleFileFormatName (SubtitleFormat format);
+guint          subtitleFileGetCount (const SubtitleFile* file);
+guint64        subtitleFileGetEnd (const SubtitleFile* file);
+guint          subtitleFileFind (const SubtitleFile* file, guint64 time,
+                                 guint* indices, guint max);
+gchar*         subtitleFileMarkupAt (const SubtitleFile* file, guint64 time);
@@ -0,0 +1,864 @@
+#include <gst/gst.h>
+#include <gst/base/gstbasetransform.h>
+#include <gst/video/video.h>
+#include <pango/pangocairo.h>
+#include <string.h>
+#include "subtitles.h"
+
+#define MAX_CUES    256                 /* kept per stream, should nothing draw them */
+#define CACHE_BYTES (8 * 1024 * 1024)   /* rendered lines kept by each overlay */
+
+enum {
+    SLOT_PRIMARY,               /* at the bottom */
+    SLOT_SECONDARY,             /* at the top */
+    SLOTS
+};
+
+typedef struct _Cue {
+    GstClockTime start;         /* running time */
+    GstClockTime end;           /* GST_CLOCK_TIME_NONE until the next cue or a gap */
+    gchar* markup;
+} Cue;
+
+/* The cues of all text streams of one pipeline: added by the mixer on the
+ * streaming threads of the text streams, taken by the overlay on the video
+ * one. Owned by the overlay, referenced by the mixer. */
+typedef struct _SubtitleCues {
+    gint refCount;
+    gint generation;            /* atomic, bumped whenever the streams change */
+    GMutex lock;
+    gchar* streams[SLOTS];      /* under the lock: ids of the streams drawn */
+    GHashTable* cues;           /* under the lock: stream id to GQueue of Cue, oldest first */
+    SubtitleFile* file;         /* under the lock: an external file, drawn by stream time */
+    gchar* fileStream;          /* under the lock: the id the file goes by in streams */
+} SubtitleCues;
+
+static void freeCue (Cue* cue) {
+    g_free (cue->markup);
+    g_free (cue);
+}
+
+static void freeCueQueue (GQueue* queue) {
+    g_queue_free_full (queue, (GDestroyNotify) freeCue);
+}
+
+static SubtitleCues* cuesNew (void) {
+    SubtitleCues* cues = g_new0 (SubtitleCues, 1);
+
+    cues->refCount = 1;
+    g_mutex_init (&cues->lock);
+    cues->cues = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+            (GDestroyNotify) freeCueQueue);
+    return cues;
+}
+
+static SubtitleCues* cuesRef (SubtitleCues* cues) {
+    g_atomic_int_inc (&cues->refCount);
+    return cues;
+}
+
+static void cuesUnref (SubtitleCues* cues) {
+    if (!cues || !g_atomic_int_dec_and_test (&cues->refCount)) {
+        return;
+    }
+    g_hash_table_destroy (cues->cues);
+    subtitleFileUnref (cues->file);
+    g_free (cues->fileStream);
+    for (guint slot = 0; slot < SLOTS; slot++) {
+        g_free (cues->streams[slot]);
+    }
+    g_mutex_clear (&cues->lock);
+    g_free (cues);
+}
+
+/* Must be called with the cues locked */
+static GQueue* streamCues (SubtitleCues* cues, const gchar* stream) {
+    GQueue* queue = g_hash_table_lookup (cues->cues, stream);
+
+    if (!queue) {
+        queue = g_queue_new();
+        g_hash_table_insert (cues->cues, g_strdup (stream), queue);
+    }
+    return queue;
+}
+
+/* Ends the cue still showing, if there is one */
+static void closeCue (GQueue* queue, GstClockTime time) {
+    Cue* last = g_queue_peek_tail (queue);
+
+    if (last && !GST_CLOCK_TIME_IS_VALID (last->end)) {
+        last->end = MAX (time, last->start);
+    }
+}
+
+/* Takes over the markup */
+static void addCue (SubtitleCues* cues, const gchar* stream, GstClockTime start,
+                    GstClockTime end, gchar* markup) {
+    Cue* cue = g_new (Cue, 1);
+    GQueue* queue;
+
+    cue->start = start;
+    cue->end = end;
+    cue->markup = markup;
+    g_mutex_lock (&cues->lock);
+    queue = streamCues (cues, stream);
+    closeCue (queue, start);
+    g_queue_push_tail (queue, cue);
+    while (g_queue_get_length (queue) > MAX_CUES) {
+        freeCue (g_queue_pop_head (queue));
+    }
+    g_mutex_unlock (&cues->lock);
+}
+
+static void gapCues (SubtitleCues* cues, const gchar* stream, GstClockTime time) {
+    g_mutex_lock (&cues->lock);
+    closeCue (streamCues (cues, stream), time);
+    g_mutex_unlock (&cues->lock);
+}
+
+static void flushCues (SubtitleCues* cues, const gchar* stream) {
+    g_mutex_lock (&cues->lock);
+    g_hash_table_remove (cues->cues, stream);
+    g_mutex_unlock (&cues->lock);
+}
+
+/* Returns the markup of the cues of a slot that show at the running time,
+ * a line each, or NULL for none. Cues that ended before it are dropped, as
+ * frames only move forward between flushes. An external file has its cues
+ * looked up in its index by stream time instead. */
+static gchar* cuesAt (SubtitleCues* cues, guint slot, GstClockTime time,
+                      GstClockTime streamTime) {
+    GString* text = NULL;
+    GQueue* queue = NULL;
+    gchar* markup;
+    Cue* cue;
+
+    g_mutex_lock (&cues->lock);
+    if (cues->file && g_strcmp0 (cues->streams[slot], cues->fileStream) == 0) {
+        markup = GST_CLOCK_TIME_IS_VALID (streamTime)
+                ? subtitleFileMarkupAt (cues->file, streamTime) : NULL;
+        g_mutex_unlock (&cues->lock);
+        return markup;
+    }
+    if (cues->streams[slot]) {
+        queue = g_hash_table_lookup (cues->cues, cues->streams[slot]);
+    }
+    while (queue && (cue = g_queue_peek_head (queue)) != NULL &&
+           GST_CLOCK_TIME_IS_VALID (cue->end) && cue->end <= time) {
+        freeCue (g_queue_pop_head (queue));
+    }
+    for (GList* l = queue ? queue->head : NULL; l; l = l->next) {
+        cue = l->data;
+        if (cue->start > time) {
+            break;
+        }
+        if (GST_CLOCK_TIME_IS_VALID (cue->end) && cue->end <= time) {
+            continue;
+        }
+        if (!text) {
+            text = g_string_new (cue->markup);
+        } else {
+            g_string_append_printf (text, "\n%s", cue->markup);
+        }
+    }
+    g_mutex_unlock (&cues->lock);
+    return text ? g_string_free (text, FALSE) : NULL;
+}
+
+/* The mixer */
+
+#define MIXER_TYPE (subtitleMixer_get_type())
+#define SUBTITLE_MIXER(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), MIXER_TYPE, SubtitleMixer))
+
+/* What the mixer knows of the stream on one of its sink pads. Apart from
+ * the stream id and the flag, it belongs to the pad's streaming thread. */
+typedef struct _MixerInput {
+    gchar* stream;              /* written under the mixer's object lock */
+    gboolean released;          /* under the mixer's object lock */
+    GstSegment segment;
+    gboolean text;              /* plain or marked up text, for the overlay to draw */
+    gboolean markup;
+} MixerInput;
+
+typedef struct _SubtitleMixer {
+    GstElement parent;
+    GstPad* srcpad;
+    /* Under the object lock */
+    SubtitleCues* cues;
+    gint generation;            /* of the cues' streams the lead was picked for */
+    GstPad* lead;               /* the sink pad whose stream goes on to playsink */
+    gboolean leadChanged;       /* its sticky events are still to be sent on */
+    guint padCount;
+} SubtitleMixer;
+
+typedef struct _SubtitleMixerClass {
+    GstElementClass parent;
+} SubtitleMixerClass;
+
+G_DEFINE_TYPE (SubtitleMixer, subtitleMixer, GST_TYPE_ELEMENT)
+
+static GstStaticPadTemplate mixerSinkTemplate = GST_STATIC_PAD_TEMPLATE ("sink_%u",
+        GST_PAD_SINK, GST_PAD_REQUEST, GST_STATIC_CAPS_ANY);
+
+static GstStaticPadTemplate mixerSrcTemplate = GST_STATIC_PAD_TEMPLATE ("src",
+        GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS_ANY);
+
+static MixerInput* mixerInput (GstPad* pad) {
+    return g_object_get_data (G_OBJECT (pad), "mixer-input");
+}
+
+static void freeMixerInput (MixerInput* input) {
+    g_free (input->stream);
+    g_free (input);
+}
+
+static SubtitleCues* mixerCues (SubtitleMixer* self) {
+    SubtitleCues* cues;
+
+    GST_OBJECT_LOCK (self);
+    cues = self->cues ? cuesRef (self->cues) : NULL;
+    GST_OBJECT_UNLOCK (self);
+    return cues;
+}
+
+/* The primary stream leads or, while it is not there, any other: playsink
+ * waits on its text pad once it is linked. Must be called with the object
+ * lock held. */
+static void updateLead (SubtitleMixer* self) {
+    gchar* primary = NULL;
+    GstPad* lead = NULL;
+
+    if (self->cues) {
+        g_mutex_lock (&self->cues->lock);
+        primary = g_strdup (self->cues->streams[SLOT_PRIMARY]);
+        self->generation = g_atomic_int_get (&self->cues->generation);
+        g_mutex_unlock (&self->cues->lock);
+    }
+    for (GList* l = GST_ELEMENT (self)->sinkpads; l; l = l->next) {
+        MixerInput* input = mixerInput (l->data);
+
+        if (input->released) {
+            continue;
+        }
+        if (!lead) {
+            lead = l->data;
+        }
+        if (primary && g_strcmp0 (input->stream, primary) == 0) {
+            lead = l->data;
+            break;
+        }
+    }
+    if (lead != self->lead) {
+        self->lead = lead;
+        self->leadChanged = TRUE;
+    }
+    g_free (primary);
+}
+
+static GstPad* mixerLead (SubtitleMixer* self) {
+    GstPad* lead;
+
+    GST_OBJECT_LOCK (self);
+    lead = self->lead ? gst_object_ref (self->lead) : NULL;
+    GST_OBJECT_UNLOCK (self);
+    return lead;
+}
+
+static gboolean forwardSticky_cb (GstPad* pad, GstEvent** event, gpointer data) {
+    SubtitleMixer* self = data;
+    UNUSED (pad);
+
+    if (GST_EVENT_TYPE (*event) != GST_EVENT_EOS) {
+        gst_pad_push_event (self->srcpad, gst_event_ref (*event));
+    }
+    return TRUE;
+}
+
+/* Whether what arrives on the pad goes on downstream. A pad that just took
+ * the lead first sends on the stream start, caps and segment it had. */
+static gboolean mixerLeads (SubtitleMixer* self, GstPad* pad) {
+    gboolean leads;
+    gboolean resend;
+
+    GST_OBJECT_LOCK (self);
+    if (self->cues && g_atomic_int_get (&self->cues->generation) != self->generation) {
+        updateLead (self);
+    }
+    leads = self->lead == pad;
+    resend = leads && self->leadChanged;
+    if (resend) {
+        self->leadChanged = FALSE;
+    }
+    GST_OBJECT_UNLOCK (self);
+
+    if (resend) {
+        gst_pad_sticky_events_foreach (pad, forwardSticky_cb, self);
+    }
+    return leads;
+}
+
+static GstClockTime runningTime (MixerInput* input, GstClockTime timestamp) {
+    return gst_segment_to_running_time (&input->segment, GST_FORMAT_TIME, timestamp);
+}
+
+/* Trailing newlines would only add empty lines */
+static gchar* bufferMarkup (GstBuffer* buffer, gboolean markup) {
+    GstMapInfo map;
+    gsize size;
+    gchar* text;
+
+    if (!gst_buffer_map (buffer, &map, GST_MAP_READ)) {
+        return NULL;
+    }
+    size = map.size;
+    while (size && (map.data[size - 1] == '\n' || map.data[size - 1] == '\r' ||
+                    map.data[size - 1] == '\0')) {
+        size--;
+    }
+    text = markup ? g_strndup ((const gchar*) map.data, size)
+                  : g_markup_escape_text ((const gchar*) map.data, size);
+    gst_buffer_unmap (buffer, &map);
+    return text;
+}
+
+static GstFlowReturn mixerChain (GstPad* pad, GstObject* parent, GstBuffer* buffer) {
+    SubtitleMixer* self = SUBTITLE_MIXER (parent);
+    MixerInput* input = mixerInput (pad);
+    SubtitleCues* cues = mixerCues (self);
+    GstClockTime timestamp = GST_BUFFER_PTS (buffer);
+    GstClockTime duration = GST_BUFFER_DURATION (buffer);
+
+    if (cues && input->text && input->stream && GST_CLOCK_TIME_IS_VALID (timestamp)) {
+        GstClockTime start = runningTime (input, timestamp);
+        GstClockTime end = GST_CLOCK_TIME_IS_VALID (duration)
+                ? runningTime (input, timestamp + duration) : GST_CLOCK_TIME_NONE;
+        gchar* markup = bufferMarkup (buffer, input->markup);
+
+        if (GST_CLOCK_TIME_IS_VALID (start) && markup && *markup) {
+            addCue (cues, input->stream, start, end, markup);
+        } else {
+            if (GST_CLOCK_TIME_IS_VALID (start)) {
+                gapCues (cues, input->stream, start);
+            }
+            g_free (markup);
+        }
+    }
+    cuesUnref (cues);
+
+    if (!mixerLeads (self, pad)) {
+        gst_buffer_unref (buffer);
+        return GST_FLOW_OK;
+    }
+    if (input->text) {
+        gst_buffer_unref (buffer);
+        if (GST_CLOCK_TIME_IS_VALID (timestamp)) {
+            gst_pad_push_event (self->srcpad, gst_event_new_gap (timestamp, duration));
+        }
+        return GST_FLOW_OK;
+    }
+    return gst_pad_push (self->srcpad, buffer);
+}
+
+static gboolean mixerSinkEvent (GstPad* pad, GstObject* parent, GstEvent* event) {
+    SubtitleMixer* self = SUBTITLE_MIXER (parent);
+    MixerInput* input = mixerInput (pad);
+    SubtitleCues* cues = mixerCues (self);
+    const GstStructure* structure;
+    const gchar* stream;
+    GstCaps* caps;
+    GstClockTime timestamp;
+    GstClockTime duration;
+
+    switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_STREAM_START:
+        gst_event_parse_stream_start (event, &stream);
+        GST_OBJECT_LOCK (self);
+        g_free (input->stream);
+        input->stream = g_strdup (stream);
+        updateLead (self);
+        GST_OBJECT_UNLOCK (self);
+        break;
+    case GST_EVENT_CAPS:
+        gst_event_parse_caps (event, &caps);
+        structure = gst_caps_get_structure (caps, 0);
+        input->text = gst_structure_has_name (structure, "text/x-raw");
+        input->markup = g_strcmp0 (gst_structure_get_string (structure, "format"),
+                "pango-markup") == 0;
+        break;
+    case GST_EVENT_SEGMENT:
+        gst_event_copy_segment (event, &input->segment);
+        break;
+    case GST_EVENT_GAP:
+        gst_event_parse_gap (event, &timestamp, &duration);
+        if (cues && input->text && input->stream) {
+            timestamp = runningTime (input, timestamp);
+            if (GST_CLOCK_TIME_IS_VALID (timestamp)) {
+                gapCues (cues, input->stream, timestamp);
+            }
+        }
+        break;
+    case GST_EVENT_FLUSH_STOP:
+        if (cues && input->stream) {
+            flushCues (cues, input->stream);
+        }
+        gst_segment_init (&input->segment, GST_FORMAT_TIME);
+        break;
+    default:
+        break;
+    }
+    cuesUnref (cues);
+
+    if (!mixerLeads (self, pad)) {
+        gst_event_unref (event);
+        return TRUE;
+    }
+    return gst_pad_push_event (self->srcpad, event);
+}
+
+/* Seeks, QoS and the like go up the leading stream only; the demuxer they
+ * reach feeds the others too */
+static gboolean mixerSrcEvent (GstPad* pad, GstObject* parent, GstEvent* event) {
+    GstPad* lead = mixerLead (SUBTITLE_MIXER (parent));
+    gboolean result = TRUE;
+    UNUSED (pad);
+
+    if (lead) {
+        result = gst_pad_push_event (lead, event);
+        gst_object_unref (lead);
+    } else {
+        gst_event_unref (event);
+    }
+    return result;
+}
+
+static gboolean mixerSrcQuery (GstPad* pad, GstObject* parent, GstQuery* query) {
+    GstPad* lead = mixerLead (SUBTITLE_MIXER (parent));
+    gboolean result;
+
+    if (!lead) {
+        return gst_pad_query_default (pad, parent, query);
+    }
+    result = gst_pad_peer_query (lead, query);
+    gst_object_unref (lead);
+    return result;
+}
+
+static GstPad* mixerRequestPad (GstElement* element, GstPadTemplate* templ,
+                                const gchar* name, const GstCaps* caps) {
+    SubtitleMixer* self = SUBTITLE_MIXER (element);
+    MixerInput* input = g_new0 (MixerInput, 1);
+    gchar* padName;
+    GstPad* pad;
+    UNUSED (caps);
+
+    GST_OBJECT_LOCK (self);
+    padName = name ? g_strdup (name) : g_strdup_printf ("sink_%u", self->padCount);
+    self->padCount++;
+    GST_OBJECT_UNLOCK (self);
+
+    pad = gst_pad_new_from_template (templ, padName);
+    g_free (padName);
+    gst_segment_init (&input->segment, GST_FORMAT_TIME);
+    g_object_set_data_full (G_OBJECT (pad), "mixer-input", input, (GDestroyNotify) freeMixerInput);
+    gst_pad_set_chain_function (pad, mixerChain);
+    gst_pad_set_event_function (pad, mixerSinkEvent);
+    gst_pad_set_active (pad, TRUE);
+    gst_element_add_pad (element, pad);
+    return pad;
+}
+
+static void mixerReleasePad (GstElement* element, GstPad* pad) {
+    SubtitleMixer* self = SUBTITLE_MIXER (element);
+
+    GST_OBJECT_LOCK (self);
+    mixerInput (pad)->released = TRUE;
+    updateLead (self);
+    GST_OBJECT_UNLOCK (self);
+    gst_pad_set_active (pad, FALSE);
+    gst_element_remove_pad (element, pad);
+}
+
+static void mixerFinalize (GObject* object) {
+    cuesUnref (SUBTITLE_MIXER (object)->cues);
+    G_OBJECT_CLASS (subtitleMixer_parent_class)->finalize (object);
+}
+
+static void subtitleMixer_class_init (SubtitleMixerClass* klass) {
+    GObjectClass* objectClass = G_OBJECT_CLASS (klass);
+    GstElementClass* elementClass = GST_ELEMENT_CLASS (klass);
+
+    objectClass->finalize = mixerFinalize;
+    gst_element_class_set_static_metadata (elementClass, "Subtitle mixer", "Generic",
+            "Collects the cues of several subtitle streams and passes one on",
+            "Project Gliese");
+    gst_element_class_add_static_pad_template (elementClass, &mixerSinkTemplate);
+    gst_element_class_add_static_pad_template (elementClass, &mixerSrcTemplate);
+    elementClass->request_new_pad = mixerRequestPad;
+    elementClass->release_pad = mixerReleasePad;
+}
+
+static void subtitleMixer_init (SubtitleMixer* self) {
+    self->srcpad = gst_pad_new_from_static_template (&mixerSrcTemplate, "src");
+    gst_pad_set_event_function (self->srcpad, mixerSrcEvent);
+    gst_pad_set_query_function (self->srcpad, mixerSrcQuery);
+    gst_element_add_pad (GST_ELEMENT (self), self->srcpad);
+    self->generation = -1;
+}
+
+/* The overlay */
+
+#define OVERLAY_TYPE (subtitleOverlay_get_type())
+#define SUBTITLE_OVERLAY(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), OVERLAY_TYPE, SubtitleOverlay))
+
+typedef struct _CachedLine {
+    GList link;                 /* in the overlay's lru queue */
+    gchar* key;
+    GstVideoOverlayRectangle* rectangle;
+    gsize bytes;
+} CachedLine;
+
+typedef struct _SubtitleOverlay {
+    GstBaseTransform parent;
+    SubtitleCues* cues;
+    /* The streaming thread's */
+    GstVideoInfo info;
+    gboolean supported;         /* system memory frames, which can be blended into */
+    PangoFontMap* fontMap;
+    PangoContext* pango;
+    GHashTable* cache;          /* slot and markup to CachedLine */
+    GQueue lru;                 /* least recently used first */
+    gsize cacheBytes;
+    gchar* shown[SLOTS];        /* the markup the composition was built from */
+    GstVideoOverlayComposition* composition;
+} SubtitleOverlay;
+
+typedef struct _SubtitleOverlayClass {
+    GstBaseTransformClass parent;
+} SubtitleOverlayClass;
+
+G_DEFINE_TYPE (SubtitleOverlay, subtitleOverlay, GST_TYPE_BASE_TRANSFORM)
+
+/* The formats are checked in setCaps(), so that anything else, GL memory
+ * included, can pass through rather than fail to link */
+static GstStaticPadTemplate overlaySinkTemplate = GST_STATIC_PAD_TEMPLATE ("sink",
+        GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS ("video/x-raw(ANY)"));
+
+static GstStaticPadTemplate overlaySrcTemplate = GST_STATIC_PAD_TEMPLATE ("src",
+        GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS ("video/x-raw(ANY)"));
+
+static void freeCachedLine (CachedLine* line) {
+    gst_video_overlay_rectangle_unref (line->rectangle);
+    g_free (line->key);
+    g_free (line);
+}
+
+static void clearCache (SubtitleOverlay* self) {
+    g_queue_init (&self->lru);
+    g_hash_table_remove_all (self->cache);
+    self->cacheBytes = 0;
+}
+
+static void clearShown (SubtitleOverlay* self) {
+    for (guint slot = 0; slot < SLOTS; slot++) {
+        g_clear_pointer (&self->shown[slot], g_free);
+    }
+    g_clear_pointer (&self->composition, gst_video_overlay_composition_unref);
+}
+
+/* Lays the markup out and rasterises it, white with a dark outline, centred
+ * at the bottom of the frame for the primary slot and at the top for the
+ * secondary one. Cairo draws premultiplied ARGB in native order, which is
+ * what the blender takes as is. */
+static GstVideoOverlayRectangle* renderLine (SubtitleOverlay* self, guint slot,
+                                             const gchar* markup) {
+    gint frameWidth = GST_VIDEO_INFO_WIDTH (&self->info);
+    gint frameHeight = GST_VIDEO_INFO_HEIGHT (&self->info);
+    gint fontSize = MAX (frameHeight / 18, 12);
+    gint outline = MAX (fontSize / 12, 1);
+    gint margin = frameHeight / 20;
+    PangoFontDescription* font;
+    PangoAttrList* attributes;
+    PangoLayout* layout;
+    PangoRectangle logical;
+    GstVideoOverlayRectangle* rectangle;
+    cairo_surface_t* surface;
+    GstBuffer* buffer;
+    GstMapInfo map;
+    cairo_t* cr;
+    gchar* text;
+    gint width, height;
+
+    if (!self->pango) {
+        self->fontMap = pango_cairo_font_map_new();
+        self->pango = pango_font_map_create_context (self->fontMap);
+    }
+    layout = pango_layout_new (self->pango);
+    font = pango_font_description_from_string ("Sans Bold");
+    pango_font_description_set_absolute_size (font, fontSize * PANGO_SCALE);
+    pango_layout_set_font_description (layout, font);
+    pango_font_description_free (font);
+    pango_layout_set_width (layout, frameWidth * 9 / 10 * PANGO_SCALE);
+    pango_layout_set_wrap (layout, PANGO_WRAP_WORD_CHAR);
+    pango_layout_set_alignment (layout, PANGO_ALIGN_CENTER);
+    if (pango_parse_markup (markup, -1, 0, &attributes, &text, NULL, NULL)) {
+        pango_layout_set_text (layout, text, -1);
+        pango_layout_set_attributes (layout, attributes);
+        pango_attr_list_unref (attributes);
+        g_free (text);
+    } else {
+        pango_layout_set_text (layout, markup, -1);
+    }
+
+    pango_layout_get_pixel_extents (layout, NULL, &logical);
+    if (logical.width <= 0 || logical.height <= 0) {
+        g_object_unref (layout);
+        return NULL;
+    }
+    width = logical.width + 2 * outline;
+    height = logical.height + 2 * outline;
+    buffer = gst_buffer_new_allocate (NULL, (gsize) width * height * 4, NULL);
+    if (!buffer || !gst_buffer_map (buffer, &map, GST_MAP_WRITE)) {
+        g_clear_pointer (&buffer, gst_buffer_unref);
+        g_object_unref (layout);
+        return NULL;
+    }
+    memset (map.data, 0, map.size);
+    surface = cairo_image_surface_create_for_data (map.data, CAIRO_FORMAT_ARGB32,
+            width, height, width * 4);
+    cr = cairo_create (surface);
+    cairo_translate (cr, outline - logical.x, outline - logical.y);
+    cairo_move_to (cr, 0, 0);
+    pango_cairo_layout_path (cr, layout);
+    cairo_set_line_width (cr, outline * 2);
+    cairo_set_line_join (cr, CAIRO_LINE_JOIN_ROUND);
+    cairo_set_source_rgba (cr, 0, 0, 0, 0.85);
+    cairo_stroke (cr);
+    cairo_move_to (cr, 0, 0);
+    cairo_set_source_rgb (cr, 1, 1, 1);
+    pango_cairo_show_layout (cr, layout);
+    cairo_destroy (cr);
+    cairo_surface_destroy (surface);
+    gst_buffer_unmap (buffer, &map);
+    g_object_unref (layout);
+
+    gst_buffer_add_video_meta (buffer, GST_VIDEO_FRAME_FLAG_NONE,
+            GST_VIDEO_OVERLAY_COMPOSITION_FORMAT_RGB, width, height);
+    rectangle = gst_video_overlay_rectangle_new_raw (buffer, MAX ((frameWidth - width) / 2, 0),
+            slot == SLOT_PRIMARY ? MAX (frameHeight - height - margin, 0) : margin,
+            width, height, GST_VIDEO_OVERLAY_FORMAT_FLAG_PREMULTIPLIED_ALPHA);
+    gst_buffer_unref (buffer);
+    return rectangle;
+}
+
+/* A rectangle also keeps the frame format version of its pixels the blender
+ * converts to, so a cue that shows again costs neither Pango nor that */
+static GstVideoOverlayRectangle* cachedLine (SubtitleOverlay* self, guint slot,
+                                             const gchar* markup) {
+    gchar* key = g_strdup_printf ("%u:%s", slot, markup);
+    CachedLine* line = g_hash_table_lookup (self->cache, key);
+    GstVideoOverlayRectangle* rectangle;
+    guint width, height;
+
+    if (line) {
+        g_free (key);
+        g_queue_unlink (&self->lru, &line->link);
+        g_queue_push_tail_link (&self->lru, &line->link);
+        return line->rectangle;
+    }
+    rectangle = renderLine (self, slot, markup);
+    if (!rectangle) {
+        g_free (key);
+        return NULL;
+    }
+    gst_video_overlay_rectangle_get_render_rectangle (rectangle, NULL, NULL, &width, &height);
+    line = g_new0 (CachedLine, 1);
+    line->link.data = line;
+    line->key = key;
+    line->rectangle = rectangle;
+    line->bytes = (gsize) width * height * 4;
+    g_hash_table_insert (self->cache, key, line);
+    g_queue_push_tail_link (&self->lru, &line->link);
+    self->cacheBytes += line->bytes;
+
+    while (self->cacheBytes > CACHE_BYTES && g_queue_get_length (&self->lru) > 1) {
+        CachedLine* oldest = g_queue_peek_head (&self->lru);
+
+        g_queue_unlink (&self->lru, &oldest->link);
+        self->cacheBytes -= oldest->bytes;
+        g_hash_table_remove (self->cache, oldest->key);
+    }
+    return rectangle;
+}
+
+static void buildComposition (SubtitleOverlay* self) {
+    g_clear_pointer (&self->composition, gst_video_overlay_composition_unref);
+    for (guint slot = 0; slot < SLOTS; slot++) {
+        GstVideoOverlayRectangle* rectangle;
+
+        if (!self->shown[slot] || !(rectangle = cachedLine (self, slot, self->shown[slot]))) {
+            continue;
+        }
+        if (!self->composition) {
+            self->composition = gst_video_overlay_composition_new (rectangle);
+        } else {
+            gst_video_overlay_composition_add_rectangle (self->composition, rectangle);
+        }
+    }
+}
+
+static gboolean overlaySetCaps (GstBaseTransform* trans, GstCaps* incaps, GstCaps* outcaps) {
+    SubtitleOverlay* self = SUBTITLE_OVERLAY (trans);
+    GstCapsFeatures* features = gst_caps_get_features (incaps, 0);
+    UNUSED (outcaps);
+
+    self->supported = gst_video_info_from_caps (&self->info, incaps) &&
+            (!features || gst_caps_features_contains (features,
+                    GST_CAPS_FEATURE_MEMORY_SYSTEM_MEMORY));
+    clearShown (self);
+    clearCache (self);
+    return TRUE;
+}
+
+/* Works out what shows on the frame before base transform decides whether
+ * it needs the frame writable: frames without subtitles pass untouched */
+static void overlayBeforeTransform (GstBaseTransform* trans, GstBuffer* buffer) {
+    SubtitleOverlay* self = SUBTITLE_OVERLAY (trans);
+    GstClockTime time = gst_segment_to_running_time (&trans->segment, GST_FORMAT_TIME,
+            GST_BUFFER_PTS (buffer));
+    GstClockTime streamTime = gst_segment_to_stream_time (&trans->segment, GST_FORMAT_TIME,
+            GST_BUFFER_PTS (buffer));
+    gchar* text[SLOTS];
+    gboolean changed = FALSE;
+
+    if (!self->supported || !GST_CLOCK_TIME_IS_VALID (time)) {
+        gst_base_transform_set_passthrough (trans, TRUE);
+        return;
+    }
+    for (guint slot = 0; slot < SLOTS; slot++) {
+        text[slot] = cuesAt (self->cues, slot, time, streamTime);
+        changed |= g_strcmp0 (text[slot], self->shown[slot]) != 0;
+    }
+    for (guint slot = 0; slot < SLOTS; slot++) {
+        if (changed) {
+            g_free (self->shown[slot]);
+            self->shown[slot] = text[slot];
+        } else {
+            g_free (text[slot]);
+        }
+    }
+    if (changed) {
+        buildComposition (self);
+    }
+    gst_base_transform_set_passthrough (trans, self->composition == NULL);
+}
+
+static GstFlowReturn overlayTransform (GstBaseTransform* trans, GstBuffer* buffer) {
+    SubtitleOverlay* self = SUBTITLE_OVERLAY (trans);
+    GstVideoFrame frame;
+
+    if (!self->composition) {
+        return GST_FLOW_OK;
+    }
+    if (!gst_video_frame_map (&frame, &self->info, buffer, GST_MAP_READWRITE)) {
+        GST_WARNING_OBJECT (self, "could not map the frame to draw subtitles on");
+        return GST_FLOW_OK;
+    }
+    gst_video_overlay_composition_blend (self->composition, &frame);
+    gst_video_frame_unmap (&frame);
+    return GST_FLOW_OK;
+}
+
+static gboolean overlayStop (GstBaseTransform* trans) {
+    SubtitleOverlay* self = SUBTITLE_OVERLAY (trans);
+
+    clearShown (self);
+    clearCache (self);
+    g_clear_object (&self->pango);
+    g_clear_object (&self->fontMap);
+    return TRUE;
+}
+
+static void overlayFinalize (GObject* object) {
+    SubtitleOverlay* self = SUBTITLE_OVERLAY (object);
+
+    overlayStop (GST_BASE_TRANSFORM (self));
+    g_hash_table_destroy (self->cache);
+    cuesUnref (self->cues);
+    G_OBJECT_CLASS (subtitleOverlay_parent_class)->finalize (object);
+}
+
+static void subtitleOverlay_class_init (SubtitleOverlayClass* klass) {
+    GObjectClass* objectClass = G_OBJECT_CLASS (klass);
+    GstElementClass* elementClass = GST_ELEMENT_CLASS (klass);
+    GstBaseTransformClass* transformClass = GST_BASE_TRANSFORM_CLASS (klass);
+
+    objectClass->finalize = overlayFinalize;
+    gst_element_class_set_static_metadata (elementClass, "Subtitle overlay",
+            "Filter/Editor/Video/Overlay/Subtitle",
+            "Draws the primary and secondary subtitle streams of a subtitle mixer",
+            "Project Gliese");
+    gst_element_class_add_static_pad_template (elementClass, &overlaySinkTemplate);
+    gst_element_class_add_static_pad_template (elementClass, &overlaySrcTemplate);
+
+    transformClass->transform_ip_on_passthrough = FALSE;
+    transformClass->set_caps = overlaySetCaps;
+    transformClass->before_transform = overlayBeforeTransform;
+    transformClass->transform_ip = overlayTransform;
+    transformClass->stop = overlayStop;
+}
+
+static void subtitleOverlay_init (SubtitleOverlay* self) {
+    self->cues = cuesNew();
+    self->cache = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+            (GDestroyNotify) freeCachedLine);
+    g_queue_init (&self->lru);
+    gst_base_transform_set_passthrough (GST_BASE_TRANSFORM (self), TRUE);
+}
+
+/* Has the mixer collect its cues for the overlay to draw */
+void subtitleMixerAttach (GstElement* mixer, GstElement* overlay) {
+    SubtitleMixer* self = SUBTITLE_MIXER (mixer);
+    SubtitleCues* cues = cuesRef (SUBTITLE_OVERLAY (overlay)->cues);
+    SubtitleCues* old;
+
+    GST_OBJECT_LOCK (self);
+    old = self->cues;
+    self->cues = cues;
+    updateLead (self);
+    GST_OBJECT_UNLOCK (self);
+    cuesUnref (old);
+}
+
+/* The stream ids to draw at the bottom and at the top, NULL for none */
+void subtitleOverlaySetStreams (GstElement* overlay, const gchar* primary,
+                                const gchar* secondary) {
+    SubtitleCues* cues = SUBTITLE_OVERLAY (overlay)->cues;
+
+    g_mutex_lock (&cues->lock);
+    g_free (cues->streams[SLOT_PRIMARY]);
+    g_free (cues->streams[SLOT_SECONDARY]);
+    cues->streams[SLOT_PRIMARY] = g_strdup (primary);
+    cues->streams[SLOT_SECONDARY] = g_strdup (secondary);
+    g_atomic_int_inc (&cues->generation);
+    g_mutex_unlock (&cues->lock);
+}
+
+/* Draws the cues of an external file wherever the id is set as a stream;
+ * NULL drops the file */
+void subtitleOverlaySetFile (GstElement* overlay, SubtitleFile* file, const gchar* id) {
+    SubtitleCues* cues = SUBTITLE_OVERLAY (overlay)->cues;
+
+    g_mutex_lock (&cues->lock);
+    if (file != cues->file) {
+        subtitleFileUnref (cues->file);
+        cues->file = file ? subtitleFileRef (file) : NULL;
+    }
+    g_free (cues->fileStream);
+    cues->fileStream = g_strdup (id);
+    g_mutex_unlock (&cues->lock);
+}
+
+void subtitlesRegister (void) {
+    gst_element_register (NULL, "gliesesubmix", GST_RANK_NONE, MIXER_TYPE);
+    gst_element_register (NULL, "gliesesubtitles", GST_RANK_NONE, OVERLAY_TYPE);
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <gst/gst.h>
+#include "gst-backend.h"
+#include "subtitlefile.h"
+
+/* Two subtitle streams on screen at once, the primary one at the bottom of
+ * the frame and the secondary one at the top.
+ *
+ * "gliesesubmix" is playbin3's text stream combiner: it takes every selected
+ * text stream, keeps their cues and passes one stream on to playsink, as
+ * gaps where the cues are text, so that playsink's own overlay stays in step
+ * but idle, and as is for bitmap formats only playsink can draw.
+ * "gliesesubtitles" is a video filter that draws the text cues onto system
+ * memory frames. Each line is laid out and rasterised by Pango once and
+ * kept as a premultiplied bitmap for as long as it shows or is used again.
+ * An external subtitle file can stand in for either stream.
+ * Registered with the process by subtitlesRegister(). */
+void subtitlesRegister (void);
+void subtitleMixerAttach (GstElement* mixer, GstElement* overlay);
+void subtitleOverlaySetStreams (GstElement* overlay, const gchar* primary,
+                                const gchar* secondary);
+void subtitleOverlaySetFile (GstElement* overlay, SubtitleFile* file, const gchar* id);
@@ -0,0 +1,637 @@
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "gst-backend.h"
+#include "thumbnailer.h"
+
+/* Hover previews for the seek slider. A separate, low priority pipeline
+ * decodes keyframes only, scaled down, and the results are kept in an LRU
+ * cache keyed by timestamp bucket that is saved to disk per file. */
+
+#define THUMBNAIL_WIDTH   160
+#define THUMBNAIL_HEIGHT  (4 * THUMBNAIL_WIDTH)  /* at most, taller frames are squeezed */
+#define DECODE_TIMEOUT    (5 * GST_SECOND)
+#define CACHE_MAGIC       "GLTH"
+#define CACHE_VERSION     1
+#define BUCKETS_PER_FILE  1000
+
+typedef struct _CacheEntry {
+    gint64    bucket;
+    Thumbnail thumbnail;
+    GList*    link;
+} CacheEntry;
+
+typedef struct _CacheHeader {
+    gchar   magic[4];
+    guint32 version;
+    gint64  sourceSize;
+    gint64  sourceMtime;
+    gdouble granularity;
+    guint32 count;
+} CacheHeader;
+
+typedef struct _CacheRecord {
+    gint64  bucket;
+    gdouble position;
+    gint32  width;
+    gint32  height;
+    gint32  stride;
+    guint32 size;
+} CacheRecord;
+
+/* An opened file and its cache. Closing the file hands it over to its
+ * worker, which saves the cache and frees it without the main thread
+ * waiting. Guarded by the lock while the file is open. */
+typedef struct _Session {
+    gchar*      uri;
+    gboolean    quit;
+    GThread*    previous;       /* worker of the file opened before */
+    GHashTable* entries;
+    GQueue      lru;
+    gsize       cacheBytes;
+    gdouble     granularity;    /* seconds per bucket */
+    gint64      sourceSize;
+    gint64      sourceMtime;
+} Session;
+
+typedef struct _ThumbnailerData {
+    GMutex        lock;
+    GCond         cond;
+    GThread*      thread;           /* the latest worker, only used on the main thread */
+    Session*      session;          /* NULL while no file is open */
+    /* A single request slot; hovering elsewhere replaces the request */
+    gboolean      hasRequest;
+    gdouble       requestPosition;
+    ThumbnailFunc requestFunc;
+    gpointer      requestData;
+    gsize         cacheSize;
+} ThumbnailerData;
+
+typedef struct _Delivery {
+    ThumbnailFunc func;
+    gpointer      userData;
+    Thumbnail     thumbnail;
+} Delivery;
+
+static ThumbnailerData thumbnailer = { .cacheSize = 32 * 1024 * 1024 };
+
+void thumbnailClear (Thumbnail* thumbnail) {
+    if (thumbnail->pixels) {
+        g_bytes_unref (thumbnail->pixels);
+        thumbnail->pixels = NULL;
+    }
+}
+
+static void thumbnailCopy (Thumbnail* dest, const Thumbnail* src) {
+    *dest = *src;
+    g_bytes_ref (dest->pixels);
+}
+
+static gint64 bucketFor (Session* session, gdouble position) {
+    return (gint64) (position / session->granularity);
+}
+
+static void cacheEntryFree (CacheEntry* entry) {
+    thumbnailClear (&entry->thumbnail);
+    g_free (entry);
+}
+
+static void cacheRemove (Session* session, CacheEntry* entry) {
+    session->cacheBytes -= g_bytes_get_size (entry->thumbnail.pixels);
+    g_queue_delete_link (&session->lru, entry->link);
+    g_hash_table_remove (session->entries, &entry->bucket);
+}
+
+/* Takes over the thumbnail's pixels. Called with the lock held. */
+static void cacheInsert (Session* session, gint64 bucket, Thumbnail* thumbnail) {
+    CacheEntry* entry = g_hash_table_lookup (session->entries, &bucket);
+
+    if (entry) {
+        cacheRemove (session, entry);
+    }
+
+    entry = g_new0 (CacheEntry, 1);
+    entry->bucket = bucket;
+    entry->thumbnail = *thumbnail;
+    thumbnail->pixels = NULL;
+
+    g_queue_push_head (&session->lru, entry);
+    entry->link = session->lru.head;
+    g_hash_table_insert (session->entries, &entry->bucket, entry);
+    session->cacheBytes += g_bytes_get_size (entry->thumbnail.pixels);
+
+    while (session->cacheBytes > thumbnailer.cacheSize && session->lru.length > 1) {
+        cacheRemove (session, (CacheEntry*) g_queue_peek_tail (&session->lru));
+    }
+}
+
+/* Called with the lock held */
+static CacheEntry* cacheFind (Session* session, gint64 bucket) {
+    CacheEntry* entry = g_hash_table_lookup (session->entries, &bucket);
+
+    if (entry) {
+        g_queue_unlink (&session->lru, entry->link);
+        g_queue_push_head_link (&session->lru, entry->link);
+    }
+    return entry;
+}
+
+/* Called with the lock held */
+static void cacheClear (Session* session) {
+    g_hash_table_remove_all (session->entries);
+    g_queue_clear (&session->lru);
+    session->cacheBytes = 0;
+    session->granularity = 1.0;
+}
+
+static Session* sessionNew (const gchar* uri) {
+    Session* session = g_new0 (Session, 1);
+
+    session->uri = g_strdup (uri);
+    session->granularity = 1.0;
+    session->entries = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+            NULL, (GDestroyNotify) cacheEntryFree);
+    return session;
+}
+
+static void sessionFree (Session* session) {
+    g_hash_table_destroy (session->entries);
+    g_queue_clear (&session->lru);
+    g_free (session->uri);
+    g_free (session);
+}
+
+static gboolean sessionQuit (Session* session) {
+    gboolean quit;
+
+    g_mutex_lock (&thumbnailer.lock);
+    quit = session->quit;
+    g_mutex_unlock (&thumbnailer.lock);
+    return quit;
+}
+
+static gchar* cachePath (const gchar* uri) {
+    gchar* checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, uri, -1);
+    gchar* name = g_strconcat (checksum, ".thumbs", NULL);
+    gchar* path = g_build_filename (g_get_user_cache_dir(), "projectgliese",
+            "thumbnails", name, NULL);
+
+    g_free (name);
+    g_free (checksum);
+    return path;
+}
+
+/* Identifies the file behind a URI so a stale cache is not reused */
+static void sourceIdentity (const gchar* uri, gint64* size, gint64* mtime) {
+    gchar* filename = g_filename_from_uri (uri, NULL, NULL);
+    GStatBuf st;
+
+    *size = *mtime = 0;
+    if (filename && g_stat (filename, &st) == 0) {
+        *size = st.st_size;
+        *mtime = st.st_mtime;
+    }
+    g_free (filename);
+}
+
+/* Called from the worker once the session is closed, so without the lock */
+static void cacheSave (Session* session) {
+    CacheHeader header = { .magic = CACHE_MAGIC, .version = CACHE_VERSION };
+    gchar* path;
+    gchar* tmpPath;
+    gchar* dir;
+    FILE* file;
+    gboolean ok = TRUE;
+
+    if (session->lru.length == 0) {
+        return;
+    }
+
+    path = cachePath (session->uri);
+    tmpPath = g_strconcat (path, ".tmp", NULL);
+    dir = g_path_get_dirname (path);
+    g_mkdir_with_parents (dir, 0700);
+
+    file = g_fopen (tmpPath, "wb");
+    if (!file) {
+        goto out;
+    }
+
+    header.sourceSize = session->sourceSize;
+    header.sourceMtime = session->sourceMtime;
+    header.granularity = session->granularity;
+    header.count = session->lru.length;
+    ok &= fwrite (&header, sizeof (header), 1, file) == 1;
+
+    /* Least recently used first, so loading restores the same order */
+    for (GList* l = session->lru.tail; l != NULL && ok; l = l->prev) {
+        CacheEntry* entry = (CacheEntry*) l->data;
+        gsize size;
+        gconstpointer pixels = g_bytes_get_data (entry->thumbnail.pixels, &size);
+        CacheRecord record = {
+            .bucket   = entry->bucket,
+            .position = entry->thumbnail.position,
+            .width    = entry->thumbnail.width,
+            .height   = entry->thumbnail.height,
+            .stride   = entry->thumbnail.stride,
+            .size     = size
+        };
+
+        ok &= fwrite (&record, sizeof (record), 1, file) == 1;
+        ok &= fwrite (pixels, 1, size, file) == size;
+    }
+    ok &= fclose (file) == 0;
+
+    if (ok) {
+        g_rename (tmpPath, path);
+    } else {
+        g_unlink (tmpPath);
+    }
+
+out:
+    g_free (dir);
+    g_free (tmpPath);
+    g_free (path);
+}
+
+/* Whether a record read from the cache file describes a thumbnail this
+ * pipeline could have produced, and fits in what is left of the file */
+static gboolean recordIsValid (const CacheRecord* record, gint64 remaining) {
+    return record->width > 0 && record->width <= THUMBNAIL_WIDTH &&
+           record->height > 0 && record->height <= THUMBNAIL_HEIGHT &&
+           record->stride == GST_ROUND_UP_4 (record->width * 3) &&
+           record->size == (guint64) record->stride * record->height &&
+           record->size <= remaining;
+}
+
+/* Called from the worker without the lock, which is only taken to add each
+ * thumbnail so lookups keep going meanwhile. A cache that fails to load
+ * entirely is corrupt, so it is thrown away rather than partially used. */
+static void cacheLoad (Session* session) {
+    CacheHeader header;
+    gchar* path = cachePath (session->uri);
+    FILE* file = g_fopen (path, "rb");
+    gint64 length;
+    gboolean ok = TRUE;
+
+    if (!file) {
+        g_free (path);
+        return;
+    }
+
+    if (fseek (file, 0, SEEK_END) != 0 || (length = ftell (file)) < 0 ||
+        fseek (file, 0, SEEK_SET) != 0 ||
+        fread (&header, sizeof (header), 1, file) != 1 ||
+        memcmp (header.magic, CACHE_MAGIC, 4) != 0 ||
+        header.version != CACHE_VERSION ||
+        header.sourceSize != session->sourceSize ||
+        header.sourceMtime != session->sourceMtime ||
+        header.granularity <= 0) {
+        fclose (file);
+        g_free (path);
+        return;
+    }
+
+    g_mutex_lock (&thumbnailer.lock);
+    session->granularity = header.granularity;
+    g_mutex_unlock (&thumbnailer.lock);
+
+    for (guint32 i = 0; i < header.count; i++) {
+        CacheRecord record;
+        Thumbnail thumbnail;
+        gpointer pixels;
+
+        ok = fread (&record, sizeof (record), 1, file) == 1 &&
+             recordIsValid (&record, length - ftell (file));
+        if (!ok) {
+            break;
+        }
+        pixels = g_malloc (record.size);
+        ok = fread (pixels, 1, record.size, file) == record.size;
+        if (!ok) {
+            g_free (pixels);
+            break;
+        }
+
+        thumbnail.position = record.position;
+        thumbnail.width = record.width;
+        thumbnail.height = record.height;
+        thumbnail.stride = record.stride;
+        thumbnail.pixels = g_bytes_new_take (pixels, record.size);
+        g_mutex_lock (&thumbnailer.lock);
+        cacheInsert (session, record.bucket, &thumbnail);
+        g_mutex_unlock (&thumbnailer.lock);
+    }
+    fclose (file);
+
+    if (!ok) {
+        g_printerr ("Discarding corrupt thumbnail cache %s\n", path);
+        g_mutex_lock (&thumbnailer.lock);
+        cacheClear (session);
+        g_mutex_unlock (&thumbnailer.lock);
+        g_unlink (path);
+    }
+    g_free (path);
+}
+
+static void lowerThreadPriority() {
+#ifdef __linux__
+    /* On Linux the nice value is per thread */
+    setpriority (PRIO_PROCESS, (id_t) syscall (SYS_gettid), 19);
+#endif
+}
+
+/* Streaming threads of the thumbnail pipeline announce themselves here from
+ * their own thread, which is where their priority can be lowered. Nothing
+ * reads this bus, so every message is dropped. */
+static GstBusSyncReply busSync_cb (GstBus* bus, GstMessage* msg, gpointer data) {
+    UNUSED (bus);
+    UNUSED (data);
+
+    if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_STREAM_STATUS) {
+        GstStreamStatusType type;
+
+        gst_message_parse_stream_status (msg, &type, NULL);
+        if (type == GST_STREAM_STATUS_TYPE_ENTER) {
+            lowerThreadPriority();
+        }
+    }
+    return GST_BUS_DROP;
+}
+
+static GstElement* createPipeline (const gchar* uri, GstElement** sink) {
+    GstElement* pipeline;
+    GstElement* source;
+    GstBus* bus;
+    gchar* description;
+
+    description = g_strdup_printf (
+            "uridecodebin name=source caps=video/x-raw expose-all-streams=false ! "
+            "videoconvert ! videoscale ! "
+            "video/x-raw,format=RGB,width=%d,height=[1,%d],pixel-aspect-ratio=1/1 ! "
+            "fakesink name=sink sync=false", THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT);
+    pipeline = gst_parse_launch (description, NULL);
+    g_free (description);
+    if (!pipeline) {
+        return NULL;
+    }
+
+    source = gst_bin_get_by_name (GST_BIN (pipeline), "source");
+    g_object_set (source, "uri", uri, NULL);
+    gst_object_unref (source);
+    *sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+
+    bus = gst_element_get_bus (pipeline);
+    gst_bus_set_sync_handler (bus, busSync_cb, NULL, NULL);
+    gst_object_unref (bus);
+
+    gst_element_set_state (pipeline, GST_STATE_PAUSED);
+    if (gst_element_get_state (pipeline, NULL, NULL, DECODE_TIMEOUT) != GST_STATE_CHANGE_SUCCESS) {
+        gst_element_set_state (pipeline, GST_STATE_NULL);
+        gst_object_unref (*sink);
+        gst_object_unref (pipeline);
+        return NULL;
+    }
+    return pipeline;
+}
+
+static gboolean decodeThumbnail (GstElement* pipeline, GstElement* sink,
+                                 gdouble position, Thumbnail* thumbnail) {
+    GstSample* sample = NULL;
+    GstBuffer* buffer;
+    GstVideoInfo info;
+    GstMapInfo map;
+    gsize size;
+
+    /* Trick mode key units lets the decoder skip everything but keyframes */
+    if (!gst_element_seek_simple (pipeline, GST_FORMAT_TIME,
+            GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_BEFORE |
+            GST_SEEK_FLAG_TRICKMODE | GST_SEEK_FLAG_TRICKMODE_KEY_UNITS,
+            (gint64) (position * GST_SECOND))) {
+        return FALSE;
+    }
+    if (gst_element_get_state (pipeline, NULL, NULL, DECODE_TIMEOUT) != GST_STATE_CHANGE_SUCCESS) {
+        return FALSE;
+    }
+
+    g_object_get (sink, "last-sample", &sample, NULL);
+    if (!sample) {
+        return FALSE;
+    }
+    buffer = gst_sample_get_buffer (sample);
+    if (!buffer || !gst_video_info_from_caps (&info, gst_sample_get_caps (sample)) ||
+        !gst_buffer_map (buffer, &map, GST_MAP_READ)) {
+        gst_sample_unref (sample);
+        return FALSE;
+    }
+
+    thumbnail->width = GST_VIDEO_INFO_WIDTH (&info);
+    thumbnail->height = GST_VIDEO_INFO_HEIGHT (&info);
+    thumbnail->stride = GST_VIDEO_INFO_PLANE_STRIDE (&info, 0);
+    size = (gsize) thumbnail->stride * thumbnail->height;
+    thumbnail->pixels = g_bytes_new (map.data, MIN (size, map.size));
+    thumbnail->position = position;
+    if (GST_BUFFER_PTS_IS_VALID (buffer)) {
+        guint64 streamTime = gst_segment_to_stream_time (gst_sample_get_segment (sample),
+                GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+        if (GST_CLOCK_TIME_IS_VALID (streamTime)) {
+            thumbnail->position = (gdouble) streamTime / GST_SECOND;
+        }
+    }
+
+    gst_buffer_unmap (buffer, &map);
+    gst_sample_unref (sample);
+    return g_bytes_get_size (thumbnail->pixels) == size;
+}
+
+static gboolean deliver_idle (Delivery* delivery) {
+    delivery->func (&delivery->thumbnail, delivery->userData);
+    thumbnailClear (&delivery->thumbnail);
+    g_free (delivery);
+    return G_SOURCE_REMOVE;
+}
+
+/* Called with the lock held */
+static void deliver (ThumbnailFunc func, gpointer userData, const Thumbnail* thumbnail) {
+    Delivery* delivery;
+
+    if (!func) {
+        return;
+    }
+    delivery = g_new0 (Delivery, 1);
+    delivery->func = func;
+    delivery->userData = userData;
+    thumbnailCopy (&delivery->thumbnail, thumbnail);
+    g_idle_add ((GSourceFunc) deliver_idle, delivery);
+}
+
+/* Everything slow about a file happens here rather than on the main thread:
+ * loading its cache, prerolling the pipeline, and saving the cache once the
+ * file is closed. */
+static gpointer thumbnailerThread (gpointer data) {
+    Session* session = (Session*) data;
+    GstElement* pipeline = NULL;
+    GstElement* sink = NULL;
+    gint64 duration;
+
+    lowerThreadPriority();
+
+    /* The file opened before may be this one, so its cache must be saved
+     * before this one is loaded */
+    if (session->previous) {
+        g_thread_join (session->previous);
+        session->previous = NULL;
+    }
+
+    sourceIdentity (session->uri, &session->sourceSize, &session->sourceMtime);
+    cacheLoad (session);
+    if (!sessionQuit (session)) {
+        pipeline = createPipeline (session->uri, &sink);
+    }
+
+    g_mutex_lock (&thumbnailer.lock);
+    /* Spread the buckets over the file unless a saved cache fixed them */
+    if (pipeline && session->lru.length == 0 &&
+        gst_element_query_duration (pipeline, GST_FORMAT_TIME, &duration)) {
+        session->granularity = MAX (1.0, (gdouble) duration / GST_SECOND / BUCKETS_PER_FILE);
+    }
+
+    /* Without a pipeline the loaded thumbnails still serve lookups until the
+     * file is closed */
+    while (!session->quit) {
+        ThumbnailFunc func;
+        gpointer userData;
+        gdouble position;
+        gint64 bucket;
+        CacheEntry* entry;
+        Thumbnail thumbnail = { 0 };
+
+        if (!pipeline || !thumbnailer.hasRequest) {
+            g_cond_wait (&thumbnailer.cond, &thumbnailer.lock);
+            continue;
+        }
+        thumbnailer.hasRequest = FALSE;
+        position = thumbnailer.requestPosition;
+        func = thumbnailer.requestFunc;
+        userData = thumbnailer.requestData;
+        bucket = bucketFor (session, position);
+
+        entry = cacheFind (session, bucket);
+        if (entry) {
+            deliver (func, userData, &entry->thumbnail);
+            continue;
+        }
+
+        g_mutex_unlock (&thumbnailer.lock);
+        /* Decode the start of the bucket so every position in it looks alike */
+        gboolean decoded = decodeThumbnail (pipeline, sink,
+                bucket * session->granularity, &thumbnail);
+        g_mutex_lock (&thumbnailer.lock);
+
+        if (decoded) {
+            deliver (func, userData, &thumbnail);
+            cacheInsert (session, bucket, &thumbnail);
+        }
+    }
+    g_mutex_unlock (&thumbnailer.lock);
+
+    if (pipeline) {
+        gst_element_set_state (pipeline, GST_STATE_NULL);
+        gst_object_unref (sink);
+        gst_object_unref (pipeline);
+    }
+
+    /* Closed, nothing else refers to the session any more */
+    cacheSave (session);
+    sessionFree (session);
+    return NULL;
+}
+
+/* Returns at once; the cache is loaded and the pipeline prerolled on the
+ * worker, and thumbnails are looked up or requested meanwhile as usual */
+void thumbnailerOpen (const gchar* uri) {
+    Session* session = sessionNew (uri);
+
+    thumbnailerClose();
+
+    g_mutex_lock (&thumbnailer.lock);
+    session->previous = thumbnailer.thread;
+    thumbnailer.session = session;
+    thumbnailer.hasRequest = FALSE;
+    g_mutex_unlock (&thumbnailer.lock);
+
+    thumbnailer.thread = g_thread_new ("thumbnailer", thumbnailerThread, session);
+}
+
+/* Stops the thumbnail pipeline of the current file without waiting for it.
+ * Its worker saves the cache in the background. */
+void thumbnailerClose() {
+    g_mutex_lock (&thumbnailer.lock);
+    if (thumbnailer.session) {
+        thumbnailer.session->quit = TRUE;
+        thumbnailer.session = NULL;
+        thumbnailer.hasRequest = FALSE;
+        g_cond_broadcast (&thumbnailer.cond);
+    }
+    g_mutex_unlock (&thumbnailer.lock);
+}
+
+/* Closes the current file and waits until every cache is saved. This blocks
+ * on decoding, so it belongs after the main loop has quit. */
+void thumbnailerShutdown() {
+    thumbnailerClose();
+
+    /* Each worker joins the one before it */
+    if (thumbnailer.thread) {
+        g_thread_join (thumbnailer.thread);
+        thumbnailer.thread = NULL;
+    }
+}
+
+void thumbnailerSetCacheSize (gsize bytes) {
+    Session* session;
+
+    g_mutex_lock (&thumbnailer.lock);
+    thumbnailer.cacheSize = bytes;
+    session = thumbnailer.session;
+    while (session && session->cacheBytes > bytes && session->lru.length > 0) {
+        cacheRemove (session, (CacheEntry*) g_queue_peek_tail (&session->lru));
+    }
+    g_mutex_unlock (&thumbnailer.lock);
+}
+
+/* Returns a cached thumbnail for the position without decoding anything.
+ * Release it with thumbnailClear(). */
+gboolean thumbnailerLookup (gdouble position, Thumbnail* thumbnail) {
+    CacheEntry* entry;
+
+    g_mutex_lock (&thumbnailer.lock);
+    entry = thumbnailer.session ?
+            cacheFind (thumbnailer.session, bucketFor (thumbnailer.session, position)) : NULL;
+    if (entry) {
+        thumbnailCopy (thumbnail, &entry->thumbnail);
+    }
+    g_mutex_unlock (&thumbnailer.lock);
+    return entry != NULL;
+}
+
+/* Asks for a thumbnail to be decoded in the background. Only the latest
+ * request is kept; func is called on the main context once it is ready. */
+void thumbnailerRequest (gdouble position, ThumbnailFunc func, gpointer userData) {
+    g_mutex_lock (&thumbnailer.lock);
+    if (thumbnailer.session) {
+        thumbnailer.hasRequest = TRUE;
+        thumbnailer.requestPosition = position;
+        thumbnailer.requestFunc = func;
+        thumbnailer.requestData = userData;
+        g_cond_signal (&thumbnailer.cond);
+    }
+    g_mutex_unlock (&thumbnailer.lock);
+}
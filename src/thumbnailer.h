@@ -0,0 +1,20 @@
+#pragma once
+#include <gst/gst.h>
+
+typedef struct _Thumbnail {
+    gdouble position;   /* seconds, of the keyframe actually decoded */
+    gint    width;
+    gint    height;
+    gint    stride;
+    GBytes* pixels;     /* packed RGB */
+} Thumbnail;
+
+typedef void (*ThumbnailFunc) (const Thumbnail* thumbnail, gpointer userData);
+
+void     thumbnailerOpen (const gchar* uri);
+void     thumbnailerClose();
+void     thumbnailerShutdown();
+void     thumbnailerSetCacheSize (gsize bytes);
+gboolean thumbnailerLookup (gdouble position, Thumbnail* thumbnail);
+void     thumbnailerRequest (gdouble position, ThumbnailFunc func, gpointer userData);
+void     thumbnailClear (Thumbnail* thumbnail);
@@ -1,6 +1,7 @@
 #include <gtk/gtk.h>
 #include <gdk/gdk.h>
 #include <gdk/gdkcursor.h>
+#include <glib/gstdio.h>
 
 #if defined (GDK_WINDOWING_X11)
 #include <gdk/gdkx.h>
@@ -11,12 +12,20 @@
 #endif
 
 #include "gst-backend.h"
+#include "library.h"
+#include "profiler.h"
+#include "resumestore.h"
+#include "thumbnailer.h"
 #include "ui.h"
 
 typedef struct _OpenMenu {
     GtkWidget* openMenu;
     GtkWidget* OpenMi;
     GtkWidget* fileMi;
+    GtkWidget* queueMi;
+    GtkWidget* playlistMi;
+    GtkWidget* mosaicMi;
+    GtkWidget* nextMi;
     GtkWidget* closeMi;
     GtkWidget* exitMi;
 } OpenMenu;
@@ -39,18 +48,24 @@ typedef struct _SubtitlesMenu {
     GtkWidget* subtitlesMenu;
     GtkWidget* subtitlesMi;
     GtkWidget* primaryTrackMi;
+    GtkWidget* primaryTrackMenu;
     GtkWidget* secondaryTrackMi;
+    GtkWidget* secondaryTrackMenu;
+    GtkWidget* addFileMi;
 } SubtitlesMenu;
 
 typedef struct _ViewMenu {
     GtkWidget* viewMenu;
     GtkWidget* viewMi;
     GtkWidget* informationMi;
+    GtkWidget* statsMi;
 } ViewMenu;
 
 typedef struct _OptionsMenu {
     GtkWidget* optionsMenu;
     GtkWidget* optionsMi;
+    GtkWidget* scanLibraryMi;
+    GtkWidget* profileMi;
     GtkWidget* preferencesMi;
 } OptionsMenu;
 
@@ -94,10 +109,22 @@ typedef struct _FullUiWidgets {
 static UiWidgets uiWidgets;
 static Menubar menubar;
 static FullUiWidgets fullUiWidgets;
+static BackendPlayer* player;
 static gboolean isPlaying = FALSE;
 static GtkWidget* revealer = NULL;
 static gulong motionSignalId;
 static GtkWidget* videoWindow = NULL;
+static gboolean sliderDragging = FALSE;
+static gchar* currentUri = NULL;
+static gboolean libraryScanning = FALSE;
+static gboolean stopHiddenVideo = TRUE;
+static gboolean videoVisible = TRUE;
+static guint visibilitySourceId = 0;
+static gboolean useGl = TRUE;
+static GtkWidget* glWidget = NULL;
+static GtkWidget* videoStack = NULL;
+static BackendColorBalance colorBalance;
+static guint colorBalanceTickId = 0;
 
 int createOpenMenu        (OpenMenu* openMenu,           GtkWidget* menubar);
 int createVideoMenu       (VideoMenu* videoMenu,         GtkWidget* menubar);
@@ -112,11 +139,22 @@ int createWindow (const char* name, int width, int height);
 static void createContext (GtkWidget* widget);
 void createAboutDialog();
 void createInformationWindow();
+void createProfileWindow (const gchar* summary);
 void createColorBalanceWindow();
-void refreshPositionLabel (GtkWidget* positionLabel);
-void refreshDurationLabel (GtkWidget* durationLabel);
+void createPreferencesDialog();
+void loadPreferences();
+void savePreferences();
+void refreshTimeLabel (GtkWidget* label, gdouble seconds);
+void refreshDuration (gdouble duration);
+void refreshPosition (gdouble position);
+void syncControls();
+void refreshTrackMenus();
+void trackChanged();
 void hideControls();
 
+static void backendEvent_cb (BackendEvent event, gdouble value, gpointer data);
+static gboolean keyPress_cb (GtkWidget* widget, GdkEventKey* event, gpointer data);
+static gboolean videoDraw_cb (GtkWidget* widget, cairo_t* cr, gpointer data);
 static void play_cb              (GtkButton* button,       gpointer data);
 static void stop_cb              (GtkButton* button,       gpointer data);
 static void slider_cb            (GtkRange*  range,        gpointer data);
@@ -124,19 +162,33 @@ static void volume_cb            (GtkRange*  volumeButton, gpointer data);
 static void fullscreen_cb        (GtkWidget* button,       gpointer data);
 static void fullscreenRealize_cb (GtkWidget* widget,       gpointer data);
 static void overlayFullscreen_cb (GtkWidget* widget, GtkWindow* mainWindow);
+static void watchVisibility (GtkWidget* window, GtkWidget* video);
+static void queueVisibilityUpdate();
+static void showDrawingArea (gboolean show);
 static void fileMenu_cb  (GtkWidget* widget);
+static void queueMenu_cb (GtkWidget* widget);
+static void playlistMenu_cb (GtkWidget* widget);
+static void subtitleFileMenu_cb (GtkWidget* widget);
+static void mosaicMenu_cb (GtkWidget* widget);
+static void nextMenu_cb (GtkWidget* widget);
 static void closeMenu_cb (GtkWidget* widget);
 static void exitMenu_cb  (GtkWidget* widget);
 static void deleteEvent_cb (GtkWidget* widget, GdkEvent* event, gpointer data);
 static void fullSlider_cb (GtkRange* range, gpointer data);
+static gboolean sliderPress_cb (GtkWidget* widget, GdkEvent* event, gpointer data);
+static gboolean sliderRelease_cb (GtkWidget* widget, GdkEvent* event, gpointer data);
+static gboolean sliderTooltip_cb (GtkWidget* widget, gint x, gint y, gboolean keyboard,
+                                  GtkTooltip* tooltip, gpointer data);
+static void thumbnailReady_cb (const Thumbnail* thumbnail, gpointer data);
 static void motionNotify_cb (GtkWidget* widget, gpointer data);
 static void aboutMenu_cb (GtkWidget* widget, gpointer data);
 static void informationMenu_cb (GtkWidget* widget, gpointer data);
+static void statsMenu_cb (GtkCheckMenuItem* item, gpointer data);
 static void colorBalanceMenu_cb (GtkWidget* widget, gpointer data);
-static void contrast_cb (GtkRange* range, gpointer data);
-static void brightness_cb (GtkRange* range, gpointer data);
-static void saturation_cb (GtkRange* range, gpointer data);
-static void hue_cb (GtkRange* range, gpointer data);
+static void scanLibraryMenu_cb (GtkWidget* widget, gpointer data);
+static void profileMenu_cb (GtkCheckMenuItem* item, gpointer data);
+static void preferencesMenu_cb (GtkWidget* widget, gpointer data);
+static void colorBalance_cb (GtkRange* range, gdouble* value);
 
 void stringReplace (char* str, char rep, char with);
 char* getFileName(char* str);
@@ -144,19 +196,37 @@ char* getFileName(char* str);
 int main (int argc, char **argv) {
     gtk_init (&argc, &argv);
     backendInit (&argc, &argv);
+    player = backendPlayerNew();
+
+    gchar* indexPath = libraryDefaultPath();
+    libraryOpen (indexPath);
+    g_free (indexPath);
+    loadPreferences();
 
 
     createWindow ("ProjectGliese", 800, 535);
 
     fullUiWidgets.fullscreenSlider = NULL;
 
-    g_timeout_add_seconds (1, (GSourceFunc) refreshUi, NULL);
+    backendSubscribe (player, backendEvent_cb, NULL);
 
     /* Start the GTK main loop. */
     gtk_main();
 
-    if (isPlaying) {
-        backendDeInit();
+    backendPlayerFree (player);
+    thumbnailerShutdown();
+    resumeStoreClose();
+    if (profilerIsRunning()) {
+        GError* error = NULL;
+        gchar* summary = profilerStop (g_getenv (PROFILER_ENVIRONMENT), &error);
+
+        if (summary) {
+            g_print ("%s", summary);
+            g_free (summary);
+        } else {
+            g_printerr ("%s\n", error->message);
+            g_clear_error (&error);
+        }
     }
     return 0;
 }
@@ -167,16 +237,75 @@ int createWindow (const char* name, int width, int height) {
     gtk_window_set_title (GTK_WINDOW (uiWidgets.window), name);
     g_signal_connect (uiWidgets.window, "delete-event",
             G_CALLBACK(deleteEvent_cb), NULL);
+    g_signal_connect (uiWidgets.window, "key-press-event",
+            G_CALLBACK (keyPress_cb), NULL);
     createUi (uiWidgets.window);
+    watchVisibility (uiWidgets.window, uiWidgets.videoWindow);
+    if (glWidget) {
+        watchVisibility (uiWidgets.window, glWidget);
+    }
     gtk_widget_show_all (uiWidgets.window);
+
+    /* The position is pushed at the display refresh rate while playing */
+    GdkDisplay* display = gtk_widget_get_display (uiWidgets.window);
+    GdkMonitor* monitor = gdk_display_get_monitor_at_window (display,
+            gtk_widget_get_window (uiWidgets.window));
+    gint refreshRate = monitor ? gdk_monitor_get_refresh_rate (monitor) : 0;
+    backendSetRefreshRate (player, refreshRate > 0 ? refreshRate / 1000.0 : 60.0);
     return 0;
 }
 
+static gboolean showOverlay() {
+    gtk_stack_set_visible_child (GTK_STACK (videoStack), uiWidgets.videoWindow);
+    return G_SOURCE_REMOVE;
+}
+
+/* Falls back to the drawing area and GstVideoOverlay when the widget could
+ * not get a GL context, e.g. without a GL driver */
+static void glRealize_cb (GtkWidget* widget, gpointer data) {
+    UNUSED (data);
+
+    GError* error = gtk_gl_area_get_error (GTK_GL_AREA (widget));
+
+    if (!error) {
+        return;
+    }
+    g_printerr ("OpenGL unavailable, using the video overlay: %s\n", error->message);
+    backendDisableGl (player);
+    glWidget = NULL;
+    /* Not while the stack is still being realized */
+    g_idle_add ((GSourceFunc) showOverlay, NULL);
+}
+
+/* With GL rendering the sink draws into a widget of its own. The drawing
+ * area stays for the frames kept while stepping and for mosaics, which
+ * render through GstVideoOverlay. */
+static void createVideoSurface (GtkWidget* box) {
+    glWidget = useGl ? backendEnableGl (player) : NULL;
+    if (!glWidget) {
+        gtk_box_pack_start (GTK_BOX (box), uiWidgets.videoWindow, TRUE, TRUE, 0);
+        return;
+    }
+    videoStack = gtk_stack_new();
+    gtk_stack_add_named (GTK_STACK (videoStack), glWidget, "gl");
+    gtk_stack_add_named (GTK_STACK (videoStack), uiWidgets.videoWindow, "overlay");
+    g_signal_connect_after (glWidget, "realize", G_CALLBACK (glRealize_cb), NULL);
+    gtk_box_pack_start (GTK_BOX (box), videoStack, TRUE, TRUE, 0);
+}
+
+static void showDrawingArea (gboolean show) {
+    if (glWidget) {
+        gtk_stack_set_visible_child (GTK_STACK (videoStack),
+                show ? uiWidgets.videoWindow : glWidget);
+    }
+}
+
 int createUi (GtkWidget* window) {
     GtkWidget* controls;
     GtkWidget* mainBox;
 
     uiWidgets.videoWindow  = gtk_drawing_area_new();
+    g_signal_connect (uiWidgets.videoWindow, "draw", G_CALLBACK (videoDraw_cb), NULL);
     uiWidgets.playButton   = gtk_button_new_from_icon_name ("media-playback-start",
             GTK_ICON_SIZE_BUTTON);
     uiWidgets.stopButton   = gtk_button_new_from_icon_name ("media-playback-stop",
@@ -189,11 +318,15 @@ int createUi (GtkWidget* window) {
 
     uiWidgets.slider = gtk_scale_new_with_range (GTK_ORIENTATION_HORIZONTAL, 0, 100, 1);
     gtk_scale_set_draw_value (GTK_SCALE (uiWidgets.slider), 0);
+    gtk_widget_set_has_tooltip (uiWidgets.slider, TRUE);
+    g_signal_connect (uiWidgets.slider, "query-tooltip",
+            G_CALLBACK (sliderTooltip_cb), NULL);
 
     uiWidgets.position = gtk_label_new ("0:00:00");
     uiWidgets.duration = gtk_label_new ("0:00:00");
 
     createMenubar (&menubar);
+    refreshTrackMenus();
 
     controls = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
     gtk_box_pack_start (GTK_BOX (controls), uiWidgets.playButton, FALSE, FALSE, 2);
@@ -206,7 +339,7 @@ int createUi (GtkWidget* window) {
 
     mainBox = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
     gtk_box_pack_start (GTK_BOX (mainBox), menubar.menubar, FALSE, FALSE, 0);
-    gtk_box_pack_start (GTK_BOX (mainBox), uiWidgets.videoWindow, TRUE, TRUE, 0);
+    createVideoSurface (mainBox);
     gtk_box_pack_start (GTK_BOX (mainBox), controls, FALSE, FALSE, 5);
     gtk_container_add (GTK_CONTAINER (window), mainBox);
 
@@ -214,51 +347,55 @@ int createUi (GtkWidget* window) {
     return 0;
 }
 
-gboolean refreshUi() {
-    gdouble current  = -1;
-    gdouble duration = 0;
+void refreshDuration (gdouble duration) {
+    gtk_range_set_range (GTK_RANGE (uiWidgets.slider), 0, duration);
+    refreshTimeLabel (uiWidgets.duration, duration);
 
-    if (!backendIsPausedOrPlaying()) {
-        return TRUE;
+    if (fullUiWidgets.fullscreenSlider != NULL) {
+        gtk_range_set_range (GTK_RANGE (fullUiWidgets.fullscreenSlider), 0, duration);
+        refreshTimeLabel (fullUiWidgets.duration, duration);
     }
+}
 
-    if (!backendDurationIsValid()) {
-        duration = backendQueryDuration();
-        gtk_range_set_range (GTK_RANGE (uiWidgets.slider), 0, duration);
-
-        refreshDurationLabel (uiWidgets.duration);
+void refreshPosition (gdouble position) {
+    /* Keyframe seeks while scrubbing would pull the slider away from the pointer */
+    if (sliderDragging) {
+        return;
     }
 
-    if (backendQueryPosition (&current)) {
-        /* Block the "value-changed" signal, so the slider_cb function is not called
-         * (which would trigger a seek the user has not requested) */
-        g_signal_handler_block (uiWidgets.slider, uiWidgets.sliderUpdateSignalId);
-        /* Set the position of the slider to the current pipeline position, in SECONDS */
-        gtk_range_set_value (GTK_RANGE (uiWidgets.slider), current);
-        /* Re-enable the signal */
-        g_signal_handler_unblock (uiWidgets.slider, uiWidgets.sliderUpdateSignalId);
+    /* Block the "value-changed" signal, so the slider_cb function is not called
+     * (which would trigger a seek the user has not requested) */
+    g_signal_handler_block (uiWidgets.slider, uiWidgets.sliderUpdateSignalId);
+    /* Set the position of the slider to the current pipeline position, in SECONDS */
+    gtk_range_set_value (GTK_RANGE (uiWidgets.slider), position);
+    /* Re-enable the signal */
+    g_signal_handler_unblock (uiWidgets.slider, uiWidgets.sliderUpdateSignalId);
 
-        refreshPositionLabel (uiWidgets.position);
-    }
+    refreshTimeLabel (uiWidgets.position, position);
 
     if (fullUiWidgets.fullscreenSlider != NULL) {
-        if (backendDurationIsValid()) {
-            duration = backendQueryDuration();
-            gtk_range_set_range (GTK_RANGE (fullUiWidgets.fullscreenSlider), 0, duration);
+        g_signal_handler_block (fullUiWidgets.fullscreenSlider, fullUiWidgets.fullScreenSliderId);
+        gtk_range_set_value (GTK_RANGE (fullUiWidgets.fullscreenSlider), position);
+        g_signal_handler_unblock (fullUiWidgets.fullscreenSlider, fullUiWidgets.fullScreenSliderId);
 
-            refreshDurationLabel (fullUiWidgets.duration);
-        }
+        refreshTimeLabel (fullUiWidgets.position, position);
+    }
+}
 
-        if (backendQueryPosition (&current)) {
-            g_signal_handler_block (fullUiWidgets.fullscreenSlider, fullUiWidgets.fullScreenSliderId);
-            gtk_range_set_value (GTK_RANGE (fullUiWidgets.fullscreenSlider), current);
-            g_signal_handler_unblock (fullUiWidgets.fullscreenSlider, fullUiWidgets.fullScreenSliderId);
+/* Pulls the current duration and position once, for controls created while
+ * the backend is already running */
+void syncControls() {
+    gdouble position;
 
-            refreshPositionLabel (fullUiWidgets.position);
-        }
+    if (!backendIsPausedOrPlaying (player)) {
+        return;
+    }
+    if (backendDurationIsValid (player)) {
+        refreshDuration (backendQueryDuration (player));
+    }
+    if (backendQueryPosition (player, &position)) {
+        refreshPosition (position);
     }
-
-    return TRUE;
 }
 
 int createMenubar (Menubar* bar) {
@@ -281,6 +418,18 @@ int createOpenMenu (OpenMenu* openMenu, GtkWidget* bar) {
     openMenu->fileMi   =
             gtk_menu_item_new_with_label ("File");
     g_signal_connect (openMenu->fileMi, "activate", G_CALLBACK (fileMenu_cb), NULL);
+    openMenu->queueMi  =
+            gtk_menu_item_new_with_label ("Play next");
+    g_signal_connect (openMenu->queueMi, "activate", G_CALLBACK (queueMenu_cb), NULL);
+    openMenu->playlistMi =
+            gtk_menu_item_new_with_label ("Add to playlist");
+    g_signal_connect (openMenu->playlistMi, "activate", G_CALLBACK (playlistMenu_cb), NULL);
+    openMenu->mosaicMi =
+            gtk_menu_item_new_with_label ("Mosaic");
+    g_signal_connect (openMenu->mosaicMi, "activate", G_CALLBACK (mosaicMenu_cb), NULL);
+    openMenu->nextMi   =
+            gtk_menu_item_new_with_label ("Next");
+    g_signal_connect (openMenu->nextMi, "activate", G_CALLBACK (nextMenu_cb), NULL);
     openMenu->closeMi  =
             gtk_menu_item_new_with_label ("Close");
     g_signal_connect (openMenu->closeMi, "activate", G_CALLBACK (closeMenu_cb), NULL);
@@ -292,6 +441,14 @@ int createOpenMenu (OpenMenu* openMenu, GtkWidget* bar) {
             openMenu->openMenu);
     gtk_menu_shell_append (GTK_MENU_SHELL (openMenu->openMenu),
             openMenu->fileMi);
+    gtk_menu_shell_append (GTK_MENU_SHELL (openMenu->openMenu),
+            openMenu->queueMi);
+    gtk_menu_shell_append (GTK_MENU_SHELL (openMenu->openMenu),
+            openMenu->playlistMi);
+    gtk_menu_shell_append (GTK_MENU_SHELL (openMenu->openMenu),
+            openMenu->mosaicMi);
+    gtk_menu_shell_append (GTK_MENU_SHELL (openMenu->openMenu),
+            openMenu->nextMi);
     gtk_menu_shell_append (GTK_MENU_SHELL (openMenu->openMenu),
             openMenu->closeMi);
     gtk_menu_shell_append (GTK_MENU_SHELL (openMenu->openMenu), openMenu->exitMi);
@@ -339,12 +496,6 @@ int createAudioMenu (AudioMenu* audioMenu, GtkWidget* bar) {
             audioMenu->trackMi);
     gtk_menu_shell_append (GTK_MENU_SHELL(bar),
             audioMenu->audioMi);
-
-    GtkWidget* track1 = gtk_menu_item_new_with_label("Track 1");
-    GtkWidget* track2 = gtk_menu_item_new_with_label("Track 2");
-
-    gtk_menu_shell_append (GTK_MENU_SHELL (menubar.audioMenu.trackMenu), track1);
-    gtk_menu_shell_append (GTK_MENU_SHELL (menubar.audioMenu.trackMenu), track2);
     return 0;
 }
 
@@ -357,6 +508,17 @@ int createSubtitlesMenu (SubtitlesMenu* subtitlesMenu, GtkWidget* bar) {
             gtk_menu_item_new_with_label ("Primary track");
     subtitlesMenu->secondaryTrackMi =
             gtk_menu_item_new_with_label ("Secondary track");
+    subtitlesMenu->addFileMi        =
+            gtk_menu_item_new_with_label ("Add subtitle file");
+    g_signal_connect (subtitlesMenu->addFileMi, "activate",
+            G_CALLBACK (subtitleFileMenu_cb), NULL);
+
+    subtitlesMenu->primaryTrackMenu   = gtk_menu_new();
+    subtitlesMenu->secondaryTrackMenu = gtk_menu_new();
+    gtk_menu_item_set_submenu (GTK_MENU_ITEM (subtitlesMenu->primaryTrackMi),
+            subtitlesMenu->primaryTrackMenu);
+    gtk_menu_item_set_submenu (GTK_MENU_ITEM (subtitlesMenu->secondaryTrackMi),
+            subtitlesMenu->secondaryTrackMenu);
 
     gtk_menu_item_set_submenu (GTK_MENU_ITEM (subtitlesMenu->subtitlesMi),
             subtitlesMenu->subtitlesMenu);
@@ -364,6 +526,10 @@ int createSubtitlesMenu (SubtitlesMenu* subtitlesMenu, GtkWidget* bar) {
             subtitlesMenu->primaryTrackMi);
     gtk_menu_shell_append (GTK_MENU_SHELL (subtitlesMenu->subtitlesMenu),
             subtitlesMenu->secondaryTrackMi);
+    gtk_menu_shell_append (GTK_MENU_SHELL (subtitlesMenu->subtitlesMenu),
+            gtk_separator_menu_item_new());
+    gtk_menu_shell_append (GTK_MENU_SHELL (subtitlesMenu->subtitlesMenu),
+            subtitlesMenu->addFileMi);
     gtk_menu_shell_append (GTK_MENU_SHELL(bar),
             subtitlesMenu->subtitlesMi);
     return 0;
@@ -377,11 +543,17 @@ int createViewMenu (ViewMenu* viewMenu, GtkWidget* bar) {
             gtk_menu_item_new_with_label ("Information and properties");
     g_signal_connect (viewMenu->informationMi,
             "activate", G_CALLBACK(informationMenu_cb), NULL);
+    viewMenu->statsMi =
+            gtk_check_menu_item_new_with_label ("Statistics overlay");
+    g_signal_connect (viewMenu->statsMi,
+            "toggled", G_CALLBACK (statsMenu_cb), NULL);
 
     gtk_menu_item_set_submenu (GTK_MENU_ITEM (viewMenu->viewMi),
             viewMenu->viewMenu);
     gtk_menu_shell_append (GTK_MENU_SHELL (viewMenu->viewMenu),
             viewMenu->informationMi);
+    gtk_menu_shell_append (GTK_MENU_SHELL (viewMenu->viewMenu),
+            viewMenu->statsMi);
     gtk_menu_shell_append (GTK_MENU_SHELL (bar), viewMenu->viewMi);
     return 0;
 }
@@ -391,11 +563,30 @@ int createOptionsMenu (OptionsMenu* optionsMenu, GtkWidget* bar) {
 
     optionsMenu->optionsMi     =
             gtk_menu_item_new_with_label ("Options");
+    optionsMenu->scanLibraryMi =
+            gtk_menu_item_new_with_label ("Scan media library");
+    g_signal_connect (optionsMenu->scanLibraryMi, "activate",
+            G_CALLBACK (scanLibraryMenu_cb), NULL);
+    optionsMenu->profileMi =
+            gtk_check_menu_item_new_with_label ("Profile pipeline");
+    /* GLIESE_PROFILE=trace.json profiles from the start and saves on exit */
+    if (g_getenv (PROFILER_ENVIRONMENT)) {
+        profilerStart();
+        gtk_check_menu_item_set_active (GTK_CHECK_MENU_ITEM (optionsMenu->profileMi), TRUE);
+    }
+    g_signal_connect (optionsMenu->profileMi, "toggled",
+            G_CALLBACK (profileMenu_cb), NULL);
     optionsMenu->preferencesMi =
             gtk_menu_item_new_with_label ("Preferences");
+    g_signal_connect (optionsMenu->preferencesMi, "activate",
+            G_CALLBACK (preferencesMenu_cb), NULL);
 
     gtk_menu_item_set_submenu (GTK_MENU_ITEM (optionsMenu->optionsMi),
             optionsMenu->optionsMenu);
+    gtk_menu_shell_append (GTK_MENU_SHELL (optionsMenu->optionsMenu),
+            optionsMenu->scanLibraryMi);
+    gtk_menu_shell_append (GTK_MENU_SHELL (optionsMenu->optionsMenu),
+            optionsMenu->profileMi);
     gtk_menu_shell_append (GTK_MENU_SHELL (optionsMenu->optionsMenu),
             optionsMenu->preferencesMi);
     gtk_menu_shell_append (GTK_MENU_SHELL (bar),
@@ -418,6 +609,164 @@ int createHelpMenu (HelpMenu* helpMenu, GtkWidget* bar) {
     return 0;
 }
 
+static void clearMenu (GtkWidget* menu) {
+    GList* children = gtk_container_get_children (GTK_CONTAINER (menu));
+
+    for (GList* l = children; l != NULL; l = l->next) {
+        gtk_widget_destroy (GTK_WIDGET (l->data));
+    }
+    g_list_free (children);
+}
+
+static gchar* trackLabel (guint number, const gchar* title, const gchar* language) {
+    GString* label = g_string_new (NULL);
+
+    g_string_printf (label, "Track %u", number);
+    if (title && *title) {
+        g_string_append_printf (label, ": %s", title);
+    }
+    if (language && *language) {
+        g_string_append_printf (label, " [%s]", language);
+    }
+    return g_string_free (label, FALSE);
+}
+
+/* Before playback has started, the library index can only tell what there is */
+static void appendTrackItem (GtkWidget* menu, guint number, const LibraryStream* stream) {
+    gchar* label = trackLabel (number, stream->title, stream->language);
+    GtkWidget* item = gtk_menu_item_new_with_label (label);
+
+    gtk_widget_set_sensitive (item, FALSE);
+    gtk_menu_shell_append (GTK_MENU_SHELL (menu), item);
+    g_free (label);
+}
+
+static void trackItem_cb (GtkCheckMenuItem* item, gpointer slot) {
+    if (gtk_check_menu_item_get_active (item)) {
+        backendSelectTrack (player, (BackendTrackSlot) GPOINTER_TO_INT (slot),
+                g_object_get_data (G_OBJECT (item), "stream-id"));
+    }
+}
+
+/* An item that plays the stream in the slot; NULL for none */
+static void appendTrackChoice (GtkWidget* menu, GSList** group, const gchar* label,
+                               const gchar* id, BackendTrackSlot slot, gboolean active) {
+    GtkWidget* item = gtk_radio_menu_item_new_with_label (*group, label);
+
+    *group = gtk_radio_menu_item_get_group (GTK_RADIO_MENU_ITEM (item));
+    g_object_set_data_full (G_OBJECT (item), "stream-id", g_strdup (id), g_free);
+    gtk_check_menu_item_set_active (GTK_CHECK_MENU_ITEM (item), active);
+    g_signal_connect (item, "toggled", G_CALLBACK (trackItem_cb), GINT_TO_POINTER (slot));
+    gtk_menu_shell_append (GTK_MENU_SHELL (menu), item);
+}
+
+static void appendPlaceholderItem (GtkWidget* menu) {
+    GList* children = gtk_container_get_children (GTK_CONTAINER (menu));
+
+    if (!children) {
+        GtkWidget* item = gtk_menu_item_new_with_label ("No tracks");
+        gtk_widget_set_sensitive (item, FALSE);
+        gtk_menu_shell_append (GTK_MENU_SHELL (menu), item);
+    }
+    g_list_free (children);
+}
+
+/* Fills the audio and subtitle track menus with the tracks the player found,
+ * or, until it has, with what the library index knows of the file */
+void refreshTrackMenus() {
+    GtkWidget* audioMenu = menubar.audioMenu.trackMenu;
+    GtkWidget* primaryMenu = menubar.subtitlesMenu.primaryTrackMenu;
+    GtkWidget* secondaryMenu = menubar.subtitlesMenu.secondaryTrackMenu;
+    GSList* audioGroup = NULL;
+    GSList* primaryGroup = NULL;
+    GSList* secondaryGroup = NULL;
+    gboolean primaryOn = FALSE;
+    gboolean secondaryOn = FALSE;
+    LibraryEntry entry;
+    LibraryStream stream;
+    BackendTrack* tracks;
+    guint count;
+    guint audioTracks = 0;
+    guint subtitleTracks = 0;
+
+    clearMenu (audioMenu);
+    clearMenu (primaryMenu);
+    clearMenu (secondaryMenu);
+
+    tracks = backendGetTracks (player, &count);
+    for (guint i = 0; i < count; i++) {
+        primaryOn |= tracks[i].slot == BACKEND_SLOT_SUBTITLE;
+        secondaryOn |= tracks[i].slot == BACKEND_SLOT_SECONDARY_SUBTITLE;
+        subtitleTracks += tracks[i].type == BACKEND_TRACK_SUBTITLE;
+    }
+    if (subtitleTracks) {
+        appendTrackChoice (primaryMenu, &primaryGroup, "Off", NULL,
+                BACKEND_SLOT_SUBTITLE, !primaryOn);
+        appendTrackChoice (secondaryMenu, &secondaryGroup, "Off", NULL,
+                BACKEND_SLOT_SECONDARY_SUBTITLE, !secondaryOn);
+        subtitleTracks = 0;
+    }
+    for (guint i = 0; i < count; i++) {
+        BackendTrack* track = &tracks[i];
+        gchar* label;
+
+        if (track->type == BACKEND_TRACK_AUDIO) {
+            label = trackLabel (++audioTracks, track->title, track->language);
+            appendTrackChoice (audioMenu, &audioGroup, label, track->id,
+                    BACKEND_SLOT_AUDIO, track->slot == BACKEND_SLOT_AUDIO);
+            g_free (label);
+        } else if (track->type == BACKEND_TRACK_SUBTITLE) {
+            label = trackLabel (++subtitleTracks, track->title, track->language);
+            appendTrackChoice (primaryMenu, &primaryGroup, label, track->id,
+                    BACKEND_SLOT_SUBTITLE, track->slot == BACKEND_SLOT_SUBTITLE);
+            appendTrackChoice (secondaryMenu, &secondaryGroup, label, track->id,
+                    BACKEND_SLOT_SECONDARY_SUBTITLE,
+                    track->slot == BACKEND_SLOT_SECONDARY_SUBTITLE);
+            g_free (label);
+        }
+    }
+    backendTracksFree (tracks, count);
+
+    if (count == 0 && currentUri && libraryLookup (currentUri, &entry)) {
+        for (guint i = 0; libraryGetStream (&entry, i, &stream); i++) {
+            if (stream.type == LIBRARY_STREAM_AUDIO) {
+                appendTrackItem (audioMenu, ++audioTracks, &stream);
+            } else if (stream.type == LIBRARY_STREAM_SUBTITLE) {
+                subtitleTracks++;
+                appendTrackItem (primaryMenu, subtitleTracks, &stream);
+                appendTrackItem (secondaryMenu, subtitleTracks, &stream);
+            }
+        }
+    }
+
+    appendPlaceholderItem (audioMenu);
+    appendPlaceholderItem (primaryMenu);
+    appendPlaceholderItem (secondaryMenu);
+    gtk_widget_show_all (audioMenu);
+    gtk_widget_show_all (primaryMenu);
+    gtk_widget_show_all (secondaryMenu);
+}
+
+/* Follows the backend onto the next playlist entry */
+void trackChanged() {
+    gchar* uri = backendGetUri (player);
+
+    if (!uri) {
+        return;
+    }
+    gchar* fileName = g_filename_from_uri (uri, NULL, NULL);
+    gchar* title = g_path_get_basename (fileName ? fileName : uri);
+
+    gtk_window_set_title (GTK_WINDOW (uiWidgets.window), title);
+    g_free (currentUri);
+    currentUri = uri;
+    thumbnailerOpen (uri);
+    refreshTrackMenus();
+
+    g_free (title);
+    g_free (fileName);
+}
+
 static void createContext (GtkWidget* widget) {
     GdkWindow* window = gtk_widget_get_window (widget);
     guintptr window_handle;
@@ -433,7 +782,7 @@ static void createContext (GtkWidget* widget) {
 #elif defined (GDK_WINDOWING_X11)
     window_handle = GDK_WINDOW_XID (window);
 #endif
-    backendSetWindow (window_handle);
+    backendSetWindow (player, window_handle);
 }
 
 void createInformationWindow() {
@@ -445,9 +794,20 @@ void createInformationWindow() {
         gtk_window_set_default_size (GTK_WINDOW (informationWindow), 400, 300);
 
         GtkTextBuffer* textBuffer = gtk_text_buffer_new (NULL);
-        backendGetInformationAboutStreams(textBuffer);
+        LibraryEntry entry;
+        gchar* information;
+
+        /* The library index answers without touching the pipeline */
+        if (currentUri && libraryLookup (currentUri, &entry)) {
+            information = libraryDescribe (&entry);
+        } else {
+            information = backendGetInformationAboutStreams (player);
+        }
+        gtk_text_buffer_set_text (textBuffer, information, -1);
+        g_free (information);
 
         GtkWidget* textView = gtk_text_view_new_with_buffer (textBuffer);
+        g_object_unref (textBuffer);
         gtk_text_view_set_editable (GTK_TEXT_VIEW (textView), FALSE);
         gtk_container_add (GTK_CONTAINER (informationWindow), textView);
 
@@ -455,8 +815,30 @@ void createInformationWindow() {
     }
 }
 
+void createProfileWindow (const gchar* summary) {
+    GtkWidget* profileWindow = gtk_window_new (GTK_WINDOW_TOPLEVEL);
+    gtk_window_set_position (GTK_WINDOW (profileWindow), GTK_WIN_POS_CENTER);
+    gtk_window_set_title (GTK_WINDOW (profileWindow), "Pipeline profile");
+    gtk_window_set_default_size (GTK_WINDOW (profileWindow), 800, 500);
+
+    GtkTextBuffer* textBuffer = gtk_text_buffer_new (NULL);
+    gtk_text_buffer_set_text (textBuffer, summary, -1);
+
+    GtkWidget* textView = gtk_text_view_new_with_buffer (textBuffer);
+    gtk_text_view_set_editable (GTK_TEXT_VIEW (textView), FALSE);
+    gtk_text_view_set_monospace (GTK_TEXT_VIEW (textView), TRUE);
+
+    GtkWidget* scrolled = gtk_scrolled_window_new (NULL, NULL);
+    gtk_container_add (GTK_CONTAINER (scrolled), textView);
+    gtk_container_add (GTK_CONTAINER (profileWindow), scrolled);
+
+    gtk_widget_show_all (profileWindow);
+}
+
 void createColorBalanceWindow() {
     if (isPlaying) {
+        backendGetColorBalanceValues (player, &colorBalance);
+
         GtkWidget* colBalWindow = gtk_window_new (GTK_WINDOW_TOPLEVEL);
         gtk_window_set_position (GTK_WINDOW (colBalWindow), GTK_WIN_POS_CENTER);
         gtk_window_set_title (GTK_WINDOW (colBalWindow), "Color balance");
@@ -467,45 +849,33 @@ void createColorBalanceWindow() {
 
         GtkWidget* contrastSlider = gtk_scale_new_with_range (GTK_ORIENTATION_HORIZONTAL,
                 -1000, 1000, 1);
+        gtk_range_set_value (GTK_RANGE (contrastSlider), colorBalance.contrast);
         g_signal_connect (contrastSlider, "value-changed",
-                          G_CALLBACK (contrast_cb), NULL);
-
-        gdouble contrastValue;
-        backendGetColorBalance ("CONTRAST", &contrastValue);
-        gtk_range_set_value (GTK_RANGE (contrastSlider), contrastValue);
+                          G_CALLBACK (colorBalance_cb), &colorBalance.contrast);
 
         GtkWidget* brightnessLabel = gtk_label_new ("Brightness");
 
         GtkWidget* brightnessSlider = gtk_scale_new_with_range (GTK_ORIENTATION_HORIZONTAL,
                 -1000, 1000, 1);
+        gtk_range_set_value (GTK_RANGE (brightnessSlider), colorBalance.brightness);
         g_signal_connect (brightnessSlider, "value-changed",
-                          G_CALLBACK (brightness_cb), NULL);
-
-        gdouble brightnessValue;
-        backendGetColorBalance ("BRIGHTNESS", &brightnessValue);
-        gtk_range_set_value (GTK_RANGE (brightnessSlider), brightnessValue);
+                          G_CALLBACK (colorBalance_cb), &colorBalance.brightness);
 
         GtkWidget* hueLabel = gtk_label_new ("Hue");
 
         GtkWidget* hueSlider = gtk_scale_new_with_range (GTK_ORIENTATION_HORIZONTAL,
                 -1000, 1000, 1);
+        gtk_range_set_value (GTK_RANGE (hueSlider), colorBalance.hue);
         g_signal_connect (hueSlider, "value-changed",
-                          G_CALLBACK (hue_cb), NULL);
-
-        gdouble hueValue;
-        backendGetColorBalance ("HUE", &hueValue);
-        gtk_range_set_value (GTK_RANGE (hueSlider), hueValue);
+                          G_CALLBACK (colorBalance_cb), &colorBalance.hue);
 
         GtkWidget* saturationLabel = gtk_label_new ("Saturation");
 
         GtkWidget* saturationSlider = gtk_scale_new_with_range (GTK_ORIENTATION_HORIZONTAL,
                 -1000, 1000, 1);
+        gtk_range_set_value (GTK_RANGE (saturationSlider), colorBalance.saturation);
         g_signal_connect (saturationSlider, "value-changed",
-                          G_CALLBACK (saturation_cb), NULL);
-
-        gdouble saturationValue;
-        backendGetColorBalance ("SATURATION", &saturationValue);
-        gtk_range_set_value (GTK_RANGE (saturationSlider), saturationValue);
+                          G_CALLBACK (colorBalance_cb), &colorBalance.saturation);
 
         GtkWidget* contrastBox = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
         gtk_box_pack_start (GTK_BOX (contrastBox), contrastLabel, FALSE, FALSE, 0);
@@ -535,6 +905,318 @@ void createColorBalanceWindow() {
     }
 }
 
+static gchar* preferencesPath() {
+    return g_build_filename (g_get_user_config_dir(), "projectgliese", "settings.ini", NULL);
+}
+
+static const gchar* threadTypeNames[] = { "auto", "frame", "slice" };
+static gint frameCacheMb = 256;
+static gint memoryBudgetMb = 0;
+static const gchar* mosaicDecodeNames[] = { "full", "reduced", "keyframes" };
+static MosaicDecode mosaicDecode = MOSAIC_DECODE_REDUCED;
+static const gchar* lutInterpolationNames[] = { "tetrahedral", "trilinear" };
+static gchar* lutPath = NULL;
+static LutInterpolation lutInterpolation = LUT_INTERPOLATION_TETRAHEDRAL;
+static gboolean resumePlayback = TRUE;
+static const gchar* visualisationNames[] = { "none", "spectrum", "scope" };
+static BackendVisualisation visualisation = BACKEND_VISUALISATION_SPECTRUM;
+static gint visualisationFps = 30;
+
+/* A LUT that no longer loads is forgotten rather than reported every start */
+static void applyLut() {
+    GError* error = NULL;
+
+    if (!backendSetLut (player, lutPath, lutInterpolation, &error)) {
+        g_printerr ("Could not load the LUT: %s\n", error->message);
+        g_clear_error (&error);
+        g_clear_pointer (&lutPath, g_free);
+    }
+}
+
+/* With the store closed every file starts from the beginning */
+static void applyResume() {
+    gchar* path;
+
+    if (!resumePlayback) {
+        resumeStoreClose();
+    } else if (!resumeStoreIsOpen()) {
+        path = resumeStoreDefaultPath();
+        resumeStoreOpen (path);
+        g_free (path);
+    }
+}
+
+void loadPreferences() {
+    GKeyFile* keyFile = g_key_file_new();
+    gchar* path = preferencesPath();
+    DecoderConfig config;
+
+    backendGetDecoderConfig (player, &config);
+    if (g_key_file_load_from_file (keyFile, path, G_KEY_FILE_NONE, NULL)) {
+        gchar* threadType = g_key_file_get_string (keyFile, "decoder", "thread-type", NULL);
+
+        config.threads = MAX (0, g_key_file_get_integer (keyFile, "decoder", "threads", NULL));
+        config.queueBytes = MAX (0, g_key_file_get_integer (keyFile, "decoder",
+                "queue-kb", NULL)) * 1024u;
+        config.queueTime = (guint64) MAX (0, g_key_file_get_integer (keyFile, "decoder",
+                "queue-ms", NULL)) * GST_MSECOND;
+        for (guint i = 0; threadType && i < G_N_ELEMENTS (threadTypeNames); i++) {
+            if (g_str_equal (threadType, threadTypeNames[i])) {
+                config.threadType = (DecoderThreadType) i;
+            }
+        }
+        g_free (threadType);
+        backendSetDecoderConfig (player, &config);
+
+        if (g_key_file_has_key (keyFile, "playback", "frame-cache-mb", NULL)) {
+            frameCacheMb = MAX (0, g_key_file_get_integer (keyFile, "playback",
+                    "frame-cache-mb", NULL));
+            backendSetFrameCacheSize (player, (gsize) frameCacheMb * 1024 * 1024);
+        }
+
+        memoryBudgetMb = MAX (0, g_key_file_get_integer (keyFile, "playback",
+                "memory-budget-mb", NULL));
+        backendSetMemoryBudget (player, (gsize) memoryBudgetMb * 1024 * 1024);
+
+        gchar* decode = g_key_file_get_string (keyFile, "playback", "mosaic-decode", NULL);
+        for (guint i = 0; decode && i < G_N_ELEMENTS (mosaicDecodeNames); i++) {
+            if (g_str_equal (decode, mosaicDecodeNames[i])) {
+                mosaicDecode = (MosaicDecode) i;
+            }
+        }
+        g_free (decode);
+        backendSetMosaicDecode (player, mosaicDecode);
+
+        if (g_key_file_has_key (keyFile, "video", "opengl", NULL)) {
+            useGl = g_key_file_get_boolean (keyFile, "video", "opengl", NULL);
+        }
+        if (g_key_file_has_key (keyFile, "playback", "stop-hidden-video", NULL)) {
+            stopHiddenVideo = g_key_file_get_boolean (keyFile, "playback",
+                    "stop-hidden-video", NULL);
+        }
+
+        gchar* interpolation = g_key_file_get_string (keyFile, "video", "lut-interpolation", NULL);
+        for (guint i = 0; interpolation && i < G_N_ELEMENTS (lutInterpolationNames); i++) {
+            if (g_str_equal (interpolation, lutInterpolationNames[i])) {
+                lutInterpolation = (LutInterpolation) i;
+            }
+        }
+        g_free (interpolation);
+        lutPath = g_key_file_get_string (keyFile, "video", "lut", NULL);
+        if (lutPath && !*lutPath) {
+            g_clear_pointer (&lutPath, g_free);
+        }
+        if (lutPath) {
+            applyLut();
+        }
+        if (g_key_file_has_key (keyFile, "playback", "resume", NULL)) {
+            resumePlayback = g_key_file_get_boolean (keyFile, "playback", "resume", NULL);
+        }
+
+        gchar* style = g_key_file_get_string (keyFile, "video", "visualisation", NULL);
+        for (guint i = 0; style && i < G_N_ELEMENTS (visualisationNames); i++) {
+            if (g_str_equal (style, visualisationNames[i])) {
+                visualisation = (BackendVisualisation) i;
+            }
+        }
+        g_free (style);
+        if (g_key_file_has_key (keyFile, "video", "visualisation-fps", NULL)) {
+            visualisationFps = MAX (0, g_key_file_get_integer (keyFile, "video",
+                    "visualisation-fps", NULL));
+        }
+        backendSetVisualisation (player, visualisation, (guint) visualisationFps);
+    }
+    applyResume();
+    g_free (path);
+    g_key_file_free (keyFile);
+}
+
+void savePreferences() {
+    GKeyFile* keyFile = g_key_file_new();
+    gchar* path = preferencesPath();
+    gchar* directory = g_path_get_dirname (path);
+    GError* error = NULL;
+    DecoderConfig config;
+
+    /* Keep whatever else is in there */
+    g_key_file_load_from_file (keyFile, path, G_KEY_FILE_KEEP_COMMENTS, NULL);
+
+    backendGetDecoderConfig (player, &config);
+    g_key_file_set_integer (keyFile, "decoder", "threads", (gint) config.threads);
+    g_key_file_set_string (keyFile, "decoder", "thread-type", threadTypeNames[config.threadType]);
+    g_key_file_set_integer (keyFile, "decoder", "queue-kb", (gint) (config.queueBytes / 1024));
+    g_key_file_set_integer (keyFile, "decoder", "queue-ms", (gint) (config.queueTime / GST_MSECOND));
+    g_key_file_set_integer (keyFile, "playback", "frame-cache-mb", frameCacheMb);
+    g_key_file_set_integer (keyFile, "playback", "memory-budget-mb", memoryBudgetMb);
+    g_key_file_set_string (keyFile, "playback", "mosaic-decode", mosaicDecodeNames[mosaicDecode]);
+    g_key_file_set_boolean (keyFile, "playback", "stop-hidden-video", stopHiddenVideo);
+    g_key_file_set_boolean (keyFile, "playback", "resume", resumePlayback);
+    g_key_file_set_boolean (keyFile, "video", "opengl", useGl);
+    g_key_file_set_string (keyFile, "video", "lut", lutPath ? lutPath : "");
+    g_key_file_set_string (keyFile, "video", "lut-interpolation",
+            lutInterpolationNames[lutInterpolation]);
+    g_key_file_set_string (keyFile, "video", "visualisation", visualisationNames[visualisation]);
+    g_key_file_set_integer (keyFile, "video", "visualisation-fps", visualisationFps);
+
+    g_mkdir_with_parents (directory, 0755);
+    if (!g_key_file_save_to_file (keyFile, path, &error)) {
+        g_printerr ("Could not save preferences: %s\n", error->message);
+        g_clear_error (&error);
+    }
+    g_free (directory);
+    g_free (path);
+    g_key_file_free (keyFile);
+}
+
+static GtkWidget* addPreference (GtkWidget* grid, gint row, const gchar* label,
+                                 GtkWidget* widget) {
+    GtkWidget* labelWidget = gtk_label_new (label);
+
+    gtk_widget_set_halign (labelWidget, GTK_ALIGN_START);
+    gtk_grid_attach (GTK_GRID (grid), labelWidget, 0, row, 1, 1);
+    gtk_grid_attach (GTK_GRID (grid), widget, 1, row, 1, 1);
+    return widget;
+}
+
+static void clearLut_cb (GtkWidget* widget, GtkWidget* chooser) {
+    UNUSED (widget);
+
+    gtk_file_chooser_unselect_all (GTK_FILE_CHOOSER (chooser));
+}
+
+/* Decoder threading and queueing, which apply from the next file opened, the
+ * frame ring for stepping back, the decoding of unfocused mosaic tiles,
+ * whether video is decoded while no window shows it, the GL renderer, the
+ * colour grading LUT, the memory budget, resuming files where they were
+ * left and what audio-only files show */
+void createPreferencesDialog() {
+    GtkWidget* dialog = gtk_dialog_new_with_buttons ("Preferences",
+            GTK_WINDOW (uiWidgets.window), GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+            "_Cancel", GTK_RESPONSE_CANCEL, "_Apply", GTK_RESPONSE_APPLY, NULL);
+    GtkWidget* grid = gtk_grid_new();
+    DecoderConfig config;
+
+    backendGetDecoderConfig (player, &config);
+    gtk_grid_set_row_spacing (GTK_GRID (grid), 10);
+    gtk_grid_set_column_spacing (GTK_GRID (grid), 20);
+    gtk_container_set_border_width (GTK_CONTAINER (grid), 20);
+
+    GtkWidget* threads = addPreference (grid, 0, "Decoder threads (0 = automatic)",
+            gtk_spin_button_new_with_range (0, 256, 1));
+    gtk_spin_button_set_value (GTK_SPIN_BUTTON (threads), config.threads);
+
+    GtkWidget* threadType = addPreference (grid, 1, "Threading",
+            gtk_combo_box_text_new());
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (threadType), "Automatic");
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (threadType), "Frame");
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (threadType), "Slice");
+    gtk_combo_box_set_active (GTK_COMBO_BOX (threadType), config.threadType);
+
+    GtkWidget* queueKb = addPreference (grid, 2, "Demuxer queue, KiB (0 = automatic)",
+            gtk_spin_button_new_with_range (0, 1024 * 1024, 256));
+    gtk_spin_button_set_value (GTK_SPIN_BUTTON (queueKb), config.queueBytes / 1024);
+
+    GtkWidget* queueMs = addPreference (grid, 3, "Demuxer queue, ms (0 = automatic)",
+            gtk_spin_button_new_with_range (0, 60000, 100));
+    gtk_spin_button_set_value (GTK_SPIN_BUTTON (queueMs),
+            (gdouble) (config.queueTime / GST_MSECOND));
+
+    GtkWidget* frameCache = addPreference (grid, 4, "Frames kept for stepping back, MiB",
+            gtk_spin_button_new_with_range (0, 8192, 64));
+    gtk_spin_button_set_value (GTK_SPIN_BUTTON (frameCache), frameCacheMb);
+
+    GtkWidget* unfocused = addPreference (grid, 5, "Mosaic tiles without focus",
+            gtk_combo_box_text_new());
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (unfocused), "Full decoding");
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (unfocused), "Reduced resolution");
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (unfocused), "Keyframes only");
+    gtk_combo_box_set_active (GTK_COMBO_BOX (unfocused), mosaicDecode);
+
+    GtkWidget* hiddenVideo = addPreference (grid, 6, "Stop video while it is not visible",
+            gtk_switch_new());
+    gtk_switch_set_active (GTK_SWITCH (hiddenVideo), stopHiddenVideo);
+    gtk_widget_set_halign (hiddenVideo, GTK_ALIGN_START);
+
+    GtkWidget* openGl = addPreference (grid, 7, "Render with OpenGL (after a restart)",
+            gtk_switch_new());
+    gtk_switch_set_active (GTK_SWITCH (openGl), useGl);
+    gtk_widget_set_halign (openGl, GTK_ALIGN_START);
+
+    GtkWidget* lutChooser = gtk_file_chooser_button_new ("Colour grading LUT",
+            GTK_FILE_CHOOSER_ACTION_OPEN);
+    GtkFileFilter* cubeFilter = gtk_file_filter_new();
+    GtkWidget* lutClear = gtk_button_new_with_label ("Clear");
+    GtkWidget* lutBox = addPreference (grid, 8, "Colour grading LUT (.cube)",
+            gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 6));
+    gtk_file_filter_set_name (cubeFilter, "3D LUT");
+    gtk_file_filter_add_pattern (cubeFilter, "*.cube");
+    gtk_file_chooser_add_filter (GTK_FILE_CHOOSER (lutChooser), cubeFilter);
+    if (lutPath) {
+        gtk_file_chooser_set_filename (GTK_FILE_CHOOSER (lutChooser), lutPath);
+    }
+    g_signal_connect (lutClear, "clicked", G_CALLBACK (clearLut_cb), lutChooser);
+    gtk_box_pack_start (GTK_BOX (lutBox), lutChooser, TRUE, TRUE, 0);
+    gtk_box_pack_start (GTK_BOX (lutBox), lutClear, FALSE, FALSE, 0);
+
+    GtkWidget* interpolation = addPreference (grid, 9, "LUT interpolation",
+            gtk_combo_box_text_new());
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (interpolation), "Tetrahedral");
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (interpolation), "Trilinear");
+    gtk_combo_box_set_active (GTK_COMBO_BOX (interpolation), lutInterpolation);
+
+    GtkWidget* memoryBudget = addPreference (grid, 10, "Memory budget, MiB (0 = unlimited)",
+            gtk_spin_button_new_with_range (0, 65536, 64));
+    gtk_spin_button_set_value (GTK_SPIN_BUTTON (memoryBudget), memoryBudgetMb);
+
+    GtkWidget* resume = addPreference (grid, 11, "Resume files where they were left",
+            gtk_switch_new());
+    gtk_switch_set_active (GTK_SWITCH (resume), resumePlayback);
+    gtk_widget_set_halign (resume, GTK_ALIGN_START);
+
+    GtkWidget* visStyle = addPreference (grid, 12, "Visualisation for audio files",
+            gtk_combo_box_text_new());
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (visStyle), "None");
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (visStyle), "Spectrum");
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (visStyle), "Oscilloscope");
+    gtk_combo_box_set_active (GTK_COMBO_BOX (visStyle), visualisation);
+
+    GtkWidget* visFps = addPreference (grid, 13, "Visualisation frames per second (0 = no cap)",
+            gtk_spin_button_new_with_range (0, 120, 5));
+    gtk_spin_button_set_value (GTK_SPIN_BUTTON (visFps), visualisationFps);
+
+    gtk_container_add (GTK_CONTAINER (gtk_dialog_get_content_area (GTK_DIALOG (dialog))), grid);
+    gtk_widget_show_all (dialog);
+
+    if (gtk_dialog_run (GTK_DIALOG (dialog)) == GTK_RESPONSE_APPLY) {
+        config.threads = gtk_spin_button_get_value_as_int (GTK_SPIN_BUTTON (threads));
+        config.threadType = MAX (0, gtk_combo_box_get_active (GTK_COMBO_BOX (threadType)));
+        config.queueBytes = gtk_spin_button_get_value_as_int (GTK_SPIN_BUTTON (queueKb)) * 1024u;
+        config.queueTime = (guint64) gtk_spin_button_get_value_as_int (
+                GTK_SPIN_BUTTON (queueMs)) * GST_MSECOND;
+        backendSetDecoderConfig (player, &config);
+        frameCacheMb = gtk_spin_button_get_value_as_int (GTK_SPIN_BUTTON (frameCache));
+        backendSetFrameCacheSize (player, (gsize) frameCacheMb * 1024 * 1024);
+        mosaicDecode = MAX (0, gtk_combo_box_get_active (GTK_COMBO_BOX (unfocused)));
+        backendSetMosaicDecode (player, mosaicDecode);
+        stopHiddenVideo = gtk_switch_get_active (GTK_SWITCH (hiddenVideo));
+        useGl = gtk_switch_get_active (GTK_SWITCH (openGl));
+        queueVisibilityUpdate();
+        g_free (lutPath);
+        lutPath = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (lutChooser));
+        lutInterpolation = MAX (0, gtk_combo_box_get_active (GTK_COMBO_BOX (interpolation)));
+        applyLut();
+        memoryBudgetMb = gtk_spin_button_get_value_as_int (GTK_SPIN_BUTTON (memoryBudget));
+        backendSetMemoryBudget (player, (gsize) memoryBudgetMb * 1024 * 1024);
+        resumePlayback = gtk_switch_get_active (GTK_SWITCH (resume));
+        applyResume();
+        visualisation = MAX (0, gtk_combo_box_get_active (GTK_COMBO_BOX (visStyle)));
+        visualisationFps = gtk_spin_button_get_value_as_int (GTK_SPIN_BUTTON (visFps));
+        backendSetVisualisation (player, visualisation, (guint) visualisationFps);
+        savePreferences();
+    }
+    gtk_widget_destroy (dialog);
+}
+
 void createAboutDialog() {
     GtkWidget* aboutWindow = gtk_about_dialog_new();
 
@@ -553,22 +1235,14 @@ void createAboutDialog() {
     gtk_widget_show_all (aboutWindow);
 }
 
-void refreshPositionLabel (GtkWidget* positionLabel) {
-    const gint size = 30;
+void refreshTimeLabel (GtkWidget* label, gdouble seconds) {
+    gchar text[30];
 
-    gchar* positionText = (gchar*) malloc (sizeof (gchar) * size);
-    backendGetPosition (positionText);
-    gtk_label_set_label (GTK_LABEL (positionLabel), positionText);
-    g_free (positionText);
-}
-
-void refreshDurationLabel (GtkWidget* durationLabel) {
-    const gint size = 30;
-
-    gchar* durationText = (gchar*) malloc (sizeof (gchar) * size);
-    backendGetDuration (durationText);
-    gtk_label_set_label (GTK_LABEL (durationLabel), durationText);
-    g_free (durationText);
+    backendFormatTime (seconds, text);
+    /* The position arrives many times per second but the text changes once */
+    if (g_strcmp0 (gtk_label_get_label (GTK_LABEL (label)), text) != 0) {
+        gtk_label_set_label (GTK_LABEL (label), text);
+    }
 }
 
 void hideControls () {
@@ -581,17 +1255,115 @@ void hideControls () {
     g_signal_handler_unblock (videoWindow, motionSignalId);
 }
 
+static void backendEvent_cb (BackendEvent event, gdouble value, gpointer data) {
+    UNUSED (data);
+
+    switch (event) {
+    case BACKEND_EVENT_DURATION:
+        refreshDuration (value);
+        break;
+    case BACKEND_EVENT_POSITION:
+        refreshPosition (value);
+        break;
+    case BACKEND_EVENT_TRACK_CHANGED:
+        trackChanged();
+        break;
+    case BACKEND_EVENT_TRACKS:
+        refreshTrackMenus();
+        break;
+    case BACKEND_EVENT_FRAME:
+        if (value >= 0) {
+            refreshPosition (value);
+        }
+        showDrawingArea (value >= 0);
+        gtk_widget_queue_draw (uiWidgets.videoWindow);
+        if (fullUiWidgets.fullscreenSlider) {
+            gtk_widget_queue_draw (videoWindow);
+        }
+        break;
+    case BACKEND_EVENT_STATE:
+    case BACKEND_EVENT_EOS:
+    case BACKEND_EVENT_ERROR:
+        break;
+    }
+}
+
+/* '.' and ',' step a frame forward and back, like in other players, 'i'
+ * toggles the statistics overlay and the digits focus a tile of a mosaic */
+static gboolean keyPress_cb (GtkWidget* widget, GdkEventKey* event, gpointer data) {
+    UNUSED (widget);
+    UNUSED (data);
+
+    if (!isPlaying) {
+        return FALSE;
+    }
+    if (backendIsMosaic (player) && event->keyval >= GDK_KEY_1 && event->keyval <= GDK_KEY_9) {
+        backendSetMosaicFocus (player, event->keyval - GDK_KEY_1);
+        return TRUE;
+    }
+    switch (event->keyval) {
+    case GDK_KEY_i: {
+        GtkCheckMenuItem* item = GTK_CHECK_MENU_ITEM (menubar.viewMenu.statsMi);
+        gtk_check_menu_item_set_active (item, !gtk_check_menu_item_get_active (item));
+        return TRUE;
+    }
+    case GDK_KEY_period:
+        backendStepFrame (player, TRUE);
+        break;
+    case GDK_KEY_comma:
+        backendStepFrame (player, FALSE);
+        break;
+    default:
+        return FALSE;
+    }
+
+    /* Stepping leaves the player paused */
+    GtkWidget* icon = gtk_image_new_from_icon_name ("media-playback-start", GTK_ICON_SIZE_BUTTON);
+    gtk_button_set_image (GTK_BUTTON (uiWidgets.playButton), icon);
+    return TRUE;
+}
+
+/* Paints the frame the backend kept while stepping back; otherwise the video
+ * sink draws into this window itself */
+static gboolean videoDraw_cb (GtkWidget* widget, cairo_t* cr, gpointer data) {
+    UNUSED (data);
+
+    BackendFrame frame = { 0 };
+    gint width = gtk_widget_get_allocated_width (widget);
+    gint height = gtk_widget_get_allocated_height (widget);
+
+    if (!isPlaying || !backendGetFrame (player, &frame)) {
+        return FALSE;
+    }
+
+    cairo_surface_t* surface = cairo_image_surface_create_for_data (
+            (guchar*) g_bytes_get_data (frame.pixels, NULL), CAIRO_FORMAT_RGB24,
+            frame.width, frame.height, frame.stride);
+    gdouble scale = MIN ((gdouble) width / frame.width, (gdouble) height / frame.height);
+
+    cairo_set_source_rgb (cr, 0, 0, 0);
+    cairo_paint (cr);
+    cairo_translate (cr, (width - frame.width * scale) / 2, (height - frame.height * scale) / 2);
+    cairo_scale (cr, scale, scale);
+    cairo_set_source_surface (cr, surface, 0, 0);
+    cairo_paint (cr);
+
+    cairo_surface_destroy (surface);
+    backendFrameClear (&frame);
+    return TRUE;
+}
+
 static void play_cb (GtkButton* button, gpointer data) {
     UNUSED (data);
 
-    if (!backendIsPlaying()) {
+    if (!backendIsPlaying (player)) {
         GtkWidget* icon = gtk_image_new_from_icon_name("media-playback-pause", GTK_ICON_SIZE_BUTTON);
         gtk_button_set_image (button, icon);
-        backendResume();
+        backendResume (player);
     } else {
         GtkWidget* icon = gtk_image_new_from_icon_name("media-playback-start", GTK_ICON_SIZE_BUTTON);
         gtk_button_set_image (button, icon);
-        backendPause();
+        backendPause (player);
     }
 }
 
@@ -599,28 +1371,181 @@ static void stop_cb (GtkButton* button, gpointer data) {
     UNUSED (button);
     UNUSED (data);
 
-    backendStop();
+    backendStop (player);
 }
 
 static void slider_cb (GtkRange* range, gpointer data) {
     UNUSED (data);
 
     gdouble value = gtk_range_get_value (GTK_RANGE (range));
-    backendSeek (value);
+    if (sliderDragging) {
+        backendScrub (player, value);
+    } else {
+        backendSeek (player, value);
+    }
 }
 
 static void fullSlider_cb (GtkRange* range, gpointer data) {
     UNUSED (data);
 
     gdouble value = gtk_range_get_value(GTK_RANGE (range));
-    backendSeek(value);
+    if (sliderDragging) {
+        backendScrub (player, value);
+    } else {
+        backendSeek (player, value);
+    }
+}
+
+static gboolean sliderPress_cb (GtkWidget* widget, GdkEvent* event, gpointer data) {
+    UNUSED (widget);
+    UNUSED (event);
+    UNUSED (data);
+
+    sliderDragging = TRUE;
+    return FALSE;
+}
+
+/* The drag is over, land exactly where the slider was released */
+static gboolean sliderRelease_cb (GtkWidget* widget, GdkEvent* event, gpointer data) {
+    UNUSED (event);
+    UNUSED (data);
+
+    sliderDragging = FALSE;
+    backendSeek (player, gtk_range_get_value (GTK_RANGE (widget)));
+    return FALSE;
+}
+
+/* Shows the time under the pointer and, once decoded, a preview of it */
+static gboolean sliderTooltip_cb (GtkWidget* widget, gint x, gint y, gboolean keyboard,
+                                  GtkTooltip* tooltip, gpointer data) {
+    UNUSED (y);
+    UNUSED (data);
+
+    GdkRectangle rect;
+    Thumbnail thumbnail;
+    gchar text[30];
+    gdouble duration = gtk_adjustment_get_upper (gtk_range_get_adjustment (GTK_RANGE (widget)));
+
+    if (!isPlaying || keyboard || duration <= 0) {
+        return FALSE;
+    }
+
+    gtk_range_get_range_rect (GTK_RANGE (widget), &rect);
+    if (rect.width <= 0) {
+        return FALSE;
+    }
+    gdouble position = CLAMP ((gdouble) (x - rect.x) / rect.width, 0, 1) * duration;
+
+    if (thumbnailerLookup (position, &thumbnail)) {
+        GdkPixbuf* pixbuf = gdk_pixbuf_new_from_bytes (thumbnail.pixels, GDK_COLORSPACE_RGB,
+                FALSE, 8, thumbnail.width, thumbnail.height, thumbnail.stride);
+        gtk_tooltip_set_icon (tooltip, pixbuf);
+        g_object_unref (pixbuf);
+        thumbnailClear (&thumbnail);
+    } else {
+        thumbnailerRequest (position, thumbnailReady_cb, NULL);
+    }
+
+    backendFormatTime (position, text);
+    gtk_tooltip_set_text (tooltip, text);
+    return TRUE;
+}
+
+static void thumbnailReady_cb (const Thumbnail* thumbnail, gpointer data) {
+    UNUSED (thumbnail);
+    UNUSED (data);
+
+    /* The preview is cached now, ask the visible slider to show it */
+    if (fullUiWidgets.fullscreenSlider != NULL) {
+        gtk_widget_trigger_tooltip_query (fullUiWidgets.fullscreenSlider);
+    } else {
+        gtk_widget_trigger_tooltip_query (uiWidgets.slider);
+    }
 }
 
 static void volume_cb (GtkRange* volumeButton, gpointer data) {
     UNUSED (data);
 
     gdouble value = gtk_scale_button_get_value (GTK_SCALE_BUTTON (volumeButton));
-    backendSetVolume (value);
+    backendSetVolume (player, value);
+}
+
+/* Mapped, in a window that is not minimised. GTK 3 cannot tell when other
+ * windows cover it. */
+static gboolean videoShown (GtkWidget* video) {
+    GtkWidget* toplevel = gtk_widget_get_toplevel (video);
+    GdkWindow* window = gtk_widget_get_window (toplevel);
+
+    return gtk_widget_get_mapped (video) && window &&
+           !(gdk_window_get_state (window) & GDK_WINDOW_STATE_ICONIFIED);
+}
+
+static gboolean updateVideoVisibility() {
+    gboolean visible = !stopHiddenVideo || videoShown (uiWidgets.videoWindow) ||
+                       (glWidget && videoShown (glWidget)) ||
+                       (fullUiWidgets.fullscreenSlider && videoShown (videoWindow));
+
+    visibilitySourceId = 0;
+    if (visible != videoVisible) {
+        videoVisible = visible;
+        backendSetVideoVisible (player, visible);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+/* Switching to and from fullscreen hides one window and shows another; the
+ * check waits for both, so the video is not dropped for a moment */
+static void queueVisibilityUpdate() {
+    if (!visibilitySourceId) {
+        visibilitySourceId = g_idle_add ((GSourceFunc) updateVideoVisibility, NULL);
+    }
+}
+
+static void videoMapped_cb (GtkWidget* widget, gpointer data) {
+    UNUSED (widget);
+    UNUSED (data);
+
+    queueVisibilityUpdate();
+}
+
+static gboolean windowState_cb (GtkWidget* widget, GdkEventWindowState* event, gpointer data) {
+    UNUSED (widget);
+    UNUSED (data);
+
+    if (event->changed_mask & GDK_WINDOW_STATE_ICONIFIED) {
+        queueVisibilityUpdate();
+    }
+    return FALSE;
+}
+
+/* Frames larger than this are scaled down before they are processed */
+static void videoSize_cb (GtkWidget* widget, GdkRectangle* allocation, gpointer data) {
+    UNUSED (data);
+
+    gint scale = gtk_widget_get_scale_factor (widget);
+
+    backendSetVideoSize (player, allocation->width * scale, allocation->height * scale);
+}
+
+static void watchVisibility (GtkWidget* window, GtkWidget* video) {
+    g_signal_connect (window, "window-state-event", G_CALLBACK (windowState_cb), NULL);
+    g_signal_connect (video, "map", G_CALLBACK (videoMapped_cb), NULL);
+    g_signal_connect (video, "unmap", G_CALLBACK (videoMapped_cb), NULL);
+    g_signal_connect (video, "size-allocate", G_CALLBACK (videoSize_cb), NULL);
+}
+
+/* The GL widget would lose its context if moved to another window, so the
+ * main window itself goes fullscreen, without its menu */
+static void glFullscreen() {
+    GdkWindow* window = gtk_widget_get_window (uiWidgets.window);
+
+    if (window && (gdk_window_get_state (window) & GDK_WINDOW_STATE_FULLSCREEN)) {
+        gtk_window_unfullscreen (GTK_WINDOW (uiWidgets.window));
+        gtk_widget_show (menubar.menubar);
+    } else {
+        gtk_widget_hide (menubar.menubar);
+        gtk_window_fullscreen (GTK_WINDOW (uiWidgets.window));
+    }
 }
 
 static void fullscreen_cb (GtkWidget* button, gpointer data) {
@@ -629,6 +1554,11 @@ static void fullscreen_cb (GtkWidget* button, gpointer data) {
     GtkWidget* controls;
     GtkWindow* parentWindow = GTK_WINDOW (gtk_widget_get_toplevel(button));
 
+    if (glWidget && !backendIsMosaic (player)) {
+        glFullscreen();
+        return;
+    }
+
     GtkWidget* fullscreenWindow = gtk_window_new (GTK_WINDOW_TOPLEVEL);
     gtk_window_set_position (GTK_WINDOW (fullscreenWindow), GTK_WIN_POS_CENTER);
     gtk_window_set_title (GTK_WINDOW (fullscreenWindow), "ProjectGliese");
@@ -637,9 +1567,13 @@ static void fullscreen_cb (GtkWidget* button, gpointer data) {
 
     videoWindow = gtk_drawing_area_new();
     gtk_container_add (GTK_CONTAINER (rootPane), videoWindow);
+    g_signal_connect (videoWindow, "draw", G_CALLBACK (videoDraw_cb), NULL);
+    g_signal_connect (fullscreenWindow, "key-press-event",
+            G_CALLBACK (keyPress_cb), NULL);
     g_signal_connect (videoWindow, "realize",
             G_CALLBACK (fullscreenRealize_cb), NULL);
     gtk_widget_add_events (videoWindow, GDK_POINTER_MOTION_MASK);
+    watchVisibility (fullscreenWindow, videoWindow);
 
     GtkWidget* playButton  = gtk_button_new_from_icon_name("media-playback-pause",
             GTK_ICON_SIZE_BUTTON);
@@ -654,7 +1588,7 @@ static void fullscreen_cb (GtkWidget* button, gpointer data) {
     GtkWidget* volumeButton = gtk_volume_button_new();
     g_signal_connect (volumeButton, "value-changed",
             G_CALLBACK (volume_cb), NULL);
-    gtk_scale_button_set_value (GTK_SCALE_BUTTON (volumeButton), backendGetVolume());
+    gtk_scale_button_set_value (GTK_SCALE_BUTTON (volumeButton), backendGetVolume (player));
 
     fullUiWidgets.position = gtk_label_new ("0:00:00");
 
@@ -663,6 +1597,13 @@ static void fullscreen_cb (GtkWidget* button, gpointer data) {
     gtk_scale_set_draw_value (GTK_SCALE (fullUiWidgets.fullscreenSlider), 0);
     fullUiWidgets.fullScreenSliderId = g_signal_connect (fullUiWidgets.fullscreenSlider,
             "value-changed", G_CALLBACK (fullSlider_cb), NULL);
+    g_signal_connect (fullUiWidgets.fullscreenSlider, "button-press-event",
+            G_CALLBACK (sliderPress_cb), NULL);
+    g_signal_connect (fullUiWidgets.fullscreenSlider, "button-release-event",
+            G_CALLBACK (sliderRelease_cb), NULL);
+    gtk_widget_set_has_tooltip (fullUiWidgets.fullscreenSlider, TRUE);
+    g_signal_connect (fullUiWidgets.fullscreenSlider, "query-tooltip",
+            G_CALLBACK (sliderTooltip_cb), NULL);
 
     fullUiWidgets.duration = gtk_label_new ("0:00:00");
 
@@ -691,6 +1632,7 @@ static void fullscreen_cb (GtkWidget* button, gpointer data) {
     gtk_widget_set_valign (controls, GTK_ALIGN_END);
 
     gtk_widget_show_all (fullscreenWindow);
+    syncControls();
 
     gtk_window_fullscreen (GTK_WINDOW (fullscreenWindow));
     motionSignalId = g_signal_connect (videoWindow, "motion-notify-event",
@@ -721,7 +1663,7 @@ static void overlayFullscreen_cb (GtkWidget* widget, GtkWindow* mainWindow) {
 
     gtk_widget_show (GTK_WIDGET (mainWindow));
     createContext (uiWidgets.videoWindow);
-    gtk_scale_button_set_value (GTK_SCALE_BUTTON (uiWidgets.volumeButton), backendGetVolume());
+    gtk_scale_button_set_value (GTK_SCALE_BUTTON (uiWidgets.volumeButton), backendGetVolume (player));
 }
 
 static void fullscreenRealize_cb (GtkWidget* widget, gpointer data) {
@@ -733,16 +1675,39 @@ static void fullscreenRealize_cb (GtkWidget* widget, gpointer data) {
 static void closeMenu_cb (GtkWidget* widget) {
     UNUSED (widget);
 
-    backendStop();
+    backendStop (player);
+    thumbnailerClose();
 }
 
 static void exitMenu_cb (GtkWidget* widget) {
     UNUSED (widget);
 
-    backendStop();
+    backendStop (player);
+    thumbnailerClose();
     gtk_main_quit();
 }
 
+/* Wires up the playback controls once the first file is opened */
+static void connectControls() {
+    isPlaying = TRUE;
+    g_signal_connect (uiWidgets.playButton, "clicked",
+            G_CALLBACK (play_cb), NULL);
+    g_signal_connect (uiWidgets.stopButton, "clicked",
+            G_CALLBACK (stop_cb), NULL);
+    g_signal_connect (uiWidgets.fullscreenButton, "clicked",
+            G_CALLBACK (fullscreen_cb), NULL);
+    g_signal_connect (uiWidgets.volumeButton, "value-changed",
+            G_CALLBACK (volume_cb), NULL);
+    uiWidgets.sliderUpdateSignalId =
+            g_signal_connect (uiWidgets.slider, "value-changed",
+                              G_CALLBACK (slider_cb), NULL);
+    g_signal_connect (uiWidgets.slider, "button-press-event",
+            G_CALLBACK (sliderPress_cb), NULL);
+    g_signal_connect (uiWidgets.slider, "button-release-event",
+            G_CALLBACK (sliderRelease_cb), NULL);
+    gtk_scale_button_set_value (GTK_SCALE_BUTTON (uiWidgets.volumeButton), 1.0);
+}
+
 static void fileMenu_cb (GtkWidget* widget) {
     if (!isPlaying) {
         GtkFileChooserNative* fileChooser;
@@ -768,28 +1733,27 @@ static void fileMenu_cb (GtkWidget* widget) {
              char* file = getFileName (fileName);
              gtk_window_set_title (GTK_WINDOW (uiWidgets.window), file);
 
-            const char* path = g_strconcat ("file://", fileName, NULL);
+            /* Escaped the way the library keys its entries */
+            gchar* path = gst_filename_to_uri (fileName, NULL);
 
-            backendPlay (path);
-            createContext (uiWidgets.videoWindow);
+            backendPlay (player, path);
+            thumbnailerOpen (path);
+            g_free (currentUri);
+            currentUri = g_strdup (path);
+            refreshTrackMenus();
+            if (glWidget) {
+                showDrawingArea (FALSE);
+            } else {
+                createContext (uiWidgets.videoWindow);
+            }
 
             GtkWidget* icon = gtk_image_new_from_icon_name ("media-playback-pause",
                     GTK_ICON_SIZE_BUTTON);
             gtk_button_set_image (GTK_BUTTON (uiWidgets.playButton), icon);
 
-            g_signal_connect (uiWidgets.playButton, "clicked",
-                    G_CALLBACK (play_cb), NULL);
-            g_signal_connect (uiWidgets.stopButton, "clicked",
-                    G_CALLBACK (stop_cb), NULL);
-            g_signal_connect (uiWidgets.fullscreenButton, "clicked",
-                    G_CALLBACK (fullscreen_cb), NULL);
-            g_signal_connect (uiWidgets.volumeButton, "value-changed",
-                    G_CALLBACK (volume_cb), NULL);
-            uiWidgets.sliderUpdateSignalId =
-                    g_signal_connect (uiWidgets.slider, "value-changed",
-                                      G_CALLBACK (slider_cb), NULL);
-            gtk_scale_button_set_value (GTK_SCALE_BUTTON (uiWidgets.volumeButton), 1.0);
+            connectControls();
 
+            g_free (path);
             g_free (file);
             g_free (fileName);
         }
@@ -814,15 +1778,21 @@ static void fileMenu_cb (GtkWidget* widget) {
             char* file = getFileName(fileName);
             gtk_window_set_title (GTK_WINDOW (uiWidgets.window), file);
 
-            const char* path = g_strconcat ("file://", fileName, NULL);
+            /* Escaped the way the library keys its entries */
+            gchar* path = gst_filename_to_uri (fileName, NULL);
 
-            backendChangeUri (path);
-            refreshDurationLabel (uiWidgets.duration);
+            backendChangeUri (player, path);
+            showDrawingArea (FALSE);
+            thumbnailerOpen (path);
+            g_free (currentUri);
+            currentUri = g_strdup (path);
+            refreshTrackMenus();
 
             GtkWidget* icon = gtk_image_new_from_icon_name ("media-playback-pause",
                     GTK_ICON_SIZE_BUTTON);
             gtk_button_set_image (GTK_BUTTON (uiWidgets.playButton), icon);
 
+            g_free (path);
             g_free (file);
             g_free (fileName);
         }
@@ -830,6 +1800,154 @@ static void fileMenu_cb (GtkWidget* widget) {
     }
 }
 
+/* Queues a file to follow the current one without a gap */
+static void queueMenu_cb (GtkWidget* widget) {
+    if (!isPlaying) {
+        fileMenu_cb (widget);
+        return;
+    }
+
+    GtkFileChooserNative* fileChooser;
+    GtkFileChooserAction action = GTK_FILE_CHOOSER_ACTION_OPEN;
+    GtkWindow* window = GTK_WINDOW (gtk_widget_get_toplevel(widget));
+    int res;
+
+    fileChooser = gtk_file_chooser_native_new ("Play Next", window,
+                                               action, "_Queue", "_Cancel");
+
+    res = gtk_native_dialog_run (GTK_NATIVE_DIALOG (fileChooser));
+    if (res == GTK_RESPONSE_ACCEPT) {
+        GtkFileChooser* chooser = GTK_FILE_CHOOSER (fileChooser);
+        gchar* uri = gtk_file_chooser_get_uri (chooser);
+
+        backendQueueUri (player, uri);
+        g_free (uri);
+    }
+    g_object_unref (fileChooser);
+}
+
+/* Shows an SRT, ASS or WebVTT file over the playing one */
+static void subtitleFileMenu_cb (GtkWidget* widget) {
+    if (!isPlaying) {
+        return;
+    }
+
+    GtkFileChooserNative* fileChooser;
+    GtkFileChooserAction action = GTK_FILE_CHOOSER_ACTION_OPEN;
+    GtkWindow* window = GTK_WINDOW (gtk_widget_get_toplevel(widget));
+    GtkFileFilter* filter = gtk_file_filter_new();
+    int res;
+
+    fileChooser = gtk_file_chooser_native_new ("Add Subtitle File", window,
+                                               action, "_Add", "_Cancel");
+    gtk_file_filter_set_name (filter, "Subtitles");
+    gtk_file_filter_add_pattern (filter, "*.srt");
+    gtk_file_filter_add_pattern (filter, "*.ass");
+    gtk_file_filter_add_pattern (filter, "*.ssa");
+    gtk_file_filter_add_pattern (filter, "*.vtt");
+    gtk_file_chooser_add_filter (GTK_FILE_CHOOSER (fileChooser), filter);
+
+    res = gtk_native_dialog_run (GTK_NATIVE_DIALOG (fileChooser));
+    if (res == GTK_RESPONSE_ACCEPT) {
+        gchar* fileName = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (fileChooser));
+        GError* error = NULL;
+
+        if (!backendAttachSubtitles (player, fileName, &error)) {
+            g_printerr ("Could not load the subtitles: %s\n", error->message);
+            g_clear_error (&error);
+        }
+        g_free (fileName);
+    }
+    g_object_unref (fileChooser);
+}
+
+/* Appends files to the playlist; the next one is prerolled in the background */
+static void playlistMenu_cb (GtkWidget* widget) {
+    if (!isPlaying) {
+        fileMenu_cb (widget);
+        return;
+    }
+
+    GtkFileChooserNative* fileChooser;
+    GtkFileChooserAction action = GTK_FILE_CHOOSER_ACTION_OPEN;
+    GtkWindow* window = GTK_WINDOW (gtk_widget_get_toplevel(widget));
+    int res;
+
+    fileChooser = gtk_file_chooser_native_new ("Add to Playlist", window,
+                                               action, "_Add", "_Cancel");
+    gtk_file_chooser_set_select_multiple (GTK_FILE_CHOOSER (fileChooser), TRUE);
+
+    res = gtk_native_dialog_run (GTK_NATIVE_DIALOG (fileChooser));
+    if (res == GTK_RESPONSE_ACCEPT) {
+        GSList* uris = gtk_file_chooser_get_uris (GTK_FILE_CHOOSER (fileChooser));
+
+        for (GSList* l = uris; l != NULL; l = l->next) {
+            backendPlaylistAppend (player, (const gchar*) l->data);
+        }
+        g_slist_free_full (uris, g_free);
+    }
+    g_object_unref (fileChooser);
+}
+
+/* Plays several files at once in a grid. A click on a tile or its number
+ * key gives it the focus. */
+static void mosaicMenu_cb (GtkWidget* widget) {
+    GtkFileChooserNative* fileChooser;
+    GtkFileChooserAction action = GTK_FILE_CHOOSER_ACTION_OPEN;
+    GtkWindow* window = GTK_WINDOW (gtk_widget_get_toplevel(widget));
+    int res;
+
+    fileChooser = gtk_file_chooser_native_new ("Open Mosaic", window,
+                                               action, "_Open", "_Cancel");
+    gtk_file_chooser_set_select_multiple (GTK_FILE_CHOOSER (fileChooser), TRUE);
+
+    res = gtk_native_dialog_run (GTK_NATIVE_DIALOG (fileChooser));
+    if (res == GTK_RESPONSE_ACCEPT) {
+        GSList* uris = gtk_file_chooser_get_uris (GTK_FILE_CHOOSER (fileChooser));
+        GPtrArray* array = g_ptr_array_new();
+        gchar* title;
+
+        for (GSList* l = uris; l != NULL; l = l->next) {
+            g_ptr_array_add (array, l->data);
+        }
+        if (!isPlaying) {
+            connectControls();
+        }
+        backendPlayMosaic (player, (const gchar* const*) array->pdata, array->len);
+        showDrawingArea (TRUE);
+        createContext (uiWidgets.videoWindow);
+
+        title = g_strdup_printf ("Mosaic of %u files", array->len);
+        gtk_window_set_title (GTK_WINDOW (uiWidgets.window), title);
+        thumbnailerClose();
+        g_clear_pointer (&currentUri, g_free);
+        refreshTrackMenus();
+
+        GtkWidget* icon = gtk_image_new_from_icon_name ("media-playback-pause",
+                GTK_ICON_SIZE_BUTTON);
+        gtk_button_set_image (GTK_BUTTON (uiWidgets.playButton), icon);
+
+        g_free (title);
+        g_ptr_array_free (array, TRUE);
+        g_slist_free_full (uris, g_free);
+    }
+    g_object_unref (fileChooser);
+}
+
+static void nextMenu_cb (GtkWidget* widget) {
+    UNUSED (widget);
+
+    if (isPlaying) {
+        backendPlaylistNext (player);
+    }
+}
+
+static void statsMenu_cb (GtkCheckMenuItem* item, gpointer data) {
+    UNUSED (data);
+
+    backendSetStatsOverlay (player, gtk_check_menu_item_get_active (item));
+}
+
 static void aboutMenu_cb (GtkWidget* widget, gpointer data) {
     UNUSED (widget);
     UNUSED (data);
@@ -851,32 +1969,123 @@ static void colorBalanceMenu_cb (GtkWidget* widget, gpointer data) {
     createColorBalanceWindow();
 }
 
-static void contrast_cb (GtkRange* range, gpointer data) {
+static gboolean libraryScanned_idle (gpointer data) {
     UNUSED (data);
 
-    gdouble value = gtk_range_get_value (GTK_RANGE (range));
-    backendSetColorBalance ("CONTRAST", value);
+    gchar* indexPath = libraryDefaultPath();
+    libraryOpen (indexPath);
+    g_free (indexPath);
+
+    libraryScanning = FALSE;
+    refreshTrackMenus();
+    return G_SOURCE_REMOVE;
+}
+
+static gpointer libraryScan_thread (gchar* directory) {
+    GError* error = NULL;
+    gchar* indexPath = libraryDefaultPath();
+
+    if (!libraryScan (directory, indexPath, &error)) {
+        g_printerr ("Library scan failed: %s\n", error ? error->message : "unknown error");
+        g_clear_error (&error);
+    }
+    g_free (indexPath);
+    g_free (directory);
+
+    g_idle_add (libraryScanned_idle, NULL);
+    return NULL;
 }
 
-static void brightness_cb (GtkRange* range, gpointer data) {
+static void scanLibraryMenu_cb (GtkWidget* widget, gpointer data) {
     UNUSED (data);
 
-    gdouble value = gtk_range_get_value (GTK_RANGE (range));
-    backendSetColorBalance ("BRIGHTNESS", value);
+    if (libraryScanning) {
+        return;
+    }
+
+    GtkFileChooserNative* fileChooser;
+    GtkWindow* window = GTK_WINDOW (gtk_widget_get_toplevel (widget));
+
+    fileChooser = gtk_file_chooser_native_new ("Scan Media Library", window,
+            GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER, "_Scan", "_Cancel");
+
+    if (gtk_native_dialog_run (GTK_NATIVE_DIALOG (fileChooser)) == GTK_RESPONSE_ACCEPT) {
+        gchar* directory = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (fileChooser));
+
+        /* The scan keeps every core busy; the UI only waits for the result */
+        libraryScanning = TRUE;
+        g_thread_unref (g_thread_new ("library-scan",
+                (GThreadFunc) libraryScan_thread, directory));
+    }
+    g_object_unref (fileChooser);
 }
 
-static void saturation_cb (GtkRange* range, gpointer data) {
+static void preferencesMenu_cb (GtkWidget* widget, gpointer data) {
+    UNUSED (widget);
     UNUSED (data);
 
-    gdouble value = gtk_range_get_value (GTK_RANGE (range));
-    backendSetColorBalance ("SATURATION", value);
+    createPreferencesDialog();
 }
 
-static void hue_cb (GtkRange* range, gpointer data) {
+/* Unchecking stops the profiler and asks where to save the trace, which opens
+ * in chrome://tracing or ui.perfetto.dev */
+static void profileMenu_cb (GtkCheckMenuItem* item, gpointer data) {
     UNUSED (data);
 
-    gdouble value = gtk_range_get_value (GTK_RANGE (range));
-    backendSetColorBalance ("HUE", value);
+    if (gtk_check_menu_item_get_active (item)) {
+        profilerStart();
+        return;
+    }
+
+    GtkFileChooserNative* fileChooser;
+    GtkWindow* window = GTK_WINDOW (uiWidgets.window);
+    GError* error = NULL;
+    gchar* path = NULL;
+    gchar* summary;
+
+    fileChooser = gtk_file_chooser_native_new ("Save Trace", window,
+            GTK_FILE_CHOOSER_ACTION_SAVE, "_Save", "_Discard");
+    gtk_file_chooser_set_current_name (GTK_FILE_CHOOSER (fileChooser), "gliese-trace.json");
+    gtk_file_chooser_set_do_overwrite_confirmation (GTK_FILE_CHOOSER (fileChooser), TRUE);
+    if (gtk_native_dialog_run (GTK_NATIVE_DIALOG (fileChooser)) == GTK_RESPONSE_ACCEPT) {
+        path = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (fileChooser));
+    }
+    g_object_unref (fileChooser);
+
+    summary = profilerStop (path, &error);
+    if (summary) {
+        createProfileWindow (summary);
+        g_free (summary);
+    } else {
+        g_printerr ("%s\n", error->message);
+        g_clear_error (&error);
+    }
+    g_free (path);
+}
+
+static gboolean colorBalanceTick_cb (GtkWidget* widget, GdkFrameClock* clock, gpointer data) {
+    UNUSED (widget);
+    UNUSED (clock);
+    UNUSED (data);
+
+    backendSetColorBalanceValues (player, &colorBalance);
+    return G_SOURCE_REMOVE;
+}
+
+static void colorBalanceTickDone (gpointer data) {
+    UNUSED (data);
+
+    colorBalanceTickId = 0;
+}
+
+/* A drag moves a slider many times a frame; the backend gets all four
+ * values once, on the next frame */
+static void colorBalance_cb (GtkRange* range, gdouble* value) {
+    *value = gtk_range_get_value (range);
+    if (!colorBalanceTickId) {
+        colorBalanceTickId = gtk_widget_add_tick_callback (GTK_WIDGET (range),
+                colorBalanceTick_cb, NULL, colorBalanceTickDone);
+    }
 }
 
 /* This function is called when the main window is closed */
@@ -885,7 +2094,8 @@ static void deleteEvent_cb (GtkWidget* widget, GdkEvent* event, gpointer data) {
     UNUSED (event);
     UNUSED (data);
 
-    backendStop();
+    backendStop (player);
+    thumbnailerClose();
     gtk_main_quit();
 }
 
@@ -900,21 +2110,9 @@ void stringReplace (char* str, char rep, char with) {
     }
 }
 
+/* The part of the path after the last slash, to be freed with g_free() */
 char* getFileName(char* str) {
-    int length = (int) strlen(str);
-
-    for (int i = length; i > 0; i--)
-    {
-        if (str[i] == '/')
-        {
-            int size = length - ++i;
-            char* fileName = (char*) malloc(sizeof(char) * size);
+    char* slash = strrchr (str, '/');
 
-            memcpy(fileName, str + i, size);
-            fileName[size] = '\0';
-
-            return fileName;
-        }
-    }
-    return NULL;
-}
\ No newline at end of file
+    return g_strdup (slash ? slash + 1 : str);
+}
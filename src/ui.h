@@ -1,4 +1,4 @@
 #pragma once
+#ifndef UNUSED
 #define UNUSED(x) (void)(x)
-
-gboolean refreshUi();
\ No newline at end of file
+#endif
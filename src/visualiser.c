@@ -0,0 +1,320 @@
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+#include <gst/video/video.h>
+#include <gst/pbutils/pbutils.h>
+#include <math.h>
+#include <string.h>
+#include "fft.h"
+#include "visualiser.h"
+
+#define VISUALISER_TYPE (visualiser_get_type())
+#define VISUALISER(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), VISUALISER_TYPE, Visualiser))
+
+#define FFT_SIZE        2048    /* 46 ms at 44.1 kHz, 21 Hz a bin */
+#define LOWEST_HZ       40.0
+#define HIGHEST_HZ      16000.0
+#define RANGE_DB        70.0    /* from the top of a bar to silence */
+#define FALL_PER_SECOND 1.5f    /* of the height, for bars on their way down */
+#define BAR_PIXELS      12      /* about; bars are spread evenly over the width */
+
+/* A native word per pixel with red, green and blue from the top byte down */
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define VIDEO_FORMAT "BGRx"
+#else
+#define VIDEO_FORMAT "xRGB"
+#endif
+
+typedef struct _Visualiser {
+    GstAudioVisualizer parent;
+    BackendVisualisation style; /* under the object lock */
+    /* The streaming thread's */
+    Fft* fft;
+    FftKernel kernel;
+    gfloat samples[FFT_SIZE];   /* the latest, mixed down, oldest first */
+    gfloat power[FFT_SIZE / 2];
+    /* The layout for the size and rate last drawn, see layOut() */
+    gint width;
+    gint height;
+    gint rate;
+    guint bars;
+    guint* edges;               /* first FFT bin of each bar, and one past the last */
+    gfloat* levels;             /* each bar's height, 0 to 1 */
+    guint32* gradient;          /* a colour per row */
+} Visualiser;
+
+typedef struct _VisualiserClass {
+    GstAudioVisualizerClass parent;
+} VisualiserClass;
+
+enum {
+    PROP_0,
+    PROP_STYLE
+};
+
+G_DEFINE_TYPE (Visualiser, visualiser, GST_TYPE_AUDIO_VISUALIZER)
+
+/* playsink converts and downmixes in front of visualisations */
+static GstStaticPadTemplate sinkTemplate = GST_STATIC_PAD_TEMPLATE ("sink",
+        GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS ("audio/x-raw, "
+                "format = (string) " GST_AUDIO_NE (F32) ", "
+                "layout = (string) interleaved, "
+                "rate = (int) [ 8000, 192000 ], "
+                "channels = (int) [ 1, 2 ]"));
+
+static GstStaticPadTemplate srcTemplate = GST_STATIC_PAD_TEMPLATE ("src",
+        GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE (VIDEO_FORMAT)));
+
+static GType styleGetType (void) {
+    static gsize type = 0;
+    static const GEnumValue values[] = {
+        { BACKEND_VISUALISATION_SPECTRUM, "Spectrum", "spectrum" },
+        { BACKEND_VISUALISATION_SCOPE, "Oscilloscope", "scope" },
+        { 0, NULL, NULL }
+    };
+
+    if (g_once_init_enter (&type)) {
+        g_once_init_leave (&type, g_enum_register_static ("GlieseVisualisation", values));
+    }
+    return type;
+}
+
+static void setProperty (GObject* object, guint id, const GValue* value, GParamSpec* pspec) {
+    Visualiser* self = VISUALISER (object);
+
+    switch (id) {
+    case PROP_STYLE:
+        GST_OBJECT_LOCK (self);
+        self->style = g_value_get_enum (value);
+        GST_OBJECT_UNLOCK (self);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, id, pspec);
+        break;
+    }
+}
+
+static void getProperty (GObject* object, guint id, GValue* value, GParamSpec* pspec) {
+    Visualiser* self = VISUALISER (object);
+
+    GST_OBJECT_LOCK (self);
+    switch (id) {
+    case PROP_STYLE:
+        g_value_set_enum (value, self->style);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, id, pspec);
+        break;
+    }
+    GST_OBJECT_UNLOCK (self);
+}
+
+static void clearLayout (Visualiser* self) {
+    g_clear_pointer (&self->edges, g_free);
+    g_clear_pointer (&self->levels, g_free);
+    g_clear_pointer (&self->gradient, g_free);
+    self->width = self->height = self->rate = 0;
+}
+
+static void finalize (GObject* object) {
+    Visualiser* self = VISUALISER (object);
+
+    clearLayout (self);
+    fftFree (self->fft);
+    G_OBJECT_CLASS (visualiser_parent_class)->finalize (object);
+}
+
+static guint32 pixel (gdouble r, gdouble g, gdouble b) {
+    return (guint32) (r * 255) << 16 | (guint32) (g * 255) << 8 | (guint32) (b * 255);
+}
+
+/* Works out the bars and colours for a frame size and sample rate: bars a
+ * dozen pixels wide, each an equal share of the octaves shown, and a
+ * gradient from green at the bottom through yellow to red at the top */
+static void layOut (Visualiser* self, gint width, gint height, gint rate) {
+    gdouble highest = MIN (HIGHEST_HZ, rate / 2.0);
+    gdouble binHz = (gdouble) rate / FFT_SIZE;
+
+    clearLayout (self);
+    self->width = width;
+    self->height = height;
+    self->rate = rate;
+    self->bars = (guint) CLAMP (width / BAR_PIXELS, 8, 256);
+    self->edges = g_new (guint, self->bars + 1);
+    self->levels = g_new0 (gfloat, self->bars);
+    self->gradient = g_new (guint32, height);
+
+    for (guint b = 0; b <= self->bars; b++) {
+        gdouble hz = LOWEST_HZ * pow (highest / LOWEST_HZ, (gdouble) b / self->bars);
+
+        self->edges[b] = (guint) CLAMP (hz / binHz, 1, FFT_SIZE / 2);
+    }
+    /* Low bars cover less than a bin; each takes at least the one it starts in */
+    for (guint b = 0; b < self->bars; b++) {
+        self->edges[b + 1] = MAX (self->edges[b + 1], MIN (self->edges[b] + 1, FFT_SIZE / 2));
+    }
+    for (gint y = 0; y < height; y++) {
+        gdouble up = 1.0 - (gdouble) y / MAX (height - 1, 1);
+
+        self->gradient[y] = up < 0.5 ? pixel (up * 2, 0.85, 0.2)
+                                     : pixel (1.0, 1.7 - up * 1.7, 0.2);
+    }
+}
+
+/* Keeps the latest FFT_SIZE samples, averaging the channels; a short buffer
+ * moves the older ones down rather than leaving a gap of silence */
+static void mixDown (Visualiser* self, const gfloat* data, guint frames, guint channels) {
+    guint count = MIN (frames, FFT_SIZE);
+    gfloat* out = self->samples + FFT_SIZE - count;
+
+    data += (gsize) (frames - count) * channels;
+    memmove (self->samples, self->samples + count, (FFT_SIZE - count) * sizeof (gfloat));
+    if (channels == 1) {
+        memcpy (out, data, count * sizeof (gfloat));
+        return;
+    }
+    for (guint i = 0; i < count; i++) {
+        out[i] = (data[2 * i] + data[2 * i + 1]) * 0.5f;
+    }
+}
+
+static void fillRect (GstVideoFrame* video, gint x0, gint x1, gint y0, gint y1,
+                      const guint32* colours, guint32 colour) {
+    guint8* data = GST_VIDEO_FRAME_PLANE_DATA (video, 0);
+    gint stride = GST_VIDEO_FRAME_PLANE_STRIDE (video, 0);
+
+    for (gint y = y0; y < y1; y++) {
+        guint32* row = (guint32*) (data + (gsize) y * stride);
+        guint32 c = colours ? colours[y] : colour;
+
+        for (gint x = x0; x < x1; x++) {
+            row[x] = c;
+        }
+    }
+}
+
+static void drawSpectrum (Visualiser* self, GstVideoFrame* video, gdouble frameSeconds) {
+    gint width = self->width;
+    gint height = self->height;
+    gfloat fall = FALL_PER_SECOND * (gfloat) frameSeconds;
+
+    fftPowerSpectrum (self->fft, self->kernel, self->samples, self->power);
+    for (guint b = 0; b < self->bars; b++) {
+        gfloat peak = 0;
+        gfloat level;
+
+        for (guint bin = self->edges[b]; bin < self->edges[b + 1]; bin++) {
+            peak = MAX (peak, self->power[bin]);
+        }
+        level = (gfloat) ((10 * log10 (peak + 1e-12) + RANGE_DB) / RANGE_DB);
+        level = CLAMP (level, 0.0f, 1.0f);
+        self->levels[b] = MAX (level, self->levels[b] - fall);
+    }
+
+    for (guint b = 0; b < self->bars; b++) {
+        gint x0 = (gint) ((gint64) b * width / self->bars);
+        gint x1 = (gint) ((gint64) (b + 1) * width / self->bars);
+        gint top = height - (gint) (self->levels[b] * height);
+
+        /* A quarter of each bar is the gap to the next */
+        fillRect (video, x0, x1 - MAX ((x1 - x0) / 4, 1), top, height, self->gradient, 0);
+    }
+}
+
+/* The samples across the width, a column from one to the next so that
+ * steep edges stay joined up */
+static void drawScope (Visualiser* self, GstVideoFrame* video) {
+    const guint32 colour = pixel (0.3, 0.9, 0.8);
+    gint width = self->width;
+    gint middle = self->height / 2;
+    gint previous = middle;
+
+    for (gint x = 0; x < width; x++) {
+        gfloat sample = self->samples[(gint64) x * (FFT_SIZE - 1) / MAX (width - 1, 1)];
+        gint y = middle - (gint) (CLAMP (sample, -1.0f, 1.0f) * (middle - 1));
+
+        if (x == 0) {
+            previous = y;
+        }
+        fillRect (video, x, x + 1, MIN (previous, y), MAX (previous, y) + 1, NULL, colour);
+        previous = y;
+    }
+}
+
+/* The base class sets req_spf to the samples of one frame from the caps
+ * before calling this; every frame is to get a full window, however short
+ * the frame, so windows overlap rather than being padded */
+static gboolean setup (GstAudioVisualizer* scope) {
+    scope->req_spf = FFT_SIZE;
+    return TRUE;
+}
+
+/* The base class clears the frame first, as no shader is set */
+static gboolean render (GstAudioVisualizer* scope, GstBuffer* audio, GstVideoFrame* video) {
+    Visualiser* self = VISUALISER (scope);
+    gint width = GST_VIDEO_FRAME_WIDTH (video);
+    gint height = GST_VIDEO_FRAME_HEIGHT (video);
+    gint rate = GST_AUDIO_INFO_RATE (&scope->ainfo);
+    guint channels = GST_AUDIO_INFO_CHANNELS (&scope->ainfo);
+    gdouble frameSeconds = 1.0 / 30;
+    BackendVisualisation style;
+    GstMapInfo map;
+
+    if (!gst_buffer_map (audio, &map, GST_MAP_READ)) {
+        return FALSE;
+    }
+    mixDown (self, (const gfloat*) map.data, map.size / (sizeof (gfloat) * channels), channels);
+    gst_buffer_unmap (audio, &map);
+
+    if (width != self->width || height != self->height || rate != self->rate) {
+        layOut (self, width, height, rate);
+    }
+    if (GST_VIDEO_INFO_FPS_N (&scope->vinfo) > 0) {
+        frameSeconds = (gdouble) GST_VIDEO_INFO_FPS_D (&scope->vinfo) /
+                GST_VIDEO_INFO_FPS_N (&scope->vinfo);
+    }
+
+    GST_OBJECT_LOCK (self);
+    style = self->style;
+    GST_OBJECT_UNLOCK (self);
+    if (style == BACKEND_VISUALISATION_SCOPE) {
+        drawScope (self, video);
+    } else {
+        drawSpectrum (self, video, frameSeconds);
+    }
+    return TRUE;
+}
+
+static void visualiser_class_init (VisualiserClass* klass) {
+    GObjectClass* objectClass = G_OBJECT_CLASS (klass);
+    GstElementClass* elementClass = GST_ELEMENT_CLASS (klass);
+    GstAudioVisualizerClass* scopeClass = GST_AUDIO_VISUALIZER_CLASS (klass);
+
+    objectClass->set_property = setProperty;
+    objectClass->get_property = getProperty;
+    objectClass->finalize = finalize;
+
+    g_object_class_install_property (objectClass, PROP_STYLE,
+            g_param_spec_enum ("style", "Style", "What is drawn of the sound",
+                    styleGetType(), BACKEND_VISUALISATION_SPECTRUM,
+                    G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    gst_element_class_set_static_metadata (elementClass, "Spectrum",
+            "Visualization", "Draws a spectrum or an oscilloscope trace of the sound",
+            "Project Gliese");
+    gst_element_class_add_static_pad_template (elementClass, &sinkTemplate);
+    gst_element_class_add_static_pad_template (elementClass, &srcTemplate);
+
+    scopeClass->setup = setup;
+    scopeClass->render = render;
+}
+
+static void visualiser_init (Visualiser* self) {
+    self->style = BACKEND_VISUALISATION_SPECTRUM;
+    self->fft = fftNew (FFT_SIZE);
+    self->kernel = fftBestKernel();
+    g_object_set (self, "shader", GST_AUDIO_VISUALIZER_SHADER_NONE, NULL);
+}
+
+void visualiserRegister (void) {
+    gst_element_register (NULL, "gliesevis", GST_RANK_NONE, VISUALISER_TYPE);
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include <gst/gst.h>
+#include "gst-backend.h"
+
+/* "gliesevis": playbin's visualisation for audio-only files, a spectrum of
+ * bars over log frequency or an oscilloscope trace. Frames are drawn at the
+ * size and rate downstream asks for, so that a capsfilter after it with the
+ * surface's size and a frame rate cap decides what it costs. The spectrum
+ * comes from the vectorised FFT in fft.h. Registered with the process by
+ * visualiserRegister(). */
+void visualiserRegister (void);